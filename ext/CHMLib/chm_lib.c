@@ -497,10 +497,15 @@ struct chmFile {
     struct LZXstate* lzx_state;
     int lzx_last_block;
 
-    /* cache for decompressed blocks */
+    /* LRU cache for decompressed blocks */
     uint8_t** cache_blocks;
     uint64_t* cache_block_indices;
+    uint64_t* cache_block_used;
+    uint64_t cache_clock;
     int32_t cache_num_blocks;
+
+    /* SumatraPDF: cache statistics */
+    struct chmCacheStats cache_stats;
 };
 
 static int64_t _chm_fetch_bytes(struct chmFile* h, uint8_t* buf, uint64_t os, int64_t len) {
@@ -537,7 +542,10 @@ struct chmFile* chm_open(const char* d, size_t len) {
     newHandle->lzx_state = NULL;
     newHandle->cache_blocks = NULL;
     newHandle->cache_block_indices = NULL;
+    newHandle->cache_block_used = NULL;
+    newHandle->cache_clock = 0;
     newHandle->cache_num_blocks = 0;
+    memset(&newHandle->cache_stats, 0, sizeof(newHandle->cache_stats));
 
     /* read and verify header */
     sremain = _CHM_ITSF_V3_LEN;
@@ -683,6 +691,9 @@ void chm_close(struct chmFile* h) {
     if (h->cache_block_indices)
         free(h->cache_block_indices);
     h->cache_block_indices = NULL;
+    if (h->cache_block_used)
+        free(h->cache_block_used);
+    h->cache_block_used = NULL;
 
     free(h);
 }
@@ -691,57 +702,60 @@ void chm_close(struct chmFile* h) {
  * set a parameter on the file handle.
  * valid parameter types:
  *          CHM_PARAM_MAX_BLOCKS_CACHED:
- *                 how many decompressed blocks should be cached?  A simple
- *                 caching scheme is used, wherein the index of the block is
- *                 used as a hash value, and hash collision results in the
- *                 invalidation of the previously cached block.
+ *                 how many decompressed blocks should be cached?
+ *                 SumatraPDF: the least recently used block is evicted
+ *                 when the cache is full (instead of using the index of
+ *                 the block as a hash value and evicting on collision)
  */
 void chm_set_param(struct chmFile* h, int paramType, int paramVal) {
     switch (paramType) {
         case CHM_PARAM_MAX_BLOCKS_CACHED:
-            if (paramVal != h->cache_num_blocks) {
+            if (paramVal > 0 && paramVal != h->cache_num_blocks) {
                 uint8_t** newBlocks;
                 uint64_t* newIndices;
-                int i;
+                uint64_t* newUsed;
+                int i, nKept = 0;
 
                 /* allocate new cached blocks */
                 newBlocks = (uint8_t**)malloc(paramVal * sizeof(uint8_t*));
-                if (newBlocks == NULL)
-                    return;
                 newIndices = (uint64_t*)malloc(paramVal * sizeof(uint64_t));
-                if (newIndices == NULL) {
+                newUsed = (uint64_t*)malloc(paramVal * sizeof(uint64_t));
+                if (newBlocks == NULL || newIndices == NULL || newUsed == NULL) {
                     free(newBlocks);
+                    free(newIndices);
+                    free(newUsed);
                     return;
                 }
                 for (i = 0; i < paramVal; i++) {
                     newBlocks[i] = NULL;
-                    newIndices[i] = 0;
+                    newIndices[i] = (uint64_t)-1;
+                    newUsed[i] = 0;
                 }
 
-                /* re-distribute old cached blocks */
+                /* keep as many old cached blocks as fit */
                 if (h->cache_blocks) {
                     for (i = 0; i < h->cache_num_blocks; i++) {
-                        int newSlot = (int)(h->cache_block_indices[i] % paramVal);
-
-                        if (h->cache_blocks[i]) {
-                            /* in case of collision, destroy newcomer */
-                            if (newBlocks[newSlot]) {
-                                free(h->cache_blocks[i]);
-                                h->cache_blocks[i] = NULL;
-                            } else {
-                                newBlocks[newSlot] = h->cache_blocks[i];
-                                newIndices[newSlot] = h->cache_block_indices[i];
-                            }
+                        if (!h->cache_blocks[i])
+                            continue;
+                        if (nKept < paramVal) {
+                            newBlocks[nKept] = h->cache_blocks[i];
+                            newIndices[nKept] = h->cache_block_indices[i];
+                            newUsed[nKept] = h->cache_block_used[i];
+                            nKept++;
+                        } else {
+                            free(h->cache_blocks[i]);
                         }
                     }
 
                     free(h->cache_blocks);
                     free(h->cache_block_indices);
+                    free(h->cache_block_used);
                 }
 
                 /* now, set new values */
                 h->cache_blocks = newBlocks;
                 h->cache_block_indices = newIndices;
+                h->cache_block_used = newUsed;
                 h->cache_num_blocks = paramVal;
             }
             break;
@@ -1008,6 +1022,46 @@ static int _chm_get_cmpblock_bounds(struct chmFile* h, uint64_t block, uint64_t*
     return 1;
 }
 
+/* SumatraPDF: get statistics about the decompressed block cache */
+void chm_get_cache_stats(struct chmFile* h, struct chmCacheStats* stats) {
+    *stats = h->cache_stats;
+}
+
+/* return the cache slot holding a block or -1 if it's not cached */
+static int _chm_find_cached_block(struct chmFile* h, uint64_t block) {
+    int i;
+    for (i = 0; i < h->cache_num_blocks; i++) {
+        if (h->cache_block_indices[i] == block && h->cache_blocks[i] != NULL) {
+            h->cache_block_used[i] = ++h->cache_clock;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* return the cache buffer to decompress a block into, evicting the
+ * least recently used block if needed. NULL on allocation failure */
+static uint8_t* _chm_cache_block_slot(struct chmFile* h, uint64_t block, int* slot) {
+    int i, lru = 0;
+    for (i = 0; i < h->cache_num_blocks; i++) {
+        if (h->cache_block_indices[i] == block && h->cache_blocks[i] != NULL) {
+            lru = i;
+            break;
+        }
+        if (h->cache_block_used[i] < h->cache_block_used[lru])
+            lru = i;
+    }
+    if (!h->cache_blocks[lru])
+        h->cache_blocks[lru] = (uint8_t*)malloc((unsigned int)(h->reset_table.block_len));
+    if (!h->cache_blocks[lru])
+        return NULL;
+    /* not valid until decompressed successfully */
+    h->cache_block_indices[lru] = (uint64_t)-1;
+    h->cache_block_used[lru] = ++h->cache_clock;
+    *slot = lru;
+    return h->cache_blocks[lru];
+}
+
 /* decompress the block.  must have lzx_mutex. */
 static int64_t _chm_decompress_block(struct chmFile* h, uint64_t block, uint8_t** ubuffer) {
     uint8_t* cbuffer = malloc(((unsigned int)h->reset_table.block_len + 6144));
@@ -1022,7 +1076,9 @@ static int64_t _chm_decompress_block(struct chmFile* h, uint64_t block, uint8_t*
         return -1;
 
     /* let the caching system pull its weight! */
-    if (block - blockAlign <= h->lzx_last_block && block >= h->lzx_last_block)
+    /* SumatraPDF: block > lzx_last_block, if block was the last one decompressed
+       but got evicted, we have to start over from the reset point */
+    if (block - blockAlign <= h->lzx_last_block && block > h->lzx_last_block)
         blockAlign = (block - h->lzx_last_block);
 
     /* check if we need previous blocks */
@@ -1037,15 +1093,11 @@ static int64_t _chm_decompress_block(struct chmFile* h, uint64_t block, uint8_t*
                     LZXreset(h->lzx_state);
                 }
 
-                indexSlot = (int)((curBlockIdx) % h->cache_num_blocks);
-                if (!h->cache_blocks[indexSlot])
-                    h->cache_blocks[indexSlot] = (uint8_t*)malloc((unsigned int)(h->reset_table.block_len));
-                if (!h->cache_blocks[indexSlot]) {
+                lbuffer = _chm_cache_block_slot(h, curBlockIdx, &indexSlot);
+                if (!lbuffer) {
                     free(cbuffer);
                     return -1;
                 }
-                h->cache_block_indices[indexSlot] = curBlockIdx;
-                lbuffer = h->cache_blocks[indexSlot];
 
                 /* decompress the previous block */
                 if (!_chm_get_cmpblock_bounds(h, curBlockIdx, &cmpStart, &cmpLen) || cmpLen < 0 ||
@@ -1053,10 +1105,13 @@ static int64_t _chm_decompress_block(struct chmFile* h, uint64_t block, uint8_t*
                     _chm_fetch_bytes(h, cbuffer, cmpStart, cmpLen) != cmpLen ||
                     LZXdecompress(h->lzx_state, cbuffer, lbuffer, (int)cmpLen, (int)h->reset_table.block_len) !=
                         DECR_OK) {
+                    h->lzx_last_block = -1;
                     free(cbuffer);
                     return (int64_t)0;
                 }
 
+                h->cache_block_indices[indexSlot] = curBlockIdx;
+                h->cache_stats.blocks_decompressed++;
                 h->lzx_last_block = (int)curBlockIdx;
             }
         }
@@ -1067,24 +1122,23 @@ static int64_t _chm_decompress_block(struct chmFile* h, uint64_t block, uint8_t*
     }
 
     /* allocate slot in cache */
-    indexSlot = (int)(block % h->cache_num_blocks);
-    if (!h->cache_blocks[indexSlot])
-        h->cache_blocks[indexSlot] = (uint8_t*)malloc(((unsigned int)h->reset_table.block_len));
-    if (!h->cache_blocks[indexSlot]) {
+    lbuffer = _chm_cache_block_slot(h, block, &indexSlot);
+    if (!lbuffer) {
         free(cbuffer);
         return -1;
     }
-    h->cache_block_indices[indexSlot] = block;
-    lbuffer = h->cache_blocks[indexSlot];
     *ubuffer = lbuffer;
 
     /* decompress the block we actually want */
     if (!_chm_get_cmpblock_bounds(h, block, &cmpStart, &cmpLen) ||
         _chm_fetch_bytes(h, cbuffer, cmpStart, cmpLen) != cmpLen ||
         LZXdecompress(h->lzx_state, cbuffer, lbuffer, (int)cmpLen, (int)h->reset_table.block_len) != DECR_OK) {
+        h->lzx_last_block = -1;
         free(cbuffer);
         return (int64_t)0;
     }
+    h->cache_block_indices[indexSlot] = block;
+    h->cache_stats.blocks_decompressed++;
     h->lzx_last_block = (int)block;
 
     /* XXX: modify LZX routines to return the length of the data they
@@ -1100,6 +1154,7 @@ static int64_t _chm_decompress_region(struct chmFile* h, uint8_t* buf, uint64_t
     uint64_t nLen;
     uint64_t gotLen;
     uint8_t* ubuffer;
+    int slot;
 
     if (len <= 0)
         return (int64_t)0;
@@ -1112,11 +1167,13 @@ static int64_t _chm_decompress_region(struct chmFile* h, uint8_t* buf, uint64_t
         nLen = h->reset_table.block_len - nOffset;
 
     /* if block is cached, return data from it. */
-    if (h->cache_block_indices[nBlock % h->cache_num_blocks] == nBlock &&
-        h->cache_blocks[nBlock % h->cache_num_blocks] != NULL) {
-        memcpy(buf, h->cache_blocks[nBlock % h->cache_num_blocks] + nOffset, (unsigned int)nLen);
+    slot = _chm_find_cached_block(h, nBlock);
+    if (slot >= 0) {
+        h->cache_stats.hits++;
+        memcpy(buf, h->cache_blocks[slot] + nOffset, (unsigned int)nLen);
         return nLen;
     }
+    h->cache_stats.misses++;
 
     /* data request not satisfied, so... start up the decompressor machine */
     if (!h->lzx_state) {
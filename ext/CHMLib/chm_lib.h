@@ -74,6 +74,14 @@ void chm_close(struct chmFile* h);
 #define CHM_PARAM_MAX_BLOCKS_CACHED 0
 void chm_set_param(struct chmFile* h, int paramType, int paramVal);
 
+/* SumatraPDF: statistics about the decompressed block cache */
+struct chmCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t blocks_decompressed;
+};
+void chm_get_cache_stats(struct chmFile* h, struct chmCacheStats* stats);
+
 /* resolve a particular object from the archive */
 #define CHM_RESOLVE_SUCCESS (0)
 #define CHM_RESOLVE_FAILURE (1)
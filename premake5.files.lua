@@ -770,6 +770,8 @@ function utils_files()
     "JsonParser.*",
     "Log.*",
     "LzmaSimpleArchive.*",
+    "PackBits.*",
+    "PixelUtil.*",
     "RegistryPaths.*",
     "Scoped.h",
     "ScopedWin.h",
@@ -783,6 +785,8 @@ function utils_files()
     "TempAllocator.*",
     "ThreadUtil.*",
     "TgaReader.*",
+    "TiffReader.*",
+    "TimingStats.*",
     "TrivialHtmlParser.*",
     "TxtParser.*",
     "UITask.*",
@@ -1177,6 +1181,7 @@ function test_util_files()
     "BaseUtil.*",
     "BitManip.*",
     "ByteOrderDecoder.*",
+    "ByteReader.*",
     "CmdLineArgsIter.*",
     "ColorUtil.*",
     "CryptoUtil.*",
@@ -1189,6 +1194,8 @@ function test_util_files()
     "HtmlPrettyPrint.*",
     "HtmlPullParser.*",
     "JsonParser.*",
+    "PackBits.*",
+    "PixelUtil.*",
     "Scoped.*",
     "SettingsUtil.*",
     "Log.*",
@@ -1200,6 +1207,8 @@ function test_util_files()
     "SquareTreeParser.*",
     "TrivialHtmlParser.*",
     "TempAllocator.*",
+    "TiffReader.*",
+    "TimingStats.*",
     "UtAssert.*",
     "Vec.*",
     "WinUtil.*",
@@ -991,7 +991,9 @@ static bool DrawDocument(MainWindow* win, HDC hdc, RECT* rcArea) {
     Rect screen(Point(), dm->GetViewPort().Size());
 
     bool isRtl = IsUIRtl();
-    for (int pageNo = 1; pageNo <= dm->PageCount(); ++pageNo) {
+    int firstPageNo, lastPageNo;
+    dm->GetPagesToCheckForVisibility(&firstPageNo, &lastPageNo);
+    for (int pageNo = firstPageNo; pageNo <= lastPageNo; ++pageNo) {
         PageInfo* pageInfo = dm->GetPageInfo(pageNo);
         if (!pageInfo || 0.0f == pageInfo->visibleRatio) {
             continue;
@@ -15,6 +15,9 @@
 #include "EbookBase.h"
 #include "ChmFile.h"
 
+// decompressed LZX blocks are usually 32 KB, so this caches ~4 MB
+constexpr int kChmBlocksCached = 128;
+
 ChmFile::~ChmFile() {
     chm_close(chmHandle);
 }
@@ -278,6 +281,8 @@ bool ChmFile::Load(const char* path) {
     if (!chmHandle) {
         return false;
     }
+    // pages and images are often fetched repeatedly and share blocks
+    chm_set_param(chmHandle, CHM_PARAM_MAX_BLOCKS_CACHED, kChmBlocksCached);
 
     ParseWindowsData();
     if (!ParseSystemData()) {
@@ -93,6 +93,8 @@ static i32 gDocumentNotOpenWhitelist[] = {
     CmdDebugTestApp,
     CmdDebugTogglePredictiveRender,
     CmdDebugToggleRtl,
+    CmdDebugToggleRenderTimings,
+    CmdDebugSaveRenderTimings,
     CmdFavoriteToggle,
     CmdToggleFullscreen,
     CmdToggleMenuBar,
@@ -190,6 +190,8 @@ Cmd* enum (e.g. CmdOpen) and a human-readable name (not used yet).
     V(CmdDebugStartStressTest, "Debug: Start Stress Test")                         \
     V(CmdDebugTogglePredictiveRender, "Debug: Toggle Predictive Rendering")        \
     V(CmdDebugToggleRtl, "Debug: Toggle Rtl")                                      \
+    V(CmdDebugToggleRenderTimings, "Debug: Toggle Render Timings")                 \
+    V(CmdDebugSaveRenderTimings, "Debug: Save Render Timings")                     \
     V(CmdDebugDelayCloseWindow, "Debug: Delay Close Window")                       \
     V(CmdHighlightKeyTerms, "Highlight Key Terms")                               \
     V(CmdReloadSearchTerms, "Reload Search Terms")                               \
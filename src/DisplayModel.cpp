@@ -44,8 +44,10 @@
 */
 
 #include "utils/BaseUtil.h"
+#include "utils/FileUtil.h"
 #include "utils/WinUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 #include "utils/Timer.h"
 
 #include "wingui/UIModels.h"
@@ -57,6 +59,7 @@
 #include "EngineAll.h"
 #include "DisplayModel.h"
 #include "GlobalPrefs.h"
+#include "FileThumbnails.h"
 #include "SumatraPDF.h"
 #include "PdfSync.h"
 #include "ProgressUpdateUI.h"
@@ -239,10 +242,16 @@ void DisplayModel::GetDisplayState(FileState* fs) {
 
     free(fs->decryptionKey);
     fs->decryptionKey = engine->GetDecryptionKey();
+
+    float zoom = inPresentation ? presZoomVirtual : zoomVirtual;
+    if (zoom == kZoomFitContent) {
+        SaveContentBoxes();
+    }
 }
 
 SizeF DisplayModel::PageSizeAfterRotation(int pageNo, bool fitToContent) const {
-    PageInfo* pageInfo = GetPageInfo(pageNo);
+    // contentBox is cached independently of the (lazy) layout
+    PageInfo* pageInfo = ValidPageNo(pageNo) ? &(pagesInfo[pageNo - 1]) : nullptr;
     ReportIf(!pageInfo);
 
     if (fitToContent && pageInfo->contentBox.IsEmpty()) {
@@ -252,6 +261,9 @@ SizeF DisplayModel::PageSizeAfterRotation(int pageNo, bool fitToContent) const {
         }
     }
 
+    if (!fitToContent && sizeRotatedFor == rotation) {
+        return pageInfo->sizeRotated;
+    }
     RectF box = fitToContent ? pageInfo->contentBox : pageInfo->page;
     return engine->Transform(box, pageNo, 1.0, rotation).Size();
 }
@@ -309,21 +321,47 @@ DisplayModel::DisplayModel(EngineBase* engine, DocControllerCallback* cb) : DocC
     textCache = new DocumentTextCache(engine);
     textSelection = new TextSelection(engine, textCache);
     textSearch = new TextSearch(engine, textCache);
+    InitializeCriticalSection(&contentBoxesAccess);
 }
 
 DisplayModel::~DisplayModel() {
     pauseRendering = true;
     cb->CleanUp(this);
 
+    if (contentBoxesThread) {
+        contentBoxesCancel.Set(1);
+        WaitForSingleObject(contentBoxesThread, INFINITE);
+        CloseHandle(contentBoxesThread);
+    }
+    DeleteCriticalSection(&contentBoxesAccess);
+
+    // the engine might outlive us
+    engine->SetOnPagesLoaded(Func0{});
+
     delete pdfSync;
     delete textSearch;
     delete textSelection;
     delete textCache;
     SafeEngineRelease(&engine);
     free(pagesInfo);
+    for (PageInfo* pi : oldPagesInfo) {
+        free(pi);
+    }
+}
+
+PageInfo* DisplayModel::GetPageInfo(int pageNo) {
+    if (!ValidPageNo(pageNo)) {
+        return nullptr;
+    }
+    ReportIf(!pagesInfo);
+    PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
+    if (lazyLayout) {
+        UpdateLazyPageInfo(pageNo, pageInfo);
+    }
+    return pageInfo;
 }
 
-PageInfo* DisplayModel::GetPageInfo(int pageNo) const {
+const PageInfo* DisplayModel::GetPageInfo(int pageNo) const {
     if (!ValidPageNo(pageNo)) {
         return nullptr;
     }
@@ -372,6 +410,7 @@ void DisplayModel::BuildPagesInfo() {
     ReportIf(pagesInfo);
     int pageCount = PageCount();
     pagesInfo = AllocArray<PageInfo>(pageCount);
+    pagesInfoCap = pageCount;
 
     log("DisplayModel::BuildPagesInfo started\n");
     auto timeStart = TimeGet();
@@ -379,6 +418,11 @@ void DisplayModel::BuildPagesInfo() {
         auto dur = TimeSinceInMs(timeStart);
         logf("DisplayModel::BuildPagesInfo took %.2f ms\n", dur);
     };
+    InitPagesInfo(1);
+}
+
+void DisplayModel::InitPagesInfo(int firstPageNo) {
+    int pageCount = PageCount();
 
     RectF defaultRect;
     float fileDPI = engine->GetFileDPI();
@@ -394,8 +438,9 @@ void DisplayModel::BuildPagesInfo() {
         newStartPage--;
     }
 
-    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
+    for (int pageNo = firstPageNo; pageNo <= pageCount; pageNo++) {
+        // not GetPageInfo() which would try to lay the page out
+        PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
         pageInfo->page = engine->PageMediabox(pageNo);
         // layout pages with an empty mediabox as A4 size (resp. letter size)
         if (pageInfo->page.IsEmpty()) {
@@ -411,10 +456,65 @@ void DisplayModel::BuildPagesInfo() {
     }
 }
 
+// adds the pages that the engine loaded in the background since the last call
+// (see EngineBase::AddLoadedPages()). Returns false if there were none
+bool DisplayModel::AddLoadedPages() {
+    int nOld = PageCount();
+    int firstChanged = engine->AddLoadedPages();
+    if (!firstChanged) {
+        return false;
+    }
+    textCache->IndexLoadedPages();
+    int nPages = PageCount();
+    if (!pagesInfo) {
+        // BuildPagesInfo() will include them
+        return true;
+    }
+    if (nPages > pagesInfoCap) {
+        int cap = std::max(nPages, pagesInfoCap * 2);
+        PageInfo* newPagesInfo = AllocArray<PageInfo>(cap);
+        memcpy(newPagesInfo, pagesInfo, nOld * sizeof(PageInfo));
+        oldPagesInfo.Append(pagesInfo);
+        pagesInfo = newPagesInfo;
+        pagesInfoCap = cap;
+    }
+    if (firstChanged <= nOld) {
+        // pages were inserted between the existing ones, so what has been
+        // rendered for the pages after them is for different pages now
+        cb->CleanUp(this);
+        for (int pageNo = firstChanged; pageNo <= nOld; pageNo++) {
+            pagesInfo[pageNo - 1].contentBox = RectF();
+        }
+    }
+    InitPagesInfo(std::min(firstChanged, nOld + 1));
+    ApplyRestoredContentBoxes(firstChanged);
+    QueueContentBoxes(firstChanged);
+
+    // force re-calculating everything that depends on the number of pages
+    sizeRotatedFor = -1;
+    pageSpace.rotation = -1;
+    Relayout(zoomVirtual, rotation);
+
+    if (restorePageNo > 0 && ValidPageNo(restorePageNo)) {
+        if (CurrentPageNo() == restoreFallbackPageNo) {
+            GoToPage(restorePageNo, false);
+        }
+        restorePageNo = 0;
+    }
+    RepaintDisplay();
+    return true;
+}
+
+// pageNo hasn't been loaded yet, so go to it once AddLoadedPages() added it
+void DisplayModel::RestorePageWhenLoaded(int pageNo) {
+    restorePageNo = pageNo;
+    restoreFallbackPageNo = PageCount();
+}
+
 // TODO: a better name e.g. ShouldShow() to better distinguish between
 // before-layout info and after-layout visibility checks
 bool DisplayModel::PageShown(int pageNo) const {
-    PageInfo* pageInfo = GetPageInfo(pageNo);
+    const PageInfo* pageInfo = GetPageInfo(pageNo);
     if (!pageInfo) {
         return false;
     }
@@ -422,13 +522,26 @@ bool DisplayModel::PageShown(int pageNo) const {
 }
 
 bool DisplayModel::PageVisible(int pageNo) const {
-    PageInfo* pageInfo = GetPageInfo(pageNo);
+    const PageInfo* pageInfo = GetPageInfo(pageNo);
     if (!pageInfo) {
         return false;
     }
     return pageInfo->visibleRatio > 0.0;
 }
 
+/* With lazy layout, pageOnScreen is only updated for pages when they're accessed
+   on the UI thread. Returns false if it's left over from an earlier layout */
+bool DisplayModel::PageOnScreenIsCurrent(int pageNo) const {
+    const PageInfo* pageInfo = GetPageInfo(pageNo);
+    if (!pageInfo) {
+        return false;
+    }
+    if (!lazyLayout) {
+        return true;
+    }
+    return pageInfo->layoutGen == layoutGen && pageInfo->visibleGen == visibleGen;
+}
+
 /* Return true if a page is visible or a page in a row below or above is visible */
 bool DisplayModel::PageVisibleNearby(int pageNo) const {
     DisplayMode mode = GetDisplayMode();
@@ -493,7 +606,7 @@ float DisplayModel::ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo) co
         int last = LastPageInARowNo(pageNo, columns, IsBookView(GetDisplayMode()), PageCount());
         RectF box;
         for (int i = first; i <= last; i++) {
-            PageInfo* pageInfo = GetPageInfo(i);
+            PageInfo* pageInfo = &(pagesInfo[i - 1]);
             if (pageInfo->contentBox.IsEmpty()) {
                 pageInfo->contentBox = engine->PageContentBox(i);
             }
@@ -540,8 +653,10 @@ int DisplayModel::FirstVisiblePageNo() const {
         return kInvalidPageNo;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
+    int first, last;
+    GetPagesToCheckForVisibility(&first, &last);
+    for (int pageNo = first; pageNo <= last; ++pageNo) {
+        const PageInfo* pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > 0.0) {
             return pageNo;
         }
@@ -566,8 +681,10 @@ int DisplayModel::CurrentPageNo() const {
     int mostVisiblePage = kInvalidPageNo;
     float ratio = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
+    int first, last;
+    GetPagesToCheckForVisibility(&first, &last);
+    for (int pageNo = first; pageNo <= last; pageNo++) {
+        const PageInfo* pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > ratio) {
             mostVisiblePage = pageNo;
             ratio = pageInfo->visibleRatio;
@@ -576,8 +693,12 @@ int DisplayModel::CurrentPageNo() const {
 
     /* if no page is visible, default to either the first or the last one */
     if (kInvalidPageNo == mostVisiblePage) {
-        PageInfo* pageInfo = GetPageInfo(1);
-        if (pageInfo && viewPort.y > pageInfo->pos.y + pageInfo->pos.dy) {
+        const PageInfo* pageInfo = GetPageInfo(1);
+        Rect pos;
+        if (pageInfo) {
+            pos = lazyLayout ? LazyPagePos(1) : pageInfo->pos;
+        }
+        if (pageInfo && viewPort.y > pos.y + pos.dy) {
             mostVisiblePage = PageCount();
         } else {
             mostVisiblePage = 1;
@@ -610,6 +731,7 @@ void DisplayModel::CalcZoomReal(float newZoomVirtual) {
         ReportIf(minZoom == (float)HUGE_VAL);
         zoomReal = minZoom;
     } else if (kZoomFitContent == newZoomVirtual) {
+        StartContentBoxesThread();
         float newZoom = ZoomRealFromVirtualForPage(newZoomVirtual, CurrentPageNo());
         // limit zooming in to 800% on almost empty pages
         if (newZoom > 8.0) {
@@ -628,6 +750,10 @@ void DisplayModel::CalcZoomReal(float newZoomVirtual) {
     } else {
         zoomReal = zoomVirtual * 0.01f * dpiFactor;
         ReportIf(zoomReal < 0.01f);
+        if (lazyLayout) {
+            // PageInfo::zoomReal is set in UpdateLazyPageInfo()
+            return;
+        }
         for (int pageNo = 1; pageNo <= nPages; pageNo++) {
             PageInfo* pageInfo = GetPageInfo(pageNo);
             pageInfo->zoomReal = zoomReal;
@@ -638,7 +764,11 @@ void DisplayModel::CalcZoomReal(float newZoomVirtual) {
 float DisplayModel::GetZoomReal(int pageNo) const {
     DisplayMode mode = GetDisplayMode();
     if (IsContinuous(mode)) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
+        if (lazyLayout) {
+            // all pages are scaled the same
+            return pageSpace.zoom;
+        }
+        const PageInfo* pageInfo = GetPageInfo(pageNo);
         return pageInfo->zoomReal;
     }
     if (IsSingle(mode)) {
@@ -666,11 +796,26 @@ void DisplayModel::Relayout(float newZoomVirtual, int newRotation) {
     }
 
     rotation = NormalizeRotation(newRotation);
+    UpdateRotatedPageSizes();
 
     bool needHScroll = false;
     bool needVScroll = false;
     viewPort = Rect(viewPort.TL(), totalViewPortSize);
 
+    // with a fixed zoom level all pages in continuous modes are scaled the same,
+    // which allows rescaling a cached page space layout instead of re-doing it
+    if (IsContinuous(GetDisplayMode()) && newZoomVirtual > 0) {
+        RelayoutLazy(newZoomVirtual);
+        return;
+    }
+    if (lazyLayout) {
+        // calculate all pages for the last time before switching to eager layout
+        for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+            GetPageInfo(pageNo);
+        }
+        lazyLayout = false;
+    }
+
 RestartLayout:
     int currPosY = windowMargin.top;
     float currZoomReal = zoomReal;
@@ -854,6 +999,246 @@ RestartLayout:
     canvasSize = Size(std::max(canvasDx, viewPort.dx), std::max(canvasDy, viewPort.dy));
 }
 
+int PageSpaceLayout::RowCount() const {
+    return rowTop.Size() - 1;
+}
+
+// don't add the full 0.5 for rounding to account for precision errors
+int PageSpaceLayout::RowTop(int row, int spacingDy) const {
+    return y0 + (int)(rowTop[row] * zoom + 0.499) + row * spacingDy;
+}
+
+void DisplayModel::UpdateRotatedPageSizes() {
+    if (sizeRotatedFor == rotation) {
+        return;
+    }
+    int pageCount = PageCount();
+    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+        PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
+        pageInfo->sizeRotated = engine->Transform(pageInfo->page, pageNo, 1.0, rotation).Size();
+    }
+    sizeRotatedFor = rotation;
+}
+
+/* Arranges the pages into rows in page space. Only needs to be re-done when
+   the rotation or the number of columns changes */
+void DisplayModel::BuildPageSpaceLayout() {
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+    int firstSlot = IsBookView(GetDisplayMode()) && columns > 1 ? 1 : 0;
+    PageSpaceLayout& l = pageSpace;
+    if (l.rotation == rotation && l.columns == columns && l.firstSlot == firstSlot) {
+        return;
+    }
+
+    auto timeStart = TimeGet();
+    l.rowTop.Reset();
+    l.columnMaxDx[0] = l.columnMaxDx[1] = 0;
+    double currY = 0;
+    double rowMaxDy = 0;
+    int pageCount = PageCount();
+    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+        int col = (pageNo - 1 + firstSlot) % columns;
+        if (1 == pageNo || 0 == col) {
+            /* starting next row */
+            currY += rowMaxDy;
+            rowMaxDy = 0;
+            l.rowTop.Append(currY);
+        }
+        SizeF size = pagesInfo[pageNo - 1].sizeRotated;
+        rowMaxDy = std::max(rowMaxDy, (double)size.dy);
+        l.columnMaxDx[col] = std::max(l.columnMaxDx[col], (double)size.dx);
+    }
+    l.rowTop.Append(currY + rowMaxDy);
+
+    l.columns = columns;
+    l.firstSlot = firstSlot;
+    l.rotation = rotation;
+    logf("DisplayModel::BuildPageSpaceLayout took %.2f ms\n", TimeSinceInMs(timeStart));
+}
+
+/* Relayout() for continuous modes at a fixed zoom level. Only calculates
+   canvas size, all page positions are derived from pageSpace when needed */
+void DisplayModel::RelayoutLazy(float newZoomVirtual) {
+    BuildPageSpaceLayout();
+    if (!lazyLayout) {
+        // visibility calculated by the eager layout stays valid until the next RecalcVisibleParts()
+        visibleGen++;
+        visibleFirst = PageCount() + 1;
+        visibleLast = 0;
+        for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+            PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
+            pageInfo->visibleGen = visibleGen;
+            if (pageInfo->visibleRatio > 0.0) {
+                visibleFirst = std::min(visibleFirst, pageNo);
+                visibleLast = pageNo;
+            }
+        }
+        visibleViewPort = viewPort;
+        lazyLayout = true;
+    }
+
+    PageSpaceLayout& l = pageSpace;
+    int columns = l.columns;
+    bool hideScrollbars = gGlobalPrefs->fixedPageUI.hideScrollbars;
+    bool needHScroll = false;
+    bool needVScroll = false;
+    int newViewPortOffsetX = 0;
+    int canvasDx = 0;
+    int canvasDy = 0;
+    for (;;) {
+        float currZoomReal = zoomReal;
+        CalcZoomReal(newZoomVirtual);
+
+        newViewPortOffsetX = 0;
+        if (0 != currZoomReal && kInvalidZoom != currZoomReal) {
+            newViewPortOffsetX = (int)(viewPort.x * zoomReal / currZoomReal);
+        }
+        viewPort.x = newViewPortOffsetX;
+
+        l.zoom = zoomReal;
+        l.y0 = 0;
+        for (int i = 0; i < dimofi(l.columnDx); i++) {
+            l.columnDx[i] = (int)(l.columnMaxDx[i] * zoomReal + 0.499);
+        }
+        if (columns == 2 && PageCount() == 1) {
+            /* don't center a single page over two columns */
+            if (IsBookView(GetDisplayMode())) {
+                l.columnDx[0] = l.columnDx[1];
+            } else {
+                l.columnDx[1] = l.columnDx[0];
+            }
+        }
+        canvasDx = windowMargin.left + l.columnDx[0] + (columns == 2 ? pageSpacing.dx + l.columnDx[1] : 0) +
+                   windowMargin.right;
+        canvasDy = windowMargin.top + l.RowTop(l.RowCount(), pageSpacing.dy) - pageSpacing.dy + windowMargin.bottom;
+
+        // restart the layout if we detect we need to show scrollbars
+        if (!hideScrollbars && !needVScroll && canvasDy > viewPort.dy) {
+            needVScroll = true;
+            viewPort.dx -= GetSystemMetrics(SM_CXVSCROLL);
+            continue;
+        }
+        if (!hideScrollbars && !needHScroll && canvasDx > viewPort.dx) {
+            needHScroll = true;
+            viewPort.dy -= GetSystemMetrics(SM_CYHSCROLL);
+            continue;
+        }
+        break;
+    }
+
+    /* since pages can be smaller than the drawing area, center them in x axis */
+    int offX = 0;
+    if (canvasDx < viewPort.dx) {
+        viewPort.x = 0;
+        offX = (viewPort.dx - canvasDx) / 2;
+        canvasDx = viewPort.dx;
+    }
+    if (viewPort.dx - (canvasDx - newViewPortOffsetX) > 0) {
+        viewPort.x = canvasDx - viewPort.dx;
+    }
+    /* if pages are smaller than drawing area in y axis, y-center them */
+    int offY = 0;
+    if (canvasDy < viewPort.dy) {
+        offY = windowMargin.top + (viewPort.dy - canvasDy) / 2;
+    }
+
+    l.x0 = offX + windowMargin.left;
+    l.y0 = windowMargin.top + offY;
+    l.canvasDx = canvasDx;
+    canvasSize = Size(std::max(canvasDx, viewPort.dx), std::max(canvasDy, viewPort.dy));
+    // invalidates pos of all pages
+    layoutGen++;
+}
+
+/* position of a page with lazy layout, what Relayout() would've calculated */
+Rect DisplayModel::LazyPagePos(int pageNo) const {
+    const PageSpaceLayout& l = pageSpace;
+    const PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
+    int slot = pageNo - 1 + l.firstSlot;
+    int row = slot / l.columns;
+    int col = slot % l.columns;
+    Rect pos;
+    // don't add the full 0.5 for rounding to account for precision errors
+    pos.dx = (int)(pageInfo->sizeRotated.dx * l.zoom + 0.499);
+    pos.dy = (int)(pageInfo->sizeRotated.dy * l.zoom + 0.499);
+    pos.y = l.RowTop(row, pageSpacing.dy);
+    // center pages in a single column but right/left align them when using two columns
+    if (1 == l.columns) {
+        pos.x = l.x0 + (l.columnDx[0] - pos.dx) / 2;
+    } else if (0 == col) {
+        pos.x = l.x0 + l.columnDx[0] - pos.dx;
+    } else {
+        pos.x = l.x0 + l.columnDx[0] + pageSpacing.dx;
+    }
+    // mirror the page layout when displaying a Right-to-Left document
+    if (displayR2L && l.columns > 1) {
+        pos.x = l.canvasDx - pos.x - pos.dx;
+    }
+    return pos;
+}
+
+Rect DisplayModel::LazyPageOnScreen(int pageNo) const {
+    Rect r = LazyPagePos(pageNo);
+    r.Offset(-visibleViewPort.x, -visibleViewPort.y);
+    return r;
+}
+
+/* calculates the parts of PageInfo that are out of date with lazy layout.
+   Does the same as the loops in Relayout() resp. RecalcVisibleParts() */
+void DisplayModel::UpdateLazyPageInfo(int pageNo, PageInfo* pageInfo) {
+    if (pageInfo->layoutGen != layoutGen) {
+        pageInfo->pos = LazyPagePos(pageNo);
+        pageInfo->zoomReal = pageSpace.zoom;
+        pageInfo->layoutGen = layoutGen;
+    }
+
+    if (pageInfo->visibleGen != visibleGen) {
+        pageInfo->visibleRatio = 0.0;
+        if (visibleFirst <= pageNo && pageNo <= visibleLast) {
+            Rect visiblePart = pageInfo->pos.Intersect(visibleViewPort);
+            if (!visiblePart.IsEmpty()) {
+                Rect pageRect = pageInfo->pos;
+                pageInfo->visibleRatio = 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
+            }
+        }
+        pageInfo->pageOnScreen = pageInfo->pos;
+        pageInfo->pageOnScreen.Offset(-visibleViewPort.x, -visibleViewPort.y);
+        pageInfo->visibleGen = visibleGen;
+    }
+}
+
+// returns the last row starting at or above canvas position y
+int DisplayModel::LazyRowAtY(int y) const {
+    int lo = 0;
+    int hi = pageSpace.RowCount() - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (pageSpace.RowTop(mid, pageSpacing.dy) <= y) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+void DisplayModel::LazyRowPages(int row, int* firstPageNo, int* lastPageNo) const {
+    int first = row * pageSpace.columns - pageSpace.firstSlot + 1;
+    *firstPageNo = std::max(first, 1);
+    *lastPageNo = std::min(first + pageSpace.columns - 1, PageCount());
+}
+
+// pages outside of this range are known to have visibleRatio == 0
+void DisplayModel::GetPagesToCheckForVisibility(int* firstPageNo, int* lastPageNo) const {
+    if (lazyLayout) {
+        *firstPageNo = visibleFirst;
+        *lastPageNo = visibleLast;
+        return;
+    }
+    *firstPageNo = 1;
+    *lastPageNo = PageCount();
+}
+
 void DisplayModel::ChangeStartPage(int newStartPage) {
     ReportIf(!ValidPageNo(newStartPage));
     ReportIf(IsContinuous(GetDisplayMode()));
@@ -882,12 +1267,38 @@ void DisplayModel::ChangeStartPage(int newStartPage) {
    coordinates of a current view into that large sheet, calculate which
    parts of each page is visible on the screen.
    Needs to be recalucated after scrolling the view. */
-void DisplayModel::RecalcVisibleParts() const {
+void DisplayModel::RecalcVisibleParts() {
     ReportIf(!pagesInfo);
     if (!pagesInfo) {
         return;
     }
 
+    if (lazyLayout) {
+        // only the rows overlapping the view port can be visible, the other
+        // pages get their pageOnScreen updated when they're accessed.
+        // The rendering thread doesn't update the layout, so the pages in
+        // (and next to) the view port are brought up to date here and pages
+        // that are no longer visible get their visibleRatio reset
+        int prevFirst = visibleFirst;
+        int prevLast = visibleLast;
+        visibleGen++;
+        visibleViewPort = viewPort;
+        int firstRow = std::max(LazyRowAtY(viewPort.y) - 1, 0);
+        int lastRow = std::min(LazyRowAtY(viewPort.y + viewPort.dy) + 1, pageSpace.RowCount() - 1);
+        int ignore;
+        LazyRowPages(firstRow, &visibleFirst, &ignore);
+        LazyRowPages(lastRow, &ignore, &visibleLast);
+        for (int pageNo = std::max(prevFirst, 1); pageNo <= std::min(prevLast, PageCount()); pageNo++) {
+            if (pageNo < visibleFirst || pageNo > visibleLast) {
+                pagesInfo[pageNo - 1].visibleRatio = 0.0;
+            }
+        }
+        for (int pageNo = visibleFirst; pageNo <= visibleLast; pageNo++) {
+            GetPageInfo(pageNo);
+        }
+        return;
+    }
+
     for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (!pageInfo->shown) {
@@ -915,8 +1326,23 @@ int DisplayModel::GetPageNoByPoint(Point pt) const {
         return -1;
     }
 
+    if (lazyLayout) {
+        // rows may overlap by a pixel due to rounding, so also check the neighbors
+        int row = LazyRowAtY(pt.y + visibleViewPort.y);
+        for (int r = std::max(row - 1, 0); r <= row + 1 && r < pageSpace.RowCount(); r++) {
+            int first, last;
+            LazyRowPages(r, &first, &last);
+            for (int pageNo = first; pageNo <= last; pageNo++) {
+                if (LazyPageOnScreen(pageNo).Contains(pt)) {
+                    return pageNo;
+                }
+            }
+        }
+        return -1;
+    }
+
     for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
+        const PageInfo* pageInfo = GetPageInfo(pageNo);
         ReportIf(!(0.0 == pageInfo->visibleRatio || pageInfo->shown));
         if (!pageInfo->shown) {
             continue;
@@ -938,18 +1364,27 @@ int DisplayModel::GetPageNextToPoint(Point pt) const {
     unsigned int maxDist = UINT_MAX;
     int closest = startPage;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
+    int first = 1;
+    int last = PageCount();
+    if (lazyLayout) {
+        // the closest page is in the row next to the point or in a neighboring one
+        int row = LazyRowAtY(pt.y + visibleViewPort.y);
+        int ignore;
+        LazyRowPages(std::max(row - 1, 0), &first, &ignore);
+        LazyRowPages(std::min(row + 1, pageSpace.RowCount() - 1), &ignore, &last);
+    }
+    for (int pageNo = first; pageNo <= last; ++pageNo) {
+        const PageInfo* pageInfo = GetPageInfo(pageNo);
         ReportIf(0.0 != pageInfo->visibleRatio && !pageInfo->shown);
         if (!pageInfo->shown) {
             continue;
         }
 
-        if (pageInfo->pageOnScreen.Contains(pt)) {
+        Rect r = lazyLayout ? LazyPageOnScreen(pageNo) : pageInfo->pageOnScreen;
+        if (r.Contains(pt)) {
             return pageNo;
         }
 
-        Rect r = pageInfo->pageOnScreen;
         unsigned int dist = distSq(pt.x - r.x - r.dx / 2, pt.y - r.y - r.dy / 2);
         if (dist < maxDist) {
             closest = pageNo;
@@ -1098,7 +1533,9 @@ void DisplayModel::RenderVisibleParts() {
     int firstVisiblePage = 0;
     int lastVisiblePage = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    int first, last;
+    GetPagesToCheckForVisibility(&first, &last);
+    for (int pageNo = first; pageNo <= last; ++pageNo) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > 0.0) {
             ReportIf(!pageInfo->shown);
@@ -1174,15 +1611,241 @@ void DisplayModel::SetViewPortSize(Size newViewPortSize) {
     }
 }
 
+// identifies the version of the file content boxes were calculated for
+static int ContentBoxesSignature(const char* path) {
+    if (!path) {
+        return 0;
+    }
+    struct {
+        i64 size;
+        FILETIME modified;
+    } data;
+    if (dir::Exists(path)) {
+        // the modification time of a directory changes when
+        // images are added, removed or renamed
+        WIN32_FILE_ATTRIBUTE_DATA fad{};
+        if (!GetFileAttributesExW(ToWStrTemp(path), GetFileExInfoStandard, &fad)) {
+            return 0;
+        }
+        data.size = 0;
+        data.modified = fad.ftLastWriteTime;
+    } else {
+        data.size = file::GetSize(path);
+        data.modified = file::GetModificationTime(path);
+        if (data.size < 0) {
+            return 0;
+        }
+    }
+    // 0 means unknown
+    return (int)(MurmurHash2(&data, sizeof(data)) | 1);
+}
+
+// restore content boxes remembered by GetContentBoxes(). Documents that are
+// still being loaded get them for the remaining pages in AddLoadedPages()
+void DisplayModel::SetContentBoxes(Vec<int>* boxes) {
+    if (!boxes || boxes->Size() < 1 + 4 || (boxes->Size() - 1) % 4 != 0) {
+        return;
+    }
+    int sig = ContentBoxesSignature(engine->FilePath());
+    if (sig == 0 || boxes->at(0) != sig) {
+        return;
+    }
+    if (!engine->IsLoadingPages() && boxes->Size() != 1 + PageCount() * 4) {
+        return;
+    }
+    contentBoxesRestored.Reset();
+    contentBoxesRestored.Append(*boxes);
+    ApplyRestoredContentBoxes(1);
+}
+
+void DisplayModel::ApplyRestoredContentBoxes(int firstPageNo) {
+    int nRestored = (contentBoxesRestored.Size() - 1) / 4;
+    int last = std::min(PageCount(), nRestored);
+    for (int pageNo = firstPageNo; pageNo <= last; pageNo++) {
+        int* v = contentBoxesRestored.LendData() + 1 + (pageNo - 1) * 4;
+        RectF box((float)v[0], (float)v[1], (float)v[2], (float)v[3]);
+        if (!box.IsEmpty()) {
+            pagesInfo[pageNo - 1].contentBox = box;
+        }
+    }
+}
+
+// pages for which the content box hasn't been calculated yet are skipped
+// instead of calculating them now, which could take long for big documents
+void DisplayModel::GetContentBoxes(Vec<int>* boxes) {
+    int sig = ContentBoxesSignature(engine->FilePath());
+    if (sig == 0) {
+        return;
+    }
+    ScopedCritSec scope(&contentBoxesAccess);
+    int nPages = PageCount();
+    int nKnown = 0;
+    boxes->Append(sig);
+    for (int i = 0; i < nPages; i++) {
+        RectF box = pagesInfo[i].contentBox;
+        if (box.IsEmpty() && i < contentBoxesFound.Size()) {
+            box = contentBoxesFound.at(i);
+        }
+        Rect r;
+        if (!box.IsEmpty()) {
+            // round outwards so that no content gets cut off
+            r.x = (int)floorf(box.x);
+            r.y = (int)floorf(box.y);
+            r.dx = (int)ceilf(box.x + box.dx) - r.x;
+            r.dy = (int)ceilf(box.y + box.dy) - r.y;
+            nKnown++;
+        }
+        boxes->Append(r.x);
+        boxes->Append(r.y);
+        boxes->Append(r.dx);
+        boxes->Append(r.dy);
+    }
+    if (nKnown == 0) {
+        boxes->Reset();
+    }
+}
+
+// content boxes are remembered in the thumbnail cache directory (and not in
+// the settings, they'd make them much bigger for documents with many pages).
+// The file has the values of GetContentBoxes()
+void DisplayModel::LoadContentBoxes() {
+    if (!gGlobalPrefs->rememberStatePerDocument) {
+        return;
+    }
+    TempStr path = GetContentBoxesPathTemp(engine->FilePath());
+    if (!path) {
+        return;
+    }
+    ByteSlice data = file::ReadFile(path);
+    if (data.empty()) {
+        return;
+    }
+    Vec<int> boxes;
+    if (data.size() % sizeof(int) == 0) {
+        boxes.Append((int*)data.data(), data.size() / sizeof(int));
+    }
+    data.Free();
+    SetContentBoxes(&boxes);
+    contentBoxesSaved.Reset();
+    contentBoxesSaved.Append(boxes);
+}
+
+// only writes the file if there are new content boxes
+void DisplayModel::SaveContentBoxes() {
+    if (!gGlobalPrefs->rememberStatePerDocument) {
+        return;
+    }
+    Vec<int> boxes;
+    GetContentBoxes(&boxes);
+    if (boxes.IsEmpty()) {
+        return;
+    }
+    size_t size = boxes.size() * sizeof(int);
+    if (boxes.size() == contentBoxesSaved.size() && memcmp(boxes.LendData(), contentBoxesSaved.LendData(), size) == 0) {
+        return;
+    }
+    TempStr path = GetContentBoxesPathTemp(engine->FilePath());
+    if (!path) {
+        return;
+    }
+    dir::CreateForFile(path);
+    if (!file::WriteFile(path, ByteSlice((u8*)boxes.LendData(), size))) {
+        logf("DisplayModel::SaveContentBoxes: failed to write '%s'\n", path);
+        return;
+    }
+    contentBoxesSaved.Reset();
+    contentBoxesSaved.Append(boxes);
+}
+
+static void CalcContentBoxesThread(DisplayModel* dm) {
+    for (;;) {
+        int pageNo = 0;
+        int gen = 0;
+        {
+            ScopedCritSec scope(&dm->contentBoxesAccess);
+            if (dm->contentBoxesCancel.Get() != 0 || dm->contentBoxesNext >= dm->contentBoxesPending.Size()) {
+                dm->contentBoxesRunning = false;
+                return;
+            }
+            pageNo = dm->contentBoxesPending.at(dm->contentBoxesNext);
+            dm->contentBoxesNext++;
+            gen = dm->contentBoxesGen;
+        }
+        // the result is also cached by the engine
+        RectF box = dm->engine->PageContentBox(pageNo);
+        ScopedCritSec scope(&dm->contentBoxesAccess);
+        if (gen == dm->contentBoxesGen) {
+            dm->contentBoxesFound.at(pageNo - 1) = box;
+        }
+    }
+}
+
+void DisplayModel::StartContentBoxesThread() {
+    if (contentBoxesThread) {
+        return;
+    }
+    // the pages after the current one are most likely to be needed first
+    int nPages = PageCount();
+    int currPageNo = CurrentPageNo();
+    if (!ValidPageNo(currPageNo)) {
+        currPageNo = 1;
+    }
+    ScopedCritSec scope(&contentBoxesAccess);
+    for (int i = 0; i < nPages; i++) {
+        contentBoxesFound.Append(RectF());
+        int pageNo = (currPageNo - 1 + i) % nPages + 1;
+        if (pagesInfo[pageNo - 1].contentBox.IsEmpty()) {
+            contentBoxesPending.Append(pageNo);
+        }
+    }
+    auto fn = MkFunc0<DisplayModel>(CalcContentBoxesThread, this);
+    contentBoxesThread = StartThread(fn, "ContentBoxesThread");
+    contentBoxesRunning = contentBoxesThread != nullptr;
+}
+
+// pages added (or renumbered) by AddLoadedPages() once the content boxes are
+// being calculated need them as well
+void DisplayModel::QueueContentBoxes(int firstPageNo) {
+    if (!contentBoxesThread) {
+        return;
+    }
+    int nPages = PageCount();
+    ScopedCritSec scope(&contentBoxesAccess);
+    int nFound = contentBoxesFound.Size();
+    if (firstPageNo <= nFound) {
+        contentBoxesGen++;
+        for (int i = firstPageNo - 1; i < nFound; i++) {
+            contentBoxesFound.at(i) = RectF();
+        }
+    }
+    for (int i = nFound; i < nPages; i++) {
+        contentBoxesFound.Append(RectF());
+    }
+    for (int pageNo = firstPageNo; pageNo <= nPages; pageNo++) {
+        if (pagesInfo[pageNo - 1].contentBox.IsEmpty()) {
+            contentBoxesPending.Append(pageNo);
+        }
+    }
+    if (contentBoxesRunning) {
+        return;
+    }
+    // the thread has run out of pages and is exiting (or has exited)
+    WaitForSingleObject(contentBoxesThread, INFINITE);
+    CloseHandle(contentBoxesThread);
+    auto fn = MkFunc0<DisplayModel>(CalcContentBoxesThread, this);
+    contentBoxesThread = StartThread(fn, "ContentBoxesThread");
+    contentBoxesRunning = contentBoxesThread != nullptr;
+}
+
 RectF DisplayModel::GetContentBox(int pageNo) const {
     RectF cbox{};
     // we cache the contentBox
-    PageInfo* pageInfo = GetPageInfo(pageNo);
+    PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
     if (pageInfo->contentBox.IsEmpty()) {
         pageInfo->contentBox = engine->PageContentBox(pageNo);
     }
     cbox = pageInfo->contentBox;
-    float zoom = pageInfo->zoomReal;
+    float zoom = lazyLayout ? pageSpace.zoom : pageInfo->zoomReal;
     // TODO: must be a better way
     if (zoom == 0) {
         zoom = zoomReal;
@@ -17,10 +17,15 @@ struct PageInfo {
     /* data that is calculated when needed. actual content size within a page (View target) */
     RectF contentBox{};
 
+    /* data that changes when rotation changes. page size after rotation in
+       document units. Calculated in DisplayModel::UpdateRotatedPageSizes() */
+    SizeF sizeRotated{};
+
     /* data that changes when zoom and rotation changes */
     /* position and size within total area after applying zoom and rotation.
        Represents display rectangle for a given page.
-       Calculated in DisplayModel::Relayout() */
+       Calculated in DisplayModel::Relayout() (or on demand in
+       DisplayModel::UpdateLazyPageInfo() when the layout is lazy) */
     Rect pos{};
 
     /* data that changes due to scrolling. Calculated in DisplayModel::RecalcVisibleParts() */
@@ -35,6 +40,36 @@ struct PageInfo {
     /* data that needs to be set before DisplayModel::Relayout().
        Determines whether a given page should be shown on the screen. */
     bool shown = false;
+
+    /* with lazy layout: DisplayModel::layoutGen resp. visibleGen for which
+       pos and zoomReal resp. pageOnScreen and visibleRatio were calculated */
+    int layoutGen = 0;
+    int visibleGen = 0;
+};
+
+/* Layout of all pages in continuous modes at a fixed zoom level, kept in page
+   space (document units after rotation, i.e. at zoom 1.0). It only changes with
+   rotation and display mode so changing the zoom just rescales it and the pixel
+   position of a page is calculated only when the page is accessed */
+struct PageSpaceLayout {
+    // top of each row of pages, rowTop[nRows] is the height of all rows
+    Vec<double> rowTop;
+    // widest page in each column
+    double columnMaxDx[2] = {0, 0};
+    int columns = 0;
+    // in book view the first page goes into the second column
+    int firstSlot = 0;
+    int rotation = -1;
+
+    // pixel values for the current zoom, set in DisplayModel::RelayoutLazy()
+    float zoom = 0;
+    int x0 = 0;
+    int y0 = 0;
+    int columnDx[2] = {0, 0};
+    int canvasDx = 0;
+
+    int RowCount() const;
+    int RowTop(int row, int spacingDy) const;
 };
 
 /* The current scroll state (needed for saving/restoring the scroll position) */
@@ -132,7 +167,12 @@ struct DisplayModel : DocController {
     // access only from Search thread
     TextSearch* textSearch = nullptr;
 
-    PageInfo* GetPageInfo(int pageNo) const;
+    // with lazy layout, brings the position and visibility of the page up
+    // to date, so it must only be called on the UI thread
+    PageInfo* GetPageInfo(int pageNo);
+    // doesn't update anything, safe to call from the rendering thread. With
+    // lazy layout, pos and pageOnScreen are only current for visible pages
+    const PageInfo* GetPageInfo(int pageNo) const;
 
     /* current rotation selected by user */
     int GetRotation() const;
@@ -153,6 +193,7 @@ struct DisplayModel : DocController {
     bool PageShown(int pageNo) const;
     bool PageVisible(int pageNo) const;
     bool PageVisibleNearby(int pageNo) const;
+    bool PageOnScreenIsCurrent(int pageNo) const;
     int FirstVisiblePageNo() const;
     bool FirstBookPageVisible() const;
     bool LastBookPageVisible() const;
@@ -189,6 +230,8 @@ struct DisplayModel : DocController {
     void CopyNavHistory(DisplayModel& orig);
 
     void SetInitialViewSettings(DisplayMode displayMode, int newStartPage, Size viewPort, int screenDPI);
+    bool AddLoadedPages();
+    void RestorePageWhenLoaded(int pageNo);
     void SetDisplayR2L(bool r2l);
     bool GetDisplayR2L() const;
 
@@ -199,14 +242,31 @@ struct DisplayModel : DocController {
     bool InPresentation() const;
 
     void BuildPagesInfo();
+    void InitPagesInfo(int firstPageNo);
+    void UpdateRotatedPageSizes();
+    void BuildPageSpaceLayout();
+    void RelayoutLazy(float newZoomVirtual);
+    void UpdateLazyPageInfo(int pageNo, PageInfo* pageInfo);
+    Rect LazyPagePos(int pageNo) const;
+    Rect LazyPageOnScreen(int pageNo) const;
+    int LazyRowAtY(int y) const;
+    void LazyRowPages(int row, int* firstPageNo, int* lastPageNo) const;
+    void GetPagesToCheckForVisibility(int* firstPageNo, int* lastPageNo) const;
     float ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo) const;
     SizeF PageSizeAfterRotation(int pageNo, bool fitToContent = false) const;
     void ChangeStartPage(int startPage);
     Point GetContentStart(int pageNo) const;
-    void RecalcVisibleParts() const;
+    void RecalcVisibleParts();
     void RenderVisibleParts();
     void AddNavPoint();
     RectF GetContentBox(int pageNo) const;
+    void SetContentBoxes(Vec<int>* boxes);
+    void GetContentBoxes(Vec<int>* boxes);
+    void LoadContentBoxes();
+    void SaveContentBoxes();
+    void StartContentBoxesThread();
+    void QueueContentBoxes(int firstPageNo);
+    void ApplyRestoredContentBoxes(int firstPageNo);
     void CalcZoomReal(float zoomVirtual);
     void GoToPage(int pageNo, int scrollY, bool addNavPt = false, int scrollX = -1);
     bool GoToPrevPage(int scrollY);
@@ -216,6 +276,53 @@ struct DisplayModel : DocController {
 
     /* an array of PageInfo, len of array is pageCount */
     PageInfo* pagesInfo = nullptr;
+    /* pages loaded by the engine in the background are added to pagesInfo
+       (see AddLoadedPages()) so it's allocated with room to grow. Arrays
+       outgrown might still be used by the rendering thread and are only
+       freed with the DisplayModel */
+    int pagesInfoCap = 0;
+    Vec<PageInfo*> oldPagesInfo;
+    /* the page to go to once the engine has loaded it unless the user moved
+       away from restoreFallbackPageNo shown until then */
+    int restorePageNo = 0;
+    int restoreFallbackPageNo = 0;
+    /* rotation for which PageInfo::sizeRotated was calculated */
+    int sizeRotatedFor = -1;
+
+    /* with kZoomFitContent, content boxes of all pages are calculated by the
+       engine on a background thread so that navigating doesn't have to wait
+       for them. PageInfo::contentBox is still only set on the UI thread, the
+       thread's results are collected in contentBoxesFound (indexed by pageNo - 1).
+       Pages loaded later are queued as well, restarting the thread if it's done.
+       Protected by contentBoxesAccess */
+    HANDLE contentBoxesThread = nullptr;
+    CRITICAL_SECTION contentBoxesAccess;
+    Vec<int> contentBoxesPending;
+    int contentBoxesNext = 0;
+    Vec<RectF> contentBoxesFound;
+    bool contentBoxesRunning = false;
+    // changes when pages are renumbered, invalidating the box being calculated
+    int contentBoxesGen = 0;
+    AtomicInt contentBoxesCancel;
+    /* content boxes restored by SetContentBoxes(), also for pages still being loaded */
+    Vec<int> contentBoxesRestored;
+    /* last content boxes written by SaveContentBoxes() */
+    Vec<int> contentBoxesSaved;
+
+    /* in continuous modes with a fixed zoom level, PageInfo::pos, zoomReal,
+       pageOnScreen and visibleRatio are calculated on demand in GetPageInfo()
+       so that the cost of zooming and scrolling doesn't depend on page count.
+       This only happens on the UI thread: RecalcVisibleParts() updates the
+       visible pages before they're queued for rendering */
+    bool lazyLayout = false;
+    PageSpaceLayout pageSpace;
+    int layoutGen = 0;
+    int visibleGen = 0;
+    /* view port at the time of the last RecalcVisibleParts() */
+    Rect visibleViewPort;
+    /* only pages within that range can have a non-zero visibleRatio */
+    int visibleFirst = 0;
+    int visibleLast = -1;
 
     DisplayMode displayMode{DisplayMode::Automatic};
     /* In non-continuous mode is the first page from a file that we're
@@ -451,6 +451,7 @@ bool EpubDoc::Load() {
         // an anchor with the file name at the top (for internal links)
         ReportIf(str::FindChar(fullPath, '"'));
         str::TransCharsInPlace(fullPath, "\"", "'");
+        chapterStarts.Append(htmlData.size());
         htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", fullPath);
         htmlData.Append(decoded);
     }
@@ -521,7 +522,19 @@ ByteSlice EpubDoc::GetHtmlData() const {
     return htmlData.AsByteSlice();
 }
 
-ByteSlice* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
+int EpubDoc::GetChapterCount() const {
+    return chapterStarts.Size();
+}
+
+ByteSlice EpubDoc::GetChapterHtml(int idx) const {
+    size_t start = chapterStarts[idx];
+    size_t end = idx + 1 < chapterStarts.Size() ? chapterStarts[idx + 1] : htmlData.size();
+    return {(u8*)htmlData.Get() + start, end - start};
+}
+
+// returns the data by value as images might be appended by another thread
+// (which can move the ImageData) but the data itself doesn't change
+ByteSlice EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
     ScopedCritSec scope(&zipAccess);
 
     if (!pagePath) {
@@ -539,11 +552,11 @@ ByteSlice* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
                     img.base = zip->GetFileDataById(img.fileId);
                 }
                 if (!img.base.empty()) {
-                    return &img.base;
+                    return img.base;
                 }
             }
         }
-        return nullptr;
+        return {};
     }
 
     AutoFreeStr url = NormalizeURL(fileName, pagePath);
@@ -557,7 +570,7 @@ ByteSlice* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
                 img.base = zip->GetFileDataById(img.fileId);
             }
             if (!img.base.empty()) {
-                return &img.base;
+                return img.base;
             }
         }
     }
@@ -570,13 +583,48 @@ ByteSlice* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
         if (!data.base.empty()) {
             data.fileName = str::Dup(url);
             images.Append(data);
-            return &images.Last().base;
+            return data.base;
         }
     }
 
+    return {};
+}
+
+TempStr EpubDoc::GetImageNameTemp(const ByteSlice& img) {
+    ScopedCritSec scope(&zipAccess);
+    for (ImageData& data : images) {
+        if (data.base.data() == img.data()) {
+            return str::DupTemp(data.fileName);
+        }
+    }
     return nullptr;
 }
 
+ByteSlice EpubDoc::GetImageDataByName(const char* name) {
+    ScopedCritSec scope(&zipAccess);
+    for (ImageData& img : images) {
+        if (str::Eq(img.fileName, name)) {
+            if (img.base.empty()) {
+                img.base = zip->GetFileDataById(img.fileId);
+            }
+            return img.base;
+        }
+    }
+    // images which aren't registered in the manifest are only added once used
+    ImageData data;
+    data.fileId = zip->GetFileId(name);
+    if (data.fileId == (size_t)-1) {
+        return {};
+    }
+    data.base = zip->GetFileDataById(data.fileId);
+    if (data.base.empty()) {
+        return {};
+    }
+    data.fileName = str::Dup(name);
+    images.Append(data);
+    return data.base;
+}
+
 ByteSlice EpubDoc::GetFileData(const char* relPath, const char* pagePath) {
     if (!pagePath) {
         ReportIf(true);
@@ -1189,26 +1237,38 @@ bool PalmDoc::Load() {
 
     ByteSlice text = mobiDoc->GetHtmlData();
     uint codePage = GuessTextCodepage((const char*)text.data(), text.size(), CP_ACP);
-    TempStr textUtf8 = strconv::ToMultiByteTemp((const char*)text.data(), codePage, CP_UTF8);
+    str::Str textUtf8(text.size());
+    if (!strconv::AppendAsUtf8(textUtf8, (const char*)text.data(), text.size(), codePage)) {
+        delete mobiDoc;
+        return false;
+    }
+    // the text isn't needed anymore, which lowers peak memory usage
+    delete mobiDoc;
 
-    const char* start = textUtf8;
-    const char* end = start + str::Len(textUtf8);
-    // TODO: speedup by not calling htmlData.Append() for every byte
-    // but gather spans and memcpy them wholesale
+    const char* start = textUtf8.Get();
+    const char* end = start + textUtf8.size();
+    // copy runs of text without special characters wholesale
+    const char* runStart = start;
     for (const char* curr = start; curr < end; curr++) {
         char c = *curr;
+        if ('&' != c && '<' != c && '\n' != c && '\r' != c) {
+            continue;
+        }
+        if ('\r' == c && (curr + 1 == end || '\n' == *(curr + 1))) {
+            continue;
+        }
+        htmlData.Append(runStart, curr - runStart);
         if ('&' == c) {
             htmlData.Append("&amp;");
         } else if ('<' == c) {
             curr = HandleTealDocTag(htmlData, tocEntries, curr, end - curr, codePage);
-        } else if ('\n' == c || '\r' == c && curr + 1 < end && '\n' != *(curr + 1)) {
-            htmlData.Append("\n<br>");
         } else {
-            htmlData.AppendChar(c);
+            htmlData.Append("\n<br>");
         }
+        runStart = curr + 1;
     }
+    htmlData.Append(runStart, end - runStart);
 
-    delete mobiDoc;
     return true;
 }
 
@@ -23,6 +23,8 @@ class EpubDoc {
     CRITICAL_SECTION zipAccess;
 
     str::Str htmlData;
+    // offsets of the chapters (spine items) within htmlData
+    Vec<size_t> chapterStarts;
     Vec<ImageData> images;
     AutoFreeStr tocPath;
     AutoFreeStr fileName;
@@ -41,8 +43,14 @@ class EpubDoc {
     ~EpubDoc();
 
     ByteSlice GetHtmlData() const;
-
-    ByteSlice* GetImageData(const char* fileName, const char* pagePath);
+    // chapters are independent of each other and each starts on a new page
+    int GetChapterCount() const;
+    ByteSlice GetChapterHtml(int idx) const;
+
+    ByteSlice GetImageData(const char* fileName, const char* pagePath);
+    // for referring to an image returned by GetImageData() e.g. in the layout cache
+    TempStr GetImageNameTemp(const ByteSlice& img);
+    ByteSlice GetImageDataByName(const char* name);
     ByteSlice GetFileData(const char* relPath, const char* pagePath);
 
     TempStr GetPropertyTemp(const char* name) const;
@@ -148,8 +148,8 @@ void EpubFormatter::HandleTagImg(HtmlToken* t) {
     if (attr) {
         TempStr src = str::DupTemp(attr->val, attr->valLen);
         url::DecodeInPlace(src);
-        ByteSlice* img = epubDoc->GetImageData(src, pagePath);
-        needAlt = !img || !EmitImage(img);
+        ByteSlice img = epubDoc->GetImageData(src, pagePath);
+        needAlt = img.empty() || !EmitImage(&img);
     }
     if (needAlt && (attr = t->GetAttrByName("alt")) != nullptr) {
         HandleText(attr->val, attr->valLen);
@@ -166,7 +166,7 @@ void EpubFormatter::HandleTagPagebreak(HtmlToken* t) {
         currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::Dup(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        styleSheet.Reset();
     }
 }
 
@@ -211,9 +211,9 @@ void EpubFormatter::HandleTagSvgImage(HtmlToken* t) {
     }
     TempStr src = str::DupTemp(attr->val, attr->valLen);
     url::DecodeInPlace(src);
-    ByteSlice* img = epubDoc->GetImageData(src, pagePath);
-    if (img) {
-        EmitImage(img);
+    ByteSlice img = epubDoc->GetImageData(src, pagePath);
+    if (!img.empty()) {
+        EmitImage(&img);
     }
 }
 
@@ -25,11 +25,19 @@ EngineBase* CreateEngineChmFromFile(const char* fileName);
 EngineBase* CreateEngineHtmlFromFile(const char* fileName);
 EngineBase* CreateEngineTxtFromFile(const char* fileName);
 
+extern bool gEbookIncrementalLayout;
+void SetEbookLayoutCacheDir(const char* dir);
+TempStr GetEbookLayoutCachePathTemp(const char* filePath);
+
 void SetDefaultEbookFont(const char* name, float size);
 void EngineEbookCleanup();
 
 /* EngineImages.cpp */
 
+extern bool gReducedImageDecoding;
+extern bool gImageDecodeAhead;
+void DropCachedImagePage(EngineBase* engine, int pageNo);
+
 bool IsEngineImageSupportedFileType(Kind);
 EngineBase* CreateEngineImageFromFile(const char* fileName);
 EngineBase* CreateEngineImageFromStream(IStream* stream);
@@ -59,6 +67,7 @@ bool EngineMupdfSaveUpdated(EngineBase* engine, const char* path, const ShowErro
 Annotation* EngineMupdfGetAnnotationAtPos(EngineBase*, int pageNo, PointF pos, Annotation*);
 ByteSlice EngineMupdfLoadAttachment(EngineBase*, int attachmentNo);
 bool AddSearchTermBookmark(EngineBase* engine, int pageNo, const char* searchTerm);
+bool CalcPdfFileFingerprint(const char* path, bool fromStream, u8 digest[16]);
 
 // Structure for hierarchical bookmark creation
 struct TermPageData {
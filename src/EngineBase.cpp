@@ -342,6 +342,18 @@ int EngineBase::PageCount() const {
     return pageCount;
 }
 
+void EngineBase::SetOnPagesLoaded(const Func0&) {
+    // all pages are loaded when the document is opened
+}
+
+int EngineBase::AddLoadedPages() {
+    return 0;
+}
+
+bool EngineBase::IsLoadingPages() {
+    return false;
+}
+
 RectF EngineBase::PageContentBox(int pageNo, RenderTarget) {
     return PageMediabox(pageNo);
 }
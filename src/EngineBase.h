@@ -391,6 +391,8 @@ struct RenderPageArgs {
     RectF* pageRect = nullptr;
     RenderTarget target = RenderTarget::View;
     AbortCookie** cookie_out = nullptr;
+    // only render the page's content (used for thumbnails, only supported by EngineMupdf)
+    bool skipAnnotations = false;
 
     RenderPageArgs(int pageNo, float zoom, int rotation, RectF* pageRect = nullptr,
                    RenderTarget target = RenderTarget::View, AbortCookie** cookie_out = nullptr);
@@ -426,6 +428,18 @@ class EngineBase {
     // number of pages the loaded document contains
     int PageCount() const;
 
+    // for engines that keep loading pages in the background after the document
+    // has been opened: fn is called from that background thread whenever
+    // AddLoadedPages() would add more pages
+    virtual void SetOnPagesLoaded(const Func0& fn);
+    // adds the pages loaded in the background so far to PageCount()
+    // must be called on the UI thread. Returns the first page that was added
+    // (or renumbered, if pages had to be inserted before the existing ones)
+    // and 0 if PageCount() didn't change
+    virtual int AddLoadedPages();
+    // true until AddLoadedPages() has added the last of the pages loaded in the background
+    virtual bool IsLoadingPages();
+
     // the box containing the visible page content (usually RectF(0, 0, pageWidth, pageHeight))
     virtual RectF PageMediabox(int pageNo) = 0;
     // the box inside PageMediabox that actually contains any relevant content
@@ -537,8 +551,17 @@ class EngineBase {
     virtual ~EngineBase();
 };
 
+// identifies the content of a document. Might only be calculated
+// when asked for (or still be calculated in the background)
+struct FileFingerprint {
+    // returns false if the fingerprint couldn't be calculated
+    virtual bool Get(u8 digest[16]) = 0;
+    virtual ~FileFingerprint() = default;
+};
+
 struct PasswordUI {
-    virtual char* GetPassword(const char* fileName, u8* fileDigest, u8 decryptionKeyOut[32], bool* saveKey) = 0;
+    virtual char* GetPassword(const char* fileName, FileFingerprint* fingerprint, u8 decryptionKeyOut[32],
+                              bool* saveKey) = 0;
     virtual ~PasswordUI() = default;
 };
 
@@ -505,7 +505,7 @@ class PasswordHolder : public PasswordUI {
   public:
     explicit PasswordHolder(const char* password) : password(password) {
     }
-    char* GetPassword(const char*, u8*, __unused u8 decryptionKeyOut[32], bool*) override {
+    char* GetPassword(const char*, FileFingerprint*, __unused u8 decryptionKeyOut[32], bool*) override {
         return str::Dup(password);
     }
 };
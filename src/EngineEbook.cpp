@@ -7,11 +7,15 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/Archive.h"
+#include "utils/ByteOrderDecoder.h"
+#include "utils/ByteWriter.h"
+#include "utils/CryptoUtil.h"
 #include "utils/Dpi.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/ThreadUtil.h"
 #include "mui/Mui.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
@@ -30,6 +34,8 @@
 #include "HtmlFormatter.h"
 #include "EbookFormatter.h"
 
+#include "utils/Log.h"
+
 Kind kindEngineEpub = "engineEpub";
 Kind kindEngineFb2 = "engineFb2";
 Kind kindEngineMobi = "engineMobi";
@@ -41,6 +47,26 @@ Kind kindEngineTxt = "engineTxt";
 static AutoFreeStr gDefaultFontName;
 static float gDefaultFontSize = 10.f;
 
+// if true, documents are shown as soon as the first kEbookFirstPages pages have
+// been laid out and the remaining pages are laid out in the background.
+// Otherwise loading lays out all pages (e.g. for EngineDump or the preview handlers)
+bool gEbookIncrementalLayout = false;
+
+constexpr int kEbookFirstPages = 32;
+// how often pages laid out in the background are handed over to the UI
+constexpr double kEbookLayoutBatchMs = 250;
+
+// if set, laid out pages are saved to (and loaded from) this directory
+// (see EngineEbook::SaveLayoutCache())
+static AutoFreeStr gEbookLayoutCacheDir;
+
+// "SLAY" (Sumatra LAYout)
+constexpr u32 kLayoutCacheMagic = 0x59414C53;
+// must be bumped whenever HtmlFormatter lays out differently
+// or the format of the cache changes
+// 2: CSS rules with multiple classes and #id selectors are applied
+constexpr u32 kLayoutCacheVersion = 2;
+
 static const WCHAR* GetDefaultFontName() {
     char* s = gDefaultFontName.Get();
     if (s) {
@@ -81,6 +107,34 @@ struct PageAnchor {
     }
 };
 
+// a destination to a page that hasn't been laid out yet
+// (see EngineEbook::GetPendingDest())
+struct PendingDest {
+    // placeholder that is updated once the destination has been laid out
+    IPageDestination* dest = nullptr;
+    char* url = nullptr;
+    // ToC item to update along with dest (if any)
+    TocItem* tocItem = nullptr;
+    bool isIndex = false;
+};
+
+class EngineEbook;
+
+// state shared by the threads laying out sections in parallel
+// (see EngineEbook::LayoutSections())
+struct SectionsLayout {
+    EngineEbook* engine = nullptr;
+    // index of the next section for a worker to lay out
+    AtomicInt nextSection;
+    // pages of a section are only accessed by the coordinator once done is set
+    Vec<HtmlPage*>* sectionPages = nullptr;
+    AtomicInt* sectionDone = nullptr;
+    // signaled whenever a worker has finished a section or is exiting
+    HANDLE progress = nullptr;
+    // false if laying out synchronously on the UI thread
+    bool resetTempAllocator = true;
+};
+
 class EbookAbortCookie : public AbortCookie {
   public:
     bool abort = false;
@@ -129,6 +183,12 @@ class EngineEbook : public EngineBase {
 
     bool BenchLoadPage(int pageNo) override;
 
+    void SetOnPagesLoaded(const Func0& fn) override;
+    int AddLoadedPages() override;
+    bool IsLoadingPages() override;
+
+    IPageDestination* GetPendingDest(const char* url, TocItem* tocItem = nullptr, bool isIndex = false);
+
   protected:
     Vec<HtmlPage*>* pages = nullptr;
     Vec<PageAnchor> anchors;
@@ -143,8 +203,51 @@ class EngineEbook : public EngineBase {
     RectF pageRect;
     float pageBorder;
 
+    // pages are laid out on layoutThread which hands them over in batches
+    // (protected by loadedAccess, see AddLoadedPages())
+    HtmlFormatterArgs formatterArgs;
+    // if set, parts of formatterArgs.htmlStr which always start on a new page
+    // and are thus laid out in parallel (with their own allocators)
+    Vec<ByteSlice> sections;
+    Vec<PoolAllocator*> sectionAllocators;
+    bool skipEmptyPages = false;
+    CRITICAL_SECTION loadedAccess;
+    Vec<HtmlPage*> loadedPages;
+    bool layoutDone = false;
+    Func0 onPagesLoaded;
+    HANDLE layoutThread = nullptr;
+    // signaled once the pages to show when opening the document have been laid out
+    HANDLE firstPagesLoaded = nullptr;
+    AtomicInt layoutCancel;
+    // only accessed on the UI thread
+    bool allPagesLaidOut = false;
+    Vec<PendingDest> pendingDests;
+
+    virtual HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) = 0;
+    void InitFormatterArgs(const ByteSlice& htmlStr, mui::TextRenderMethod textRenderMethod);
+    void WriteLayoutCacheKey(ByteWriter& w);
+    void SaveLayoutCache(Vec<HtmlPage*>& laidOut);
+    bool LoadLayoutCache(Vec<HtmlPage*>& laidOut);
+    // images are referenced by name in the layout cache (if possible, otherwise
+    // the data is copied into the cache)
+    virtual TempStr GetImageNameTemp(const ByteSlice&) {
+        return nullptr;
+    }
+    virtual ByteSlice GetImageByName(const char*) {
+        return {};
+    }
+    bool StartLayout();
+    void StopLayout();
+    void WaitForLayout();
+    static void LayoutThread(EngineEbook* e);
+    static void LayoutSections(EngineEbook* e);
+    static void LayoutSectionsWorker(SectionsLayout* sl);
+    void HandOverPages(Vec<HtmlPage*>& laidOut, bool isLast);
+    void ResolvePendingDests();
+    static EngineBase* WithAllPages(EngineBase* clone);
+
     void GetTransform(Matrix& m, float zoom, int rotation);
-    bool ExtractPageAnchors();
+    void ExtractPageAnchors(int firstPageNo);
     TempStr ExtractFontListTemp();
 
     virtual IPageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo);
@@ -200,9 +303,20 @@ EngineEbook::EngineEbook() {
     pageBorder = 0.4f * GetFileDPI();
     preferredLayout = preferredLayout = PageLayout(PageLayout::Type::Single);
     InitializeCriticalSection(&pagesAccess);
+    InitializeCriticalSection(&loadedAccess);
 }
 
+// derived classes must call StopLayout() before deleting the document
 EngineEbook::~EngineEbook() {
+    StopLayout();
+    SafeCloseHandle(&firstPagesLoaded);
+    DeleteVecMembers(loadedPages);
+    DeleteVecMembers(sectionAllocators);
+    for (PendingDest& pd : pendingDests) {
+        str::Free(pd.url);
+    }
+    DeleteCriticalSection(&loadedAccess);
+
     EnterCriticalSection(&pagesAccess);
 
     if (pages) {
@@ -257,15 +371,17 @@ void EngineEbook::GetTransform(Matrix& m, float zoom, int rotation) {
     GetBaseTransform(m, ToGdipRectF(pageRect), zoom, rotation);
 }
 
+// pages can be added in the background (see AddLoadedPages())
 Vec<DrawInstr>* EngineEbook::GetHtmlPage(int pageNo) {
-    ReportIf(pageNo < 1 || PageCount() < pageNo);
-    if (pageNo < 1 || PageCount() < pageNo) {
+    HtmlPage* page = GetHtmlPage2(pageNo);
+    if (!page) {
         return nullptr;
     }
-    return &pages->at(pageNo - 1)->instructions;
+    return &page->instructions;
 }
 
 HtmlPage* EngineEbook::GetHtmlPage2(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
     ReportIf(pageNo < 1 || PageCount() < pageNo);
     if (pageNo < 1 || PageCount() < pageNo) {
         return nullptr;
@@ -273,15 +389,616 @@ HtmlPage* EngineEbook::GetHtmlPage2(int pageNo) {
     return pages->at(pageNo - 1);
 }
 
-bool EngineEbook::ExtractPageAnchors() {
-    ScopedCritSec scope(&pagesAccess);
+void EngineEbook::InitFormatterArgs(const ByteSlice& htmlStr, mui::TextRenderMethod textRenderMethod) {
+    HtmlFormatterArgs& args = formatterArgs;
+    args.htmlStr = htmlStr;
+    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
+    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
+    args.SetFontName(GetDefaultFontName());
+    args.fontSize = GetDefaultFontSize();
+    args.textAllocator = &allocator;
+    args.textRenderMethod = textRenderMethod;
+}
 
-    DrawInstr* baseAnchor = nullptr;
-    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
-        Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
-        if (!pageInstrs) {
+// lays out all pages and hands them over to the UI thread in batches: first the
+// pages to show when opening the document and then, as long as the layout takes,
+// whatever has been laid out every kEbookLayoutBatchMs.
+// The formatter must be created on the thread it's used on (it measures text
+// with a per-thread Graphics)
+void EngineEbook::LayoutThread(EngineEbook* e) {
+    if (e->sections.Size() > 1) {
+        LayoutSections(e);
+        return;
+    }
+    // firstPagesLoaded is only created for laying out in the background
+    bool isBackground = e->firstPagesLoaded != nullptr;
+    HtmlFormatter* formatter = e->CreateFormatter(&e->formatterArgs);
+    Vec<HtmlPage*> laidOut;
+    Vec<HtmlPage*> allPages;
+    bool isFirstBatch = true;
+    auto t = TimeGet();
+    for (HtmlPage* pd = formatter->Next(e->skipEmptyPages); pd; pd = formatter->Next(e->skipEmptyPages)) {
+        laidOut.Append(pd);
+        allPages.Append(pd);
+        if (isBackground) {
+            // text runs are measured with ToWStrTemp()
+            ResetTempAllocator();
+        }
+        if (e->layoutCancel.Get() != 0) {
+            break;
+        }
+        bool handOver = isFirstBatch ? laidOut.Size() >= kEbookFirstPages : TimeSinceInMs(t) >= kEbookLayoutBatchMs;
+        if (handOver) {
+            e->HandOverPages(laidOut, false);
+            isFirstBatch = false;
+            t = TimeGet();
+        }
+    }
+    delete formatter;
+    e->HandOverPages(laidOut, true);
+    if (e->layoutCancel.Get() == 0) {
+        e->SaveLayoutCache(allPages);
+    }
+}
+
+// lays out sections until there are none left (each with a new formatter
+// as they're independent of each other)
+void EngineEbook::LayoutSectionsWorker(SectionsLayout* sl) {
+    EngineEbook* e = sl->engine;
+    PoolAllocator* allocator = nullptr;
+    {
+        ScopedCritSec scope(&e->loadedAccess);
+        allocator = new PoolAllocator();
+        e->sectionAllocators.Append(allocator);
+    }
+
+    int nSections = e->sections.Size();
+    for (int idx = sl->nextSection.Inc() - 1; idx < nSections; idx = sl->nextSection.Inc() - 1) {
+        ByteSlice section = e->sections[idx];
+        int offset = (int)(section.data() - e->formatterArgs.htmlStr.data());
+
+        HtmlFormatterArgs args;
+        args.pageDx = e->formatterArgs.pageDx;
+        args.pageDy = e->formatterArgs.pageDy;
+        args.SetFontName(e->formatterArgs.GetFontName());
+        args.fontSize = e->formatterArgs.fontSize;
+        args.textAllocator = allocator;
+        args.textRenderMethod = e->formatterArgs.textRenderMethod;
+        args.htmlStr = section;
+
+        HtmlFormatter* formatter = e->CreateFormatter(&args);
+        Vec<HtmlPage*>& laidOut = sl->sectionPages[idx];
+        for (HtmlPage* pd = formatter->Next(e->skipEmptyPages); pd; pd = formatter->Next(e->skipEmptyPages)) {
+            // reparseIdx must be an offset within the whole document
+            pd->reparseIdx += offset;
+            laidOut.Append(pd);
+            if (sl->resetTempAllocator) {
+                // text runs are measured with ToWStrTemp()
+                ResetTempAllocator();
+            }
+            if (e->layoutCancel.Get() != 0) {
+                break;
+            }
+        }
+        delete formatter;
+        sl->sectionDone[idx].Set(1);
+        SetEvent(sl->progress);
+        if (e->layoutCancel.Get() != 0) {
+            break;
+        }
+    }
+    SetEvent(sl->progress);
+}
+
+// lays out sections on as many threads as there are cores and hands over
+// the pages in document order (same batching as in LayoutThread())
+void EngineEbook::LayoutSections(EngineEbook* e) {
+    int nSections = e->sections.Size();
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int nWorkers = std::clamp((int)si.dwNumberOfProcessors, 1, nSections);
+
+    SectionsLayout sl;
+    sl.engine = e;
+    sl.sectionPages = new Vec<HtmlPage*>[nSections];
+    sl.sectionDone = new AtomicInt[nSections];
+    sl.progress = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+
+    Vec<HANDLE> workers;
+    for (int i = 0; i < nWorkers; i++) {
+        auto fn = MkFunc0<SectionsLayout>(LayoutSectionsWorker, &sl);
+        HANDLE h = StartThread(fn, "EbookLayoutSectionThread");
+        if (h) {
+            workers.Append(h);
+        }
+    }
+    if (workers.Size() == 0) {
+        // lay out on this thread instead
+        sl.resetTempAllocator = e->firstPagesLoaded != nullptr;
+        LayoutSectionsWorker(&sl);
+    }
+
+    Vec<HtmlPage*> laidOut;
+    Vec<HtmlPage*> allPages;
+    bool isFirstBatch = true;
+    auto t = TimeGet();
+    int idx = 0;
+    while (idx < nSections && e->layoutCancel.Get() == 0) {
+        if (sl.sectionDone[idx].Get() == 0) {
+            WaitForSingleObject(sl.progress, INFINITE);
+            continue;
+        }
+        for (HtmlPage* pd : sl.sectionPages[idx]) {
+            laidOut.Append(pd);
+            allPages.Append(pd);
+        }
+        sl.sectionPages[idx].Reset();
+        idx++;
+        bool handOver = isFirstBatch ? laidOut.Size() >= kEbookFirstPages : TimeSinceInMs(t) >= kEbookLayoutBatchMs;
+        if (handOver && idx < nSections) {
+            e->HandOverPages(laidOut, false);
+            isFirstBatch = false;
+            t = TimeGet();
+        }
+    }
+
+    for (HANDLE h : workers) {
+        WaitForSingleObject(h, INFINITE);
+        CloseHandle(h);
+    }
+    // if cancelled, the remaining pages are handed over so that they're deleted
+    for (int i = idx; i < nSections; i++) {
+        for (HtmlPage* pd : sl.sectionPages[i]) {
+            laidOut.Append(pd);
+        }
+    }
+    e->HandOverPages(laidOut, true);
+    if (e->layoutCancel.Get() == 0) {
+        e->SaveLayoutCache(allPages);
+    }
+
+    CloseHandle(sl.progress);
+    delete[] sl.sectionPages;
+    delete[] sl.sectionDone;
+}
+
+void EngineEbook::HandOverPages(Vec<HtmlPage*>& laidOut, bool isLast) {
+    ScopedCritSec scope(&loadedAccess);
+    for (HtmlPage* page : laidOut) {
+        loadedPages.Append(page);
+    }
+    laidOut.Reset();
+    layoutDone = isLast;
+    onPagesLoaded.Call();
+    if (firstPagesLoaded) {
+        SetEvent(firstPagesLoaded);
+    }
+}
+
+// returns once the first pages have been laid out (or all of them,
+// if !gEbookIncrementalLayout or they could be loaded from the layout cache)
+bool EngineEbook::StartLayout() {
+    pages = new Vec<HtmlPage*>();
+    Vec<HtmlPage*> cached;
+    if (LoadLayoutCache(cached)) {
+        HandOverPages(cached, true);
+    } else if (!gEbookIncrementalLayout) {
+        LayoutThread(this);
+    } else {
+        firstPagesLoaded = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (!firstPagesLoaded) {
+            return false;
+        }
+        auto fn = MkFunc0<EngineEbook>(LayoutThread, this);
+        layoutThread = StartThread(fn, "EbookLayoutThread");
+        if (!layoutThread) {
             return false;
         }
+        WaitForSingleObject(firstPagesLoaded, INFINITE);
+    }
+    AddLoadedPages();
+    return pageCount > 0;
+}
+
+void EngineEbook::StopLayout() {
+    if (!layoutThread) {
+        return;
+    }
+    layoutCancel.Set(1);
+    WaitForSingleObject(layoutThread, INFINITE);
+    SafeCloseHandle(&layoutThread);
+}
+
+void EngineEbook::WaitForLayout() {
+    if (layoutThread) {
+        WaitForSingleObject(layoutThread, INFINITE);
+    }
+    AddLoadedPages();
+}
+
+// clones are e.g. used for printing which needs all pages
+EngineBase* EngineEbook::WithAllPages(EngineBase* clone) {
+    if (clone) {
+        ((EngineEbook*)clone)->WaitForLayout();
+    }
+    return clone;
+}
+
+// the layout cache of a document is <md5 of its path>.layout, so there's only ever
+// one per document (which is overwritten when laid out with different settings)
+TempStr GetEbookLayoutCachePathTemp(const char* filePath) {
+    if (!gEbookLayoutCacheDir || !filePath) {
+        return nullptr;
+    }
+    u8 digest[16]{};
+    CalcMD5Digest((u8*)filePath, str::Leni(filePath), digest);
+    AutoFreeStr fingerPrint = str::MemToHex(digest, dimof(digest));
+    return path::JoinTemp(gEbookLayoutCacheDir, str::JoinTemp(fingerPrint, ".layout"));
+}
+
+void SetEbookLayoutCacheDir(const char* dir) {
+    gEbookLayoutCacheDir.SetCopy(dir);
+}
+
+static void WriteFloat(ByteWriter& w, float f) {
+    u32 v;
+    memcpy(&v, &f, sizeof(v));
+    w.Write32(v);
+}
+
+static float ReadFloat(ByteOrderDecoder& d) {
+    u32 v = d.UInt32();
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+static void WriteBytes(ByteWriter& w, const void* s, size_t len) {
+    w.Write32((u32)len);
+    w.d.Append((const char*)s, len);
+}
+
+// returns a pointer into the cache data (or nullptr if it's not valid)
+static const char* ReadBytes(ByteOrderDecoder& d, const u8* data, size_t* lenOut) {
+    *lenOut = d.UInt32();
+    const char* s = (const char*)data + d.Offset();
+    d.Skip(*lenOut);
+    return d.IsOk() ? s : nullptr;
+}
+
+// the cache is only valid for the same file laid out with the same arguments
+void EngineEbook::WriteLayoutCacheKey(ByteWriter& w) {
+    const char* path = FilePath();
+    FILETIME mtime = file::GetModificationTime(path);
+    w.Write32(kLayoutCacheMagic);
+    w.Write32(kLayoutCacheVersion);
+    w.Write64((u64)file::GetSize(path));
+    w.Write64(((u64)mtime.dwHighDateTime << 32) | mtime.dwLowDateTime);
+    w.Write64((u64)formatterArgs.htmlStr.size());
+    WriteFloat(w, formatterArgs.pageDx);
+    WriteFloat(w, formatterArgs.pageDy);
+    WriteFloat(w, formatterArgs.fontSize);
+    w.Write32((u32)formatterArgs.textRenderMethod);
+    w.Write8(skipEmptyPages ? 1 : 0);
+    TempStr fontName = ToUtf8Temp(formatterArgs.GetFontName());
+    WriteBytes(w, fontName, str::Len(fontName));
+}
+
+// the smallest possible size of a page (reparseIdx, number of instructions)
+// and of an instruction (type, bbox) in the layout cache
+constexpr size_t kCachedPageMinSize = 2 * sizeof(u32);
+constexpr size_t kCachedInstrMinSize = 1 + 4 * sizeof(u32);
+
+// how a DrawInstr's str is stored in the layout cache
+enum class CachedStr : u8 {
+    // an offset into formatterArgs.htmlStr
+    HtmlOffset,
+    // the data itself (e.g. text with resolved entities)
+    Data,
+    // an image referenced by name (see GetImageByName())
+    ImageName,
+};
+
+// called on the layout thread once all pages have been laid out
+// (the pages have already been handed over but the UI doesn't modify instructions)
+void EngineEbook::SaveLayoutCache(Vec<HtmlPage*>& laidOut) {
+    TempStr cachePath = GetEbookLayoutCachePathTemp(FilePath());
+    if (!cachePath) {
+        return;
+    }
+    const char* html = (const char*)formatterArgs.htmlStr.data();
+    size_t htmlLen = formatterArgs.htmlStr.size();
+
+    // fonts are stored once and referenced by index
+    Vec<mui::CachedFont*> fonts;
+    ByteWriterLE wp(laidOut.Size() * 2048);
+    wp.Write32((u32)laidOut.Size());
+    for (HtmlPage* page : laidOut) {
+        wp.Write32((u32)page->reparseIdx);
+        wp.Write32((u32)page->instructions.Size());
+        for (DrawInstr& i : page->instructions) {
+            wp.Write8((u8)i.type);
+            WriteFloat(wp, i.bbox.x);
+            WriteFloat(wp, i.bbox.y);
+            WriteFloat(wp, i.bbox.dx);
+            WriteFloat(wp, i.bbox.dy);
+            switch (i.type) {
+                case DrawInstrType::SetFont: {
+                    int idx = fonts.Find(i.font);
+                    if (idx < 0) {
+                        idx = fonts.Size();
+                        fonts.Append(i.font);
+                    }
+                    wp.Write32((u32)idx);
+                    break;
+                }
+                case DrawInstrType::String:
+                case DrawInstrType::RtlString:
+                case DrawInstrType::LinkStart:
+                case DrawInstrType::Anchor:
+                case DrawInstrType::Image: {
+                    TempStr imageName = nullptr;
+                    if (i.type == DrawInstrType::Image) {
+                        imageName = GetImageNameTemp(i.GetImage());
+                    }
+                    if (imageName) {
+                        wp.Write8((u8)CachedStr::ImageName);
+                        WriteBytes(wp, imageName, str::Len(imageName));
+                    } else if (i.str.s >= html && i.str.s + i.str.len <= html + htmlLen) {
+                        wp.Write8((u8)CachedStr::HtmlOffset);
+                        wp.Write32((u32)(i.str.s - html));
+                        wp.Write32((u32)i.str.len);
+                    } else {
+                        wp.Write8((u8)CachedStr::Data);
+                        WriteBytes(wp, i.str.s, i.str.len);
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+
+    ByteWriterLE w(wp.Size() + 1024);
+    WriteLayoutCacheKey(w);
+    w.Write32((u32)fonts.Size());
+    for (mui::CachedFont* font : fonts) {
+        WriteFloat(w, font->GetSize());
+        w.Write32((u32)font->GetStyle());
+        TempStr name = ToUtf8Temp(font->GetName());
+        WriteBytes(w, name, str::Len(name));
+    }
+    w.d.Append(wp.d);
+
+    // written under a temporary name so that a partially written cache is never loaded
+    dir::CreateForFile(cachePath);
+    TempStr tmpPath = str::FormatTemp("%s.%d.tmp", cachePath, (int)GetCurrentThreadId());
+    if (!file::WriteFile(tmpPath, w.AsByteSlice())) {
+        return;
+    }
+    if (!MoveFileExW(ToWStrTemp(tmpPath), ToWStrTemp(cachePath), MOVEFILE_REPLACE_EXISTING)) {
+        logf("EngineEbook::SaveLayoutCache: MoveFileExW('%s') failed\n", cachePath);
+        file::Delete(tmpPath);
+    }
+}
+
+// loads the pages from the layout cache if it's valid for the document and formatterArgs
+bool EngineEbook::LoadLayoutCache(Vec<HtmlPage*>& laidOut) {
+    TempStr cachePath = GetEbookLayoutCachePathTemp(FilePath());
+    if (!cachePath || !file::Exists(cachePath)) {
+        return false;
+    }
+    ByteWriterLE key;
+    WriteLayoutCacheKey(key);
+    ByteSlice data = file::ReadFile(cachePath);
+    defer {
+        data.Free();
+    };
+    if (data.size() < key.Size() || !memeq(data.data(), key.d.Get(), key.Size())) {
+        return false;
+    }
+
+    const u8* d0 = data.data();
+    ByteOrderDecoder d(d0, data.size(), ByteOrderDecoder::LittleEndian);
+    d.Skip(key.Size());
+    const char* html = (const char*)formatterArgs.htmlStr.data();
+    size_t htmlLen = formatterArgs.htmlStr.size();
+
+    Vec<mui::CachedFont*> fonts;
+    u32 nFonts = d.UInt32();
+    for (u32 i = 0; i < nFonts && d.IsOk(); i++) {
+        float sizePt = ReadFloat(d);
+        auto style = (Gdiplus::FontStyle)d.UInt32();
+        size_t len;
+        const char* name = ReadBytes(d, d0, &len);
+        if (!name) {
+            return false;
+        }
+        mui::CachedFont* font = mui::GetCachedFont(ToWStrTemp(name, len), sizePt, style);
+        if (!font) {
+            return false;
+        }
+        fonts.Append(font);
+    }
+
+    // the counts are checked against the size of the remaining data so that
+    // a corrupt cache doesn't make us allocate lots of empty pages
+    u32 nPages = d.UInt32();
+    bool ok = d.IsOk() && nPages <= (data.size() - d.Offset()) / kCachedPageMinSize;
+    for (u32 pageNo = 0; ok && pageNo < nPages; pageNo++) {
+        int reparseIdx = (int)d.UInt32();
+        u32 nInstrs = d.UInt32();
+        ok = d.IsOk() && nInstrs <= (data.size() - d.Offset()) / kCachedInstrMinSize;
+        if (!ok) {
+            break;
+        }
+        auto page = new HtmlPage(reparseIdx);
+        laidOut.Append(page);
+        for (u32 n = 0; ok && n < nInstrs; n++) {
+            DrawInstr i((DrawInstrType)d.UInt8());
+            i.bbox.x = ReadFloat(d);
+            i.bbox.y = ReadFloat(d);
+            i.bbox.dx = ReadFloat(d);
+            i.bbox.dy = ReadFloat(d);
+            switch (i.type) {
+                case DrawInstrType::SetFont: {
+                    u32 idx = d.UInt32();
+                    ok = idx < (u32)fonts.Size();
+                    i.font = ok ? fonts[idx] : nullptr;
+                    break;
+                }
+                case DrawInstrType::String:
+                case DrawInstrType::RtlString:
+                case DrawInstrType::LinkStart:
+                case DrawInstrType::Anchor:
+                case DrawInstrType::Image: {
+                    auto how = (CachedStr)d.UInt8();
+                    if (how == CachedStr::HtmlOffset) {
+                        size_t off = d.UInt32();
+                        i.str.len = d.UInt32();
+                        ok = off + i.str.len <= htmlLen;
+                        i.str.s = html + off;
+                    } else if (how == CachedStr::Data) {
+                        const char* s = ReadBytes(d, d0, &i.str.len);
+                        ok = s != nullptr;
+                        i.str.s = ok ? (const char*)Allocator::MemDup(&allocator, s, i.str.len) : nullptr;
+                    } else if (how == CachedStr::ImageName && i.type == DrawInstrType::Image) {
+                        size_t len;
+                        const char* name = ReadBytes(d, d0, &len);
+                        ByteSlice img = name ? GetImageByName(str::DupTemp(name, len)) : ByteSlice();
+                        ok = !img.empty();
+                        i.str.s = (const char*)img.data();
+                        i.str.len = img.size();
+                    } else {
+                        ok = false;
+                    }
+                    break;
+                }
+                case DrawInstrType::ElasticSpace:
+                case DrawInstrType::FixedSpace:
+                case DrawInstrType::Line:
+                case DrawInstrType::LinkEnd:
+                    break;
+                default:
+                    ok = false;
+                    break;
+            }
+            ok = ok && d.IsOk();
+            page->instructions.Append(i);
+        }
+    }
+    if (!ok || laidOut.Size() == 0) {
+        logf("EngineEbook::LoadLayoutCache: '%s' is invalid\n", cachePath);
+        DeleteVecMembers(laidOut);
+        return false;
+    }
+    return true;
+}
+
+void EngineEbook::SetOnPagesLoaded(const Func0& fn) {
+    ScopedCritSec scope(&loadedAccess);
+    onPagesLoaded = fn;
+    if (loadedPages.Size() > 0 || layoutDone && !allPagesLaidOut) {
+        onPagesLoaded.Call();
+    }
+}
+
+int EngineEbook::AddLoadedPages() {
+    int nAdded = 0;
+    {
+        ScopedCritSec scope(&loadedAccess);
+        nAdded = loadedPages.Size();
+        if (nAdded > 0) {
+            ScopedCritSec scope2(&pagesAccess);
+            for (HtmlPage* page : loadedPages) {
+                pages->Append(page);
+            }
+            pageCount = pages->Size();
+            ExtractPageAnchors(pageCount - nAdded + 1);
+        }
+        loadedPages.Reset();
+        if (layoutDone) {
+            allPagesLaidOut = true;
+        }
+    }
+    if (nAdded > 0 || allPagesLaidOut) {
+        ResolvePendingDests();
+    }
+    return nAdded > 0 ? pageCount - nAdded + 1 : 0;
+}
+
+bool EngineEbook::IsLoadingPages() {
+    return !allPagesLaidOut;
+}
+
+// returns a placeholder for a destination that might be on a page that hasn't
+// been laid out yet. It's updated by AddLoadedPages() once it has been
+IPageDestination* EngineEbook::GetPendingDest(const char* url, TocItem* tocItem, bool isIndex) {
+    if (allPagesLaidOut) {
+        return nullptr;
+    }
+    PendingDest pd;
+    pd.dest = NewSimpleDest(0, RectF());
+    pd.url = str::Dup(url);
+    pd.tocItem = tocItem;
+    pd.isIndex = isIndex;
+    pendingDests.Append(pd);
+    return pd.dest;
+}
+
+// ToC items are in document order, so after the first one that can't be resolved
+// yet, the others can't either. Index items are in alphabetical order and there
+// can be a lot of them, so they're only resolved after all pages have been laid out
+void EngineEbook::ResolvePendingDests() {
+    bool tocPending = false;
+    // compacts pendingDests to the ones still pending
+    int nPending = 0;
+    int n = pendingDests.Size();
+    for (int i = 0; i < n; i++) {
+        PendingDest pd = pendingDests[i];
+        bool inToc = pd.tocItem && !pd.isIndex;
+        if (!allPagesLaidOut && (pd.isIndex || inToc && tocPending)) {
+            pendingDests[nPending++] = pd;
+            continue;
+        }
+        IPageDestination* dest = GetNamedDest(pd.url);
+        if (!dest && pd.tocItem && str::FindChar(pd.url, '%')) {
+            char* decodedUrl = str::DupTemp(pd.url);
+            url::DecodeInPlace(decodedUrl);
+            dest = GetNamedDest(decodedUrl);
+        }
+        if (!dest) {
+            tocPending = tocPending || inToc;
+            if (!allPagesLaidOut) {
+                pendingDests[nPending++] = pd;
+                continue;
+            }
+            // the destination doesn't exist
+            if (pd.tocItem) {
+                delete pd.tocItem->dest;
+                pd.tocItem->dest = nullptr;
+            }
+        } else {
+            pd.dest->pageNo = dest->pageNo;
+            pd.dest->rect = dest->rect;
+            pd.dest->zoom = dest->zoom;
+            if (inToc) {
+                pd.tocItem->pageNo = dest->pageNo;
+            }
+            delete dest;
+        }
+        str::Free(pd.url);
+    }
+    pendingDests.RemoveAt(nPending, n - nPending);
+}
+
+// must be called with pagesAccess held
+void EngineEbook::ExtractPageAnchors(int firstPageNo) {
+    // base anchors carry over from previous pages
+    DrawInstr* baseAnchor = firstPageNo > 1 ? baseAnchors.Last() : nullptr;
+    for (int pageNo = firstPageNo; pageNo <= pageCount; pageNo++) {
+        Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
 
         for (size_t k = 0; k < pageInstrs->size(); k++) {
             DrawInstr* i = &pageInstrs->at(k);
@@ -297,7 +1014,6 @@ bool EngineEbook::ExtractPageAnchors() {
     }
 
     ReportIf(baseAnchors.size() != pages->size());
-    return true;
 }
 
 RectF EngineEbook::Transform(const RectF& rect, int, float zoom, int rotation, bool inverse) {
@@ -471,6 +1187,9 @@ IPageElement* EngineEbook::CreatePageLink(DrawInstr* link, Rect rect, int pageNo
     }
 
     IPageDestination* dest = GetNamedDest(url);
+    if (!dest) {
+        dest = GetPendingDest(url);
+    }
     if (!dest) {
         return nullptr;
     }
@@ -561,6 +1280,10 @@ IPageDestination* EngineEbook::GetNamedDest(const char* name) {
                 break;
             }
         }
+        if (!baseAnchor && !allPagesLaidOut) {
+            // the document might not have been laid out yet
+            return nullptr;
+        }
     }
 
     size_t id_len = str::Len(id);
@@ -580,6 +1303,11 @@ IPageDestination* EngineEbook::GetNamedDest(const char* name) {
         }
     }
 
+    if (!allPagesLaidOut) {
+        // the ID might be on a page that hasn't been laid out yet
+        return nullptr;
+    }
+
     // don't fail if an ID doesn't exist in a merged document
     if (basePageNo != 0) {
         RectF rect(0, pageBorder, pageRect.dx, 10);
@@ -657,13 +1385,13 @@ static void AppendTocItem(TocItem*& root, TocItem* item, int level) {
 }
 
 class EbookTocBuilder : public EbookTocVisitor {
-    EngineBase* engine = nullptr;
+    EngineEbook* engine = nullptr;
     TocItem* root = nullptr;
     int idCounter = 0;
     bool isIndex = false;
 
   public:
-    explicit EbookTocBuilder(EngineBase* engine) {
+    explicit EbookTocBuilder(EngineEbook* engine) {
         this->engine = engine;
     }
 
@@ -695,6 +1423,9 @@ void EbookTocBuilder::Visit(const char* name, const char* url, int level) {
     // TODO: send parent to newEbookTocItem
     TocItem* item = newEbookTocItem(nullptr, name, dest);
     item->id = ++idCounter;
+    if (!dest && url && !url::IsAbsolute(url)) {
+        item->dest = engine->GetPendingDest(url, item, isIndex);
+    }
     if (isIndex) {
         item->pageNo = 0;
         level++;
@@ -733,6 +1464,16 @@ class EngineEpub : public EngineEbook {
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new EpubFormatter(args, doc);
+    }
+    TempStr GetImageNameTemp(const ByteSlice& img) override {
+        return doc->GetImageNameTemp(img);
+    }
+    ByteSlice GetImageByName(const char* name) override {
+        return doc->GetImageDataByName(name);
+    }
 };
 
 EngineEpub::EngineEpub() : EngineEbook() {
@@ -741,6 +1482,7 @@ EngineEpub::EngineEpub() : EngineEbook() {
 }
 
 EngineEpub::~EngineEpub() {
+    StopLayout();
     delete doc;
     delete tocTree;
     if (stream) {
@@ -750,11 +1492,11 @@ EngineEpub::~EngineEpub() {
 
 EngineBase* EngineEpub::Clone() {
     if (stream) {
-        return CreateFromStream(stream);
+        return WithAllPages(CreateFromStream(stream));
     }
     const char* path = FilePath();
     if (path) {
-        return CreateFromFile(path);
+        return WithAllPages(CreateFromFile(path));
     }
     return nullptr;
 }
@@ -785,20 +1527,12 @@ bool EngineEpub::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args{};
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
-
-    pages = EpubFormatter(&args, doc).FormatAllPages(false);
-
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    InitFormatterArgs(doc->GetHtmlData(), mui::TextRenderMethod::GdiplusQuick);
+    // each chapter starts on a new page, so they can be laid out in parallel
+    for (int i = 0; i < doc->GetChapterCount(); i++) {
+        sections.Append(doc->GetChapterHtml(i));
+    }
+    if (!StartLayout()) {
         return false;
     }
 
@@ -807,7 +1541,7 @@ bool EngineEpub::FinishLoading() {
         preferredLayout.r2l = true;
     }
 
-    return pageCount > 0;
+    return true;
 }
 
 ByteSlice EngineEpub::GetFileData() {
@@ -882,6 +1616,7 @@ class EngineFb2 : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".fb2");
     }
     ~EngineFb2() override {
+        StopLayout();
         delete tocTree;
         delete doc;
     }
@@ -890,7 +1625,7 @@ class EngineFb2 : public EngineEbook {
         if (!fileName) {
             return nullptr;
         }
-        return CreateFromFile(fileName);
+        return WithAllPages(CreateFromFile(fileName));
     }
 
     TempStr GetPropertyTemp(const char* name) override {
@@ -912,6 +1647,22 @@ class EngineFb2 : public EngineEbook {
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new Fb2Formatter(args, doc);
+    }
+    TempStr GetImageNameTemp(const ByteSlice& img) override {
+        for (ImageData& data : doc->images) {
+            if (data.base.data() == img.data()) {
+                return str::DupTemp(data.fileName);
+            }
+        }
+        return nullptr;
+    }
+    ByteSlice GetImageByName(const char* name) override {
+        ByteSlice* img = doc->GetImageData(name);
+        return img ? *img : ByteSlice();
+    }
 };
 
 bool EngineFb2::Load(const char* fileName) {
@@ -930,26 +1681,12 @@ bool EngineFb2::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetXmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
-
     if (doc->IsZipped()) {
         str::ReplaceWithCopy(&defaultExt, ".fb2z");
     }
 
-    pages = Fb2Formatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
-    return pageCount > 0;
+    InitFormatterArgs(doc->GetXmlData(), mui::TextRenderMethod::GdiplusQuick);
+    return StartLayout();
 }
 
 TocTree* EngineFb2::GetToc() {
@@ -1005,6 +1742,7 @@ class EngineMobi : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".mobi");
     }
     ~EngineMobi() override {
+        StopLayout();
         delete tocTree;
         delete doc;
     }
@@ -1013,7 +1751,7 @@ class EngineMobi : public EngineEbook {
         if (!fileName) {
             return nullptr;
         }
-        return CreateFromFile(fileName);
+        return WithAllPages(CreateFromFile(fileName));
     }
 
     TempStr GetPropertyTemp(const char* name) override {
@@ -1036,6 +1774,24 @@ class EngineMobi : public EngineEbook {
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new MobiFormatter(args, doc);
+    }
+    // images are referenced by their record index
+    TempStr GetImageNameTemp(const ByteSlice& img) override {
+        for (size_t i = 1; i <= doc->imagesCount; i++) {
+            ByteSlice* data = doc->GetImage(i);
+            if (data && data->data() == img.data()) {
+                return str::FormatTemp("%d", (int)i);
+            }
+        }
+        return nullptr;
+    }
+    ByteSlice GetImageByName(const char* name) override {
+        ByteSlice* img = doc->GetImage((size_t)atoi(name));
+        return img ? *img : ByteSlice();
+    }
 };
 
 bool EngineMobi::Load(const char* fileName) {
@@ -1054,22 +1810,9 @@ bool EngineMobi::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
-
-    pages = MobiFormatter(&args, doc).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
-    return pageCount > 0;
+    InitFormatterArgs(doc->GetHtmlData(), mui::TextRenderMethod::GdiplusQuick);
+    skipEmptyPages = true;
+    return StartLayout();
 }
 
 IPageDestination* EngineMobi::GetNamedDest(const char* name) {
@@ -1079,11 +1822,15 @@ IPageDestination* EngineMobi::GetNamedDest(const char* name) {
     }
     int pageNo;
     for (pageNo = 1; pageNo < PageCount(); pageNo++) {
-        if (pages->at(pageNo)->reparseIdx > filePos) {
+        if (GetHtmlPage2(pageNo + 1)->reparseIdx > filePos) {
             break;
         }
     }
     ReportIf(pageNo < 1 || pageNo > PageCount());
+    if (pageNo == PageCount() && !allPagesLaidOut) {
+        // filePos might be on a page that hasn't been laid out yet
+        return nullptr;
+    }
 
     ByteSlice htmlData = doc->GetHtmlData();
     size_t htmlLen = htmlData.size();
@@ -1160,6 +1907,7 @@ class EnginePdb : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".pdb");
     }
     ~EnginePdb() override {
+        StopLayout();
         delete tocTree;
         delete doc;
     }
@@ -1168,7 +1916,7 @@ class EnginePdb : public EngineEbook {
         if (!fileName) {
             return nullptr;
         }
-        return CreateFromFile(fileName);
+        return WithAllPages(CreateFromFile(fileName));
     }
 
     TempStr GetPropertyTemp(const char* name) override {
@@ -1187,6 +1935,10 @@ class EnginePdb : public EngineEbook {
     TocTree* tocTree = nullptr;
 
     bool Load(const char* fileName);
+
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new HtmlFormatter(args);
+    }
 };
 
 bool EnginePdb::Load(const char* fileName) {
@@ -1197,23 +1949,9 @@ bool EnginePdb::Load(const char* fileName) {
         return false;
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
-
-    pages = HtmlFormatter(&args).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
-
-    return pageCount > 0;
+    InitFormatterArgs(doc->GetHtmlData(), mui::TextRenderMethod::GdiplusQuick);
+    skipEmptyPages = true;
+    return StartLayout();
 }
 
 TocTree* EnginePdb::GetToc() {
@@ -1249,13 +1987,17 @@ EngineBase* CreateEnginePdbFromFile(const char* fileName) {
 
 #include "ChmFile.h"
 
+// used by ChmFormatter on the layout thread
 class ChmDataCache {
     ChmFile* doc = nullptr; // owned by creator
+    // chmlib isn't thread-safe, so doc is shared with
+    // the UI thread through docAccess (owned by creator)
+    CRITICAL_SECTION* docAccess = nullptr;
     ByteSlice html;
     Vec<ImageData> images;
 
   public:
-    ChmDataCache(ChmFile* doc, char* html) : doc(doc), html(html) {
+    ChmDataCache(ChmFile* doc, CRITICAL_SECTION* docAccess, char* html) : doc(doc), docAccess(docAccess), html(html) {
     }
 
     ~ChmDataCache() {
@@ -1272,13 +2014,21 @@ class ChmDataCache {
 
     ByteSlice* GetImageData(const char* id, const char* pagePath) {
         AutoFreeStr url = NormalizeURL(id, pagePath);
+        return GetImageDataByUrl(url);
+    }
+
+    ByteSlice* GetImageDataByUrl(const char* url) {
         for (size_t i = 0; i < images.size(); i++) {
             if (str::Eq(images.at(i).fileName, url)) {
                 return &images.at(i).base;
             }
         }
 
-        auto tmp = doc->GetData(url);
+        ByteSlice tmp;
+        {
+            ScopedCritSec scope(docAccess);
+            tmp = doc->GetData(url);
+        }
         if (tmp.empty()) {
             return nullptr;
         }
@@ -1286,13 +2036,24 @@ class ChmDataCache {
         ImageData data;
         data.base = tmp;
 
-        data.fileName = url.Release();
+        data.fileName = str::Dup(url);
         images.Append(data);
         return &images.Last().base;
     }
 
+    // for referring to an image returned by GetImageData() in the layout cache
+    TempStr GetImageUrlTemp(const ByteSlice& img) {
+        for (ImageData& data : images) {
+            if (data.base.data() == img.data()) {
+                return str::DupTemp(data.fileName);
+            }
+        }
+        return nullptr;
+    }
+
     ByteSlice GetFileData(const char* relPath, const char* pagePath) {
         AutoFreeStr url = NormalizeURL(relPath, pagePath);
+        ScopedCritSec scope(docAccess);
         return doc->GetData(url);
     }
 };
@@ -1339,7 +2100,7 @@ void ChmFormatter::HandleTagPagebreak(HtmlToken* t) {
         currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::Dup(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        styleSheet.Reset();
     }
 }
 
@@ -1379,18 +2140,21 @@ class EngineChm : public EngineEbook {
         pageRect = RectF(0, 0, 8.27f * GetFileDPI(), 11.693f * GetFileDPI());
         kind = kindEngineChm;
         str::ReplaceWithCopy(&defaultExt, ".chm");
+        InitializeCriticalSection(&docAccess);
     }
     ~EngineChm() override {
+        StopLayout();
         delete dataCache;
         delete doc;
         delete tocTree;
+        DeleteCriticalSection(&docAccess);
     }
     EngineBase* Clone() override {
         const char* fileName = FilePath();
         if (!fileName) {
             return nullptr;
         }
-        return CreateFromFile(fileName);
+        return WithAllPages(CreateFromFile(fileName));
     }
 
     TempStr GetPropertyTemp(const char* name) override {
@@ -1407,12 +2171,25 @@ class EngineChm : public EngineEbook {
 
   protected:
     ChmFile* doc = nullptr;
+    // doc is also used on the layout thread (through dataCache)
+    CRITICAL_SECTION docAccess;
     ChmDataCache* dataCache = nullptr;
     TocTree* tocTree = nullptr;
 
     bool Load(const char* fileName);
 
     IPageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo) override;
+
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new ChmFormatter(args, dataCache);
+    }
+    TempStr GetImageNameTemp(const ByteSlice& img) override {
+        return dataCache->GetImageUrlTemp(img);
+    }
+    ByteSlice GetImageByName(const char* name) override {
+        ByteSlice* img = dataCache->GetImageDataByUrl(name);
+        return img ? *img : ByteSlice();
+    }
 };
 
 // cf. http://www.w3.org/TR/html4/charset.html#h-5.2.2
@@ -1527,25 +2304,10 @@ bool EngineChm::Load(const char* fileName) {
     }
 
     char* html = ChmHtmlCollector(doc).GetHtml();
-    dataCache = new ChmDataCache(doc, html);
-
-    HtmlFormatterArgs args;
-    args.htmlStr = dataCache->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    dataCache = new ChmDataCache(doc, &docAccess, html);
 
-    pages = ChmFormatter(&args, dataCache).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
-
-    return pageCount > 0;
+    InitFormatterArgs(dataCache->GetHtmlData(), mui::TextRenderMethod::GdiplusQuick);
+    return StartLayout();
 }
 
 IPageDestination* EngineChm::GetNamedDest(const char* name) {
@@ -1555,7 +2317,11 @@ IPageDestination* EngineChm::GetNamedDest(const char* name) {
     }
     unsigned int topicID;
     if (str::Parse(name, "%u%$", &topicID)) {
-        char* url = doc->ResolveTopicID(topicID);
+        char* url;
+        {
+            ScopedCritSec scope(&docAccess);
+            url = doc->ResolveTopicID(topicID);
+        }
         if (url) {
             dest = EngineEbook::GetNamedDest(url);
             str::Free(url);
@@ -1568,6 +2334,7 @@ TocTree* EngineChm::GetToc() {
     if (tocTree) {
         return tocTree;
     }
+    ScopedCritSec scope(&docAccess);
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     if (doc->HasIndex()) {
@@ -1595,22 +2362,30 @@ static IPageDestination* newChmEmbeddedDest(const char* path) {
     return res;
 }
 
-IPageElement* EngineChm::CreatePageLink(DrawInstr* link, Rect rect, int pageNo) {
-    IPageElement* linkEl = EngineEbook::CreatePageLink(link, rect, pageNo);
-    if (linkEl) {
-        return linkEl;
+// only HTML files are laid out as pages (see ChmHtmlCollector)
+static bool IsChmHtmlPath(const char* url) {
+    const char* hash = str::FindChar(url, '#');
+    if (hash) {
+        url = str::DupTemp(url, hash - url);
     }
+    return str::EndsWithI(url, ".htm") || str::EndsWithI(url, ".html");
+}
 
+IPageElement* EngineChm::CreatePageLink(DrawInstr* link, Rect rect, int pageNo) {
     DrawInstr* baseAnchor = baseAnchors.at(pageNo - 1);
     AutoFreeStr basePath = str::Dup(baseAnchor->str.s, baseAnchor->str.len);
     AutoFreeStr url = str::Dup(link->str.s, link->str.len);
     url.Set(NormalizeURL(url, basePath));
-    if (!doc->HasData(url)) {
-        return nullptr;
+    // check for other files first, as links to pages that haven't been
+    // laid out yet are pending (see GetPendingDest())
+    if (!url::IsAbsolute(url) && !IsChmHtmlPath(url)) {
+        ScopedCritSec scope(&docAccess);
+        if (doc->HasData(url)) {
+            IPageDestination* dest = newChmEmbeddedDest(url);
+            return NewEbookLink(link, rect, dest, pageNo);
+        }
     }
-
-    IPageDestination* dest = newChmEmbeddedDest(url);
-    return NewEbookLink(link, rect, dest, pageNo);
+    return EngineEbook::CreatePageLink(link, rect, pageNo);
 }
 
 EngineBase* EngineChm::CreateFromFile(const char* fileName) {
@@ -1637,6 +2412,7 @@ class EngineHtml : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".html");
     }
     ~EngineHtml() override {
+        StopLayout();
         delete doc;
     }
     EngineBase* Clone() override {
@@ -1644,7 +2420,7 @@ class EngineHtml : public EngineEbook {
         if (!fileName) {
             return nullptr;
         }
-        return CreateFromFile(fileName);
+        return WithAllPages(CreateFromFile(fileName));
     }
 
     TempStr GetPropertyTemp(const char* name) override {
@@ -1662,6 +2438,10 @@ class EngineHtml : public EngineEbook {
     bool Load(const char* fileName);
 
     IPageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo) override;
+
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new HtmlFileFormatter(args, doc);
+    }
 };
 
 bool EngineHtml::Load(const char* fileName) {
@@ -1672,23 +2452,8 @@ bool EngineHtml::Load(const char* fileName) {
         return false;
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::Gdiplus;
-
-    pages = HtmlFileFormatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
-
-    return pageCount > 0;
+    InitFormatterArgs(doc->GetHtmlData(), mui::TextRenderMethod::Gdiplus);
+    return StartLayout();
 }
 
 static IPageDestination* newRemoteHtmlDest(const char* relativeURL) {
@@ -1742,6 +2507,7 @@ class EngineTxt : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".txt");
     }
     ~EngineTxt() override {
+        StopLayout();
         delete tocTree;
         delete doc;
     }
@@ -1750,7 +2516,7 @@ class EngineTxt : public EngineEbook {
         if (!fileName) {
             return nullptr;
         }
-        return CreateFromFile(fileName);
+        return WithAllPages(CreateFromFile(fileName));
     }
 
     TempStr GetPropertyTemp(const char* name) override {
@@ -1769,6 +2535,10 @@ class EngineTxt : public EngineEbook {
     TocTree* tocTree = nullptr;
 
     bool Load(const char* fileName);
+
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new TxtFormatter(args);
+    }
 };
 
 bool EngineTxt::Load(const char* fileName) {
@@ -1790,23 +2560,8 @@ bool EngineTxt::Load(const char* fileName) {
         pageRect = RectF(0, 0, 8.5f * GetFileDPI(), 11.f * GetFileDPI());
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::Gdiplus;
-
-    pages = TxtFormatter(&args).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
-
-    return pageCount > 0;
+    InitFormatterArgs(doc->GetHtmlData(), mui::TextRenderMethod::Gdiplus);
+    return StartLayout();
 }
 
 TocTree* EngineTxt::GetToc() {
@@ -1838,4 +2593,5 @@ EngineBase* CreateEngineTxtFromFile(const char* fileName) {
 
 void EngineEbookCleanup() {
     gDefaultFontName.Reset();
+    gEbookLayoutCacheDir.Reset();
 }
@@ -12,6 +12,8 @@
 #include "utils/JsonParser.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/TimingStats.h"
+#include "utils/ThreadUtil.h"
 #include "utils/DirIter.h"
 
 #include "wingui/UIModels.h"
@@ -49,8 +51,48 @@ Kind kindEngineImage = "engineImage";
 Kind kindEngineImageDir = "engineImageDir";
 Kind kindEngineComicBooks = "engineComicBooks";
 
-// number of decoded bitmaps to cache for quicker rendering
-#define MAX_IMAGE_PAGE_CACHE 10
+// decoded bitmaps are cached for quicker rendering as long as they take up
+// less than this share of physical memory (within the limits below)
+constexpr int kImagePageCacheMemoryDivisor = 8;
+constexpr size_t kImagePageCacheMinBytes = 128 * 1024 * 1024;
+#if defined(_WIN64)
+constexpr size_t kImagePageCacheMaxBytes = 1024 * 1024 * 1024;
+#else
+constexpr size_t kImagePageCacheMaxBytes = 256 * 1024 * 1024;
+#endif
+
+// how many pages after (and before) the current page are decoded in the background
+constexpr int kDecodeAheadPages = 2;
+constexpr int kDecodeBehindPages = 1;
+constexpr int kDecodeAheadThreadsMax = 2;
+
+// directories with more images than that are shown as soon as the first
+// batch has been found and the rest is added in batches in the background
+constexpr int kImageDirBatchSize = 1024;
+
+// single images larger than that are decoded in parts (only the part
+// of the image that is rendered) if their format allows it
+constexpr int kImageRegionMinPixels = 32 * 1024 * 1024;
+
+// how long RenderPage() had to wait for a decoded image
+static TimingStats gImagePageStallStats("EngineImages: page decode stall");
+
+// decode images at 1/2, 1/4 or 1/8 of their size when rendering at low zoom
+bool gReducedImageDecoding = true;
+
+// decode the pages around the current page in background threads
+// (disabled when benchmarking so that timings aren't skewed)
+bool gImageDecodeAhead = true;
+
+// the largest reduction at which the decoded image is still
+// at least as large as the rendered page
+static int ImageReduceForZoom(float zoom) {
+    int reduce = 0;
+    while (reduce < kMaxImageReduce && zoom * (float)(1 << (reduce + 1)) <= 1.f) {
+        reduce++;
+    }
+    return reduce;
+}
 
 ///// EngineImages methods apply to all types of engines handling full-page images /////
 
@@ -59,6 +101,12 @@ struct ImagePage {
     Bitmap* bmp = nullptr;
     bool ownBmp = true;
     int refs = 1;
+    // bmp is being decoded (outside of cacheAccess)
+    bool isLoading = false;
+    // approximate size of the decoded bitmap
+    size_t nBytes = 0;
+    // bmp is decoded at 1/2^reduce of the page size
+    int reduce = 0;
 
     ImagePage(int pageNo, Bitmap* bmp) {
         this->pageNo = pageNo;
@@ -70,6 +118,9 @@ struct ImagePageInfo {
     Vec<IPageElement*> allElements;
     RectF mediabox{};
     bool hasMediaBox = false;
+    // set by the first PageContentBox() (protected by cacheAccess)
+    RectF contentBox{};
+    bool hasContentBox = false;
     ImagePageInfo() = default;
 };
 
@@ -109,16 +160,45 @@ class EngineImages : public EngineBase {
     ScopedComPtr<IStream> fileStream;
 
     CRITICAL_SECTION cacheAccess;
+    // signaled whenever a page finished loading
+    CONDITION_VARIABLE pageLoaded;
+    // Most Recently Used first
     Vec<ImagePage*> pageCache;
+    size_t pageCacheBytes = 0;
+    size_t pageCacheMaxBytes = 0;
     Vec<ImagePageInfo*> pages;
 
+    // only for engines whose LoadBitmapForPage() can be called from multiple threads
+    bool decodeAhead = false;
+    // pages waiting to be decoded by decode-ahead threads (protected by cacheAccess)
+    Vec<int> decodeAheadQueue;
+    int decodeAheadReduce = 0;
+    int nDecodeAheadThreads = 0;
+
+    // how GetPage() requests were satisfied
+    int nCacheHits = 0;
+    int nDecodeAheadWaits = 0;
+    int nCacheMisses = 0;
+    double stallMs = 0;
+
     void GetTransform(Matrix& m, int pageNo, float zoom, int rotation);
+    RenderedBitmap* RenderBitmap(RenderPageArgs& args, Bitmap* bmp, Rect bmpRect);
 
-    virtual Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) = 0;
+    // can be called from multiple threads at once if decodeAhead is set
+    // reduce is the requested reduction (see ImagePage) and is updated to the one achieved
+    virtual Bitmap* LoadBitmapForPage(int pageNo, int& reduce, bool& deleteAfterUse) = 0;
     virtual RectF LoadMediabox(int pageNo) = 0;
 
-    ImagePage* GetPage(int pageNo, bool tryOnly = false);
+    ImagePageInfo* GetPageInfo(int pageNo);
+    ImagePage* GetPage(int pageNo, bool tryOnly = false, int reduce = 0);
     void DropPage(ImagePage* page, bool forceRemove);
+    bool IsPageCacheFull() const;
+    ImagePage* FindCachedPage(int pageNo, int reduce) const;
+    void DropCoarserPages(int pageNo, int reduce);
+    void LoadPage(ImagePage* page);
+    void FreePagesOverBudget();
+    void StartDecodeAhead(int pageNo, int reduce);
+    void DecodeAheadThread();
 
     RectF PageContentBox(int pageNo, RenderTarget) override;
 };
@@ -131,9 +211,25 @@ EngineImages::EngineImages() {
     isImageCollection = true;
 
     InitializeCriticalSection(&cacheAccess);
+    InitializeConditionVariable(&pageLoaded);
+
+    MEMORYSTATUSEX ms{};
+    ms.dwLength = sizeof(ms);
+    size_t maxBytes = kImagePageCacheMinBytes;
+    if (GlobalMemoryStatusEx(&ms)) {
+        u64 n = ms.ullTotalPhys / kImagePageCacheMemoryDivisor;
+        maxBytes = (size_t)std::min<u64>(n, kImagePageCacheMaxBytes);
+    }
+    pageCacheMaxBytes = std::max(maxBytes, kImagePageCacheMinBytes);
 }
 
 EngineImages::~EngineImages() {
+    // decode-ahead threads hold a reference so they must have finished
+    ReportIf(nDecodeAheadThreads != 0);
+    if (nCacheHits + nDecodeAheadWaits + nCacheMisses > 0) {
+        logf("EngineImages: %d cache hits, %d waits for decode-ahead, %d misses, %.2f ms stalled\n", nCacheHits,
+             nDecodeAheadWaits, nCacheMisses, stallMs);
+    }
     EnterCriticalSection(&cacheAccess);
     while (pageCache.size() > 0) {
         ImagePage* lastPage = pageCache.Last();
@@ -145,10 +241,15 @@ EngineImages::~EngineImages() {
     DeleteCriticalSection(&cacheAccess);
 }
 
-RectF EngineImages::PageMediabox(int pageNo) {
+// pages can be added in the background (see EngineImageDir::AddLoadedPages())
+ImagePageInfo* EngineImages::GetPageInfo(int pageNo) {
+    ScopedCritSec scope(&cacheAccess);
     ReportIf((pageNo < 1) || (pageNo > pageCount));
-    int n = pageNo - 1;
-    ImagePageInfo* pi = pages[n];
+    return pages[pageNo - 1];
+}
+
+RectF EngineImages::PageMediabox(int pageNo) {
+    ImagePageInfo* pi = GetPageInfo(pageNo);
     RectF& mbox = pi->mediabox;
     if (!pi->hasMediaBox) {
         mbox = LoadMediabox(pageNo);
@@ -162,11 +263,36 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     auto pageRect = args.pageRect;
     auto zoom = args.zoom;
     auto rotation = args.rotation;
+    int reduce = gReducedImageDecoding ? ImageReduceForZoom(zoom) : 0;
 
-    ImagePage* page = GetPage(pageNo);
+    auto stallStart = TimeGet();
+    ImagePage* page = GetPage(pageNo, false, reduce);
+    double stallDur = TimeSinceInMs(stallStart);
+    if (gTimingStatsEnabled) {
+        gImagePageStallStats.Add(stallDur);
+    }
+    StartDecodeAhead(pageNo, reduce);
     if (!page) {
         return nullptr;
     }
+    {
+        ScopedCritSec scope(&cacheAccess);
+        stallMs += stallDur;
+    }
+
+    // a bitmap decoded at a reduction is stretched over the whole page
+    Rect pageRcI = PageMediabox(pageNo).Round();
+    RenderedBitmap* res = RenderBitmap(args, page->bmp, pageRcI);
+    DropPage(page, false);
+    return res;
+}
+
+// draws bmp stretched over bmpRect (in page coordinates)
+RenderedBitmap* EngineImages::RenderBitmap(RenderPageArgs& args, Bitmap* bmp, Rect bmpRect) {
+    auto pageNo = args.pageNo;
+    auto pageRect = args.pageRect;
+    auto zoom = args.zoom;
+    auto rotation = args.rotation;
 
     auto timeStart = TimeGet();
     defer {
@@ -203,13 +329,11 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     m.Translate((float)-screenTL.x, (float)-screenTL.y, MatrixOrderAppend);
     g.SetTransform(&m);
 
-    Rect pageRcI = PageMediabox(pageNo).Round();
     ImageAttributes imgAttrs;
     imgAttrs.SetWrapMode(WrapModeTileFlipXY);
-    Status ok =
-        g.DrawImage(page->bmp, ToGdipRect(pageRcI), pageRcI.x, pageRcI.y, pageRcI.dx, pageRcI.dy, UnitPixel, &imgAttrs);
+    Status ok = g.DrawImage(bmp, ToGdipRect(bmpRect), 0, 0, (int)bmp->GetWidth(), (int)bmp->GetHeight(), UnitPixel,
+                            &imgAttrs);
 
-    DropPage(page, false);
     DeleteDC(hDC);
 
     if (ok != Ok) {
@@ -253,8 +377,7 @@ static IPageElement* NewImageElement(int pageNo, float dx, float dy) {
 
 // don't delete the result
 Vec<IPageElement*> EngineImages::GetElements(int pageNo) {
-    ReportIf(pageNo < 1 || pageNo > pageCount);
-    auto* pi = pages[pageNo - 1];
+    auto* pi = GetPageInfo(pageNo);
     if (pi->allElements.size() > 0) {
         return pi->allElements;
     }
@@ -321,44 +444,120 @@ bool EngineImages::SaveFileAs(const char* dstPath) {
     return file::WriteFile(dstPath, d);
 }
 
-ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly) {
+// returns a page decoded at the given reduction or at a higher resolution
+ImagePage* EngineImages::FindCachedPage(int pageNo, int reduce) const {
+    for (ImagePage* page : pageCache) {
+        if (page->pageNo == pageNo && page->reduce <= reduce) {
+            return page;
+        }
+    }
+    return nullptr;
+}
+
+// pages decoded at a lower resolution than reduce are superseded
+void EngineImages::DropCoarserPages(int pageNo, int reduce) {
     ScopedCritSec scope(&cacheAccess);
+    for (int i = pageCache.Size() - 1; i >= 0; i--) {
+        ImagePage* page = pageCache[i];
+        // decode-ahead threads don't hold a reference to the page they're loading
+        if (page->pageNo == pageNo && page->reduce > reduce && !page->isLoading) {
+            DropPage(page, true);
+        }
+    }
+}
 
-    ImagePage* result = nullptr;
+bool EngineImages::IsPageCacheFull() const {
+    return pageCacheBytes >= pageCacheMaxBytes;
+}
 
-    for (size_t i = 0; i < pageCache.size(); i++) {
-        if (pageCache.at(i)->pageNo == pageNo) {
-            result = pageCache.at(i);
-            break;
+// decodes the bitmap of a page that has been added to the cache with isLoading set
+// must be called without holding cacheAccess so that other pages can be
+// looked up (and decoded) in the meantime
+void EngineImages::LoadPage(ImagePage* page) {
+    bool ownBmp = true;
+    int reduce = page->reduce;
+    Bitmap* bmp = LoadBitmapForPage(page->pageNo, reduce, ownBmp);
+    size_t nBytes = 0;
+    if (bmp && ownBmp) {
+        nBytes = (size_t)bmp->GetWidth() * (size_t)bmp->GetHeight() * GetPixelFormatSize(bmp->GetPixelFormat()) / 8;
+    }
+
+    ScopedCritSec scope(&cacheAccess);
+    page->bmp = bmp;
+    page->ownBmp = ownBmp;
+    page->nBytes = nBytes;
+    page->reduce = reduce;
+    page->isLoading = false;
+    if (pageCache.Contains(page)) {
+        pageCacheBytes += nBytes;
+    }
+    WakeAllConditionVariable(&pageLoaded);
+    FreePagesOverBudget();
+}
+
+// drop the least recently used pages until the cache fits into pageCacheMaxBytes
+// (but always keep the most recently used page and pages that are in use)
+void EngineImages::FreePagesOverBudget() {
+    ScopedCritSec scope(&cacheAccess);
+    for (int i = pageCache.Size() - 1; i > 0 && IsPageCacheFull(); i--) {
+        ImagePage* page = pageCache[i];
+        if (page->isLoading || page->refs > 1) {
+            continue;
         }
+        DropPage(page, true);
+    }
+}
+
+// tryOnly: only return the page if it's already decoded
+// reduce: the page may be decoded at up to 1/2^reduce of its size
+ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly, int reduce) {
+    EnterCriticalSection(&cacheAccess);
+
+    ImagePage* result = FindCachedPage(pageNo, reduce);
+    if (result && result->isLoading && tryOnly) {
+        result = nullptr;
     }
     if (!result && tryOnly) {
+        LeaveCriticalSection(&cacheAccess);
         return nullptr;
     }
 
     if (!result) {
-        // TODO: drop most memory intensive pages first
-        if (pageCache.size() >= MAX_IMAGE_PAGE_CACHE) {
-            ReportIf(pageCache.size() != MAX_IMAGE_PAGE_CACHE);
-            DropPage(pageCache.Last(), true);
-        }
+        nCacheMisses++;
+        DropCoarserPages(pageNo, reduce);
         result = new ImagePage(pageNo, nullptr);
-        result->bmp = LoadBitmapForPage(pageNo, result->ownBmp);
-        pageCache.InsertAt(0, result);
-    } else if (result != pageCache.at(0)) {
-        // keep the list Most Recently Used first
-        pageCache.Remove(result);
+        result->reduce = reduce;
+        result->isLoading = true;
+        // reference for the caller
+        result->refs++;
         pageCache.InsertAt(0, result);
+        LeaveCriticalSection(&cacheAccess);
+        LoadPage(result);
+        EnterCriticalSection(&cacheAccess);
+    } else {
+        result->refs++;
+        if (result->isLoading) {
+            // being decoded by a decode-ahead thread
+            nDecodeAheadWaits++;
+            while (result->isLoading) {
+                SleepConditionVariableCS(&pageLoaded, &cacheAccess, INFINITE);
+            }
+        } else {
+            nCacheHits++;
+        }
+        if (pageCache.Contains(result) && result != pageCache.at(0)) {
+            // keep the list Most Recently Used first
+            pageCache.Remove(result);
+            pageCache.InsertAt(0, result);
+        }
     }
+
     // return nullptr if a page failed to load
-    if (result && !result->bmp) {
-        return nullptr;
+    if (!result->bmp) {
+        DropPage(result, false);
+        result = nullptr;
     }
-    if (!result) {
-        return nullptr;
-    }
-
-    result->refs++;
+    LeaveCriticalSection(&cacheAccess);
     return result;
 }
 
@@ -368,7 +567,9 @@ void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     ReportIf(page->refs < 0);
 
     if (0 == page->refs || forceRemove) {
-        pageCache.Remove(page);
+        if (pageCache.Remove(page) >= 0) {
+            pageCacheBytes -= page->nBytes;
+        }
     }
 
     if (0 == page->refs) {
@@ -379,20 +580,72 @@ void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     }
 }
 
-// Get content box for image by cropping out margins of similar color
-RectF EngineImages::PageContentBox(int pageNo, RenderTarget target) {
-    // try to load bitmap for the image
-    auto page = GetPage(pageNo, true);
-    if (!page)
-        return RectF{};
-    defer {
-        DropPage(page, false);
-    };
+static void DecodeAheadThreadFunc(EngineImages* e) {
+    e->DecodeAheadThread();
+    // balances the AddRef() in StartDecodeAhead()
+    e->Release();
+}
 
-    auto bmp = page->bmp;
-    if (!bmp)
-        return RectF{};
+void EngineImages::DecodeAheadThread() {
+    for (;;) {
+        ImagePage* page = nullptr;
+        {
+            ScopedCritSec scope(&cacheAccess);
+            if (decodeAheadQueue.size() == 0 || IsPageCacheFull()) {
+                decodeAheadQueue.Reset();
+                nDecodeAheadThreads--;
+                return;
+            }
+            int pageNo = decodeAheadQueue.PopAt(0);
+            if (FindCachedPage(pageNo, decodeAheadReduce)) {
+                continue;
+            }
+            DropCoarserPages(pageNo, decodeAheadReduce);
+            page = new ImagePage(pageNo, nullptr);
+            page->reduce = decodeAheadReduce;
+            page->isLoading = true;
+            // behind the page that's currently shown
+            pageCache.InsertAt(std::min(1, pageCache.Size()), page);
+        }
+        LoadPage(page);
+        ResetTempAllocator();
+    }
+}
+
+// decode the pages around pageNo in the background so that
+// turning a page doesn't have to wait for the image to be decoded
+void EngineImages::StartDecodeAhead(int pageNo, int reduce) {
+    if (!decodeAhead || !gImageDecodeAhead) {
+        return;
+    }
+    ScopedCritSec scope(&cacheAccess);
+    // only the pages around the most recently requested page are relevant
+    decodeAheadQueue.Reset();
+    decodeAheadReduce = reduce;
+    for (int i = 1; i <= kDecodeAheadPages; i++) {
+        int n = pageNo + i;
+        if (n <= pageCount && !FindCachedPage(n, reduce)) {
+            decodeAheadQueue.Append(n);
+        }
+    }
+    for (int i = 1; i <= kDecodeBehindPages; i++) {
+        int n = pageNo - i;
+        if (n >= 1 && !FindCachedPage(n, reduce)) {
+            decodeAheadQueue.Append(n);
+        }
+    }
+    int nToStart = std::min(kDecodeAheadThreadsMax - nDecodeAheadThreads, decodeAheadQueue.Size());
+    for (int i = 0; i < nToStart; i++) {
+        nDecodeAheadThreads++;
+        AddRef();
+        auto fn = MkFunc0<EngineImages>(DecodeAheadThreadFunc, this);
+        RunAsync(fn, "DecodeAheadThread");
+    }
+}
 
+// Get content box for image by cropping out margins of similar color
+// (in bitmap coordinates)
+static RectF BitmapContentBox(Bitmap* bmp) {
     const int w = bmp->GetWidth(), h = bmp->GetHeight();
     // don't need pixel-perfect margin, so scan 200 points at most
     const int deltaX = std::max(1, w / 200), deltaY = std::max(1, h / 200);
@@ -485,10 +738,59 @@ RectF EngineImages::PageContentBox(int pageNo, RenderTarget target) {
             break;
     }
     bmp->UnlockBits(&bmpData);
-
     return ToRectF(r);
 }
 
+RectF EngineImages::PageContentBox(int pageNo, RenderTarget) {
+    ImagePageInfo* pi = GetPageInfo(pageNo);
+    {
+        ScopedCritSec scope(&cacheAccess);
+        if (pi->hasContentBox) {
+            return pi->contentBox;
+        }
+    }
+
+    // use the bitmap for the image if it's already decoded (at any resolution)
+    Bitmap* bmp = nullptr;
+    bool deleteBmp = false;
+    auto page = GetPage(pageNo, true, kMaxImageReduce);
+    if (page) {
+        bmp = page->bmp;
+    } else if (decodeAhead) {
+        // decode at the lowest resolution, bypassing the cache so that
+        // calculating content boxes for all pages doesn't evict the pages
+        // that are being viewed
+        int reduce = kMaxImageReduce;
+        bmp = LoadBitmapForPage(pageNo, reduce, deleteBmp);
+    }
+    defer {
+        if (page) {
+            DropPage(page, false);
+        }
+        if (deleteBmp) {
+            delete bmp;
+        }
+    };
+    if (!bmp) {
+        return RectF{};
+    }
+
+    RectF res = BitmapContentBox(bmp);
+    RectF mbox = PageMediabox(pageNo);
+    if (!res.IsEmpty() && (bmp->GetWidth() != (uint)mbox.dx || bmp->GetHeight() != (uint)mbox.dy)) {
+        // from reduced bitmap to page coordinates
+        float sx = mbox.dx / (float)bmp->GetWidth();
+        float sy = mbox.dy / (float)bmp->GetHeight();
+        res = RectF(res.x * sx, res.y * sy, res.dx * sx, res.dy * sy);
+    }
+    if (!res.IsEmpty()) {
+        ScopedCritSec scope(&cacheAccess);
+        pi->contentBox = res;
+        pi->hasContentBox = true;
+    }
+    return res;
+}
+
 ///// ImageEngine handles a single image file /////
 
 class EngineImage : public EngineImages {
@@ -498,6 +800,8 @@ class EngineImage : public EngineImages {
 
     EngineBase* Clone() override;
 
+    RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+
     TempStr GetPropertyTemp(const char* name) override;
 
     static EngineBase* CreateFromFile(const char* fileName);
@@ -505,12 +809,15 @@ class EngineImage : public EngineImages {
 
     Bitmap* image = nullptr;
     Kind imageFormat = nullptr;
+    // set instead of image for very large images which are only decoded in parts
+    ImageRegionReader* regionReader = nullptr;
 
     bool LoadSingleFile(const char* fileName);
     bool LoadFromStream(IStream* stream);
+    bool LoadImageData(ByteSlice data);
     bool FinishLoading();
 
-    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadBitmapForPage(int pageNo, int& reduce, bool& deleteAfterUse) override;
     RectF LoadMediabox(int pageNo) override;
 };
 
@@ -520,11 +827,22 @@ EngineImage::EngineImage() {
 
 EngineImage::~EngineImage() {
     delete image;
+    delete regionReader;
 }
 
 EngineBase* EngineImage::Clone() {
-    Bitmap* bmp = image->Clone(0, 0, image->GetWidth(), image->GetHeight(), PixelFormat32bppARGB);
-    if (!bmp) {
+    Bitmap* bmp = nullptr;
+    ImageRegionReader* reader = nullptr;
+    if (regionReader) {
+        ByteSlice data = regionReader->data.Clone();
+        reader = NewImageRegionReader(data);
+        if (!reader) {
+            data.Free();
+        }
+    } else {
+        bmp = image->Clone(0, 0, image->GetWidth(), image->GetHeight(), PixelFormat32bppARGB);
+    }
+    if (!bmp && !reader) {
         return nullptr;
     }
 
@@ -537,6 +855,7 @@ EngineBase* EngineImage::Clone() {
         fileStream->Clone(&clone->fileStream);
     }
     clone->image = bmp;
+    clone->regionReader = reader;
     clone->FinishLoading();
 
     return clone;
@@ -572,9 +891,7 @@ bool EngineImage::LoadSingleFile(const char* path) {
         fileExt = "";
     }
     str::ReplaceWithCopy(&defaultExt, fileExt);
-    image = BitmapFromData(data);
-    data.Free();
-    return FinishLoading();
+    return LoadImageData(data);
 }
 
 bool EngineImage::LoadFromStream(IStream* stream) {
@@ -596,6 +913,21 @@ bool EngineImage::LoadFromStream(IStream* stream) {
     str::ReplaceWithCopy(&defaultExt, path::GetExtTemp(fileExtA));
 
     ByteSlice data = GetDataFromStream(stream, nullptr);
+    return LoadImageData(data);
+}
+
+// takes ownership of data
+bool EngineImage::LoadImageData(ByteSlice data) {
+    // huge images (e.g. scanned drawings) are only decoded in parts
+    // in RenderPage() so that they open quickly and with bounded memory
+    Size size = BitmapSizeFromHeader(data, nullptr);
+    if ((i64)size.dx * (i64)size.dy >= kImageRegionMinPixels) {
+        regionReader = NewImageRegionReader(data);
+        if (regionReader) {
+            logf("EngineImage: decoding %dx%d image in parts\n", size.dx, size.dy);
+            return FinishLoading();
+        }
+    }
     image = BitmapFromData(data);
     data.Free();
     return FinishLoading();
@@ -615,6 +947,16 @@ static void ReportIfNotMultiImage(EngineImage* e) {
 }
 
 bool EngineImage::FinishLoading() {
+    if (regionReader) {
+        fileDPI = regionReader->dpi;
+        auto pi = new ImagePageInfo();
+        Size size = regionReader->size;
+        pi->mediabox = RectF(0, 0, (float)size.dx, (float)size.dy);
+        pi->hasMediaBox = true;
+        pages.Append(pi);
+        pageCount = pages.Size();
+        return true;
+    }
     if (!image || image->GetLastStatus() != Ok) {
         return false;
     }
@@ -649,7 +991,7 @@ bool EngineImage::FinishLoading() {
 #define PropertyTagXPSubject 0x9c9f
 #endif
 
-static TempStr GetImagePropertyTemp(Bitmap* bmp, PROPID id, PROPID altId = 0) {
+static TempStr GetImagePropertyTemp(Gdiplus::Image* bmp, PROPID id, PROPID altId = 0) {
     char* value = nullptr;
     uint size = bmp->GetPropertyItemSize(id);
     PropertyItem* item = (PropertyItem*)malloc(size);
@@ -674,7 +1016,7 @@ static TempStr GetImagePropertyTemp(Bitmap* bmp, PROPID id, PROPID altId = 0) {
     return res;
 }
 
-TempStr EngineImage::GetPropertyTemp(const char* name) {
+static TempStr GetImagePropertyByNameTemp(Gdiplus::Image* image, const char* name) {
     if (str::Eq(name, kPropTitle)) {
         return GetImagePropertyTemp(image, PropertyTagImageDescription, PropertyTagXPTitle);
     }
@@ -696,7 +1038,61 @@ TempStr EngineImage::GetPropertyTemp(const char* name) {
     return nullptr;
 }
 
-Bitmap* EngineImage::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
+TempStr EngineImage::GetPropertyTemp(const char* name) {
+    if (image) {
+        return GetImagePropertyByNameTemp(image, name);
+    }
+    if (!regionReader) {
+        return nullptr;
+    }
+    // GDI+ only reads the metadata, the pixels aren't decoded until they're needed
+    ScopedComPtr<IStream> stream(CreateStreamFromData(regionReader->data));
+    if (!stream) {
+        return nullptr;
+    }
+    Gdiplus::Image* img = Gdiplus::Image::FromStream(stream);
+    TempStr res = nullptr;
+    if (img && img->GetLastStatus() == Ok) {
+        res = GetImagePropertyByNameTemp(img, name);
+    }
+    delete img;
+    return res;
+}
+
+RenderedBitmap* EngineImage::RenderPage(RenderPageArgs& args) {
+    if (!regionReader) {
+        return EngineImages::RenderPage(args);
+    }
+    // only decode the part of the image that is rendered
+    RectF pageRc = args.pageRect ? *args.pageRect : PageMediabox(1);
+    int reduce = gReducedImageDecoding ? ImageReduceForZoom(args.zoom) : 0;
+    Rect rc = pageRc.Round();
+    // include a few more pixels so that the interpolation at the edges
+    // matches the neighboring tiles
+    rc.Inflate(2 << reduce, 2 << reduce);
+    Bitmap* bmp = regionReader->DecodeRegion(rc, reduce);
+    if (!bmp) {
+        return nullptr;
+    }
+    RenderedBitmap* res = RenderBitmap(args, bmp, rc);
+    delete bmp;
+    return res;
+}
+
+Bitmap* EngineImage::LoadBitmapForPage(int pageNo, int& reduce, bool& deleteAfterUse) {
+    if (regionReader) {
+        // e.g. for thumbnails, decode the whole image at a size that fits the page cache
+        Size size = regionReader->size;
+        while (reduce < kMaxImageReduce && ((i64)size.dx * size.dy >> (2 * reduce)) > kImageRegionMinPixels) {
+            reduce++;
+        }
+        Rect rc(0, 0, size.dx, size.dy);
+        deleteAfterUse = true;
+        return regionReader->DecodeRegion(rc, reduce);
+    }
+
+    // all frames are cloned from the already decoded image
+    reduce = 0;
     if (1 == pageNo) {
         deleteAfterUse = false;
         return image;
@@ -721,12 +1117,16 @@ Bitmap* EngineImage::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
 }
 
 RectF EngineImage::LoadMediabox(int pageNo) {
+    if (regionReader) {
+        Size size = regionReader->size;
+        return RectF(0, 0, (float)size.dx, (float)size.dy);
+    }
     if (1 == pageNo) {
         return RectF(0, 0, (float)image->GetWidth(), (float)image->GetHeight());
     }
 
     // fill the cache to prevent the first few frames from being unpacked twice
-    ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
+    ImagePage* page = GetPage(pageNo, IsPageCacheFull());
     if (page) {
         RectF mbox(0, 0, (float)page->bmp->GetWidth(), (float)page->bmp->GetHeight());
         DropPage(page, false);
@@ -776,6 +1176,15 @@ static Kind imageEngineKinds[] = {
 };
 // clang-format on
 
+// for benchmarking: makes the next render of the page decode the image again
+void DropCachedImagePage(EngineBase* engine, int pageNo) {
+    if (!engine || !engine->isImageCollection) {
+        return;
+    }
+    // drops the page decoded at every resolution
+    ((EngineImages*)engine)->DropCoarserPages(pageNo, -1);
+}
+
 bool IsEngineImageSupportedFileType(Kind kind) {
     // logf("IsEngineImageSupportedFileType(%s)\n", kind);
     int n = (int)dimof(imageEngineKinds);
@@ -799,14 +1208,25 @@ class EngineImageDir : public EngineImages {
     EngineImageDir() {
         fileDPI = 96.0f;
         kind = kindEngineImageDir;
+        // pages are independent files
+        decodeAhead = true;
         str::ReplaceWithCopy(&defaultExt, "");
         // TODO: is there a better place to expose pageFileNames
         // than through page labels?
         hasPageLabels = true;
+        InitializeCriticalSection(&filesAccess);
     }
 
     ~EngineImageDir() override {
+        if (loadThread) {
+            loadCancel.Set(1);
+            WaitForSingleObject(loadThread, INFINITE);
+            CloseHandle(loadThread);
+        }
+        SafeCloseHandle(&firstBatchLoaded);
+        DeleteVecMembers(loadedPages);
         delete tocTree;
+        DeleteCriticalSection(&filesAccess);
     }
 
     EngineBase* Clone() override {
@@ -831,42 +1251,292 @@ class EngineImageDir : public EngineImages {
 
     TocTree* GetToc() override;
 
+    void SetOnPagesLoaded(const Func0& fn) override;
+    int AddLoadedPages() override;
+    bool IsLoadingPages() override;
+
     static EngineBase* CreateFromFile(const char* fileName);
 
     // protected:
 
-    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadBitmapForPage(int pageNo, int& reduce, bool& deleteAfterUse) override;
     RectF LoadMediabox(int pageNo) override;
 
+    TempStr PagePathTemp(int pageNo);
+    void AddFoundFiles(StrVec& names, bool loadSizes, bool merge);
+    int MergeLoadedPages(StrVec& names, Vec<ImagePageInfo*>& infos);
+
+    // names of the image files within the directory in natural sort order.
+    // only modified on the UI thread, other threads must hold filesAccess
     StrVec pageFileNames;
     TocTree* tocTree = nullptr;
+
+    // the directory is enumerated on loadThread which hands over the pages
+    // it found in batches (protected by filesAccess)
+    CRITICAL_SECTION filesAccess;
+    StrVec loadedFileNames;
+    Vec<ImagePageInfo*> loadedPages;
+    // some of loadedFileNames sort before pages that have already been added
+    bool mergeLoaded = false;
+    Func0 onPagesLoaded;
+    HANDLE loadThread = nullptr;
+    // signaled once the pages to show when opening the directory have been found
+    HANDLE firstBatchLoaded = nullptr;
+    AtomicInt loadCancel;
 };
 
-static bool LoadImageDir(EngineImageDir* e, const char* dir) {
-    e->SetFilePath(dir);
+static bool IsSortedNatural(StrVec& v) {
+    for (int i = 1; i < v.Size(); i++) {
+        if (StrLessNatural(v.At(i), v.At(i - 1))) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    DirIter di{dir};
+// Directories with many images are shown as soon as the first kImageDirBatchSize
+// images have been found and the rest is added in batches. That only works if
+// the file system lists the files in (natural) sort order, which NTFS does e.g.
+// for zero-padded page numbers. Otherwise all files have to be found and sorted
+// before the directory can be shown. If the order only breaks after pages have
+// been handed over, the remaining files are merged with them at the end
+static void LoadImageDirThread(EngineImageDir* e) {
+    StrVec names;
+    // last file of the previous batch
+    AutoFreeStr lastName;
+    bool isFirstBatch = true;
+    bool inOrder = true;
+    int nEntries = 0;
+
+    DirIter di{e->FilePath()};
     for (DirIterEntry* de : di) {
-        auto path = de->filePath;
-        Kind kind = GuessFileTypeFromName(path);
+        if (e->loadCancel.Get() != 0) {
+            break;
+        }
+        Kind kind = GuessFileTypeFromName(de->name);
         if (IsEngineImageSupportedFileType(kind)) {
-            e->pageFileNames.Append(path);
+            names.Append(de->name);
+        }
+        // de is allocated from the temp allocator
+        if (++nEntries % kImageDirBatchSize == 0) {
+            ResetTempAllocator();
+        }
+        if (!inOrder || names.Size() < kImageDirBatchSize) {
+            continue;
+        }
+        if (isFirstBatch) {
+            inOrder = IsSortedNatural(names);
+        } else {
+            SortNatural(&names);
+            inOrder = StrLessNatural(lastName, names.At(0));
         }
+        if (!inOrder) {
+            // collect the remaining files and sort them all at the end
+            continue;
+        }
+        lastName.SetCopy(names.At(names.Size() - 1));
+        e->AddFoundFiles(names, !isFirstBatch, false);
+        names.Reset();
+        isFirstBatch = false;
     }
 
-    int nFiles = e->pageFileNames.Size();
-    if (nFiles == 0) {
-        return false;
+    if (e->loadCancel.Get() == 0) {
+        SortNatural(&names);
+        bool merge = !isFirstBatch && names.Size() > 0 && !StrLessNatural(lastName, names.At(0));
+        e->AddFoundFiles(names, !isFirstBatch, merge);
     }
+    // in case there were no images at all
+    SetEvent(e->firstBatchLoaded);
+}
 
-    SortNatural(&e->pageFileNames);
-
-    for (int i = 0; i < nFiles; i++) {
+// called on loadThread. After the first batch, the page sizes are loaded
+// as well so that adding the pages on the UI thread is cheap
+void EngineImageDir::AddFoundFiles(StrVec& names, bool loadSizes, bool merge) {
+    Vec<ImagePageInfo*> infos;
+    for (char* name : names) {
         ImagePageInfo* pi = new ImagePageInfo();
-        e->pages.Append(pi);
+        if (loadSizes && loadCancel.Get() == 0) {
+            TempStr path = path::JoinTemp(FilePath(), name);
+            Size size = BitmapSizeFromFile(path);
+            pi->mediabox = RectF(0, 0, (float)size.dx, (float)size.dy);
+            pi->hasMediaBox = true;
+            ResetTempAllocator();
+        }
+        infos.Append(pi);
+    }
+
+    ScopedCritSec scope(&filesAccess);
+    for (char* name : names) {
+        loadedFileNames.Append(name);
+    }
+    for (ImagePageInfo* pi : infos) {
+        loadedPages.Append(pi);
+    }
+    mergeLoaded = mergeLoaded || merge;
+    onPagesLoaded.Call();
+    SetEvent(firstBatchLoaded);
+}
+
+void EngineImageDir::SetOnPagesLoaded(const Func0& fn) {
+    ScopedCritSec scope(&filesAccess);
+    onPagesLoaded = fn;
+    if (loadedPages.Size() > 0) {
+        onPagesLoaded.Call();
+    }
+}
+
+int EngineImageDir::AddLoadedPages() {
+    StrVec names;
+    Vec<ImagePageInfo*> infos;
+    bool merge = false;
+    {
+        ScopedCritSec scope(&filesAccess);
+        for (char* name : loadedFileNames) {
+            names.Append(name);
+        }
+        for (ImagePageInfo* pi : loadedPages) {
+            infos.Append(pi);
+        }
+        merge = mergeLoaded;
+        loadedFileNames.Reset();
+        loadedPages.Reset();
+        mergeLoaded = false;
+    }
+    int nAdded = infos.Size();
+    if (nAdded == 0) {
+        return 0;
+    }
+
+    int firstChanged = pageCount + 1;
+    if (merge) {
+        firstChanged = MergeLoadedPages(names, infos);
+    } else {
+        ScopedCritSec scope(&filesAccess);
+        for (char* name : names) {
+            pageFileNames.Append(name);
+        }
+        ScopedCritSec scope2(&cacheAccess);
+        for (ImagePageInfo* pi : infos) {
+            pages.Append(pi);
+        }
+        pageCount = pages.Size();
+    }
+
+    if (tocTree) {
+        TocItem* last = tocTree->root->child;
+        for (TocItem* item = last; item; item = item->next) {
+            // labels of renumbered pages change as well
+            if (item->pageNo >= firstChanged) {
+                str::ReplaceWithCopy(&item->title, GetPageLabeTemp(item->pageNo));
+            }
+            last = item;
+        }
+        for (int i = pageCount - nAdded + 1; i <= pageCount; i++) {
+            TempStr label = GetPageLabeTemp(i);
+            TocItem* item = new TocItem(last->parent, label, i);
+            item->id = i;
+            last->next = item;
+            last = item;
+        }
+    }
+    return firstChanged;
+}
+
+// inserts the pages found out of order between the pages that have already been
+// added (all in natural sort order), renumbering the pages after them.
+// Returns the first renumbered page
+int EngineImageDir::MergeLoadedPages(StrVec& names, Vec<ImagePageInfo*>& infos) {
+    int nOld = pageFileNames.Size();
+    int nPages = nOld + names.Size();
+    auto nameAt = [&](int i) { return i < nOld ? pageFileNames.At(i) : names.At(i - nOld); };
+    // order[i] is the index (as above) of the page that becomes page i + 1
+    Vec<int> order;
+    for (int i = 0; i < nPages; i++) {
+        order.Append(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return StrLessNatural(nameAt(a), nameAt(b)); });
+    int firstChanged = 1;
+    while (firstChanged <= nOld && order.at(firstChanged - 1) == firstChanged - 1) {
+        firstChanged++;
+    }
+
+    StrVec newNames;
+    Vec<ImagePageInfo*> newPages;
+    Vec<int> newPageNo;
+    newPageNo.SetSize(nOld);
+    for (int i = 0; i < nPages; i++) {
+        int idx = order.at(i);
+        newNames.Append(nameAt(idx));
+        if (idx < nOld) {
+            newPages.Append(pages.at(idx));
+            newPageNo.at(idx) = i + 1;
+        } else {
+            newPages.Append(infos.at(idx - nOld));
+        }
+    }
+
+    // cached pages are renumbered, which requires that none is being decoded
+    // (LoadPage() gets the file name for page->pageNo)
+    EnterCriticalSection(&cacheAccess);
+    for (;;) {
+        bool isLoading = false;
+        for (ImagePage* page : pageCache) {
+            isLoading = isLoading || page->isLoading;
+        }
+        if (!isLoading) {
+            break;
+        }
+        SleepConditionVariableCS(&pageLoaded, &cacheAccess, INFINITE);
+    }
+    decodeAheadQueue.Reset();
+    for (ImagePage* page : pageCache) {
+        page->pageNo = newPageNo.at(page->pageNo - 1);
+    }
+    for (int i = 0; i < nOld; i++) {
+        for (IPageElement* el : pages.at(i)->allElements) {
+            auto ipel = (PageElementImage*)el;
+            ipel->pageNo = newPageNo.at(i);
+            ipel->imageID = newPageNo.at(i);
+        }
+    }
+    {
+        ScopedCritSec scope(&filesAccess);
+        pageFileNames.Reset();
+        for (char* name : newNames) {
+            pageFileNames.Append(name);
+        }
+    }
+    pages.Reset();
+    for (ImagePageInfo* pi : newPages) {
+        pages.Append(pi);
+    }
+    pageCount = pages.Size();
+    LeaveCriticalSection(&cacheAccess);
+    return firstChanged;
+}
+
+bool EngineImageDir::IsLoadingPages() {
+    ScopedCritSec scope(&filesAccess);
+    if (loadedPages.Size() > 0) {
+        return true;
     }
+    return loadThread && WaitForSingleObject(loadThread, 0) == WAIT_TIMEOUT;
+}
 
-    e->pageCount = nFiles;
+static bool LoadImageDir(EngineImageDir* e, const char* dir) {
+    e->SetFilePath(dir);
+
+    e->firstBatchLoaded = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    auto fn = MkFunc0<EngineImageDir>(LoadImageDirThread, e);
+    e->loadThread = StartThread(fn, "LoadImageDirThread");
+    if (!e->firstBatchLoaded || !e->loadThread) {
+        return false;
+    }
+    WaitForSingleObject(e->firstBatchLoaded, INFINITE);
+    e->AddLoadedPages();
+    if (e->pageCount == 0) {
+        return false;
+    }
 
     // TODO: better handle the case where images have different resolutions
     ImagePage* page = e->GetPage(1);
@@ -882,8 +1552,7 @@ TempStr EngineImageDir::GetPageLabeTemp(int pageNo) const {
         return EngineBase::GetPageLabeTemp(pageNo);
     }
 
-    const char* path = pageFileNames.At(pageNo - 1);
-    TempStr fileName = path::GetBaseNameTemp(path);
+    const char* fileName = pageFileNames.At(pageNo - 1);
     TempStr ext = path::GetExtTemp(fileName);
     if (!ext) {
         return str::DupTemp(fileName);
@@ -896,8 +1565,7 @@ TempStr EngineImageDir::GetPageLabeTemp(int pageNo) const {
 int EngineImageDir::GetPageByLabel(const char* label) const {
     size_t nLabel = str::Len(label);
     for (int i = 0; i < pageFileNames.Size(); i++) {
-        char* pagePath = pageFileNames[i];
-        TempStr fileName = path::GetBaseNameTemp(pagePath);
+        char* fileName = pageFileNames[i];
         char* ext = path::GetExtTemp(fileName);
         if (!str::StartsWith(fileName, label)) {
             continue;
@@ -922,11 +1590,14 @@ TocTree* EngineImageDir::GetToc() {
     TempStr label = GetPageLabeTemp(1);
     TocItem* root = newImageDirTocItem(nullptr, label, 1);
     root->id = 1;
+    TocItem* last = root;
     for (int i = 2; i <= PageCount(); i++) {
         label = GetPageLabeTemp(i);
         TocItem* item = newImageDirTocItem(root, label, i);
         item->id = i;
-        root->AddSiblingAtEnd(item);
+        // not AddSiblingAtEnd() which would be quadratic for big directories
+        last->next = item;
+        last = item;
     }
     auto realRoot = new TocItem();
     realRoot->child = root;
@@ -940,35 +1611,36 @@ bool EngineImageDir::SaveFileAs(const char* dstPath) {
     if (!ok) {
         return false;
     }
-    for (char* pathOld : pageFileNames) {
-        TempStr fileName = path::GetBaseNameTemp(pathOld);
+    for (char* fileName : pageFileNames) {
+        TempStr pathOld = path::JoinTemp(FilePath(), fileName);
         TempStr pathNew = path::JoinTemp(dstPath, fileName);
         ok = ok && file::Copy(pathNew, pathOld, true);
     }
     return ok;
 }
 
-Bitmap* EngineImageDir::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
-    char* path = pageFileNames.At(pageNo - 1);
+TempStr EngineImageDir::PagePathTemp(int pageNo) {
+    ScopedCritSec scope(&filesAccess);
+    const char* fileName = pageFileNames.At(pageNo - 1);
+    return path::JoinTemp(FilePath(), fileName);
+}
+
+Bitmap* EngineImageDir::LoadBitmapForPage(int pageNo, int& reduce, bool& deleteAfterUse) {
+    TempStr path = PagePathTemp(pageNo);
     ByteSlice bmpData = file::ReadFile(path);
     if (!bmpData) {
         return nullptr;
     }
     deleteAfterUse = true;
-    Bitmap* res = BitmapFromData(bmpData);
+    Bitmap* res = BitmapFromDataReduced(bmpData, reduce);
     bmpData.Free();
     return res;
 }
 
 RectF EngineImageDir::LoadMediabox(int pageNo) {
-    char* path = pageFileNames.At(pageNo - 1);
-    ByteSlice bmpData = file::ReadFile(path);
-    if (bmpData) {
-        Size size = BitmapSizeFromData(bmpData);
-        bmpData.Free();
-        return RectF(0, 0, (float)size.dx, (float)size.dy);
-    }
-    return RectF();
+    TempStr path = PagePathTemp(pageNo);
+    Size size = BitmapSizeFromFile(path);
+    return RectF(0, 0, (float)size.dx, (float)size.dy);
 }
 
 EngineBase* EngineImageDir::CreateFromFile(const char* fileName) {
@@ -1111,7 +1783,7 @@ class EngineCbx : public EngineImages {
     static EngineBase* CreateFromStream(IStream* stream);
 
   protected:
-    Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadBitmapForPage(int pageNo, int& reduce, bool& deleteAfterUse) override;
     RectF LoadMediabox(int pageNo) override;
 
     bool LoadFromFile(const char* fileName);
@@ -1119,8 +1791,10 @@ class EngineCbx : public EngineImages {
     bool FinishLoading();
 
     ByteSlice GetImageData(int pageNo);
+    ByteSlice GetImageDataPrefix(int pageNo, size_t maxSize);
 
-    // access to cbxFile must be protected after initialization (with cacheAccess)
+    // access to cbxFile must be protected after initialization (with archiveAccess)
+    CRITICAL_SECTION archiveAccess;
     MultiFormatArchive* cbxFile = nullptr;
     Vec<MultiFormatArchive::FileInfo*> files;
     TocTree* tocTree = nullptr;
@@ -1132,11 +1806,15 @@ class EngineCbx : public EngineImages {
 EngineCbx::EngineCbx(MultiFormatArchive* arch) {
     cbxFile = arch;
     kind = kindEngineComicBooks;
+    InitializeCriticalSection(&archiveAccess);
+    // GetImageData() serializes access to the archive, decoding happens in parallel
+    decodeAhead = true;
 }
 
 EngineCbx::~EngineCbx() {
     delete tocTree;
     delete cbxFile;
+    DeleteCriticalSection(&archiveAccess);
 }
 
 EngineBase* EngineCbx::Clone() {
@@ -1295,10 +1973,19 @@ TocTree* EngineCbx::GetToc() {
 ByteSlice EngineCbx::GetImageData(int pageNo) {
     ReportIf((pageNo < 1) || (pageNo > PageCount()));
     size_t fileId = files[pageNo - 1]->fileId;
+    ScopedCritSec scope(&archiveAccess);
     ByteSlice d = cbxFile->GetFileDataById(fileId);
     return d;
 }
 
+ByteSlice EngineCbx::GetImageDataPrefix(int pageNo, size_t maxSize) {
+    ReportIf((pageNo < 1) || (pageNo > PageCount()));
+    size_t fileId = files[pageNo - 1]->fileId;
+    ScopedCritSec scope(&archiveAccess);
+    ByteSlice d = cbxFile->GetFileDataPrefixById(fileId, maxSize);
+    return d;
+}
+
 TempStr EngineCbx::GetPropertyTemp(const char* name) {
     if (str::Eq(name, kPropTitle)) {
         return cip.propTitle;
@@ -1328,11 +2015,11 @@ TempStr EngineCbx::GetPropertyTemp(const char* name) {
     return nullptr;
 }
 
-Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
+Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, int& reduce, bool& deleteAfterUse) {
     auto timeStart = TimeGet();
     defer {
         auto dur = TimeSinceInMs(timeStart);
-        logf("EngineCbx::LoadBitmapForPage(page: %d) took %.2f ms\n", pageNo, dur);
+        logf("EngineCbx::LoadBitmapForPage(page: %d, reduce: %d) took %.2f ms\n", pageNo, reduce, dur);
     };
     ByteSlice img = GetImageData(pageNo);
     if (img.empty()) {
@@ -1340,12 +2027,39 @@ Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
         return nullptr;
     }
     deleteAfterUse = true;
-    auto res = BitmapFromData(img);
+    auto res = BitmapFromDataReduced(img, reduce);
     img.Free();
     return res;
 }
 
 RectF EngineCbx::LoadMediabox(int pageNo) {
+    // the size is usually in the first few hundred bytes of the image
+    // so try to avoid uncompressing and decoding the whole image
+    size_t fileSize = files[pageNo - 1]->fileSizeUncompressed;
+    size_t toRead = kBitmapHeaderProbeSize;
+    while (toRead < fileSize && toRead <= kBitmapHeaderMaxProbeSize) {
+        ByteSlice d = GetImageDataPrefix(pageNo, toRead);
+        if (d.empty()) {
+            break;
+        }
+        size_t needed = 0;
+        Size size;
+        if (d.size() >= fileSize) {
+            // got the whole file anyway
+            size = BitmapSizeFromData(d);
+        } else {
+            size = BitmapSizeFromHeader(d, &needed);
+        }
+        d.Free();
+        if (!size.IsEmpty()) {
+            return RectF(0, 0, (float)size.dx, (float)size.dy);
+        }
+        if (needed <= toRead) {
+            break;
+        }
+        toRead = needed;
+    }
+
     ByteSlice img = GetImageData(pageNo);
     if (!img.empty()) {
         Size size = BitmapSizeFromData(img);
@@ -1358,7 +2072,7 @@ RectF EngineCbx::LoadMediabox(int pageNo) {
     }
     img.Free();
 
-    ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
+    ImagePage* page = GetPage(pageNo, IsPageCacheFull());
     if (page) {
         RectF mbox(0, 0, (float)page->bmp->GetWidth(), (float)page->bmp->GetHeight());
         DropPage(page, false);
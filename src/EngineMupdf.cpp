@@ -16,10 +16,13 @@ extern "C" {
 #include "utils/GuessFileType.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/PixelUtil.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
 #include "utils/Timer.h"
+#include "utils/TimingStats.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/UIModels.h"
 
@@ -526,32 +529,226 @@ static fz_stream* FzOpenOrReadFile(fz_context* ctx, const char* path) {
     return stm;
 }
 
-static void FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
+// larger documents only have parts of their data hashed for the fingerprint
+constexpr i64 kSampledFingerprintMinSize = (i64)1024 * 1024 * 1024;
+constexpr i64 kFingerprintHeadTailSize = 1024 * 1024;
+constexpr i64 kFingerprintChunkSize = 64 * 1024;
+constexpr int kFingerprintSamples = 64;
+
+static TimingStats gFingerprintStats("EngineMupdf: fingerprint");
+
+struct FingerprintRange {
+    i64 off = 0;
+    i64 size = 0;
+};
+
+// the parts of a file that make up its fingerprint: either all of it or, for
+// large files, the beginning, the end and evenly spaced chunks in between
+// (the size of the file is hashed in addition to those)
+static void GetFingerprintRanges(i64 fileLen, Vec<FingerprintRange>& ranges) {
+    if (fileLen < kSampledFingerprintMinSize) {
+        for (i64 off = 0; off < fileLen; off += kFingerprintChunkSize) {
+            ranges.Append(FingerprintRange{off, std::min(kFingerprintChunkSize, fileLen - off)});
+        }
+        return;
+    }
+    ranges.Append(FingerprintRange{0, kFingerprintHeadTailSize});
+    i64 step = (fileLen - 2 * kFingerprintHeadTailSize) / kFingerprintSamples;
+    for (int i = 0; i < kFingerprintSamples; i++) {
+        ranges.Append(FingerprintRange{kFingerprintHeadTailSize + i * step, kFingerprintChunkSize});
+    }
+    ranges.Append(FingerprintRange{fileLen - kFingerprintHeadTailSize, kFingerprintHeadTailSize});
+}
+
+static void Md5FileLen(fz_md5* md5, i64 fileLen) {
+    // keeps fingerprints of smaller files compatible with older versions
+    if (fileLen >= kSampledFingerprintMinSize) {
+        fz_md5_update(md5, (const u8*)&fileLen, sizeof(fileLen));
+    }
+}
+
+// Fingerprint of a PDF document, only needed for remembering its decryption key.
+// If all of the document is in memory (which is the case for files that were
+// small enough to be read into memory) or the file can be memory mapped, it's
+// calculated on a background thread while the user enters the password.
+// Otherwise it's read in chunks on demand.
+struct FzFingerprint : FileFingerprint {
+    fz_context* ctx = nullptr;
+    fz_stream* stm = nullptr;
     i64 fileLen = -1;
-    fz_buffer* buf = nullptr;
+    // set if all of stm's data is in memory (or mapped)
+    const u8* data = nullptr;
+    // only mapped until the fingerprint has been calculated
+    // (see file::MapReadOnly())
+    file::MappedFile* mapped = nullptr;
+    HANDLE hThread = nullptr;
+    // set when the fingerprint turned out not to be needed
+    AtomicInt cancel;
+    bool isDone = false;
+    bool ok = false;
+    u8 digest[16]{};
 
+    FzFingerprint(fz_context* ctx, fz_stream* stm, const char* path);
+    ~FzFingerprint() override;
+    bool Get(u8 digestOut[16]) override;
+    void CalcFromMemory();
+    void CalcFromStream();
+};
+
+static void CalcFingerprintThread(FzFingerprint* fp) {
+    fp->CalcFromMemory();
+    fp->data = nullptr;
+    delete fp->mapped;
+    fp->mapped = nullptr;
+}
+
+FzFingerprint::FzFingerprint(fz_context* ctx, fz_stream* stm, const char* path) {
+    this->ctx = ctx;
+    if (!stm) {
+        return;
+    }
+    this->stm = fz_keep_stream(ctx, stm);
     fz_try(ctx) {
         fz_seek(ctx, stm, 0, 2);
         fileLen = fz_tell(ctx, stm);
         fz_seek(ctx, stm, 0, 0);
-        buf = fz_read_all(ctx, stm, fileLen);
+        // memory streams have all their data available
+        if (fileLen == (i64)(stm->wp - stm->rp)) {
+            data = stm->rp;
+        }
     }
     fz_catch(ctx) {
-        fz_warn(ctx, "couldn't read stream data, using a nullptr fingerprint instead");
-        ZeroMemory(digest, 16);
         fz_report_error(ctx);
-        return;
+        fileLen = -1;
     }
-    ReportIf(nullptr == buf);
-    u8* data;
-    size_t size = fz_buffer_extract(ctx, buf, &data);
-    ReportIf((size_t)fileLen != size);
-    fz_drop_buffer(ctx, buf);
+    if (!data && fileLen > 0) {
+        mapped = file::MapReadOnly(path);
+        if (mapped && mapped->data.size() == (size_t)fileLen) {
+            data = mapped->data.data();
+        } else {
+            delete mapped;
+            mapped = nullptr;
+        }
+    }
+    if (data) {
+        // the data doesn't change until stm is dropped in the destructor
+        auto fn = MkFunc0<FzFingerprint>(CalcFingerprintThread, this);
+        hThread = StartThread(fn, "FingerprintThread");
+    }
+}
+
+FzFingerprint::~FzFingerprint() {
+    if (hThread) {
+        cancel.Set(1);
+        WaitForSingleObject(hThread, INFINITE);
+        CloseHandle(hThread);
+    }
+    delete mapped;
+    fz_drop_stream(ctx, stm);
+}
 
+void FzFingerprint::CalcFromMemory() {
+    auto timeStart = TimeGet();
+    Vec<FingerprintRange> ranges;
+    GetFingerprintRanges(fileLen, ranges);
     fz_md5 md5;
     fz_md5_init(&md5);
-    fz_md5_update(&md5, data, size);
+    Md5FileLen(&md5, fileLen);
+    ok = true;
+    for (FingerprintRange& r : ranges) {
+        if (cancel.Get() != 0) {
+            ok = false;
+            break;
+        }
+        fz_md5_update(&md5, data + r.off, (size_t)r.size);
+    }
     fz_md5_final(&md5, digest);
+    if (ok && gTimingStatsEnabled) {
+        gFingerprintStats.Add(TimeSinceInMs(timeStart));
+    }
+}
+
+// must be called on the thread that owns ctx
+void FzFingerprint::CalcFromStream() {
+    auto timeStart = TimeGet();
+    u8* buf = AllocArray<u8>((size_t)kFingerprintHeadTailSize);
+    if (!buf) {
+        return;
+    }
+    Vec<FingerprintRange> ranges;
+    GetFingerprintRanges(fileLen, ranges);
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    Md5FileLen(&md5, fileLen);
+    fz_try(ctx) {
+        for (FingerprintRange& r : ranges) {
+            fz_seek(ctx, stm, r.off, 0);
+            size_t nRead = fz_read(ctx, stm, buf, (size_t)r.size);
+            if (nRead != (size_t)r.size) {
+                fz_throw(ctx, FZ_ERROR_GENERIC, "insufficient data for fingerprint");
+            }
+            fz_md5_update(&md5, buf, nRead);
+        }
+        fz_md5_final(&md5, digest);
+        ok = true;
+    }
+    fz_catch(ctx) {
+        fz_warn(ctx, "couldn't read stream data, using a nullptr fingerprint instead");
+        fz_report_error(ctx);
+    }
+    free(buf);
+    if (gTimingStatsEnabled) {
+        gFingerprintStats.Add(TimeSinceInMs(timeStart));
+    }
+}
+
+bool FzFingerprint::Get(u8 digestOut[16]) {
+    if (!isDone) {
+        auto timeStart = TimeGet();
+        if (hThread) {
+            WaitForSingleObject(hThread, INFINITE);
+            CloseHandle(hThread);
+            hThread = nullptr;
+        } else if (fileLen >= 0) {
+            CalcFromStream();
+        }
+        isDone = true;
+        logf("FzFingerprint::Get(): waited %.2f ms for fingerprint of %.1f MB\n", TimeSinceInMs(timeStart),
+             (double)fileLen / (1024 * 1024));
+    }
+    memcpy(digestOut, digest, 16);
+    return ok;
+}
+
+// for testing: the fingerprint of a file as calculated when asking for the password
+// of a PDF document. If fromStream is set, it's read through a file stream
+// instead of from memory or a mapping of the file
+bool CalcPdfFileFingerprint(const char* path, bool fromStream, u8 digest[16]) {
+    fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    if (!ctx) {
+        return false;
+    }
+    fz_stream* stm = nullptr;
+    if (fromStream) {
+        WCHAR* pathW = ToWStrTemp(path);
+        fz_try(ctx) {
+            stm = fz_open_file_w(ctx, pathW);
+        }
+        fz_catch(ctx) {
+            stm = nullptr;
+            fz_report_error(ctx);
+        }
+    } else {
+        stm = FzOpenOrReadFile(ctx, path);
+    }
+    bool ok = false;
+    if (stm) {
+        FzFingerprint fingerprint(ctx, stm, fromStream ? nullptr : path);
+        ok = fingerprint.Get(digest);
+    }
+    fz_drop_stream(ctx, stm);
+    fz_drop_context(ctx);
+    return ok;
 }
 
 static ByteSlice FzExtractStreamData(fz_context* ctx, fz_stream* stream) {
@@ -860,53 +1057,26 @@ static RenderedBitmap* TryRenderAsPaletteImage(fz_pixmap* pixmap) {
     int w = pixmap->w;
     int h = pixmap->h;
     int rows8 = ((w + 3) / 4) * 4;
-    u8* bmpData = (u8*)calloc(rows8, h);
+    DWORD imgSize = (DWORD)(rows8 * h);
+
+    // convert directly into the memory backing the DIB
+    HANDLE hMap = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, imgSize, nullptr);
+    if (!hMap) {
+        return nullptr;
+    }
+    u8* bmpData = (u8*)MapViewOfFile(hMap, FILE_MAP_WRITE, 0, 0, imgSize);
     if (!bmpData) {
+        CloseHandle(hMap);
         return nullptr;
     }
 
     ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
-
-    u8* dest = bmpData;
-    u8* source = pixmap->samples;
     u32* palette = (u32*)bmi.Get()->bmiColors;
-    u8 grayIdxs[256]{};
-
-    int paletteSize = 0;
-    RGBQUAD c;
-    for (int j = 0; j < h; j++) {
-        for (int i = 0; i < w; i++) {
-            c.rgbRed = *source++;
-            c.rgbGreen = *source++;
-            c.rgbBlue = *source++;
-            c.rgbReserved = 0;
-            source++;
-
-            /* find this color in the palette */
-            int k;
-            bool isGray = c.rgbRed == c.rgbGreen && c.rgbRed == c.rgbBlue;
-            if (isGray) {
-                k = grayIdxs[c.rgbRed] || palette[0] == *(u32*)&c ? grayIdxs[c.rgbRed] : paletteSize;
-            } else {
-                for (k = 0; k < paletteSize && palette[k] != *(u32*)&c; k++) {
-                    ;
-                }
-            }
-            /* add it to the palette if it isn't in there and if there's still space left */
-            if (k == paletteSize) {
-                if (++paletteSize > 256) {
-                    free(bmpData);
-                    return nullptr;
-                }
-                if (isGray) {
-                    grayIdxs[c.rgbRed] = (BYTE)k;
-                }
-                palette[k] = *(u32*)&c;
-            }
-            /* 8-bit data consists of indices into the color palette */
-            *dest++ = k;
-        }
-        dest += rows8 - w;
+    int paletteSize = PalettizeRgbx(pixmap->samples, (int)pixmap->stride, bmpData, rows8, w, h, palette);
+    UnmapViewOfFile(bmpData);
+    if (paletteSize < 0) {
+        CloseHandle(hMap);
+        return nullptr;
     }
 
     BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
@@ -916,18 +1086,15 @@ static RenderedBitmap* TryRenderAsPaletteImage(fz_pixmap* pixmap) {
     bmih->biPlanes = 1;
     bmih->biCompression = BI_RGB;
     bmih->biBitCount = 8;
-    bmih->biSizeImage = h * rows8;
+    bmih->biSizeImage = imgSize;
     bmih->biClrUsed = paletteSize;
 
     void* data = nullptr;
-    HANDLE hMap = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmih->biSizeImage, nullptr);
     HBITMAP hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &data, hMap, 0);
     if (!hbmp) {
-        free(bmpData);
+        CloseHandle(hMap);
         return nullptr;
     }
-    memcpy(data, bmpData, bmih->biSizeImage);
-    free(bmpData);
     return new RenderedBitmap(hbmp, Size(w, h), hMap);
 }
 
@@ -963,7 +1130,12 @@ static fz_pixmap* FzConvertPixmap2(fz_context* ctx, fz_pixmap* pix, fz_colorspac
     return cvt;
 }
 
+static TimingStats gLoadPageStats("EngineMupdf: GetFzPageInfo");
+static TimingStats gRunPageStats("EngineMupdf: run page");
+static TimingStats gConvertPixmapStats("EngineMupdf: NewRenderedFzPixmap");
+
 RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap) {
+    TimingScope timing(&gConvertPixmapStats);
     if (pixmap->n == 4 && fz_colorspace_is_rgb(ctx, pixmap->colorspace)) {
         RenderedBitmap* res = TryRenderAsPaletteImage(pixmap);
         if (res) {
@@ -981,11 +1153,20 @@ RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap) {
     fz_var(csdest);
     fz_var(cp);
 
+    // for device RGB (the colorspace we render into) mupdf's conversion
+    // to BGR is a plain swizzle, which we do ourselves straight into
+    // the bitmap memory without an intermediate pixmap
+    bool canSwizzle = pixmap->n == 4 && pixmap->alpha && pixmap->s == 0 && pixmap->colorspace == fz_device_rgb(ctx);
+
     /* BGRA is a GDI compatible format */
     fz_try(ctx) {
-        csdest = fz_device_bgr(ctx);
-        cp = fz_default_color_params;
-        bgrPixmap = FzConvertPixmap2(ctx, pixmap, csdest, nullptr, nullptr, cp, 1);
+        if (canSwizzle) {
+            bgrPixmap = fz_keep_pixmap(ctx, pixmap);
+        } else {
+            csdest = fz_device_bgr(ctx);
+            cp = fz_default_color_params;
+            bgrPixmap = FzConvertPixmap2(ctx, pixmap, csdest, nullptr, nullptr, cp, 1);
+        }
     }
     fz_catch(ctx) {
         fz_report_error(ctx);
@@ -1020,10 +1201,17 @@ RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap) {
     HBITMAP hbmp = CreateDIBSection(nullptr, bmi, usage, &data, hMap, 0);
     if (data) {
         u8* samples = bgrPixmap->samples;
-        memcpy(data, samples, imgSize);
+        if (canSwizzle) {
+            SwapRedBlue(samples, (int)bgrPixmap->stride, (u8*)data, (int)bgrPixmap->stride, w, h);
+        } else {
+            memcpy(data, samples, imgSize);
+        }
     }
     fz_drop_pixmap(ctx, bgrPixmap);
     if (!hbmp) {
+        if (hMap) {
+            CloseHandle(hMap);
+        }
         return nullptr;
     }
     // return a RenderedBitmap even if hbmp is nullptr so that callers can
@@ -1700,7 +1888,7 @@ class PasswordCloner : public PasswordUI {
         this->cryptKey = cryptKey;
     }
 
-    char* GetPassword(const char*, u8*, u8 decryptionKeyOut[32], bool* saveKey) override {
+    char* GetPassword(const char*, FileFingerprint*, u8 decryptionKeyOut[32], bool* saveKey) override {
         memcpy(decryptionKeyOut, cryptKey, 32);
         *saveKey = true;
         return nullptr;
@@ -2079,10 +2267,7 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
     }
 
     // TODO: make this work for non-PDF formats?
-    u8 digest[16 + 32]{};
-    if (pdfdoc) {
-        FzStreamFingerprint(ctx, pdfdoc->file, digest);
-    }
+    FzFingerprint fingerprint(ctx, pdfdoc ? pdfdoc->file : nullptr, FilePath());
 
     bool ok = false;
     bool saveKey = false;
@@ -2091,7 +2276,7 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
         if (pdfdoc) {
             decryptKey = pdf_crypt_key(ctx, pdfdoc->crypt);
         }
-        AutoFreeStr pwd(pwdUI->GetPassword(FilePath(), digest, decryptKey, &saveKey));
+        AutoFreeStr pwd(pwdUI->GetPassword(FilePath(), &fingerprint, decryptKey, &saveKey));
         if (!pwd) {
             // password not given or encryption key has been remembered
             ok = saveKey;
@@ -2122,6 +2307,8 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
     }
 
     if (pdfdoc && ok && saveKey) {
+        u8 digest[16 + 32]{};
+        fingerprint.Get(digest);
         memcpy(digest + 16, pdf_crypt_key(ctx, pdfdoc->crypt), 32);
         decryptionKey = _MemToHex(&digest);
     }
@@ -2904,49 +3091,56 @@ RectF EngineMupdf::PageContentBox(int pageNo, RenderTarget target) {
         return RectF();
     }
 
-    ScopedCritSec scope(ctxAccess);
+    int gen = 0;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (pageInfo->hasContentBox) {
+            return pageInfo->contentBox;
+        }
+        gen = pageInfo->contentBoxGen;
+    }
 
     fz_cookie fzcookie{};
     fz_rect rect = fz_empty_rect;
     fz_device* dev = nullptr;
-    fz_display_list* list = nullptr;
-
-    fz_rect pagerect = fz_bound_page(ctx, pageInfo->page);
+    bool ok = false;
 
     fz_var(dev);
-    fz_var(list);
+    fz_var(ok);
 
     RectF mediabox = pageInfo->mediabox;
 
+    // run the page straight into the bbox device, a display list
+    // would only be used once
+    EnterCriticalSection(ctxAccess);
     fz_try(ctx) {
-        list = fz_new_display_list_from_page(ctx, pageInfo->page);
-        if (list) {
-            dev = fz_new_bbox_device(ctx, &rect);
-            fz_run_display_list(ctx, list, dev, fz_identity, pagerect, &fzcookie);
-            fz_close_device(ctx, dev);
-        }
+        dev = fz_new_bbox_device(ctx, &rect);
+        fz_run_page(ctx, pageInfo->page, dev, fz_identity, &fzcookie);
+        fz_close_device(ctx, dev);
+        ok = true;
     }
     fz_always(ctx) {
         fz_drop_device(ctx, dev);
-        if (list) {
-            fz_drop_display_list(ctx, list);
-        }
     }
     fz_catch(ctx) {
         fz_report_error(ctx);
-        list = nullptr;
     }
+    // pagesAccess must not be acquired while holding ctxAccess
+    LeaveCriticalSection(ctxAccess);
 
-    if (!list) {
-        return mediabox;
+    RectF res = mediabox;
+    if (ok && !fz_is_infinite_rect(rect)) {
+        res = ToRectF(rect).Intersect(mediabox);
     }
-
-    if (fz_is_infinite_rect(rect)) {
-        return mediabox;
+    // don't remember failures, they might be temporary (e.g. out of memory)
+    if (ok) {
+        ScopedCritSec scope(&pagesAccess);
+        if (gen == pageInfo->contentBoxGen) {
+            pageInfo->contentBox = res;
+            pageInfo->hasContentBox = true;
+        }
     }
-
-    RectF rect2 = ToRectF(rect);
-    return rect2.Intersect(mediabox);
+    return res;
 }
 
 RectF EngineMupdf::Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse) {
@@ -2982,7 +3176,11 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
         fzcookie = (fz_cookie*)cookie->GetData();
     }
 
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false, fzcookie);
+    FzPageInfo* pageInfo = nullptr;
+    {
+        TimingScope timing(&gLoadPageStats);
+        pageInfo = GetFzPageInfo(pageNo, false, fzcookie);
+    }
     if (!pageInfo || !pageInfo->page) {
         return nullptr;
     }
@@ -3031,7 +3229,15 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
             // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
             // or "Print". "Export" is not used
             dev = fz_new_draw_device(ctx, ctm, pix);
-            pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, fzcookie);
+            {
+                // interpreting the content and rasterizing are interleaved by the draw device
+                TimingScope timing(&gRunPageStats);
+                if (args.skipAnnotations) {
+                    pdf_run_page_contents_with_usage(ctx, pdfpage, dev, fz_identity, usage, fzcookie);
+                } else {
+                    pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, fzcookie);
+                }
+            }
             bitmap = NewRenderedFzPixmap(ctx, pix);
             fz_close_device(ctx, dev);
         }
@@ -3055,7 +3261,10 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
             // fz_clear_pixmap(ctx, pix);
             // fz_fill_pixmap_with_color(ctx, pix, )
             dev = fz_new_draw_device(ctx, ctm, pix);
-            fz_run_page_contents(ctx, page, dev, fz_identity, NULL);
+            {
+                TimingScope timing(&gRunPageStats);
+                fz_run_page_contents(ctx, page, dev, fz_identity, NULL);
+            }
             fz_close_device(ctx, dev);
             fz_drop_device(ctx, dev);
             bitmap = NewRenderedFzPixmap(ctx, pix);
@@ -3977,6 +4186,9 @@ NO_INLINE void MarkNotificationAsModified(EngineMupdf* e, Annotation* annot, Ann
     auto ctx = e->Ctx();
     RebuildCommentsFromAnnotations(ctx, pageInfo);
     pageInfo->elementsNeedRebuilding = true;
+    // annotations are part of the content
+    pageInfo->hasContentBox = false;
+    pageInfo->contentBoxGen++;
 }
 
 // creates Annotation wrapper around pdf_annot
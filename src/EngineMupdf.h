@@ -33,6 +33,13 @@ struct FzPageInfo {
     RectF mediabox{};
     Vec<FitzPageImageInfo*> images;
 
+    // set by the first PageContentBox() (protected by pagesAccess)
+    RectF contentBox{};
+    bool hasContentBox = false;
+    // incremented when annotations change so that a content box
+    // calculated concurrently with the change isn't remembered
+    int contentBoxGen = 0;
+
     // if false, only loaded page (fast)
     // if true, loaded expensive info (extracted text etc.)
     bool fullyLoaded = false;
@@ -279,7 +279,11 @@ static bool shouldDeleteThumbnail = false;
 // either way, I just disabled deleting of stale thumbnail because it seems fishy
 // Should probably change the logic to: remove thumbnails for files marked as missing
 
-// removes thumbnails that don't belong to any frequently used item in file history
+// in EngineEbook.cpp
+extern TempStr GetEbookLayoutCachePathTemp(const char* filePath);
+
+// removes thumbnails (and ebook layout caches and content boxes) that don't belong to any
+// frequently used item in file history
 void CleanUpThumbnailCache() {
     const FileHistory& fileHistory = gFileHistory;
     TempStr thumbsDir = GetThumbnailCacheDirTemp();
@@ -287,7 +291,8 @@ void CleanUpThumbnailCache() {
     StrVec filePaths;
     DirIter di{thumbsDir};
     for (DirIterEntry* de : di) {
-        if (path::Match(de->filePath, "*.png")) {
+        if (path::Match(de->filePath, "*.png") || path::Match(de->filePath, "*.layout") ||
+            path::Match(de->filePath, "*.boxes")) {
             filePaths.Append(de->filePath);
         }
     }
@@ -312,10 +317,21 @@ void CleanUpThumbnailCache() {
         if (!ok) {
             logf("CleanUpThumbnailCache: failed to remove '%s'\n", path);
         }
+        TempStr layoutPath = GetEbookLayoutCachePathTemp(fs->filePath);
+        if (layoutPath) {
+            filePaths.Remove(layoutPath);
+        }
+        TempStr boxesPath = GetContentBoxesPathTemp(fs->filePath);
+        if (boxesPath) {
+            filePaths.Remove(boxesPath);
+        }
     }
 
     for (char* path : filePaths) {
-        if (shouldDeleteThumbnail) {
+        // unlike thumbnails (see above), layout caches and content boxes
+        // are cheap to re-create, so they're always deleted
+        bool isCache = path::Match(path, "*.layout") || path::Match(path, "*.boxes");
+        if (shouldDeleteThumbnail || isCache) {
             logf("CleanUpThumbnailCache: deleting '%s'\n", path);
             file::Delete(path);
         }
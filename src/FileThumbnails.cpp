@@ -6,10 +6,16 @@
 #include "utils/FileUtil.h"
 #include "utils/DirIter.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
 #include "utils/WinUtil.h"
 
+#include "wingui/UIModels.h"
+
 #include "Settings.h"
 #include "DocController.h"
+#include "EngineBase.h"
+#include "EngineAll.h"
 #include "FzImgReader.h"
 #include "FileHistory.h"
 
@@ -18,7 +24,8 @@
 
 #include "utils/Log.h"
 
-char* GetThumbnailPathTemp(const char* filePath) {
+// <fingerprint of filePath><ext> in the thumbnail cache directory
+static TempStr GetCachePathTemp(const char* filePath, const char* ext) {
     // create a fingerprint of a (normalized) path for the file name
     // I'd have liked to also include the file's last modification time
     // in the fingerprint (much quicker than hashing the entire file's
@@ -41,10 +48,19 @@ char* GetThumbnailPathTemp(const char* filePath) {
         return nullptr;
     }
 
-    TempStr res = path::JoinTemp(thumbsDir, str::JoinTemp(fingerPrint, ".png"));
+    TempStr res = path::JoinTemp(thumbsDir, str::JoinTemp(fingerPrint, ext));
     return res;
 }
 
+char* GetThumbnailPathTemp(const char* filePath) {
+    return GetCachePathTemp(filePath, ".png");
+}
+
+// content boxes remembered by DisplayModel for fit content mode
+TempStr GetContentBoxesPathTemp(const char* filePath) {
+    return GetCachePathTemp(filePath, ".boxes");
+}
+
 TempStr GetThumbnailCacheDirTemp() {
     TempStr thumbsDir = GetPathInAppDataDirTemp("sumatrapdfcache");
     return thumbsDir;
@@ -114,6 +130,35 @@ void SetThumbnail(FileState* fs, RenderedBitmap* bmp) {
     SaveThumbnail(fs);
 }
 
+// the .png is written under a temporary name and then renamed so that
+// a partially written thumbnail is never seen by LoadThumbnail()
+// (thumbnails can be written from multiple threads and processes)
+static bool SaveThumbnailAtomically(RenderedBitmap* thumbnail, const char* thumbnailPath) {
+    if (!dir::CreateForFile(thumbnailPath)) {
+        logf("SaveThumbnail: dir::CreateForFile('%s') failed\n", thumbnailPath);
+        ReportIfQuick(true);
+    }
+    ReportIfQuick(!str::EndsWithI(thumbnailPath, ".png"));
+
+    TempStr tmpPath = str::FormatTemp("%s.%d.tmp", thumbnailPath, (int)GetCurrentThreadId());
+    TempWStr tmpPathW = ToWStrTemp(tmpPath);
+    Gdiplus::Bitmap bmp(thumbnail->GetBitmap(), nullptr);
+    CLSID tmpClsid = GetEncoderClsid(L"image/png");
+    Gdiplus::Status status = bmp.Save(tmpPathW, &tmpClsid, nullptr);
+    if (status != Gdiplus::Ok) {
+        file::Delete(tmpPath);
+        return false;
+    }
+    TempWStr pathW = ToWStrTemp(thumbnailPath);
+    BOOL ok = MoveFileExW(tmpPathW, pathW, MOVEFILE_REPLACE_EXISTING);
+    if (!ok) {
+        logf("SaveThumbnail: MoveFileExW('%s') failed\n", thumbnailPath);
+        file::Delete(tmpPath);
+        return false;
+    }
+    return true;
+}
+
 void SaveThumbnail(FileState* fs) {
     if (!fs->thumbnail) {
         return;
@@ -123,16 +168,152 @@ void SaveThumbnail(FileState* fs) {
     if (!thumbnailPath) {
         return;
     }
-    if (!dir::CreateForFile(thumbnailPath)) {
-        logf("SaveThumbnail: dir::CreateForFile('%s') failed, file path: '%s'\n", thumbnailPath, fs->filePath);
-        ReportIfQuick(true);
+    SaveThumbnailAtomically(fs->thumbnail, thumbnailPath);
+}
+
+// calculates the zoom and the part of page 1 to render for a thumbnail of the given size
+// (the width of the page is scaled to size.dx and cropped at size.dy)
+bool GetThumbnailPageRect(EngineBase* engine, Size size, float* zoomOut, RectF* pageRectOut) {
+    RectF pageRect = engine->PageMediabox(1);
+    if (pageRect.IsEmpty()) {
+        return false;
     }
-    ReportIfQuick(!str::EndsWithI(thumbnailPath, ".png"));
 
-    Gdiplus::Bitmap bmp(fs->thumbnail->GetBitmap(), nullptr);
-    CLSID tmpClsid = GetEncoderClsid(L"image/png");
-    TempWStr pathW = ToWStrTemp(thumbnailPath);
-    bmp.Save(pathW, &tmpClsid, nullptr);
+    pageRect = engine->Transform(pageRect, 1, 1.0f, 0);
+    float zoom = size.dx / (float)pageRect.dx;
+    if (pageRect.dy > (float)size.dy / zoom) {
+        pageRect.dy = (float)size.dy / zoom;
+    }
+    *pageRectOut = engine->Transform(pageRect, 1, 1.0f, 0, true);
+    *zoomOut = zoom;
+    return true;
+}
+
+// --- batch creation of missing thumbnails
+
+// how many documents are opened at the same time for creating thumbnails
+constexpr int kThumbnailWorkersMax = 2;
+
+struct MissingThumbnailsData {
+    StrVec filePaths;
+    // index of the next path to process
+    LONG nextIdx = 0;
+    // the last worker to finish deletes the data
+    LONG nWorkers = 0;
+};
+
+struct ThumbnailCreatedData {
+    char* filePath = nullptr;
+    RenderedBitmap* bmp = nullptr;
+
+    ~ThumbnailCreatedData() {
+        str::Free(filePath);
+        delete bmp;
+    }
+};
+
+extern void MaybeRedrawHomePage();
+
+static void ThumbnailCreated(ThumbnailCreatedData* d) {
+    FileState* fs = gFileHistory.FindByPath(d->filePath);
+    // the document might have been opened (and got a thumbnail) in the meantime
+    if (fs && !fs->thumbnail) {
+        fs->thumbnail = d->bmp;
+        d->bmp = nullptr;
+        MaybeRedrawHomePage();
+    }
+    delete d;
+}
+
+static bool IsThumbnailUpToDate(const char* filePath, const char* thumbnailPath) {
+    if (!file::Exists(thumbnailPath)) {
+        return false;
+    }
+    FILETIME bmpTime = file::GetModificationTime(thumbnailPath);
+    FILETIME fileTime = file::GetModificationTime(filePath);
+    return FileTimeDiffInSecs(fileTime, bmpTime) <= 0;
+}
+
+// only renders the content of the first page (no annotations, no text extraction)
+// and returns nullptr for documents that can't be opened without a password
+static RenderedBitmap* CreateThumbnailHeadless(const char* filePath) {
+    EngineBase* engine = CreateEngineFromFile(filePath, nullptr, false);
+    if (!engine) {
+        return nullptr;
+    }
+    RenderedBitmap* bmp = nullptr;
+    float zoom;
+    RectF pageRect;
+    if (GetThumbnailPageRect(engine, Size(kThumbnailDx, kThumbnailDy), &zoom, &pageRect)) {
+        RenderPageArgs args(1, zoom, 0, &pageRect);
+        args.skipAnnotations = true;
+        bmp = engine->RenderPage(args);
+    }
+    SafeEngineRelease(&engine);
+    if (bmp && bmp->GetSize().IsEmpty()) {
+        delete bmp;
+        bmp = nullptr;
+    }
+    return bmp;
+}
+
+static void MissingThumbnailsWorker(MissingThumbnailsData* d) {
+    int n = d->filePaths.Size();
+    for (;;) {
+        int idx = (int)InterlockedIncrement(&d->nextIdx) - 1;
+        if (idx >= n) {
+            break;
+        }
+        const char* filePath = d->filePaths[idx];
+        TempStr thumbnailPath = GetThumbnailPathTemp(filePath);
+        if (thumbnailPath && DocumentPathExists(filePath) && !IsThumbnailUpToDate(filePath, thumbnailPath)) {
+            RenderedBitmap* bmp = CreateThumbnailHeadless(filePath);
+            if (bmp && SaveThumbnailAtomically(bmp, thumbnailPath)) {
+                logf("CreateMissingThumbnailsAsync: created thumbnail for '%s'\n", filePath);
+                auto res = new ThumbnailCreatedData();
+                res->filePath = str::Dup(filePath);
+                res->bmp = bmp;
+                auto fn = MkFunc0<ThumbnailCreatedData>(ThumbnailCreated, res);
+                uitask::Post(fn, "TaskThumbnailCreated");
+            } else {
+                delete bmp;
+            }
+        }
+        ResetTempAllocator();
+    }
+    if (InterlockedDecrement(&d->nWorkers) == 0) {
+        delete d;
+    }
+}
+
+// renders thumbnails for documents shown on the home page that don't have one
+// (e.g. after a profile migration) with a few documents being opened in parallel
+void CreateMissingThumbnailsAsync() {
+    auto d = new MissingThumbnailsData();
+    Vec<FileState*> list;
+    gFileHistory.GetFrequencyOrder(list);
+    int n = 0;
+    for (FileState* fs : list) {
+        if (n++ >= kFileHistoryMaxFrequent * 2) {
+            break;
+        }
+        // already loaded means it has an up-to-date thumbnail
+        if (fs->isMissing || fs->thumbnail || !fs->filePath) {
+            continue;
+        }
+        d->filePaths.Append(fs->filePath);
+    }
+    int nWorkers = std::min(kThumbnailWorkersMax, d->filePaths.Size());
+    if (nWorkers == 0) {
+        delete d;
+        return;
+    }
+    logf("CreateMissingThumbnailsAsync: checking %d files with %d threads\n", d->filePaths.Size(), nWorkers);
+    d->nWorkers = nWorkers;
+    for (int i = 0; i < nWorkers; i++) {
+        auto fn = MkFunc0<MissingThumbnailsData>(MissingThumbnailsWorker, d);
+        RunAsync(fn, "MissingThumbnailsThread");
+    }
 }
 
 void RemoveThumbnail(FileState* fs) {
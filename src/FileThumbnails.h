@@ -1,6 +1,8 @@
 /* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+class EngineBase;
+
 // thumbnails are 150px high and have a ratio of sqrt(2) : 1
 constexpr int kThumbnailDx = 212;
 constexpr int kThumbnailDy = 150;
@@ -13,5 +15,9 @@ void RemoveThumbnail(FileState* fs);
 
 TempStr GetThumbnailCacheDirTemp();
 char* GetThumbnailPathTemp(const char* filePath);
+TempStr GetContentBoxesPathTemp(const char* filePath);
 void DeleteThumbnailForFile(const char* path);
 void DeleteThumbnailCacheDirectory();
+
+bool GetThumbnailPageRect(EngineBase* engine, Size size, float* zoomOut, RectF* pageRectOut);
+void CreateMissingThumbnailsAsync();
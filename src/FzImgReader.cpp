@@ -11,9 +11,13 @@ extern "C" {
 }
 
 #include "utils/BaseUtil.h"
+#include "utils/ByteReader.h"
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/FileUtil.h"
+#include "utils/GuessFileType.h"
+#include "utils/TiffReader.h"
+#include "utils/WebpReader.h"
 
 #include "FzImgReader.h"
 
@@ -55,7 +59,8 @@ void fz_drop_context_windows(fz_context* ctx) {
     delete c;
 }
 
-static Gdiplus::Bitmap* ImageFromJpegData(fz_context* ctx, const u8* data, int len) {
+// reduce: decode at 1/2^reduce of the full size (using libjpeg's DCT scaling)
+static Gdiplus::Bitmap* ImageFromJpegData(fz_context* ctx, const u8* data, int len, int reduce = 0) {
     int w = 0, h = 0, xres = 0, yres = 0;
     fz_colorspace* cs = nullptr;
     fz_stream* stm = nullptr;
@@ -68,7 +73,7 @@ static Gdiplus::Bitmap* ImageFromJpegData(fz_context* ctx, const u8* data, int l
     fz_try(ctx) {
         fz_load_jpeg_info(ctx, data, len, &w, &h, &xres, &yres, &cs, &orient);
         stm = fz_open_memory(ctx, data, len);
-        stm = fz_open_dctd(ctx, stm, -1, 1, 0, nullptr);
+        stm = fz_open_dctd(ctx, stm, -1, 1, reduce, nullptr);
     }
     fz_catch(ctx) {
         fz_drop_colorspace(ctx, cs);
@@ -85,6 +90,9 @@ static Gdiplus::Bitmap* ImageFromJpegData(fz_context* ctx, const u8* data, int l
         fz_drop_colorspace(ctx, cs);
         return nullptr;
     }
+    // libjpeg rounds scaled dimensions up
+    w = (w + (1 << reduce) - 1) >> reduce;
+    h = (h + (1 << reduce) - 1) >> reduce;
 
     Gdiplus::Bitmap bmp(w, h, fmt);
     bmp.SetResolution(xres, yres);
@@ -260,6 +268,64 @@ Gdiplus::Bitmap* BitmapFromData(const ByteSlice& bmpData) {
     return FzImageFromData(bmpData);
 }
 
+// JPEGs with an EXIF orientation are left to BitmapFromData() which rotates them
+static Gdiplus::Bitmap* JpegImageFromDataReduced(const ByteSlice& d, int reduce) {
+    const u8* data = (const u8*)d.data();
+    size_t len = d.size();
+    if (len > INT_MAX) {
+        return nullptr;
+    }
+
+    fz_context* ctx = fz_new_context_windows();
+    if (!ctx) {
+        return nullptr;
+    }
+
+    Gdiplus::Bitmap* result = nullptr;
+    int w = 0, h = 0, xres = 0, yres = 0;
+    fz_colorspace* cs = nullptr;
+    uint8_t orient = 0;
+
+    fz_var(cs);
+    fz_var(orient);
+
+    fz_try(ctx) {
+        fz_load_jpeg_info(ctx, data, len, &w, &h, &xres, &yres, &cs, &orient);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        orient = 0xff;
+    }
+    fz_drop_colorspace(ctx, cs);
+    if (orient <= 1) {
+        result = ImageFromJpegData(ctx, data, (int)len, reduce);
+    }
+
+    fz_drop_context_windows(ctx);
+    return result;
+}
+
+// decodes the image at 1/2^reduce of its full size if the format allows
+// doing that cheaply (JPEG, WebP), otherwise at full size
+// reduce is updated to the reduction that was actually applied
+Gdiplus::Bitmap* BitmapFromDataReduced(const ByteSlice& bmpData, int& reduce) {
+    reduce = std::clamp(reduce, 0, kMaxImageReduce);
+    if (reduce > 0) {
+        Gdiplus::Bitmap* bmp = nullptr;
+        Kind kind = GuessFileTypeFromContent(bmpData);
+        if (kind == kindFileJpeg) {
+            bmp = JpegImageFromDataReduced(bmpData, reduce);
+        } else if (kind == kindFileWebp) {
+            bmp = webp::ImageFromData(bmpData, reduce);
+        }
+        if (bmp) {
+            return bmp;
+        }
+    }
+    reduce = 0;
+    return BitmapFromData(bmpData);
+}
+
 RenderedBitmap* LoadRenderedBitmap(const char* path) {
     if (!path) {
         return nullptr;
@@ -286,3 +352,656 @@ RenderedBitmap* LoadRenderedBitmap(const char* path) {
 
     return rendered;
 }
+
+///// decoding parts of very large images /////
+
+ImageRegionReader::~ImageRegionReader() {
+    data.Free();
+}
+
+// extends rc to multiples of 2^reduce pixels and clips it to the image
+static Rect AlignRegion(Rect rc, Size size, int reduce) {
+    int mask = (1 << reduce) - 1;
+    int x1 = rc.x + rc.dx;
+    int y1 = rc.y + rc.dy;
+    rc.x &= ~mask;
+    rc.y &= ~mask;
+    rc.dx = ((x1 + mask) & ~mask) - rc.x;
+    rc.dy = ((y1 + mask) & ~mask) - rc.y;
+    return rc.Intersect(Rect(0, 0, size.dx, size.dy));
+}
+
+// the size of rc (aligned by AlignRegion()) reduced by 1/2^reduce
+static Size ReducedRegionSize(Rect rc, int reduce) {
+    int mask = (1 << reduce) - 1;
+    return Size((rc.dx + mask) >> reduce, (rc.dy + mask) >> reduce);
+}
+
+// averages the pixels of the decoded part of an image (rc) into a 24bpp bitmap
+// reduced by 1/2^reduce. Rows (or parts of rows) can be added in any order
+// within a band of at most bandDy rows, FlushRowsAbove() writes out the
+// pixels once all of their rows have been added
+struct RegionAccumulator {
+    Rect rc;
+    int reduce = 0;
+    Size out;
+    Gdiplus::BitmapData* bmpData = nullptr;
+    // RGB sums of the pixels of output rows [sumsY, sumsY + sumsRows)
+    u16* sums = nullptr;
+    int sumsY = 0;
+    int sumsRows = 0;
+
+    RegionAccumulator(Rect rc, int reduce, int bandDy, Gdiplus::BitmapData* bmpData);
+    ~RegionAccumulator();
+    void AddRow(int y, int x, int dx, const u8* px, int nComps);
+    void FlushRowsAbove(int y);
+};
+
+RegionAccumulator::RegionAccumulator(Rect rc, int reduce, int bandDy, Gdiplus::BitmapData* bmpData) {
+    this->rc = rc;
+    this->reduce = reduce;
+    this->bmpData = bmpData;
+    out = ReducedRegionSize(rc, reduce);
+    // a band can end in the middle of an output row
+    sumsRows = std::min(((bandDy + (1 << reduce) - 1) >> reduce) + 1, out.dy);
+    sums = AllocArray<u16>((size_t)sumsRows * out.dx * 3);
+}
+
+RegionAccumulator::~RegionAccumulator() {
+    free(sums);
+}
+
+// px has nComps (1 for gray, 3 for RGB) samples for the pixels x to x + dx of row y
+void RegionAccumulator::AddRow(int y, int x, int dx, const u8* px, int nComps) {
+    if (y < rc.y || y >= rc.y + rc.dy) {
+        return;
+    }
+    int oy = ((y - rc.y) >> reduce) - sumsY;
+    if (oy < 0 || oy >= sumsRows) {
+        ReportIf(true);
+        return;
+    }
+    int x0 = std::max(x, rc.x);
+    int x1 = std::min(x + dx, rc.x + rc.dx);
+    u16* row = sums + (size_t)oy * out.dx * 3;
+    for (int sx = x0; sx < x1; sx++) {
+        const u8* s = px + (size_t)(sx - x) * nComps;
+        u16* d = row + ((sx - rc.x) >> reduce) * 3;
+        if (3 == nComps) {
+            d[0] += s[0];
+            d[1] += s[1];
+            d[2] += s[2];
+        } else {
+            d[0] += s[0];
+            d[1] += s[0];
+            d[2] += s[0];
+        }
+    }
+}
+
+// writes out the output rows whose pixels lie entirely above row y
+void RegionAccumulator::FlushRowsAbove(int y) {
+    size_t rowSize = (size_t)out.dx * 3;
+    int nDone = 0;
+    for (; nDone < sumsRows && sumsY + nDone < out.dy; nDone++) {
+        int oy = sumsY + nDone;
+        int y0 = rc.y + (oy << reduce);
+        int y1 = std::min(y0 + (1 << reduce), rc.y + rc.dy);
+        if (y1 > y) {
+            break;
+        }
+        const u16* s = sums + nDone * rowSize;
+        u8* d = (u8*)bmpData->Scan0 + (size_t)oy * bmpData->Stride;
+        for (int ox = 0; ox < out.dx; ox++) {
+            int x0 = rc.x + (ox << reduce);
+            int x1 = std::min(x0 + (1 << reduce), rc.x + rc.dx);
+            int n = (x1 - x0) * (y1 - y0);
+            // RGB -> BGR
+            d[0] = (u8)(s[2] / n);
+            d[1] = (u8)(s[1] / n);
+            d[2] = (u8)(s[0] / n);
+            s += 3;
+            d += 3;
+        }
+    }
+    if (nDone == 0) {
+        return;
+    }
+    int nLeft = sumsRows - nDone;
+    memmove(sums, sums + nDone * rowSize, nLeft * rowSize * sizeof(u16));
+    ZeroMemory(sums + nLeft * rowSize, nDone * rowSize * sizeof(u16));
+    sumsY += nDone;
+}
+
+static Gdiplus::Bitmap* NewRegionBitmap(Size size, Gdiplus::BitmapData* bmpData, float dpi) {
+    auto bmp = new Gdiplus::Bitmap(size.dx, size.dy, PixelFormat24bppRGB);
+    Gdiplus::Rect bmpRect(0, 0, size.dx, size.dy);
+    if (bmp->GetLastStatus() != Gdiplus::Ok ||
+        bmp->LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, PixelFormat24bppRGB, bmpData) != Gdiplus::Ok) {
+        delete bmp;
+        return nullptr;
+    }
+    bmp->SetResolution(dpi, dpi);
+    return bmp;
+}
+
+// TIFF images stored in many strips or tiles, only the strips/tiles
+// overlapping the requested part of the image are decoded
+struct TiffRegionReader : ImageRegionReader {
+    int compression = 1;
+    int photometric = 1;
+    int bitsPerSample = 1;
+    int samplesPerPixel = 1;
+    int predictor = 1;
+    int g3opts = 0;
+    bool isTiled = false;
+    // size is the size after applying orientation, stored is the size of the strips/tiles
+    Size stored;
+    int orientation = 1;
+    // the size of a tile or the image width and rows per strip
+    Size band;
+    Vec<u32> offsets;
+    Vec<u32> byteCounts;
+    ByteSlice jpegTables;
+
+    Gdiplus::Bitmap* DecodeRegion(Rect& rc, int reduce) override;
+    Gdiplus::Bitmap* DecodeStoredRegion(Rect& rc, int reduce);
+    bool DecodeBand(fz_context* ctx, int bandNo, Point pos, RegionAccumulator& acc, u8* line, u8* px);
+    fz_stream* OpenBandStream(fz_context* ctx, const u8* d, size_t len, Size bandSize, fz_stream* encstm,
+                              fz_stream** tables);
+};
+
+static ImageRegionReader* NewTiffRegionReader(const ByteSlice& data) {
+    TiffInfo info;
+    // multi-page TIFFs are left to GDI+
+    if (!TiffParse(data, info) || info.isMultiPage) {
+        return nullptr;
+    }
+
+    Size& sz = info.size;
+    Size& band = info.band;
+    int spp = info.samplesPerPixel;
+    int bps = info.bitsPerSample;
+    int comp = info.compression;
+    int photo = info.photometric;
+    bool isFax = comp == 2 || comp == 3 || comp == 4;
+    bool ok = info.fillOrder == 1 && info.planarConfig == 1;
+    ok &= isFax || comp == 1 || comp == 5 || comp == 7 || comp == 8 || comp == 32946 || comp == 32773;
+    ok &= (bps == 1 && spp == 1 && (photo == 0 || photo == 1) && comp != 7) ||
+          (bps == 8 && !isFax && (photo == 0 || photo == 1)) || (bps == 8 && !isFax && photo == 2 && spp >= 3) ||
+          (bps == 8 && comp == 7 && photo == 6 && spp == 3);
+    ok &= info.predictor == 1 || (info.predictor == 2 && bps == 8 && (comp == 5 || comp == 8 || comp == 32946));
+    ok &= band.dx > 0 && band.dy > 0;
+    if (ok) {
+        size_t nBands = (size_t)((sz.dx + band.dx - 1) / band.dx) * (size_t)((sz.dy + band.dy - 1) / band.dy);
+        // a single strip would have to be decoded for every part of the image
+        ok = nBands > 1 && info.offsets.size() == nBands && info.byteCounts.size() == nBands;
+    }
+    if (!ok) {
+        return nullptr;
+    }
+
+    auto tiff = new TiffRegionReader();
+    tiff->stored = sz;
+    tiff->orientation = info.orientation;
+    tiff->size = TiffOrientedSize(sz, info.orientation);
+    if (info.dpi > 0) {
+        tiff->dpi = info.dpi;
+    }
+    tiff->compression = comp;
+    tiff->photometric = photo;
+    tiff->bitsPerSample = bps;
+    tiff->samplesPerPixel = spp;
+    tiff->predictor = info.predictor;
+    tiff->g3opts = info.g3opts;
+    tiff->isTiled = info.isTiled;
+    tiff->band = band;
+    tiff->offsets = info.offsets;
+    tiff->byteCounts = info.byteCounts;
+    tiff->jpegTables = info.jpegTables;
+    return tiff;
+}
+
+fz_stream* TiffRegionReader::OpenBandStream(fz_context* ctx, const u8* d, size_t len, Size bandSize,
+                                            fz_stream* encstm, fz_stream** tables) {
+    switch (compression) {
+        case 1:
+            return fz_keep_stream(ctx, encstm);
+        case 2:
+        case 3:
+        case 4: {
+            int k = compression == 4 ? -1 : compression == 2 ? 0 : (g3opts & 1);
+            return fz_open_faxd(ctx, encstm, k, 0, compression == 2, bandSize.dx, bandSize.dy, 0, 1);
+        }
+        case 5: {
+            bool oldTiff = len >= 2 && d[0] == 0 && (d[1] & 1);
+            return fz_open_lzwd(ctx, encstm, oldTiff ? 0 : 1, 9, oldTiff ? 1 : 0, oldTiff);
+        }
+        case 7:
+            if (jpegTables.size() > 0) {
+                *tables = fz_open_memory(ctx, jpegTables.data(), jpegTables.size());
+            }
+            return fz_open_dctd(ctx, encstm, photometric == 2 ? 0 : -1, 1, 0, *tables);
+        case 8:
+        case 32946:
+            return fz_open_flated(ctx, encstm, 15);
+        case 32773:
+            return fz_open_rld(ctx, encstm);
+    }
+    fz_throw(ctx, FZ_ERROR_FORMAT, "unsupported TIFF compression: %d", compression);
+}
+
+// decodes strip or tile bandNo, whose top-left pixel is at pos
+bool TiffRegionReader::DecodeBand(fz_context* ctx, int bandNo, Point pos, RegionAccumulator& acc, u8* line,
+                                  u8* px) {
+    size_t off = offsets[bandNo];
+    size_t len = byteCounts[bandNo];
+    if (off > data.size() || len > data.size() - off) {
+        return false;
+    }
+    const u8* d = data.data() + off;
+    Size bandSize = band;
+    if (!isTiled) {
+        bandSize.dy = std::min(band.dy, stored.dy - pos.y);
+    }
+    int nRows = std::min(pos.y + bandSize.dy, acc.rc.y + acc.rc.dy) - pos.y;
+    size_t rowBytes = ((size_t)bandSize.dx * samplesPerPixel * bitsPerSample + 7) / 8;
+    int spp = samplesPerPixel;
+    // YCbCr is converted to RGB by the JPEG decoder
+    int nComps = photometric >= 2 ? 3 : 1;
+
+    fz_stream* encstm = nullptr;
+    fz_stream* tables = nullptr;
+    fz_stream* stm = nullptr;
+    fz_stream* pred = nullptr;
+    bool ok = true;
+
+    fz_var(encstm);
+    fz_var(tables);
+    fz_var(stm);
+    fz_var(pred);
+
+    fz_try(ctx) {
+        encstm = fz_open_memory(ctx, d, len);
+        stm = OpenBandStream(ctx, d, len, bandSize, encstm, &tables);
+        if (predictor == 2) {
+            pred = fz_open_predict(ctx, stm, 2, bandSize.dx, samplesPerPixel, bitsPerSample);
+        }
+        for (int row = 0; row < nRows; row++) {
+            size_t n = fz_read(ctx, pred ? pred : stm, line, rowBytes);
+            if (n < rowBytes) {
+                // treat missing data as white (like mupdf, just without a warning)
+                memset(line + n, photometric == 0 ? 0 : 0xff, rowBytes - n);
+            }
+            int y = pos.y + row;
+            if (y < acc.rc.y) {
+                continue;
+            }
+            for (int x = 0; x < bandSize.dx; x++) {
+                u8* p = px + x * nComps;
+                if (bitsPerSample == 1) {
+                    p[0] = (line[x >> 3] >> (7 - (x & 7))) & 1 ? 0xff : 0;
+                } else {
+                    memcpy(p, line + (size_t)x * spp, nComps);
+                }
+                if (photometric == 0) {
+                    p[0] = 255 - p[0];
+                }
+            }
+            acc.AddRow(y, pos.x, bandSize.dx, px, nComps);
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_stream(ctx, pred);
+        fz_drop_stream(ctx, stm);
+        fz_drop_stream(ctx, tables);
+        fz_drop_stream(ctx, encstm);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        ok = false;
+    }
+    return ok;
+}
+
+// same order as TIFF orientations 2 to 8 (like MaybeFlipBitmap() in GdiPlusUtil.cpp)
+static Gdiplus::RotateFlipType gTiffRotateFlip[] = {
+    Gdiplus::RotateNoneFlipX,  Gdiplus::Rotate180FlipNone, Gdiplus::Rotate180FlipX,    Gdiplus::Rotate90FlipX,
+    Gdiplus::Rotate90FlipNone, Gdiplus::Rotate270FlipX,    Gdiplus::Rotate270FlipNone,
+};
+
+// rc is in the coordinates of the image after applying orientation
+Gdiplus::Bitmap* TiffRegionReader::DecodeRegion(Rect& rc, int reduce) {
+    if (orientation == 1) {
+        return DecodeStoredRegion(rc, reduce);
+    }
+    Rect storedRc = TiffOrientRect(rc, size, TiffInverseOrientation(orientation));
+    Gdiplus::Bitmap* bmp = DecodeStoredRegion(storedRc, reduce);
+    if (!bmp) {
+        return nullptr;
+    }
+    bmp->RotateFlip(gTiffRotateFlip[orientation - 2]);
+    rc = TiffOrientRect(storedRc, stored, orientation);
+    return bmp;
+}
+
+Gdiplus::Bitmap* TiffRegionReader::DecodeStoredRegion(Rect& rc, int reduce) {
+    reduce = std::clamp(reduce, 0, kMaxImageReduce);
+    rc = AlignRegion(rc, stored, reduce);
+    if (rc.IsEmpty()) {
+        return nullptr;
+    }
+    fz_context* ctx = fz_new_context_windows();
+    if (!ctx) {
+        return nullptr;
+    }
+    Gdiplus::BitmapData bmpData;
+    Gdiplus::Bitmap* bmp = NewRegionBitmap(ReducedRegionSize(rc, reduce), &bmpData, dpi / (1 << reduce));
+    if (!bmp) {
+        fz_drop_context_windows(ctx);
+        return nullptr;
+    }
+
+    bool ok = true;
+    {
+        RegionAccumulator acc(rc, reduce, band.dy, &bmpData);
+        size_t rowBytes = ((size_t)band.dx * samplesPerPixel * bitsPerSample + 7) / 8;
+        u8* line = AllocArray<u8>(rowBytes);
+        u8* px = AllocArray<u8>((size_t)band.dx * 3);
+        int bandsPerRow = (stored.dx + band.dx - 1) / band.dx;
+        int by0 = rc.y / band.dy;
+        int by1 = (rc.y + rc.dy - 1) / band.dy;
+        int bx0 = rc.x / band.dx;
+        int bx1 = (rc.x + rc.dx - 1) / band.dx;
+        for (int by = by0; ok && by <= by1; by++) {
+            for (int bx = bx0; ok && bx <= bx1; bx++) {
+                Point pos(bx * band.dx, by * band.dy);
+                ok = DecodeBand(ctx, by * bandsPerRow + bx, pos, acc, line, px);
+            }
+            acc.FlushRowsAbove(std::min((by + 1) * band.dy, stored.dy));
+        }
+        free(line);
+        free(px);
+    }
+    bmp->UnlockBits(&bmpData);
+    fz_drop_context_windows(ctx);
+    if (!ok) {
+        delete bmp;
+        return nullptr;
+    }
+    return bmp;
+}
+
+// baseline JPEGs with restart markers at the start of rows of MCUs (minimum coded units):
+// the rows overlapping the requested part of the image are copied into a smaller JPEG
+// which is then decoded with libjpeg's DCT scaling (l2factor)
+struct JpegRegionReader : ImageRegionReader {
+    int nComps = 3;
+    // offset of the image height in the SOF segment
+    size_t sofHeightOff = 0;
+    // the entropy-coded data of the scan
+    size_t scanStart = 0;
+    size_t scanEnd = 0;
+    // a band is the smallest number of MCU rows starting after a restart marker
+    int bandDy = 0;
+    int intervalsPerBand = 0;
+    // offset of the entropy-coded data of each band
+    Vec<size_t> bandStarts;
+
+    Gdiplus::Bitmap* DecodeRegion(Rect& rc, int reduce) override;
+    ByteSlice BandsToJpeg(int b0, int b1);
+};
+
+static ImageRegionReader* NewJpegRegionReader(const ByteSlice& data) {
+    ByteReader r(data);
+    auto jpeg = new JpegRegionReader();
+    int restartInterval = 0;
+    int nScanComps = 0;
+    int hMax = 1;
+    int vMax = 1;
+    size_t idx = 2;
+    while (idx + 4 <= r.len && jpeg->scanStart == 0) {
+        if (r.Byte(idx) != 0xFF) {
+            break;
+        }
+        u8 marker = r.Byte(idx + 1);
+        if (marker == 0xFF) {
+            idx++;
+            continue;
+        }
+        size_t segLen = r.WordBE(idx + 2);
+        if (marker == 0xC0 || marker == 0xC1) {
+            jpeg->sofHeightOff = idx + 5;
+            jpeg->size.dy = r.WordBE(idx + 5);
+            jpeg->size.dx = r.WordBE(idx + 7);
+            jpeg->nComps = r.Byte(idx + 9);
+            for (int i = 0; i < jpeg->nComps; i++) {
+                u8 sampling = r.Byte(idx + 11 + i * 3);
+                hMax = std::max(hMax, sampling >> 4);
+                vMax = std::max(vMax, sampling & 0xF);
+            }
+        } else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // progressive, lossless and arithmetic coded JPEGs
+            break;
+        } else if (marker == 0xDD) {
+            restartInterval = r.WordBE(idx + 4);
+        } else if (marker == 0xDA) {
+            nScanComps = r.Byte(idx + 4);
+            jpeg->scanStart = idx + 2 + segLen;
+        }
+        idx += 2 + segLen;
+    }
+    Size& sz = jpeg->size;
+    // non-interleaved scans (and a single scan with all components) are required
+    bool ok = jpeg->scanStart > 0 && jpeg->sofHeightOff > 0 && restartInterval > 0 && sz.dx > 0 && sz.dy > 0;
+    ok &= nScanComps == jpeg->nComps && (jpeg->nComps == 1 || jpeg->nComps == 3);
+    if (!ok) {
+        delete jpeg;
+        return nullptr;
+    }
+
+    // a single component scan isn't interleaved and has 8x8 MCUs
+    int mcuDx = jpeg->nComps == 1 ? 8 : 8 * hMax;
+    int mcuDy = jpeg->nComps == 1 ? 8 : 8 * vMax;
+    int mcusPerRow = (sz.dx + mcuDx - 1) / mcuDx;
+    int mcuRows = (sz.dy + mcuDy - 1) / mcuDy;
+    int rowsPerBand = 0;
+    if (mcusPerRow % restartInterval == 0) {
+        rowsPerBand = 1;
+        jpeg->intervalsPerBand = mcusPerRow / restartInterval;
+    } else if (restartInterval % mcusPerRow == 0) {
+        rowsPerBand = restartInterval / mcusPerRow;
+        jpeg->intervalsPerBand = 1;
+    }
+    int nBands = rowsPerBand > 0 ? (mcuRows + rowsPerBand - 1) / rowsPerBand : 0;
+    if (nBands < 2) {
+        delete jpeg;
+        return nullptr;
+    }
+    jpeg->bandDy = rowsPerBand * mcuDy;
+
+    // find the restart markers at which bands start
+    const u8* d = r.d;
+    size_t len = r.len;
+    jpeg->bandStarts.Append(jpeg->scanStart);
+    jpeg->scanEnd = len;
+    int nIntervals = 0;
+    for (size_t i = jpeg->scanStart; i + 1 < len;) {
+        const u8* p = (const u8*)memchr(d + i, 0xFF, len - i - 1);
+        if (!p) {
+            break;
+        }
+        i = p - d;
+        u8 marker = d[i + 1];
+        if (marker == 0) {
+            // stuffed 0xFF byte
+            i += 2;
+        } else if (marker == 0xFF) {
+            i++;
+        } else if (marker >= 0xD0 && marker <= 0xD7) {
+            nIntervals++;
+            if (nIntervals % jpeg->intervalsPerBand == 0) {
+                jpeg->bandStarts.Append(i + 2);
+            }
+            i += 2;
+        } else {
+            jpeg->scanEnd = i;
+            break;
+        }
+    }
+    // some encoders put a restart marker before EOI
+    if (jpeg->bandStarts.Size() == nBands + 1 && jpeg->bandStarts.Last() == jpeg->scanEnd) {
+        jpeg->bandStarts.Pop();
+    }
+    if (jpeg->bandStarts.Size() != nBands) {
+        delete jpeg;
+        return nullptr;
+    }
+    return jpeg;
+}
+
+// creates a JPEG image of bands b0 to b1 (inclusive) with renumbered restart markers
+ByteSlice JpegRegionReader::BandsToJpeg(int b0, int b1) {
+    const u8* d = data.data();
+    size_t start = bandStarts[b0];
+    size_t end = b1 + 1 < bandStarts.Size() ? bandStarts[b1 + 1] - 2 : scanEnd;
+    int dy = std::min((b1 + 1) * bandDy, size.dy) - b0 * bandDy;
+
+    str::Str jpeg;
+    jpeg.Append((const char*)d, sofHeightOff);
+    jpeg.AppendChar((char)(dy >> 8));
+    jpeg.AppendChar((char)(dy & 0xFF));
+    jpeg.Append((const char*)d + sofHeightOff + 2, scanStart - sofHeightOff - 2);
+    size_t scanOff = jpeg.size();
+    jpeg.Append((const char*)d + start, end - start);
+    jpeg.Append("\xFF\xD9", 2);
+
+    // the decoder expects the first restart marker to be RST0
+    u8* s = (u8*)jpeg.Get();
+    size_t len = jpeg.size() - 2;
+    int n = 0;
+    for (size_t i = scanOff; i + 1 < len; i++) {
+        if (s[i] != 0xFF) {
+            continue;
+        }
+        if (s[i + 1] >= 0xD0 && s[i + 1] <= 0xD7) {
+            s[i + 1] = (u8)(0xD0 + (n++ & 7));
+            i++;
+        } else if (s[i + 1] == 0) {
+            i++;
+        }
+    }
+    return jpeg.StealAsByteSlice();
+}
+
+Gdiplus::Bitmap* JpegRegionReader::DecodeRegion(Rect& rc, int reduce) {
+    reduce = std::clamp(reduce, 0, kMaxImageReduce);
+    rc = AlignRegion(rc, size, reduce);
+    if (rc.IsEmpty()) {
+        return nullptr;
+    }
+    int b0 = rc.y / bandDy;
+    int b1 = (rc.y + rc.dy - 1) / bandDy;
+    ByteSlice jpeg = BandsToJpeg(b0, b1);
+    fz_context* ctx = fz_new_context_windows();
+    if (!ctx) {
+        jpeg.Free();
+        return nullptr;
+    }
+
+    // libjpeg already reduces the image (rounding its size up) so the
+    // pixels of the reduced image are only copied
+    Rect reducedRc(rc.x >> reduce, rc.y >> reduce, 0, 0);
+    Size reducedSize = ReducedRegionSize(rc, reduce);
+    reducedRc.dx = reducedSize.dx;
+    reducedRc.dy = reducedSize.dy;
+    int dx = (size.dx + (1 << reduce) - 1) >> reduce;
+    int y0 = (b0 * bandDy) >> reduce;
+
+    Gdiplus::BitmapData bmpData;
+    Gdiplus::Bitmap* bmp = NewRegionBitmap(reducedSize, &bmpData, dpi / (1 << reduce));
+    if (!bmp) {
+        jpeg.Free();
+        fz_drop_context_windows(ctx);
+        return nullptr;
+    }
+
+    fz_stream* memstm = nullptr;
+    fz_stream* stm = nullptr;
+    bool ok = true;
+    RegionAccumulator acc(reducedRc, 0, 1, &bmpData);
+    size_t rowBytes = (size_t)dx * nComps;
+    u8* line = AllocArray<u8>(rowBytes);
+
+    fz_var(memstm);
+    fz_var(stm);
+
+    fz_try(ctx) {
+        memstm = fz_open_memory(ctx, jpeg.data(), jpeg.size());
+        stm = fz_open_dctd(ctx, memstm, -1, 1, reduce, nullptr);
+        for (int y = y0; y < reducedRc.y + reducedRc.dy; y++) {
+            size_t n = fz_read(ctx, stm, line, rowBytes);
+            if (n < rowBytes) {
+                fz_throw(ctx, FZ_ERROR_GENERIC, "insufficient data for image");
+            }
+            acc.AddRow(y, 0, dx, line, nComps);
+            acc.FlushRowsAbove(y + 1);
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_stream(ctx, stm);
+        fz_drop_stream(ctx, memstm);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        ok = false;
+    }
+
+    free(line);
+    jpeg.Free();
+    bmp->UnlockBits(&bmpData);
+    fz_drop_context_windows(ctx);
+    if (!ok) {
+        delete bmp;
+        return nullptr;
+    }
+    return bmp;
+}
+
+ImageRegionReader* NewImageRegionReader(const ByteSlice& data) {
+    Kind kind = GuessFileTypeFromContent(data);
+    ImageRegionReader* res = nullptr;
+    if (kind == kindFileTiff) {
+        res = NewTiffRegionReader(data);
+    } else if (kind == kindFileJpeg && data.size() <= INT_MAX) {
+        // JPEGs with an EXIF orientation are left to BitmapFromData() which rotates them
+        fz_context* ctx = fz_new_context_windows();
+        if (ctx) {
+            int w = 0, h = 0, xres = 0, yres = 0;
+            fz_colorspace* cs = nullptr;
+            uint8_t orient = 0;
+            fz_var(cs);
+            fz_var(orient);
+            fz_try(ctx) {
+                fz_load_jpeg_info(ctx, data.data(), data.size(), &w, &h, &xres, &yres, &cs, &orient);
+            }
+            fz_catch(ctx) {
+                fz_report_error(ctx);
+                orient = 0xff;
+            }
+            int n = cs ? cs->n : 0;
+            fz_drop_colorspace(ctx, cs);
+            fz_drop_context_windows(ctx);
+            if (orient <= 1 && (n == 1 || n == 3)) {
+                res = NewJpegRegionReader(data);
+            }
+            if (res && xres > 0) {
+                res->dpi = (float)xres;
+            }
+        }
+    }
+    if (res) {
+        res->data = data;
+    }
+    return res;
+}
@@ -11,4 +11,25 @@ void fz_drop_context_windows(fz_context* ctx);
 Gdiplus::Bitmap* FzImageFromData(const ByteSlice&);
 
 Gdiplus::Bitmap* BitmapFromData(const ByteSlice&);
+// images can be decoded at 1/2, 1/4 or 1/8 of their size
+constexpr int kMaxImageReduce = 3;
+Gdiplus::Bitmap* BitmapFromDataReduced(const ByteSlice&, int& reduce);
 RenderedBitmap* LoadRenderedBitmap(const char* path);
+
+// decodes parts of very large images without decoding all of the image
+// (TIFFs stored in strips or tiles, JPEGs with restart markers)
+struct ImageRegionReader {
+    ByteSlice data;
+    Size size;
+    float dpi = 96.f;
+
+    virtual ~ImageRegionReader();
+    // decodes the part rc of the image at 1/2^reduce of its size
+    // rc is updated to the part that was decoded (aligned to 2^reduce pixels)
+    // can be called from multiple threads at once
+    virtual Gdiplus::Bitmap* DecodeRegion(Rect& rc, int reduce) = 0;
+};
+
+// returns nullptr if the image can't be decoded in parts,
+// otherwise the result takes ownership of data
+ImageRegionReader* NewImageRegionReader(const ByteSlice& data);
@@ -64,6 +64,82 @@ Control objects further to make allocating hundreds of them cheaper or introduce
 other base element(s) with less functionality and less overhead).
 */
 
+// widths of the words measured so far, keyed by font and the word's UTF-8 bytes.
+// The words point either into the html or to text allocated from textAllocator,
+// both of which outlive the formatter, so they don't have to be copied
+struct TextWidthCache {
+    struct Entry {
+        mui::CachedFont* font;
+        const char* s;
+        size_t len;
+        RectF bbox;
+    };
+    // open addressing with linear probing, nEntries is a power of 2
+    Entry* entries = nullptr;
+    size_t nEntries = 0;
+    size_t nUsed = 0;
+
+    TextWidthCache();
+    ~TextWidthCache();
+    bool Get(mui::CachedFont* font, const char* s, size_t len, RectF* bboxOut);
+    void Add(mui::CachedFont* font, const char* s, size_t len, RectF bbox);
+    Entry* Find(mui::CachedFont* font, const char* s, size_t len);
+};
+
+TextWidthCache::TextWidthCache() {
+    nEntries = 4096;
+    entries = AllocArray<Entry>(nEntries);
+}
+
+TextWidthCache::~TextWidthCache() {
+    free(entries);
+}
+
+// returns either the entry for the key or the empty entry where it belongs
+TextWidthCache::Entry* TextWidthCache::Find(mui::CachedFont* font, const char* s, size_t len) {
+    u32 hash = MurmurHash2(s, len) ^ (u32)((uintptr_t)font * 2654435761u);
+    size_t mask = nEntries - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Entry* e = &entries[i];
+        if (!e->font) {
+            return e;
+        }
+        if (e->font == font && e->len == len && memeq(e->s, s, len)) {
+            return e;
+        }
+    }
+}
+
+bool TextWidthCache::Get(mui::CachedFont* font, const char* s, size_t len, RectF* bboxOut) {
+    Entry* e = Find(font, s, len);
+    if (!e->font) {
+        return false;
+    }
+    *bboxOut = e->bbox;
+    return true;
+}
+
+void TextWidthCache::Add(mui::CachedFont* font, const char* s, size_t len, RectF bbox) {
+    // keep the table at most half full
+    if ((nUsed + 1) * 2 > nEntries) {
+        Entry* old = entries;
+        size_t nOld = nEntries;
+        nEntries *= 2;
+        entries = AllocArray<Entry>(nEntries);
+        for (size_t i = 0; i < nOld; i++) {
+            if (old[i].font) {
+                *Find(old[i].font, old[i].s, old[i].len) = old[i];
+            }
+        }
+        free(old);
+    }
+    Entry* e = Find(font, s, len);
+    if (!e->font) {
+        nUsed++;
+    }
+    *e = {font, s, len, bbox};
+}
+
 bool ValidReparseIdx(ptrdiff_t idx, HtmlPullParser* parser) {
     return !((idx < 0) || (idx > (int)parser->Len()));
 }
@@ -167,6 +243,7 @@ HtmlFormatter::HtmlFormatter(HtmlFormatterArgs* args)
 
     gfx = mui::AllocGraphicsForMeasureText();
     textMeasure = CreateTextRender(args->textRenderMethod, gfx, 10, 10);
+    widthCache = new TextWidthCache();
     defaultFontName.SetCopy(args->GetFontName());
     defaultFontSize = args->fontSize;
 
@@ -194,6 +271,7 @@ HtmlFormatter::~HtmlFormatter() {
     DeleteVecMembers(pagesToSend);
     delete currPage;
     delete textMeasure;
+    delete widthCache;
     mui::FreeGraphicsForMeasureText(gfx);
     delete htmlParser;
 }
@@ -717,6 +795,15 @@ void HtmlFormatter::EmitTextRun(const char* s, const char* end) {
             currReparseIdx = s - htmlParser->Start();
         }
 
+        mui::CachedFont* font = CurrFont();
+        RectF bbox;
+        bool isCached = widthCache->Get(font, s, end - s, &bbox);
+        if (isCached && bbox.dx <= pageDx - currX) {
+            AppendInstr(DrawInstr::Str(s, end - s, bbox, dirRtl));
+            currX += bbox.dx;
+            break;
+        }
+
         WCHAR* buf = ToWStrTemp(s, end - s);
         size_t strLen = str::Len(buf);
         // soft hyphens should not be displayed
@@ -724,8 +811,11 @@ void HtmlFormatter::EmitTextRun(const char* s, const char* end) {
         if (0 == strLen) {
             break;
         }
-        textMeasure->SetFont(CurrFont());
-        RectF bbox = textMeasure->Measure(buf, strLen);
+        textMeasure->SetFont(font);
+        if (!isCached) {
+            bbox = textMeasure->Measure(buf, strLen);
+            widthCache->Add(font, s, end - s, bbox);
+        }
         if (bbox.dx <= pageDx - currX) {
             AppendInstr(DrawInstr::Str(s, end - s, bbox, dirRtl));
             currX += bbox.dx;
@@ -969,45 +1059,215 @@ void HtmlFormatter::HandleTagPre(HtmlToken* t) {
     }
 }
 
-StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen) {
-    u32 classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
-    for (size_t i = 0; i < styleRules.size(); i++) {
-        StyleRule& rule = styleRules.at(i);
-        if (tag == rule.tag && classHash == rule.classHash) {
+static u32 StyleRuleKeyHash(HtmlTag tag, u32 classHash, u32 idHash) {
+    u32 h = (u32)tag * 2654435761u;
+    h ^= classHash + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= idHash + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h;
+}
+
+// parse "#id", "*#id" and "el#id" which CssPullParser doesn't handle
+static bool ParseIdSelector(const CssSelector* sel, HtmlTag* tag, u32* idHash) {
+    const char* hash = (const char*)memchr(sel->s, '#', sel->sLen);
+    const char* end = sel->s + sel->sLen;
+    if (!hash || hash + 1 == end) {
+        return false;
+    }
+    for (const char* c = hash + 1; c < end; c++) {
+        if (!isalnum((u8)*c) && *c != '-' && *c != '_') {
+            return false;
+        }
+    }
+    if (hash == sel->s || hash == sel->s + 1 && *sel->s == '*') {
+        *tag = Tag_Any;
+    } else {
+        *tag = FindHtmlTagFast(sel->s, hash - sel->s);
+        if (Tag_NotFound == *tag) {
+            return false;
+        }
+    }
+    *idHash = MurmurHash2(hash + 1, end - hash - 1);
+    return true;
+}
+
+void StyleSheet::Reset() {
+    rules.Reset();
+    index.Reset();
+    lastOrder = 0;
+    hasIdRules = false;
+    ClearCache();
+}
+
+void StyleSheet::ClearCache() {
+    for (CachedStyle& c : cache) {
+        c.valid = false;
+    }
+}
+
+void StyleSheet::InsertIntoIndex(int ruleIdx) {
+    StyleRule& rule = rules.at(ruleIdx);
+    u32 mask = (u32)index.size() - 1;
+    u32 i = StyleRuleKeyHash(rule.tag, rule.classHash, rule.idHash) & mask;
+    while (index.at((size_t)i) != 0) {
+        i = (i + 1) & mask;
+    }
+    index.at((size_t)i) = ruleIdx + 1;
+}
+
+void StyleSheet::Add(const StyleRule& rule) {
+    rules.Append(rule);
+    if (rules.size() * 2 <= index.size()) {
+        InsertIntoIndex((int)rules.size() - 1);
+        return;
+    }
+    // keep the load factor below 1/2
+    index.SetSize(std::max(index.size() * 2, (size_t)64));
+    for (int i = 0; i < (int)rules.size(); i++) {
+        InsertIntoIndex(i);
+    }
+}
+
+StyleRule* StyleSheet::Find(HtmlTag tag, u32 classHash, u32 idHash) {
+    if (index.size() == 0) {
+        return nullptr;
+    }
+    u32 mask = (u32)index.size() - 1;
+    for (u32 i = StyleRuleKeyHash(tag, classHash, idHash) & mask;; i = (i + 1) & mask) {
+        int ruleIdx = index.at((size_t)i);
+        if (0 == ruleIdx) {
+            return nullptr;
+        }
+        StyleRule& rule = rules.at(ruleIdx - 1);
+        if (rule.tag == tag && rule.classHash == classHash && rule.idHash == idHash) {
             return &rule;
         }
     }
-    return nullptr;
 }
 
-StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
+void StyleSheet::Parse(const char* data, size_t len) {
+    CssPullParser parser(data, len);
+    while (parser.NextRule()) {
+        StyleRule rule = StyleRule::Parse(&parser);
+        rule.order = ++lastOrder;
+        const CssSelector* sel;
+        while ((sel = parser.NextSelector()) != nullptr) {
+            HtmlTag tag = sel->tag;
+            u32 classHash = sel->clazz ? MurmurHash2(sel->clazz, sel->clazzLen) : 0;
+            u32 idHash = 0;
+            if (Tag_NotFound == tag && !ParseIdSelector(sel, &tag, &idHash)) {
+                continue;
+            }
+            StyleRule* prevRule = Find(tag, classHash, idHash);
+            if (prevRule) {
+                prevRule->Merge(rule);
+                prevRule->order = rule.order;
+            } else {
+                rule.tag = tag;
+                rule.classHash = classHash;
+                rule.idHash = idHash;
+                Add(rule);
+            }
+            hasIdRules |= idHash != 0;
+        }
+    }
+    ClearCache();
+}
+
+// merges rules of the same specificity in the order they were declared
+static void MergeInOrder(StyleRule& dst, StyleRule** matches, int n) {
+    for (int i = 1; i < n; i++) {
+        for (int j = i; j > 0 && matches[j - 1]->order > matches[j]->order; j--) {
+            std::swap(matches[j - 1], matches[j]);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        dst.Merge(*matches[i]);
+    }
+}
+
+StyleRule StyleSheet::Compute(HtmlToken* t) {
+    AttrInfo* classAttr = t->GetAttrByName("class");
+    u32 classAttrHash = classAttr ? MurmurHash2(classAttr->val, classAttr->valLen) : 0;
+    u32 idHash = 0;
+    if (hasIdRules) {
+        AttrInfo* idAttr = t->GetAttrByName("id");
+        idHash = idAttr ? MurmurHash2(idAttr->val, idAttr->valLen) : 0;
+    }
+
+    CachedStyle& cached = cache[StyleRuleKeyHash(t->tag, classAttrHash, idHash) % kCacheSize];
+    if (cached.valid && cached.tag == t->tag && cached.classAttrHash == classAttrHash && cached.idHash == idHash) {
+        return cached.style;
+    }
+
     StyleRule rule;
     // get style rules ordered by specificity
-    StyleRule* prevRule = FindStyleRule(Tag_Body, nullptr, 0);
+    StyleRule* prevRule = Find(Tag_Body, 0, 0);
     if (prevRule) {
         rule.Merge(*prevRule);
     }
-    prevRule = FindStyleRule(Tag_Any, nullptr, 0);
+    prevRule = Find(Tag_Any, 0, 0);
     if (prevRule) {
         rule.Merge(*prevRule);
     }
-    prevRule = FindStyleRule(t->tag, nullptr, 0);
+    prevRule = Find(t->tag, 0, 0);
     if (prevRule) {
         rule.Merge(*prevRule);
     }
-    // TODO: support multiple class names
-    AttrInfo* attr = t->GetAttrByName("class");
-    if (attr) {
-        prevRule = FindStyleRule(Tag_Any, attr->val, attr->valLen);
+    if (classAttr) {
+        // class attribute can have multiple space-separated class names
+        u32 classHashes[16];
+        int nClasses = 0;
+        const char* s = classAttr->val;
+        const char* end = s + classAttr->valLen;
+        while (nClasses < dimofi(classHashes)) {
+            SkipWs(s, end);
+            if (s == end) {
+                break;
+            }
+            const char* name = s;
+            SkipNonWs(s, end);
+            classHashes[nClasses++] = MurmurHash2(name, s - name);
+        }
+        StyleRule* matches[dimof(classHashes)];
+        int nMatches = 0;
+        for (int i = 0; i < nClasses; i++) {
+            prevRule = Find(Tag_Any, classHashes[i], 0);
+            if (prevRule) {
+                matches[nMatches++] = prevRule;
+            }
+        }
+        MergeInOrder(rule, matches, nMatches);
+        nMatches = 0;
+        for (int i = 0; i < nClasses; i++) {
+            prevRule = Find(t->tag, classHashes[i], 0);
+            if (prevRule) {
+                matches[nMatches++] = prevRule;
+            }
+        }
+        MergeInOrder(rule, matches, nMatches);
+    }
+    if (idHash != 0) {
+        prevRule = Find(Tag_Any, 0, idHash);
         if (prevRule) {
             rule.Merge(*prevRule);
         }
-        prevRule = FindStyleRule(t->tag, attr->val, attr->valLen);
+        prevRule = Find(t->tag, 0, idHash);
         if (prevRule) {
             rule.Merge(*prevRule);
         }
     }
-    attr = t->GetAttrByName("style");
+
+    cached.valid = true;
+    cached.tag = t->tag;
+    cached.classAttrHash = classAttrHash;
+    cached.idHash = idHash;
+    cached.style = rule;
+    return rule;
+}
+
+StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
+    StyleRule rule = styleSheet.Compute(t);
+    AttrInfo* attr = t->GetAttrByName("style");
     if (attr) {
         StyleRule newRule = StyleRule::Parse(attr->val, attr->valLen);
         rule.Merge(newRule);
@@ -1016,24 +1276,7 @@ StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
 }
 
 void HtmlFormatter::ParseStyleSheet(const char* data, size_t len) {
-    CssPullParser parser(data, len);
-    while (parser.NextRule()) {
-        StyleRule rule = StyleRule::Parse(&parser);
-        const CssSelector* sel;
-        while ((sel = parser.NextSelector()) != nullptr) {
-            if (Tag_NotFound == sel->tag) {
-                continue;
-            }
-            StyleRule* prevRule = FindStyleRule(sel->tag, sel->clazz, sel->clazzLen);
-            if (prevRule) {
-                prevRule->Merge(rule);
-            } else {
-                rule.tag = sel->tag;
-                rule.classHash = sel->clazz ? MurmurHash2(sel->clazz, sel->clazzLen) : 0;
-                styleRules.Append(rule);
-            }
-        }
-    }
+    styleSheet.Parse(data, len);
 }
 
 void HtmlFormatter::HandleTagStyle(HtmlToken* t) {
@@ -83,6 +83,10 @@ class CssPullParser;
 struct StyleRule {
     HtmlTag tag = Tag_NotFound;
     u32 classHash = 0;
+    u32 idHash = 0;
+    // position of the last declaration merged into this rule,
+    // orders rules of the same specificity
+    int order = 0;
 
     enum Unit { px, pt, em, inherit };
 
@@ -98,6 +102,41 @@ struct StyleRule {
     static StyleRule Parse(const char* s, size_t len);
 };
 
+struct HtmlToken;
+
+// CSS rules of all stylesheets of a document, indexed by the tag, class
+// and id of their selector so that matching an element only takes
+// a few hash lookups instead of a scan over all rules
+struct StyleSheet {
+    Vec<StyleRule> rules;
+    // open addressing hash table of indexes into rules (+1, 0 is empty)
+    Vec<int> index;
+    int lastOrder = 0;
+    bool hasIdRules = false;
+
+    // elements with the same tag, class and id attributes get the same style
+    struct CachedStyle {
+        bool valid = false;
+        HtmlTag tag = Tag_NotFound;
+        u32 classAttrHash = 0;
+        u32 idHash = 0;
+        StyleRule style;
+    };
+    static constexpr int kCacheSize = 128;
+    CachedStyle cache[kCacheSize];
+
+    void Reset();
+    void Parse(const char* data, size_t len);
+    StyleRule* Find(HtmlTag tag, u32 classHash, u32 idHash);
+    // doesn't include the element's style attribute
+    StyleRule Compute(HtmlToken* t);
+
+  private:
+    void Add(const StyleRule& rule);
+    void InsertIntoIndex(int ruleIdx);
+    void ClearCache();
+};
+
 struct DrawStyle {
     mui::CachedFont* font = nullptr;
     AlignAttr align{AlignAttr::NotFound};
@@ -156,8 +195,8 @@ struct HtmlFormatterArgs {
 };
 
 class HtmlPullParser;
-struct HtmlToken;
 struct CssSelector;
+struct TextWidthCache;
 
 class HtmlFormatter {
   protected:
@@ -218,7 +257,6 @@ class HtmlFormatter {
     void RevertStyleChange();
 
     void ParseStyleSheet(const char* data, size_t len);
-    StyleRule* FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen);
     StyleRule ComputeStyleRule(HtmlToken* t);
 
     void AppendInstr(const DrawInstr& di);
@@ -237,6 +275,8 @@ class HtmlFormatter {
     float defaultFontSize = 0;
     Allocator* textAllocator = nullptr;
     mui::ITextRender* textMeasure = nullptr;
+    // most words are repeated many times, so they're only measured once per font
+    TextWidthCache* widthCache = nullptr;
 
     // style stack of the current line
     Vec<DrawStyle> styleStack;
@@ -258,7 +298,7 @@ class HtmlFormatter {
     Vec<HtmlTag> tagNesting;
     bool keepTagNesting = false;
     // set from CSS and to be checked by the individual tag handlers
-    Vec<StyleRule> styleRules;
+    StyleSheet styleSheet;
 
     // isntructions for the current line
     Vec<DrawInstr> currLineInstr;
@@ -10,6 +10,7 @@
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/ThreadUtil.h"
 #include "utils/TrivialHtmlParser.h"
 
 #include "wingui/UIModels.h"
@@ -119,42 +120,67 @@ struct MobiHeader {
 
 static_assert(kMobiHeaderLen == sizeof(MobiHeader), "wrong size of MobiHeader structure");
 
-// Uncompress source data compressed with PalmDoc compression into a buffer.
+// uncompressed size of a text record (the maximum, usually all but the last record)
+constexpr size_t kPalmDocRecordSize = 4096;
+
+// Uncompress source data compressed with PalmDoc compression, appending it to dst.
 // http://wiki.mobileread.com/wiki/PalmDOC#Format
+// Writes directly into space made in dst, a record at a time
 // Returns false on decoding errors
 static bool PalmdocUncompress(const u8* src, size_t srcLen, str::Str& dst) {
     const u8* srcEnd = src + srcLen;
+    char* buf = dst.Get();
+    size_t pos = dst.size();
+    size_t end = pos;
+    bool ok = true;
     while (src < srcEnd) {
+        // a single token is uncompressed to at most 10 bytes
+        if (pos + 10 > end) {
+            if (!dst.AppendBlanks(kPalmDocRecordSize)) {
+                ok = false;
+                break;
+            }
+            buf = dst.Get();
+            end += kPalmDocRecordSize;
+        }
         u8 c = *src++;
         if ((c >= 1) && (c <= 8)) {
             if (src + c > srcEnd) {
-                return false;
+                ok = false;
+                break;
             }
-            dst.Append(src, c);
+            memcpy(buf + pos, src, c);
+            pos += c;
             src += c;
         } else if (c < 128) {
-            dst.AppendChar((char)c);
+            buf[pos++] = (char)c;
         } else if (c < 192) {
             if (src + 1 > srcEnd) {
-                return false;
+                ok = false;
+                break;
             }
             u16 c2 = (c << 8) | (u8)*src++;
             u16 back = (c2 >> 3) & 0x07ff;
-            if (back > dst.size() || 0 == back) {
-                return false;
+            if (back > pos || 0 == back) {
+                ok = false;
+                break;
             }
+            // can overlap with the bytes being written, so copy byte by byte
             for (u8 n = (c2 & 7) + 3; n > 0; n--) {
-                char ctmp = dst.at(dst.size() - back);
-                dst.AppendChar(ctmp);
+                buf[pos] = buf[pos - back];
+                pos++;
             }
         } else {
             // c >= 192
-            dst.AppendChar(' ');
-            dst.AppendChar((char)(c ^ 0x80));
+            buf[pos++] = ' ';
+            buf[pos++] = (char)(c ^ 0x80);
         }
     }
 
-    return true;
+    if (end > pos) {
+        dst.RemoveAt(pos, end - pos);
+    }
+    return ok;
 }
 
 #define kHuffHeaderLen 24
@@ -192,9 +218,27 @@ static_assert(kCdicHeaderLen == sizeof(CdicHeader), "wrong size of CdicHeader st
 
 #define kCdicsMax 32
 
+// number of leading bits of a code for which the code length is looked up at once
+#define kHuffLookupBits 12
+
+// how to decode the codes starting with a given kHuffLookupBits prefix:
+// code = base - (bits >> (32 - codeLen)). codeLen is 0 if the prefix
+// doesn't determine the code length (or the tables are corrupted)
+struct HuffLookup {
+    u32 base = 0;
+    u32 codeLen = 0;
+};
+
+// a dictionary entry with all the codes it contains expanded
+struct HuffSymbol {
+    const char* s = nullptr;
+    u32 len = 0;
+};
+
 class HuffDicDecompressor {
     u32 cacheTable[kCacheItemCount]{};
     u32 baseTable[kBaseTableItemCount]{};
+    HuffLookup lookup[1 << kHuffLookupBits];
 
     size_t dictsCount = 0;
     // owned by the creator (in our case: by the PdbReader)
@@ -203,62 +247,120 @@ class HuffDicDecompressor {
 
     u32 codeLength = 0;
 
-    Vec<u32> recursionGuard;
+    // expanded symbols by code, set when first used (by any thread)
+    Vec<HuffSymbol*> symbols;
+    PoolAllocator symbolsAllocator;
+
+    void BuildLookup();
+    HuffSymbol* GetSymbol(u32 code, Vec<u32>& recursionGuard);
+    bool Decompress(u8* src, size_t srcSize, str::Str& dst, Vec<u32>& recursionGuard);
 
   public:
     HuffDicDecompressor();
 
     bool SetHuffData(u8* huffData, size_t huffDataLen);
     bool AddCdicData(u8* cdicData, u32 cdicDataLen);
+    // can be called from multiple threads at once
     bool Decompress(u8* src, size_t srcSize, str::Str& dst);
-    bool DecodeOne(u32 code, str::Str& dst);
 };
 
 HuffDicDecompressor::HuffDicDecompressor() {
+    symbolsAllocator.minBlockSize = 64 * 1024;
 }
 
-bool HuffDicDecompressor::DecodeOne(u32 code, str::Str& dst) {
-    u16 dict = (u16)(code >> codeLength);
+// resolves the code length for all codes whose length is determined by
+// their first kHuffLookupBits bits, the same way as Decompress() does
+void HuffDicDecompressor::BuildLookup() {
+    for (u32 prefix = 0; prefix < dimof(lookup); prefix++) {
+        lookup[prefix] = HuffLookup();
+        u32 bits = prefix << (32 - kHuffLookupBits);
+        u32 v = cacheTable[bits >> 24];
+        u32 codeLen = v & 0x1f;
+        if (!codeLen) {
+            continue;
+        }
+        if (v & 0x80) {
+            lookup[prefix] = {v >> 8, codeLen};
+            continue;
+        }
+        for (codeLen--; codeLen < kHuffLookupBits;) {
+            codeLen++;
+            if (baseTable[codeLen * 2 - 2] <= (bits >> (32 - codeLen))) {
+                lookup[prefix] = {baseTable[codeLen * 2 - 1], codeLen};
+                break;
+            }
+        }
+    }
+}
+
+// returns the symbol for a code, expanding it if it's used for the first time
+// (which is why this is fast for frequently used symbols)
+HuffSymbol* HuffDicDecompressor::GetSymbol(u32 code, Vec<u32>& recursionGuard) {
+    u32 dict = code >> codeLength;
     if (dict >= dictsCount) {
         logf("invalid dict value\n");
-        return false;
+        return nullptr;
     }
-    code &= ((1 << (codeLength)) - 1);
-    u16 offset = UInt16BE(dicts[dict] + code * 2);
+    // AddCdicData() makes sure there's an entry for every code of every dictionary
+    HuffSymbol** cached = &symbols.at((size_t)code);
+    auto sym = (HuffSymbol*)InterlockedCompareExchangePointer((void**)cached, nullptr, nullptr);
+    if (sym) {
+        return sym;
+    }
+
+    u32 idx = code & ((1 << (codeLength)) - 1);
+    u16 offset = UInt16BE(dicts[dict] + idx * 2);
 
     if ((u32)offset + 2 > dictSize[dict]) {
         logf("invalid offset\n");
-        return false;
+        return nullptr;
     }
     u16 symLen = UInt16BE(dicts[dict] + offset);
     u8* p = dicts[dict] + offset + 2;
     if ((u32)(symLen & 0x7fff) > dictSize[dict] - offset - 2) {
         logf("invalid symLen\n");
-        return false;
+        return nullptr;
     }
 
+    const char* s;
+    u32 len;
     if (!(symLen & 0x8000)) {
         if (recursionGuard.Contains(code)) {
             logf("infinite recursion\n");
-            return false;
+            return nullptr;
         }
         recursionGuard.Append(code);
-        if (!Decompress(p, symLen, dst)) {
-            return false;
-        }
+        str::Str expanded;
+        bool ok = Decompress(p, symLen, expanded, recursionGuard);
         recursionGuard.Pop();
+        if (!ok) {
+            return nullptr;
+        }
+        len = (u32)expanded.size();
+        s = (const char*)Allocator::MemDup(&symbolsAllocator, expanded.Get(), expanded.size());
     } else {
         symLen &= 0x7fff;
         if (symLen > 127) {
             logf("symLen too big\n");
-            return false;
+            return nullptr;
         }
-        dst.Append((char*)p, symLen);
-    }
-    return true;
+        s = (const char*)p;
+        len = symLen;
+    }
+    sym = symbolsAllocator.AllocStruct<HuffSymbol>();
+    sym->s = s;
+    sym->len = len;
+    // if another thread has expanded the same symbol in the meantime, use theirs
+    auto prev = (HuffSymbol*)InterlockedCompareExchangePointer((void**)cached, sym, nullptr);
+    return prev ? prev : sym;
 }
 
 bool HuffDicDecompressor::Decompress(u8* src, size_t srcSize, str::Str& dst) {
+    Vec<u32> recursionGuard;
+    return Decompress(src, srcSize, dst, recursionGuard);
+}
+
+bool HuffDicDecompressor::Decompress(u8* src, size_t srcSize, str::Str& dst, Vec<u32>& recursionGuard) {
     u32 bitsConsumed = 0;
     u32 bits = 0;
 
@@ -278,18 +380,21 @@ bool HuffDicDecompressor::Decompress(u8* src, size_t srcSize, str::Str& dst) {
         if (br.BitsLeft() < 8 && 0 == bits) {
             break;
         }
-        u32 v = cacheTable[bits >> 24];
-        u32 codeLen = v & 0x1f;
-        if (!codeLen) {
-            logf("corrupted table, zero code len\n");
-            return false;
-        }
-        bool isTerminal = (v & 0x80) != 0;
 
         u32 code;
-        if (isTerminal) {
-            code = (v >> 8) - (bits >> (32 - codeLen));
+        u32 codeLen;
+        HuffLookup& lu = lookup[bits >> (32 - kHuffLookupBits)];
+        if (lu.codeLen) {
+            codeLen = lu.codeLen;
+            code = lu.base - (bits >> (32 - codeLen));
         } else {
+            // a longer code or corrupted tables
+            u32 v = cacheTable[bits >> 24];
+            codeLen = v & 0x1f;
+            if (!codeLen) {
+                logf("corrupted table, zero code len\n");
+                return false;
+            }
             u32 baseVal;
             codeLen -= 1;
             do {
@@ -304,9 +409,11 @@ bool HuffDicDecompressor::Decompress(u8* src, size_t srcSize, str::Str& dst) {
             code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
         }
 
-        if (!DecodeOne(code, dst)) {
+        HuffSymbol* sym = GetSymbol(code, recursionGuard);
+        if (!sym) {
             return false;
         }
+        dst.Append(sym->s, sym->len);
         bitsConsumed = codeLen;
     }
 
@@ -361,6 +468,7 @@ bool HuffDicDecompressor::SetHuffData(u8* huffData, size_t huffDataLen) {
         baseTable[i] = d.UInt32();
     }
     ReportIf(d.Offset() != kHuffRecordMinLen);
+    BuildLookup();
     return true;
 }
 
@@ -395,6 +503,8 @@ bool HuffDicDecompressor::AddCdicData(u8* cdicData, u32 cdicDataLen) {
     dicts[dictsCount] = cdicData + hdrLen;
     dictSize[dictsCount] = size;
     ++dictsCount;
+    // codeLength can only get smaller, so there's an entry for every code
+    symbols.AppendBlanks(maxSize);
     return true;
 }
 
@@ -856,6 +966,84 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut) {
     return false;
 }
 
+// state shared by the threads decompressing records in parallel
+// (see MobiDoc::LoadDocRecordsInParallel())
+struct MobiRecordsLoad {
+    MobiDoc* doc = nullptr;
+    // index of the next record for a worker to decompress
+    AtomicInt nextRec;
+    // a record is only accessed by the coordinator once recDone is set
+    // (to 1 if it was decompressed successfully, to 2 otherwise)
+    str::Str* recs = nullptr;
+    AtomicInt* recDone = nullptr;
+    // signaled whenever a worker has finished a record or is exiting
+    HANDLE progress = nullptr;
+};
+
+static void LoadDocRecordsThread(MobiRecordsLoad* rl) {
+    int nRecs = (int)rl->doc->docRecCount;
+    for (int idx = rl->nextRec.Inc() - 1; idx < nRecs; idx = rl->nextRec.Inc() - 1) {
+        bool ok = rl->doc->LoadDocRecordIntoBuffer((size_t)idx + 1, rl->recs[idx]);
+        rl->recDone[idx].Set(ok ? 1 : 2);
+        SetEvent(rl->progress);
+    }
+    SetEvent(rl->progress);
+}
+
+// HuffDic decompression is slow and records are independent of each other,
+// so they're decompressed on as many threads as there are cores and appended
+// to doc in order as soon as they're ready. Returns the number of failed records
+size_t MobiDoc::LoadDocRecordsInParallel() {
+    int nRecs = (int)docRecCount;
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int nWorkers = std::clamp((int)si.dwNumberOfProcessors, 1, nRecs);
+
+    MobiRecordsLoad rl;
+    rl.doc = this;
+    rl.recs = new str::Str[nRecs];
+    rl.recDone = new AtomicInt[nRecs];
+    rl.progress = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+
+    Vec<HANDLE> workers;
+    for (int i = 0; rl.progress && i < nWorkers; i++) {
+        auto fn = MkFunc0<MobiRecordsLoad>(LoadDocRecordsThread, &rl);
+        HANDLE h = StartThread(fn, "MobiDecompressThread");
+        if (h) {
+            workers.Append(h);
+        }
+    }
+    if (workers.Size() == 0) {
+        LoadDocRecordsThread(&rl);
+    }
+
+    size_t nFailed = 0;
+    for (int idx = 0; idx < nRecs;) {
+        int done = rl.recDone[idx].Get();
+        if (done == 0) {
+            WaitForSingleObject(rl.progress, INFINITE);
+            continue;
+        }
+        if (done != 1) {
+            nFailed++;
+        }
+        doc->Append(rl.recs[idx]);
+        rl.recs[idx].Reset();
+        idx++;
+    }
+
+    for (HANDLE h : workers) {
+        WaitForSingleObject(h, INFINITE);
+        CloseHandle(h);
+    }
+    if (rl.progress) {
+        CloseHandle(rl.progress);
+    }
+    delete[] rl.recs;
+    delete[] rl.recDone;
+    return nFailed;
+}
+
 bool MobiDoc::LoadForPdbReader(PdbReader* pdbReader) {
     this->pdbReader = pdbReader;
     if (!ParseHeader()) {
@@ -863,11 +1051,16 @@ bool MobiDoc::LoadForPdbReader(PdbReader* pdbReader) {
     }
 
     ReportIf(doc != nullptr);
-    doc = new str::Str(docUncompressedSize);
+    // + kPalmDocRecordSize as PalmdocUncompress() makes space a record at a time
+    doc = new str::Str(docUncompressedSize + kPalmDocRecordSize);
     size_t nFailed = 0;
-    for (size_t i = 1; i <= docRecCount; i++) {
-        if (!LoadDocRecordIntoBuffer(i, *doc)) {
-            nFailed++;
+    if (COMPRESSION_HUFF == compressionType && huffDic && docRecCount > 1) {
+        nFailed = LoadDocRecordsInParallel();
+    } else {
+        for (size_t i = 1; i <= docRecCount; i++) {
+            if (!LoadDocRecordIntoBuffer(i, *doc)) {
+                nFailed++;
+            }
         }
     }
 
@@ -887,10 +1080,13 @@ bool MobiDoc::LoadForPdbReader(PdbReader* pdbReader) {
         *s = ' ';
     }
     if (textEncoding != CP_UTF8) {
-        TempStr docUtf8 = strconv::ToMultiByteTemp(doc->Get(), textEncoding, CP_UTF8);
-        if (docUtf8) {
-            doc->Reset();
-            doc->Append(docUtf8);
+        // converted in chunks, so that we don't need the whole text as WCHAR on top
+        auto docUtf8 = new str::Str(doc->size() + doc->size() / 8);
+        if (strconv::AppendAsUtf8(*docUtf8, doc->Get(), doc->size(), textEncoding)) {
+            delete doc;
+            doc = docUtf8;
+        } else {
+            delete docUtf8;
         }
     }
     return true;
@@ -31,6 +31,7 @@ struct MobiDoc {
 
     bool ParseHeader();
     bool LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut);
+    size_t LoadDocRecordsInParallel();
     void LoadImages();
     bool LoadImage(size_t imageNo);
     bool LoadForPdbReader(PdbReader* pdbReader);
@@ -5,6 +5,8 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/PackBits.h"
+#include "utils/TimingStats.h"
 
 #include "wingui/UIModels.h"
 
@@ -37,6 +39,11 @@ static DWORD WINAPI RenderCacheThread(LPVOID data);
 
 bool gShowTileLayout = false;
 
+// stages of the render pipeline, see TimingStats.h
+static TimingStats gRenderPageStats("RenderCache: RenderPage");
+static TimingStats gCacheAddStats("RenderCache: Add");
+static TimingStats gPaintStats("RenderCache: Paint");
+
 RenderCache::RenderCache() : maxTileSize({GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)}) {
     // enable when debugging RenderCache logic
     // gEnableDbgLog = true;
@@ -59,7 +66,7 @@ RenderCache::~RenderCache() {
 
     CloseHandle(renderThread);
     CloseHandle(startRendering);
-    if (curReq || 0 != requestCount || cacheCount != 0) {
+    if (curReq || 0 != requestCount || cacheCount != 0 || compressedCache.size() != 0) {
         logvf("RenderCache::~RenderCache: curReq: 0x%p, requestCount: %d, cacheCount: %d\n", curReq, requestCount,
               cacheCount);
         ReportIf(true);
@@ -73,13 +80,14 @@ RenderCache::~RenderCache() {
 
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
    <rotation> and <zoom> in the cache - call DropCacheEntry when you
-   no longer need a found entry. */
+   no longer need a found entry. Compressed bitmaps are only restored
+   by RestoreCompressed() and previews are only found by FindPreview() */
 BitmapCacheEntry* RenderCache::Find(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
     ScopedCritSec scope(&cacheAccess);
     rotation = NormalizeRotation(rotation);
     for (int i = 0; i < cacheCount; i++) {
         BitmapCacheEntry* e = cache[i];
-        if ((dm == e->dm) && (pageNo == e->pageNo) && (rotation == e->rotation) &&
+        if ((dm == e->dm) && (pageNo == e->pageNo) && (rotation == e->rotation) && !e->isPreview &&
             (kInvalidZoom == zoom || zoom == e->zoom) && (!tile || e->tile == *tile)) {
             e->refs++;
             ReportIf(i != e->cacheIdx);
@@ -89,12 +97,30 @@ BitmapCacheEntry* RenderCache::Find(DisplayModel* dm, int pageNo, int rotation,
     return nullptr;
 }
 
+// the preview of a page (at whatever zoom level it was rendered)
+BitmapCacheEntry* RenderCache::FindPreview(DisplayModel* dm, int pageNo, int rotation) {
+    ScopedCritSec scope(&cacheAccess);
+    rotation = NormalizeRotation(rotation);
+    for (int i = 0; i < cacheCount; i++) {
+        BitmapCacheEntry* e = cache[i];
+        if ((dm == e->dm) && (pageNo == e->pageNo) && (rotation == e->rotation) && e->isPreview) {
+            e->refs++;
+            ReportIf(i != e->cacheIdx);
+            return e;
+        }
+    }
+    return nullptr;
+}
+
+// also true for compressed bitmaps (without decompressing them), never for previews
 bool RenderCache::Exists(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
+    ScopedCritSec scope(&cacheAccess);
     BitmapCacheEntry* entry = Find(dm, pageNo, rotation, zoom, tile);
     if (entry) {
         DropCacheEntry(entry);
+        return true;
     }
-    return entry != nullptr;
+    return FindCompressed(dm, pageNo, NormalizeRotation(rotation), zoom, tile) >= 0;
 }
 
 bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
@@ -136,13 +162,12 @@ bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
     return true;
 }
 
-static bool FreeIfFull(RenderCache* rc, const PageRenderRequest& req) {
+static bool FreeIfFull(RenderCache* rc, DisplayModel* dm) {
     int n = rc->cacheCount;
     if (n < MAX_BITMAPS_CACHED) {
         return true;
     }
 
-    DisplayModel* dm = req.dm;
     // free an invisible page of the same DisplayModel ...
     for (int i = 0; i < n; i++) {
         auto entry = rc->cache[i];
@@ -173,21 +198,38 @@ static bool FreeIfFull(RenderCache* rc, const PageRenderRequest& req) {
 }
 
 void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
+    TimingScope timing(&gCacheAddStats);
     ScopedCritSec scope(&cacheAccess);
     ReportIf(!req.dm);
 
     req.rotation = NormalizeRotation(req.rotation);
     ReportIf(cacheCount > MAX_BITMAPS_CACHED);
 
-    /* It's possible there still is a cached bitmap with different zoom/rotation */
-    FreePage(req.dm, req.pageNo, &req.tile);
+    if (req.isPreview) {
+        // a preview is only needed as long as nothing else has been rendered for the page
+        if (Exists(req.dm, req.pageNo, req.rotation)) {
+            delete bmp;
+            return;
+        }
+        // replace a preview for a different zoom level or rotation
+        for (int i = cacheCount - 1; i >= 0; i--) {
+            BitmapCacheEntry* entry = cache[i];
+            if (entry->dm == req.dm && entry->pageNo == req.pageNo && entry->isPreview) {
+                DropCacheEntry(entry);
+            }
+        }
+    } else {
+        /* It's possible there still is a cached bitmap with different zoom/rotation */
+        FreePage(req.dm, req.pageNo, &req.tile);
+    }
 
-    bool hasSpace = FreeIfFull(this, req);
+    bool hasSpace = FreeIfFull(this, req.dm);
     ReportIf(!hasSpace); // TODO: FreeIfFull() might actually fail to free
     ReportIf(cacheCount > MAX_BITMAPS_CACHED);
 
     // Copy the PageRenderRequest as it will be reused
     auto entry = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bmp);
+    entry->isPreview = req.isPreview;
     entry->cacheIdx = cacheCount;
     cache[cacheCount] = entry;
     cacheCount++;
@@ -227,15 +269,21 @@ static Rect GetTileOnScreen(EngineBase* engine, int pageNo, int rotation, float
     return bbox;
 }
 
-static bool IsTileVisible(DisplayModel* dm, int pageNo, TilePosition tile, float fuzz = 0) {
+// only uses the const DisplayModel API, since this is also called on the rendering thread
+static bool IsTileVisible(const DisplayModel* dm, int pageNo, TilePosition tile, float fuzz = 0) {
     if (!dm) {
         return false;
     }
-    PageInfo* pageInfo = dm->GetPageInfo(pageNo);
+    const PageInfo* pageInfo = dm->GetPageInfo(pageNo);
     EngineBase* engine = dm->GetEngine();
     if (!engine || !pageInfo) {
         return false;
     }
+    // with lazy layout, only the pages in and next to the view port are laid
+    // out (see RecalcVisibleParts()), so the other pages can't be visible
+    if (!dm->PageOnScreenIsCurrent(pageNo)) {
+        return false;
+    }
     int rotation = dm->GetRotation();
     float zoom = dm->GetZoomReal(pageNo);
     Rect r = pageInfo->pageOnScreen;
@@ -249,6 +297,236 @@ static bool IsTileVisible(DisplayModel* dm, int pageNo, TilePosition tile, float
     return !tileOnScreen.Intersect(screen).IsEmpty();
 }
 
+// pixels of a rendered bitmap as top-down DIB of 8 (if the bitmap has a palette) or 32 bits
+// per pixel, compressed with PackBits. Returns false if compression isn't worth it
+static bool CompressBitmap(RenderedBitmap* bmp, CompressedCacheEntry* res) {
+    DIBSECTION info{};
+    if (!bmp || GetObject(bmp->GetBitmap(), sizeof(info), &info) != sizeof(info)) {
+        return false;
+    }
+    int bpp = info.dsBm.bmBitsPixel == 8 ? 8 : 32;
+    int w = bmp->size.dx;
+    int h = bmp->size.dy;
+    int stride = ((w * bpp / 8 + 3) / 4) * 4;
+    size_t nBytes = (size_t)stride * h;
+
+    BITMAPINFO* bmi = (BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD));
+    u8* bits = AllocArray<u8>(nBytes);
+    if (!bmi || !bits) {
+        free(bmi);
+        free(bits);
+        return false;
+    }
+    BITMAPINFOHEADER* bmih = &bmi->bmiHeader;
+    bmih->biSize = sizeof(*bmih);
+    bmih->biWidth = w;
+    bmih->biHeight = -h;
+    bmih->biPlanes = 1;
+    bmih->biCompression = BI_RGB;
+    bmih->biBitCount = (WORD)bpp;
+    bmih->biSizeImage = (DWORD)nBytes;
+
+    HDC hdc = GetDC(nullptr);
+    int nLines = GetDIBits(hdc, bmp->GetBitmap(), 0, h, bits, bmi, DIB_RGB_COLORS);
+    ReleaseDC(nullptr, hdc);
+
+    ByteSlice packed;
+    if (nLines == h) {
+        packed = PackBitsCompress({bits, nBytes}, bpp / 8);
+    }
+    free(bits);
+    // not worth keeping if it doesn't compress at least 2:1
+    if (packed.empty() || packed.sz > nBytes / 2) {
+        packed.Free();
+        free(bmi);
+        return false;
+    }
+    res->size = bmp->size;
+    res->bmi = bmi;
+    res->data = packed;
+    return true;
+}
+
+static RenderedBitmap* DecompressBitmap(CompressedCacheEntry* e) {
+    BITMAPINFOHEADER* bmih = &e->bmi->bmiHeader;
+    void* data = nullptr;
+    HANDLE hMap = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmih->biSizeImage, nullptr);
+    HBITMAP hbmp = CreateDIBSection(nullptr, e->bmi, DIB_RGB_COLORS, &data, hMap, 0);
+    if (!hbmp) {
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        return nullptr;
+    }
+    bool ok = PackBitsDecompress(e->data, bmih->biBitCount / 8, {(u8*)data, bmih->biSizeImage});
+    if (!ok) {
+        DeleteObject(hbmp);
+        CloseHandle(hMap);
+        return nullptr;
+    }
+    return new RenderedBitmap(hbmp, e->size, hMap);
+}
+
+// compresses the bitmaps queued by FreeNotVisible(). Called on the render
+// thread when there's nothing to render, stops as soon as there is
+void RenderCache::CompressPending() {
+    for (;;) {
+        {
+            ScopedCritSec scope(&requestAccess);
+            if (requestCount > 0) {
+                return;
+            }
+        }
+        CompressedCacheEntry* e = nullptr;
+        RenderedBitmap* bmp = nullptr;
+        {
+            ScopedCritSec scope(&cacheAccess);
+            for (CompressedCacheEntry* pending : compressedCache) {
+                if (pending->bitmap) {
+                    e = pending;
+                    break;
+                }
+            }
+            if (!e) {
+                return;
+            }
+            compressedCache.Remove(e);
+            bmp = e->bitmap;
+            e->bitmap = nullptr;
+            compressing = e;
+            compressingDropped = false;
+        }
+        bool ok = CompressBitmap(bmp, e);
+        delete bmp;
+
+        ScopedCritSec scope(&cacheAccess);
+        compressing = nullptr;
+        if (ok && !compressingDropped) {
+            AddCompressed(e);
+        } else {
+            delete e;
+        }
+    }
+}
+
+// keep a bitmap compressed by CompressPending() unless the tile
+// has been rendered again in the meantime
+void RenderCache::AddCompressed(CompressedCacheEntry* e) {
+    ScopedCritSec scope(&cacheAccess);
+    BitmapCacheEntry* entry = Find(e->dm, e->pageNo, e->rotation, e->zoom, &e->tile);
+    if (entry) {
+        DropCacheEntry(entry);
+        delete e;
+        return;
+    }
+    compressedCache.Append(e);
+    compressedCacheSize += (i64)e->data.sz;
+    while (compressedCacheSize > kMaxCompressedCacheSize && compressedCache.size() > 0) {
+        DropCompressed(0);
+    }
+}
+
+void RenderCache::DropCompressed(int idx) {
+    ScopedCritSec scope(&cacheAccess);
+    CompressedCacheEntry* e = compressedCache[idx];
+    compressedCache.RemoveAt(idx);
+    compressedCacheSize -= (i64)e->data.sz;
+    delete e;
+}
+
+// index of the most recently compressed matching bitmap or -1
+int RenderCache::FindCompressed(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
+    ScopedCritSec scope(&cacheAccess);
+    int n = compressedCache.Size();
+    for (int i = n - 1; i >= 0; i--) {
+        CompressedCacheEntry* e = compressedCache[i];
+        if ((dm == e->dm) && (pageNo == e->pageNo) && (rotation == e->rotation) &&
+            (kInvalidZoom == zoom || zoom == e->zoom) && (!tile || e->tile == *tile)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// turn a compressed bitmap back into a regular cache entry (with a reference for the caller)
+// only called when the bitmap is about to be painted. The bitmap is decompressed
+// without holding cacheAccess so that the render thread isn't blocked
+BitmapCacheEntry* RenderCache::RestoreCompressed(DisplayModel* dm, int pageNo, int rotation, float zoom,
+                                                 TilePosition* tile) {
+    rotation = NormalizeRotation(rotation);
+    CompressedCacheEntry* e = nullptr;
+    {
+        ScopedCritSec scope(&cacheAccess);
+        int i = FindCompressed(dm, pageNo, rotation, zoom, tile);
+        if (i < 0) {
+            return nullptr;
+        }
+        e = compressedCache[i];
+        compressedCache.RemoveAt(i);
+        compressedCacheSize -= (i64)e->data.sz;
+    }
+    // a bitmap that hasn't been compressed yet can be used as is
+    RenderedBitmap* bmp = e->bitmap;
+    e->bitmap = nullptr;
+    if (!bmp) {
+        bmp = DecompressBitmap(e);
+    }
+
+    ScopedCritSec scope(&cacheAccess);
+    // the tile might have been rendered again in the meantime
+    BitmapCacheEntry* entry = Find(e->dm, e->pageNo, e->rotation, e->zoom, &e->tile);
+    if (entry) {
+        delete bmp;
+        delete e;
+        return entry;
+    }
+    entry = bmp ? new BitmapCacheEntry(e->dm, e->pageNo, e->rotation, e->zoom, e->tile, bmp) : nullptr;
+    delete e;
+    if (!entry || !FreeIfFull(this, dm)) {
+        delete entry;
+        return nullptr;
+    }
+    logvf("RenderCache::RestoreCompressed: dm: 0x%p, pageNo: %d, zoom: %.2f\n", dm, pageNo, entry->zoom);
+    entry->cacheIdx = cacheCount;
+    cache[cacheCount] = entry;
+    cacheCount++;
+    entry->refs++;
+    return entry;
+}
+
+// a given tile of the page or all tiles not rendered at a given resolution
+// (and at resolution 0 for quick zoom previews)
+static bool ShouldFreeTile(TilePosition entryTile, bool outOfDate, bool isPreview, TilePosition* tile) {
+    if (!tile) {
+        return true;
+    }
+    return entryTile == *tile || tile->row == (USHORT)-1 && entryTile.res > 0 && entryTile.res != tile->res ||
+           tile->row == (USHORT)-1 && entryTile.res == 0 && (outOfDate || isPreview);
+}
+
+static bool ShouldFreeCompressed(CompressedCacheEntry* e, DisplayModel* dm, int pageNo, TilePosition* tile) {
+    bool shouldFree = !dm || (e->dm == dm && (pageNo == kInvalidPageNo || e->pageNo == pageNo));
+    if (shouldFree && pageNo != kInvalidPageNo) {
+        shouldFree = ShouldFreeTile(e->tile, false, false, tile);
+    }
+    return shouldFree;
+}
+
+// free compressed bitmaps of a specific page (or all pages of the given
+// DisplayModel or of all DisplayModels if dm is nullptr)
+void RenderCache::FreeCompressed(DisplayModel* dm, int pageNo, TilePosition* tile) {
+    ScopedCritSec scope(&cacheAccess);
+    for (int i = compressedCache.Size() - 1; i >= 0; i--) {
+        if (ShouldFreeCompressed(compressedCache[i], dm, pageNo, tile)) {
+            DropCompressed(i);
+        }
+    }
+    // the DisplayModel might be deleted before the render thread is done with it
+    if (compressing && ShouldFreeCompressed(compressing, dm, pageNo, tile)) {
+        compressingDropped = true;
+    }
+}
+
 /* Free all bitmaps in the cache that are of a specific page (or all pages
    of the given DisplayModel, or even all invisible pages). */
 void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
@@ -263,17 +541,14 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
     for (int i = cacheCount - 1; i >= 0; i--) {
         BitmapCacheEntry* entry = cache[i];
         bool shouldFree = (entry->dm == dm) && (entry->pageNo == pageNo);
-        if (shouldFree && tile) {
-            // a given tile of the page or all tiles not rendered at a given resolution
-            // (and at resolution 0 for quick zoom previews)
-            shouldFree = (entry->tile == *tile ||
-                          tile->row == (USHORT)-1 && entry->tile.res > 0 && entry->tile.res != tile->res ||
-                          tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate);
+        if (shouldFree) {
+            shouldFree = ShouldFreeTile(entry->tile, entry->outOfDate, entry->isPreview, tile);
         }
         if (shouldFree) {
             DropCacheEntry(entry);
         }
     }
+    FreeCompressed(dm, pageNo, tile);
 }
 
 void RenderCache::FreeForDisplayModel(DisplayModel* dm) {
@@ -286,23 +561,47 @@ void RenderCache::FreeForDisplayModel(DisplayModel* dm) {
             DropCacheEntry(entry);
         }
     }
+    FreeCompressed(dm);
 }
 
+// called on the UI thread (while painting), so the bitmaps of the freed
+// entries are only queued here and compressed on the render thread
 void RenderCache::FreeNotVisible() {
     // logvf("RenderCache::FreeNotVisible\n");
-    ScopedCritSec scope(&cacheAccess);
-    // must go from end becaues freeing changes the cache
-    for (int i = cacheCount - 1; i >= 0; i--) {
-        BitmapCacheEntry* entry = cache[i];
-        // all invisible pages resp. page tiles
-        bool shouldFree = !entry->dm->PageVisibleNearby(entry->pageNo);
-        if (!shouldFree && entry->tile.res > 1) {
-            shouldFree = !IsTileVisible(entry->dm, entry->pageNo, entry->tile, 2.0);
-        }
-        if (shouldFree) {
+    bool queued = false;
+    {
+        ScopedCritSec scope(&cacheAccess);
+        // must go from end becaues freeing changes the cache
+        for (int i = cacheCount - 1; i >= 0; i--) {
+            BitmapCacheEntry* entry = cache[i];
+            // all invisible pages resp. page tiles
+            bool shouldFree = !entry->dm->PageVisibleNearby(entry->pageNo);
+            if (!shouldFree && entry->tile.res > 1) {
+                shouldFree = !IsTileVisible(entry->dm, entry->pageNo, entry->tile, 2.0);
+            }
+            if (!shouldFree) {
+                continue;
+            }
+            // keep it around compressed in case the user scrolls back
+            // (previews are cheap to re-create and out-of-date bitmaps must be re-created)
+            if (entry->refs == 1 && entry->bitmap && !entry->outOfDate && !entry->isPreview) {
+                auto e = new CompressedCacheEntry();
+                e->dm = entry->dm;
+                e->pageNo = entry->pageNo;
+                e->rotation = entry->rotation;
+                e->zoom = entry->zoom;
+                e->tile = entry->tile;
+                e->bitmap = entry->bitmap;
+                entry->bitmap = nullptr;
+                compressedCache.Append(e);
+                queued = true;
+            }
             DropCacheEntry(entry);
         }
     }
+    if (queued) {
+        SetEvent(startRendering);
+    }
 }
 
 // keep the cached bitmaps for visible pages to avoid flickering during a reload.
@@ -321,6 +620,8 @@ void RenderCache::KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm)
         entry->zoom = kInvalidZoom;
         entry->outOfDate = true;
     }
+    // compressed bitmaps are all invisible, so they'd be out-of-date anyway
+    FreeCompressed(oldDm);
 }
 
 // marks all tiles containing rect of pageNo as out of date
@@ -342,6 +643,7 @@ void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectF rect) {
             e->outOfDate = true;
         }
     }
+    FreeCompressed(dm, pageNo);
 }
 
 // determine the count of tiles required for a page at a given zoom level
@@ -383,7 +685,7 @@ USHORT RenderCache::GetMaxTileRes(DisplayModel* dm, int pageNo, int rotation) {
     USHORT maxRes = 0;
     for (int i = 0; i < cacheCount; i++) {
         auto e = cache[i];
-        if (e->dm == dm && e->pageNo == pageNo && e->rotation == rotation) {
+        if (e->dm == dm && e->pageNo == pageNo && e->rotation == rotation && !e->isPreview) {
             maxRes = std::max(e->tile.res, maxRes);
         }
     }
@@ -410,6 +712,7 @@ bool RenderCache::ReduceTileSize() {
     while (cacheCount > 0) {
         FreeForDisplayModel(cache[0]->dm);
     }
+    FreeCompressed(nullptr);
     while (requestCount > 0) {
         ClearQueueForDisplayModel(requests[0].dm);
     }
@@ -447,7 +750,7 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->GetRotation());
     float zoom = dm->GetZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+    if (curReq && !curReq->isPreview && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
         if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
             /* we're already rendering exactly the same page */
             return;
@@ -464,7 +767,7 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
 
     for (int i = 0; i < requestCount; i++) {
         PageRenderRequest* req = &(requests[i]);
-        if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
+        if (!req->isPreview && (req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
             if ((req->zoom == zoom) && (req->rotation == rotation)) {
                 /* Request with exactly the same parameters already queued for
                    rendering. Move it to the top of the queue so that it'll
@@ -492,6 +795,62 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
     Render(dm, pageNo, rotation, zoom, &tile);
 }
 
+// returns the zoom level for a preview of the page or 0 if a preview isn't worth it
+float RenderCache::GetPreviewZoom(DisplayModel* dm, int pageNo) const {
+    EngineBase* engine = dm->GetEngine();
+    // images are decoded at full size regardless of zoom, so a preview wouldn't be faster
+    if (!engine || engine->IsImageCollection()) {
+        return 0;
+    }
+    float zoom = dm->GetZoomReal(pageNo) * kPreviewZoomFactor;
+    RectF mediabox = engine->PageMediabox(pageNo);
+    RectF pixelbox = engine->Transform(mediabox, pageNo, zoom, dm->GetRotation());
+    if (pixelbox.dx < kPreviewMinSize || pixelbox.dy < kPreviewMinSize) {
+        return 0;
+    }
+    // previews are always rendered as a single tile
+    float scale = std::min(maxTileSize.dx / pixelbox.dx, maxTileSize.dy / pixelbox.dy);
+    if (scale < 1.0f) {
+        zoom *= scale;
+    }
+    return zoom;
+}
+
+/* Render a quick low-resolution version of the whole page so that there's
+   something to show while the tiles at the proper resolution are being rendered.
+   Previews are rendered before all other requests */
+void RenderCache::RequestPreview(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&requestAccess);
+    if (!dm || dm->pauseRendering) {
+        return;
+    }
+    int rotation = NormalizeRotation(dm->GetRotation());
+    float zoom = GetPreviewZoom(dm, pageNo);
+    if (zoom <= 0) {
+        return;
+    }
+
+    if (curReq && curReq->isPreview && (curReq->pageNo == pageNo) && (curReq->dm == dm)) {
+        if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
+            return;
+        }
+        /* a preview for an outdated zoom level or rotation is of no use */
+        AbortCurrentRequest();
+    }
+    for (int i = 0; i < requestCount; i++) {
+        PageRenderRequest* req = &(requests[i]);
+        if (req->isPreview && (req->pageNo == pageNo) && (req->dm == dm)) {
+            req->zoom = zoom;
+            req->rotation = rotation;
+            req->pageRect = GetTileRectUser(dm->GetEngine(), pageNo, rotation, zoom, req->tile);
+            return;
+        }
+    }
+
+    TilePosition tile(0, 0, 0);
+    Render(dm, pageNo, rotation, zoom, &tile, nullptr, nullptr, true);
+}
+
 void RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectF pageRect,
                          const OnBitmapRendered& callback) {
     bool ok = Render(dm, pageNo, rotation, zoom, nullptr, &pageRect, &callback);
@@ -501,7 +860,7 @@ void RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
 }
 
 bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile, RectF* pageRect,
-                         const OnBitmapRendered* renderCb) {
+                         const OnBitmapRendered* renderCb, bool isPreview) {
     logvf("RenderCache::Render: pageNo %d\n", pageNo);
     ReportIf(!dm);
     if (!dm || dm->pauseRendering) {
@@ -544,6 +903,7 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
     } else {
         CrashMe();
     }
+    newRequest->isPreview = isPreview;
     newRequest->abort = false;
     newRequest->abortCookie = nullptr;
     newRequest->timestamp = GetTickCount();
@@ -557,12 +917,13 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
 int RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile) {
     ScopedCritSec scope(&requestAccess);
 
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile) {
+    if (curReq && !curReq->isPreview && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile) {
         return GetTickCount() - curReq->timestamp;
     }
 
     for (int i = 0; i < requestCount; i++) {
-        if (requests[i].pageNo == pageNo && requests[i].dm == dm && requests[i].tile == tile) {
+        if (!requests[i].isPreview && requests[i].pageNo == pageNo && requests[i].dm == dm &&
+            requests[i].tile == tile) {
             return GetTickCount() - requests[i].timestamp;
         }
     }
@@ -579,8 +940,17 @@ bool RenderCache::GetNextRequest(PageRenderRequest* req) {
 
     ReportIf(requestCount < 0);
     ReportIf(requestCount > MAX_PAGE_REQUESTS);
+    // most recent request first, except that previews go before everything else
+    int idx = requestCount - 1;
+    for (int i = requestCount - 1; i >= 0; i--) {
+        if (requests[i].isPreview) {
+            idx = i;
+            break;
+        }
+    }
+    *req = requests[idx];
     requestCount--;
-    *req = requests[requestCount];
+    memmove(&(requests[idx]), &(requests[idx + 1]), sizeof(PageRenderRequest) * (requestCount - idx));
     curReq = req;
     ReportIf(requestCount < 0);
     ReportIf(req->abort);
@@ -628,8 +998,10 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel* dm, int pageNo, TilePo
     int curPos = 0;
     for (int i = 0; i < reqCount; i++) {
         PageRenderRequest* req = &(requests[i]);
-        bool shouldRemove = req->dm == dm && (pageNo == kInvalidPageNo || req->pageNo == pageNo) &&
-                            (!tile || req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5));
+        // previews are for the whole page, so they're kept when clearing tiles
+        bool shouldRemove =
+            req->dm == dm && (pageNo == kInvalidPageNo || req->pageNo == pageNo) &&
+            (!tile || !req->isPreview && (req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5)));
         if (i != curPos) {
             requests[curPos] = requests[i];
         }
@@ -662,6 +1034,8 @@ static DWORD WINAPI RenderCacheThread(LPVOID data) {
 
     for (;;) {
         if (cache->ClearCurrentRequest()) {
+            // compress bitmaps that went out of view while there's nothing to render
+            cache->CompressPending();
             DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
             // Is it not a page render request?
             if (WAIT_OBJECT_0 != waitResult) {
@@ -687,7 +1061,8 @@ static DWORD WINAPI RenderCacheThread(LPVOID data) {
         // make sure that we have extracted page text for
         // all rendered pages to allow text selection and
         // searching without any further delays
-        if (!req.dm->textCache->HasTextForPage(req.pageNo)) {
+        // (but don't delay previews, they're supposed to be quick)
+        if (!req.isPreview && !req.dm->textCache->HasTextForPage(req.pageNo)) {
             req.dm->textCache->GetTextForPage(req.pageNo);
         }
 
@@ -704,6 +1079,9 @@ static DWORD WINAPI RenderCacheThread(LPVOID data) {
             continue;
         }
         auto durMs = TimeSinceInMs(timeStart);
+        if (gTimingStatsEnabled) {
+            gRenderPageStats.Add(durMs);
+        }
         if (durMs > 100) {
             auto path = engine->FilePath();
             logfa("Slow rendering: %.2f ms, page: %d in '%s'\n", (float)durMs, req.pageNo, path);
@@ -729,9 +1107,12 @@ static DWORD WINAPI RenderCacheThread(LPVOID data) {
 // TODO: conceptually, RenderCache is not the right place for code that paints
 //       (this is the only place that knows about Tiles, though)
 int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, TilePosition tile, Rect tileOnScreen,
-                           bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement) {
+                           bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement, bool* painted) {
     float zoom = dm->GetZoomReal(pageNo);
     BitmapCacheEntry* entry = Find(dm, pageNo, dm->GetRotation(), zoom, &tile);
+    if (!entry) {
+        entry = RestoreCompressed(dm, pageNo, dm->GetRotation(), zoom, &tile);
+    }
     int renderDelay = 0;
 
     if (!entry) {
@@ -740,6 +1121,13 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
                 *renderedReplacement = true;
             }
             entry = Find(dm, pageNo, dm->GetRotation(), kInvalidZoom, &tile);
+            if (!entry) {
+                entry = RestoreCompressed(dm, pageNo, dm->GetRotation(), kInvalidZoom, &tile);
+            }
+            // a preview covers the whole page, same as the tile of resolution 0
+            if (!entry && 0 == tile.res) {
+                entry = FindPreview(dm, pageNo, dm->GetRotation());
+            }
         }
         renderDelay = GetRenderDelay(dm, pageNo, tile);
         if (renderMissing && RENDER_DELAY_UNDEFINED == renderDelay && !IsRenderQueueFull()) {
@@ -764,6 +1152,7 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
 
     HDC bmpDC = CreateCompatibleDC(hdc);
     if (bmpDC) {
+        *painted = true;
         Size bmpSize = renderedBmp->GetSize();
         int xSrc = -std::min(tileOnScreen.x, 0);
         int ySrc = -std::min(tileOnScreen.y, 0);
@@ -823,6 +1212,7 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
              bounds.dy, dur);
     };
 #endif
+    TimingScope timing(&gPaintStats);
 
     if (!dm->ShouldCacheRendering(pageNo)) {
         int rotation = dm->GetRotation();
@@ -843,6 +1233,7 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
 
     int rotation = dm->GetRotation();
     float zoom = dm->GetZoomReal(pageNo);
+
     USHORT targetRes = GetTileRes(dm, pageNo);
     USHORT maxRes = GetMaxTileRes(dm, pageNo, rotation);
     if (maxRes < targetRes) {
@@ -853,6 +1244,7 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
     queue.Append(TilePosition(0, 0, 0));
     int renderDelayMin = RENDER_DELAY_UNDEFINED;
     bool neededScaling = false;
+    bool painted = false;
 
     while (queue.size() > 0) {
         TilePosition tile = queue.PopAt(0);
@@ -870,7 +1262,7 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
 
         bool isTargetRes = tile.res == targetRes;
         int renderDelay = PaintTile(hdc, isect, dm, pageNo, tile, tileOnScreen, isTargetRes, renderOutOfDateCue,
-                                    isTargetRes ? &neededScaling : nullptr);
+                                    isTargetRes ? &neededScaling : nullptr, &painted);
         if (!(isTargetRes && 0 == renderDelay) && tile.res < maxRes) {
             queue.Append(TilePosition(tile.res + 1, tile.row * 2, tile.col * 2));
             queue.Append(TilePosition(tile.res + 1, tile.row * 2, tile.col * 2 + 1));
@@ -891,6 +1283,12 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
         }
     }
 
+    // if there's nothing at all to show for this page (not even a bitmap at a
+    // different zoom level to scale), get a quick low-resolution preview first
+    if (!painted && !isRemoteSession && renderDelayMin != RENDER_DELAY_FAILED && !Exists(dm, pageNo, rotation)) {
+        RequestPreview(dm, pageNo);
+    }
+
     if (gConserveMemory) {
         if (!neededScaling) {
             if (renderOutOfDateCue) {
@@ -918,4 +1316,5 @@ void RenderCache::LogCacheSize() {
         }
     }
     logValueSize("bitmapCache", size);
+    logValueSize("compressedBitmapCache", compressedCacheSize);
 }
@@ -14,6 +14,14 @@ constexpr int RENDER_DELAY_FAILED = std::numeric_limits<int>::max() - 2;
 // TODO: this should be based on amount of memory taken by rendered pages
 // i.e. one big page can use as much memory as lots of small pages
 #define MAX_BITMAPS_CACHED 64
+// bitmaps that are no longer visible are kept compressed (as long as they
+// fit into this many bytes) so that scrolling back doesn't require re-rendering
+constexpr i64 kMaxCompressedCacheSize = 64 * 1024 * 1024;
+
+// previews are rendered at this fraction of the zoom level
+constexpr float kPreviewZoomFactor = 0.25f;
+// don't bother with a preview if it would be smaller than this (in either dimension)
+constexpr int kPreviewMinSize = 100;
 
 struct PageInfo;
 
@@ -49,6 +57,10 @@ struct BitmapCacheEntry {
     // owned by the BitmapCacheEntry
     RenderedBitmap* bitmap = nullptr;
     bool outOfDate = false;
+    // a low-resolution rendering of the whole page, only shown until
+    // the page has been rendered at the proper resolution. Uses the tile
+    // of resolution 0 but is only found by FindPreview()
+    bool isPreview = false;
     int refs = 1;
 
     BitmapCacheEntry(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile,
@@ -65,6 +77,31 @@ struct BitmapCacheEntry {
     }
 };
 
+/* Pixels of a BitmapCacheEntry that went out of view, run-length compressed
+   with PackBits on the render thread (see FreeNotVisible() and CompressPending()).
+   Is turned back into a BitmapCacheEntry when the tile is needed again. */
+struct CompressedCacheEntry {
+    DisplayModel* dm = nullptr;
+    int pageNo = 0;
+    int rotation = 0;
+    float zoom = 0.f;
+    TilePosition tile;
+
+    // the bitmap while it's waiting to be compressed
+    RenderedBitmap* bitmap = nullptr;
+
+    Size size;
+    // header and (for 8-bit bitmaps) palette of the DIB
+    BITMAPINFO* bmi = nullptr;
+    ByteSlice data;
+
+    ~CompressedCacheEntry() {
+        delete bitmap;
+        free(bmi);
+        data.Free();
+    }
+};
+
 /* Even though this looks a lot like a BitmapCacheEntry, we keep it
    separate for clarity in the code (PageRenderRequests are reused,
    while BitmapCacheEntries are ref-counted) */
@@ -76,6 +113,7 @@ struct PageRenderRequest {
     TilePosition tile;
 
     RectF pageRect; // calculated from TilePosition
+    bool isPreview = false;
     bool abort = false;
     AbortCookie* abortCookie = nullptr;
     DWORD timestamp = 0;
@@ -91,6 +129,14 @@ struct RenderCache {
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION cacheAccess;
 
+    // oldest first, also protected by cacheAccess
+    Vec<CompressedCacheEntry*> compressedCache;
+    i64 compressedCacheSize = 0;
+    // the entry the render thread is compressing (it's not in compressedCache
+    // in the meantime). Set compressingDropped instead of freeing it
+    CompressedCacheEntry* compressing = nullptr;
+    bool compressingDropped = false;
+
     PageRenderRequest requests[MAX_PAGE_REQUESTS]{};
     int requestCount = 0;
     PageRenderRequest* curReq = nullptr;
@@ -137,18 +183,28 @@ struct RenderCache {
     }
     int GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile);
     void RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, bool clearQueueForPage = true);
+    float GetPreviewZoom(DisplayModel* dm, int pageNo) const;
+    void RequestPreview(DisplayModel* dm, int pageNo);
     bool Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile = nullptr,
-                RectF* pageRect = nullptr, const OnBitmapRendered* renderCb = nullptr);
+                RectF* pageRect = nullptr, const OnBitmapRendered* renderCb = nullptr, bool isPreview = false);
     void ClearQueueForDisplayModel(DisplayModel* dm, int pageNo = kInvalidPageNo, TilePosition* tile = nullptr);
     void AbortCurrentRequest();
 
     BitmapCacheEntry* Find(DisplayModel* dm, int pageNo, int rotation, float zoom = kInvalidZoom,
                            TilePosition* tile = nullptr);
+    BitmapCacheEntry* FindPreview(DisplayModel* dm, int pageNo, int rotation);
     bool DropCacheEntry(BitmapCacheEntry* entry);
     void FreePage(DisplayModel* dm, int pageNo, TilePosition* tile = nullptr);
     void FreeNotVisible();
 
+    void CompressPending();
+    void AddCompressed(CompressedCacheEntry* e);
+    int FindCompressed(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile);
+    BitmapCacheEntry* RestoreCompressed(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile);
+    void DropCompressed(int idx);
+    void FreeCompressed(DisplayModel* dm, int pageNo = kInvalidPageNo, TilePosition* tile = nullptr);
+
     int PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, TilePosition tile, Rect tileOnScreen,
-                  bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement);
+                  bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement, bool* painted);
     void LogCacheSize();
 };
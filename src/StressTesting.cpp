@@ -2,6 +2,8 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+#include <chm_lib.h>
+#include "utils/Archive.h"
 #include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
@@ -19,6 +21,8 @@
 #include "EngineAll.h"
 #include "GlobalPrefs.h"
 #include "ChmModel.h"
+#include "EbookBase.h"
+#include "ChmFile.h"
 #include "DisplayModel.h"
 #include "RenderCache.h"
 #include "ProgressUpdateUI.h"
@@ -63,6 +67,48 @@ static bool IsFullRange(Vec<PageRange>& ranges) {
     return isFull;
 }
 
+// fit page into a typical laptop screen
+constexpr float kBenchFitPageDx = 1366.f;
+constexpr float kBenchFitPageDy = 768.f;
+
+static double BenchRenderFitPage(EngineBase* engine, int pagenum, float zoom) {
+    auto t = TimeGet();
+    RenderPageArgs args(pagenum, zoom, 0);
+    RenderedBitmap* rendered = engine->RenderPage(args);
+    if (!rendered) {
+        return -1;
+    }
+    delete rendered;
+    return TimeSinceInMs(t);
+}
+
+// compares rendering at fit page zoom with and without decoding images
+// at reduced resolution. The page is dropped from the cache before each
+// render so that both include decoding the image
+static void BenchFitPageImage(EngineBase* engine, int pagenum) {
+    RectF mbox = engine->PageMediabox(pagenum);
+    if (mbox.IsEmpty()) {
+        return;
+    }
+    float zoom = std::min(kBenchFitPageDx / mbox.dx, kBenchFitPageDy / mbox.dy);
+    if (zoom >= 1.f) {
+        return;
+    }
+    bool wasReduced = gReducedImageDecoding;
+    gReducedImageDecoding = true;
+    DropCachedImagePage(engine, pagenum);
+    double reducedMs = BenchRenderFitPage(engine, pagenum, zoom);
+    gReducedImageDecoding = false;
+    DropCachedImagePage(engine, pagenum);
+    double fullMs = BenchRenderFitPage(engine, pagenum, zoom);
+    gReducedImageDecoding = wasReduced;
+    if (reducedMs < 0 || fullMs < 0) {
+        logf("Error: failed to render page %d at fit page\n", pagenum);
+        return;
+    }
+    logf("pagefit    %3d: %.2f ms (full resolution: %.2f ms, zoom: %.2f)\n", pagenum, reducedMs, fullMs, zoom);
+}
+
 static void BenchLoadRender(EngineBase* engine, int pagenum) {
     auto t = TimeGet();
     bool ok = engine->BenchLoadPage(pagenum);
@@ -74,6 +120,10 @@ static void BenchLoadRender(EngineBase* engine, int pagenum) {
     double timeMs = TimeSinceInMs(t);
     logf("pageload   %3d: %.2f ms\n", pagenum, timeMs);
 
+    if (engine->isImageCollection) {
+        BenchFitPageImage(engine, pagenum);
+    }
+
     t = TimeGet();
     RenderPageArgs args(pagenum, 1.0, 0);
     RenderedBitmap* rendered = engine->RenderPage(args);
@@ -101,11 +151,70 @@ static void BenchChmLoadOnly(const char* filePath) {
     double timeMs = TimeSinceInMs(t);
     logf("load: %.2f ms\n", timeMs);
 
+    // simulate navigating through all pages, forward and then back
+    int nPages = chmModel->pages.Size();
+    t = TimeGet();
+    for (int i = 0; i < nPages; i++) {
+        ByteSlice d = chmModel->doc->GetData(chmModel->pages.At(i));
+        d.Free();
+    }
+    for (int i = nPages - 1; i >= 0; i--) {
+        ByteSlice d = chmModel->doc->GetData(chmModel->pages.At(i));
+        d.Free();
+    }
+    timeMs = TimeSinceInMs(t);
+    struct chmCacheStats stats{};
+    chm_get_cache_stats(chmModel->doc->chmHandle, &stats);
+    logf("navigate %d pages: %.2f ms (block cache hits: %d, misses: %d, blocks decompressed: %d)\n", nPages, timeMs,
+         (int)stats.hits, (int)stats.misses, (int)stats.blocks_decompressed);
+
     delete chmModel;
 
     logf("Finished (in %.2f ms): %s\n", TimeSinceInMs(total), filePath);
 }
 
+static MultiFormatArchive* OpenComicArchive(const char* path, Kind kind) {
+    if (kind == kindFileCbz || kind == kindFileZip) {
+        return OpenZipArchive(path, false);
+    }
+    if (kind == kindFileCbr || kind == kindFileRar) {
+        return OpenRarArchive(path);
+    }
+    if (kind == kindFileCb7 || kind == kindFile7Z) {
+        return Open7zArchive(path);
+    }
+    return nullptr;
+}
+
+// times reading all files of a comic book archive in order and then in
+// reverse order (i.e. turning pages backwards), which is expensive
+// for solid archives
+static void BenchArchive(const char* path, Kind kind) {
+    MultiFormatArchive* archive = OpenComicArchive(path, kind);
+    if (!archive) {
+        return;
+    }
+    int nFiles = archive->GetFileInfos().Size();
+
+    auto t = TimeGet();
+    for (int i = 0; i < nFiles; i++) {
+        ByteSlice d = archive->GetFileDataById((size_t)i);
+        d.Free();
+    }
+    double inOrderMs = TimeSinceInMs(t);
+
+    t = TimeGet();
+    for (int i = nFiles - 1; i >= 0; i--) {
+        ByteSlice d = archive->GetFileDataById((size_t)i);
+        d.Free();
+    }
+    double reverseMs = TimeSinceInMs(t);
+
+    logf("archive: %d files, in order: %.2f ms, reverse order: %.2f ms (solid cache hits: %d, restarts: %d)\n",
+         nFiles, inOrderMs, reverseMs, archive->nSolidCacheHits, archive->nSolidRestarts);
+    delete archive;
+}
+
 static void BenchFile(const char* path, const char* pagesSpec) {
     if (!file::Exists(path)) {
         return;
@@ -128,6 +237,8 @@ static void BenchFile(const char* path, const char* pagesSpec) {
     auto total = TimeGet();
     logf("Starting: %s\n", path);
 
+    BenchArchive(path, kind);
+
     auto t = TimeGet();
     EngineBase* engine = CreateEngineFromFile(path, nullptr, true);
     if (!engine) {
@@ -137,6 +248,17 @@ static void BenchFile(const char* path, const char* pagesSpec) {
 
     double timeMs = TimeSinceInMs(t);
     logf("load: %.2f ms\n", timeMs);
+    if (engine->IsLoadingPages()) {
+        // e.g. ebooks are shown after laying out the first pages,
+        // so the above is the time to first page
+        logf("first pages: %d\n", engine->PageCount());
+        while (engine->IsLoadingPages()) {
+            if (!engine->AddLoadedPages()) {
+                Sleep(1);
+            }
+        }
+        logf("load all pages: %.2f ms\n", TimeSinceInMs(t));
+    }
     int pages = engine->PageCount();
     logf("page count: %d\n", pages);
 
@@ -194,6 +316,8 @@ static void BenchDir(char* dir) {
 }
 
 void BenchFileOrDir(StrVec& pathsToBench) {
+    // pages decoded in the background would be timed as cache hits
+    gImageDecodeAhead = false;
     int n = pathsToBench.Size() / 2;
     for (int i = 0; i < n; i++) {
         char* path = pathsToBench.At(2 * i);
@@ -20,6 +20,7 @@
 #include "utils/GdiPlusUtil.h"
 #include "utils/Archive.h"
 #include "utils/Timer.h"
+#include "utils/TimingStats.h"
 #include "utils/LzmaSimpleArchive.h"
 
 #include "wingui/UIModels.h"
@@ -454,17 +455,21 @@ class HwndPasswordUI : public PasswordUI {
     explicit HwndPasswordUI(HWND hwnd) : hwnd(hwnd), pwdIdx(0) {
     }
 
-    char* GetPassword(const char* fileName, u8* fileDigest, u8 decryptionKeyOut[32], bool* saveKey) override;
+    char* GetPassword(const char* fileName, FileFingerprint* fingerprint, u8 decryptionKeyOut[32],
+                      bool* saveKey) override;
 };
 
 /* Get password for a given 'fileName', can be nullptr if user cancelled the
    dialog box or if the encryption key has been filled in instead.
    Caller needs to free() the result. */
-char* HwndPasswordUI::GetPassword(const char* path, u8* fileDigest, u8 decryptionKeyOut[32], bool* saveKey) {
+char* HwndPasswordUI::GetPassword(const char* path, FileFingerprint* fingerprint, u8 decryptionKeyOut[32],
+                                  bool* saveKey) {
     FileState* fileFromHistory = gFileHistory.FindByName(path, nullptr);
-    if (fileFromHistory && fileFromHistory->decryptionKey) {
-        AutoFreeStr fingerprint = str::MemToHex(fileDigest, 16);
-        *saveKey = str::StartsWith(fileFromHistory->decryptionKey, fingerprint.Get());
+    u8 fileDigest[16]{};
+    // the fingerprint is only needed (and calculated) if we've remembered a key
+    if (fileFromHistory && fileFromHistory->decryptionKey && fingerprint && fingerprint->Get(fileDigest)) {
+        AutoFreeStr fingerprintHex = str::MemToHex(fileDigest, 16);
+        *saveKey = str::StartsWith(fileFromHistory->decryptionKey, fingerprintHex.Get());
         if (*saveKey && str::HexToMem(fileFromHistory->decryptionKey + 32, decryptionKeyOut, 32)) {
             return nullptr;
         }
@@ -704,20 +709,14 @@ struct ControllerCallbackHandler : DocControllerCallback {
 
 void ControllerCallbackHandler::RenderThumbnail(DisplayModel* dm, Size size, const OnBitmapRendered* saveThumbnail) {
     auto engine = dm->GetEngine();
-    RectF pageRect = engine->PageMediabox(1);
-    if (pageRect.IsEmpty()) {
+    float zoom;
+    RectF pageRect;
+    if (!GetThumbnailPageRect(engine, size, &zoom, &pageRect)) {
         // saveThumbnail must always be called for clean-up code
         saveThumbnail->Call(nullptr);
         return;
     }
 
-    pageRect = engine->Transform(pageRect, 1, 1.0f, 0);
-    float zoom = size.dx / (float)pageRect.dx;
-    if (pageRect.dy > (float)size.dy / zoom) {
-        pageRect.dy = (float)size.dy / zoom;
-    }
-    pageRect = engine->Transform(pageRect, 1, 1.0f, 0, true);
-
     gRenderCache->Render(dm, 1, 0, zoom, pageRect, *saveThumbnail);
 }
 
@@ -1107,6 +1106,24 @@ static bool showTocByDefault(const char* path) {
     return showByDefault;
 }
 
+static void AddLoadedPagesToDocument(DisplayModel* dm) {
+    // the document might have been closed in the meantime
+    MainWindow* win = FindMainWindowByController(dm);
+    if (!win || !dm->AddLoadedPages()) {
+        return;
+    }
+    if (win->ctrl == dm) {
+        UpdateToolbarPageText(win, dm->PageCount(), true);
+        ToolbarUpdateStateForWindow(win, false);
+    }
+}
+
+// called from the engine's background thread
+static void ScheduleAddLoadedPages(DisplayModel* dm) {
+    auto fn = MkFunc0<DisplayModel>(AddLoadedPagesToDocument, dm);
+    uitask::Post(fn, "TaskAddLoadedPages");
+}
+
 // Document is represented as DocController. Replace current DocController (if any) with ctrl
 // in current tab.
 // meaning of the internal values of LoadArgs:
@@ -1192,6 +1209,7 @@ static void ReplaceDocumentInCurrentTab(LoadArgs* args, DocController* ctrl, Fil
                 dpi = DpiGetForHwnd(win->hwndFrame);
             }
             dm->SetInitialViewSettings(displayMode, ss.page, win->GetViewPortSize(), dpi);
+            dm->LoadContentBoxes();
             // TODO: also expose Manga Mode for image folders?
             if (tab->GetEngineType() == kindEngineComicBooks || tab->GetEngineType() == kindEngineImageDir) {
                 dm->SetDisplayR2L(fs ? fs->displayR2L : gGlobalPrefs->comicBookUI.cbxMangaMode);
@@ -1205,6 +1223,8 @@ static void ReplaceDocumentInCurrentTab(LoadArgs* args, DocController* ctrl, Fil
                 win->uiaProvider->OnDocumentUnload();
                 win->uiaProvider->OnDocumentLoad(dm);
             }
+            // e.g. big image directories are still being loaded
+            dm->GetEngine()->SetOnPagesLoaded(MkFunc0<DisplayModel>(ScheduleAddLoadedPages, dm));
         } else if (win->AsChm()) {
             win->AsChm()->SetParentHwnd(win->hwndCanvas);
             win->ctrl->SetDisplayMode(displayMode);
@@ -1228,6 +1248,10 @@ static void ReplaceDocumentInCurrentTab(LoadArgs* args, DocController* ctrl, Fil
             }
             // else let win->AsFixed()->Relayout() scroll to fit the page (again)
         } else if (win->ctrl->PageCount() > 0) {
+            if (win->AsFixed() && ss.page > win->ctrl->PageCount()) {
+                // the page might not have been loaded yet
+                win->AsFixed()->RestorePageWhenLoaded(ss.page);
+            }
             ss.page = limitValue(ss.page, 1, win->ctrl->PageCount());
         }
         // else let win->ctrl->GoToPage(ss.page, false) verify the page number
@@ -5084,6 +5108,34 @@ static void TogglePredictiveRender(MainWindow* win) {
     ShowNotification(args);
 }
 
+static void ToggleRenderTimings(MainWindow* win) {
+    gTimingStatsEnabled = !gTimingStatsEnabled;
+    if (gTimingStatsEnabled) {
+        TimingStatsResetAll();
+    } else {
+        TimingStatsLogAll();
+    }
+    NotificationCreateArgs args;
+    args.hwndParent = win->hwndCanvas;
+    args.msg = gTimingStatsEnabled ? "Enabled render timings" : "Disabled render timings";
+    args.timeoutMs = 3000;
+    ShowNotification(args);
+}
+
+// log the render timings and save them as render-timings.json in app data directory
+static void SaveRenderTimings(MainWindow* win) {
+    TimingStatsLogAll();
+    str::Str json;
+    TimingStatsToJson(json);
+    TempStr path = GetPathInAppDataDirTemp("render-timings.json");
+    bool ok = path && file::WriteFile(path, json.AsByteSlice());
+    NotificationCreateArgs args;
+    args.hwndParent = win->hwndCanvas;
+    args.msg = ok ? str::FormatTemp("Saved render timings to '%s'", path) : "Failed to save render timings";
+    args.timeoutMs = 5000;
+    ShowNotification(args);
+}
+
 static void DownloadDebugSymbols() {
     TempStr msg = (TempStr) "Symbols were already downloaded";
 
@@ -6116,6 +6168,14 @@ static LRESULT FrameOnCommand(MainWindow* win, HWND hwnd, UINT msg, WPARAM wp, L
             TogglePredictiveRender(win);
             break;
 
+        case CmdDebugToggleRenderTimings:
+            ToggleRenderTimings(win);
+            break;
+
+        case CmdDebugSaveRenderTimings:
+            SaveRenderTimings(win);
+            break;
+
         case CmdToggleLinks:
             gGlobalPrefs->showLinks = !gGlobalPrefs->showLinks;
             for (auto& w : gWindows) {
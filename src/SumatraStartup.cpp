@@ -964,6 +964,8 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
     ScopedGdiPlus gdiPlus(true);
     mui::Initialize();
     uitask::Initialize();
+    // the UI adds the pages laid out in the background (see EngineBase::AddLoadedPages())
+    gEbookIncrementalLayout = true;
 
     if (!IsDebuggerPresent()) {
         // VSCode shows both debugger output and console out which doubles the logging
@@ -1157,6 +1159,10 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
     if (flags.pathsToBenchmark.Size() > 0) {
         BenchFileOrDir(flags.pathsToBenchmark);
     }
+    if (gGlobalPrefs->rememberOpenedFiles) {
+        // ebooks are laid out again only if the layout cache is out of date
+        SetEbookLayoutCacheDir(GetThumbnailCacheDirTemp());
+    }
 
     if (flags.exitImmediately) {
         goto Exit;
@@ -1379,6 +1385,10 @@ ContinueOpenWindow:
     }
     // call this once it's clear whether Perm::SavePreferences has been granted
     RegisterSettingsForFileChanges();
+    // fill in thumbnails missing from the home page (e.g. after a profile migration)
+    if (showStartPage && HasPermission(Perm::SavePreferences)) {
+        CreateMissingThumbnailsAsync();
+    }
 
     // Change current directory for 2 reasons:
     // * prevent dll hijacking (LoadLibrary first loads from current directory
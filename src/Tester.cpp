@@ -15,6 +15,9 @@
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPrettyPrint.h"
+#include "utils/HtmlPullParser.h"
+#include "utils/PixelUtil.h"
+#include "utils/ThreadUtil.h"
 #include "mui/Mui.h"
 #include "utils/Timer.h"
 #include "utils/WinUtil.h"
@@ -26,6 +29,7 @@
 #include "DocProperties.h"
 #include "DocController.h"
 #include "EngineBase.h"
+#include "EngineAll.h"
 #include "EbookBase.h"
 #include "PalmDbReader.h"
 #include "MobiDoc.h"
@@ -42,6 +46,9 @@ static bool gSaveHtml = false;
 static bool gSaveImages = false;
 // if true, we'll do a layout of mobi files
 static bool gLayout = false;
+// if true, layout measures text with fixed metrics (see mui::TextRenderFixed)
+// so that the resulting page count doesn't depend on the machine
+static bool gLayoutFixedMetrics = false;
 // directory to which we'll save mobi html and images
 #define kMobiSaveDir "..\\ebooks-converted"
 
@@ -49,10 +56,17 @@ static int Usage() {
     printf("Tester.exe\n");
     printf("  -mobi dirOrFile : run mobi tests in a given directory or for a given file\n");
     printf("  -layout - will also layout mobi files\n");
+    printf("  -fixed-metrics - layout with fixed text metrics instead of GDI+\n");
     printf("  -save-html] - will save html content of mobi file\n");
     printf("  -save-images - will save images extracted from mobi files\n");
     printf("  -zip-create - creates a sample zip file that needs to be manually checked that it worked\n");
     printf("  -bench-md5 - compare Window's md5 vs. our code\n");
+    printf("  -bench-pixelutil - time palettizing and swapping red/blue of a 4K page vs. scalar code\n");
+    printf("  -bench-strconv - time converting 8 MB of CP1252 text to UTF-8 in chunks vs. all at once\n");
+    printf("  -bench-html - time parsing 8 MB of ebook-like html with HtmlPullParser\n");
+    printf("  -layout-stress file1 file2 ... - lay out ebooks concurrently and compare page counts\n");
+    printf("  -layout-cache - check that truncated ebook layout caches are rejected\n");
+    printf("  -fingerprint - check PDF fingerprints of small files and time them for large sparse files\n");
     system("pause");
     return 1;
 }
@@ -93,7 +107,8 @@ static void MobiSaveImages(const char* filePathBase, MobiDoc* mb) {
 }
 
 // This loads and layouts a given mobi file. Used for profiling layout process.
-static void MobiLayout(MobiDoc* mobiDoc) {
+// Returns the number of pages
+static int MobiLayout(MobiDoc* mobiDoc) {
     PoolAllocator textAllocator;
 
     HtmlFormatterArgs args;
@@ -103,25 +118,35 @@ static void MobiLayout(MobiDoc* mobiDoc) {
     args.fontSize = 12;
     args.htmlStr = mobiDoc->GetHtmlData();
     args.textAllocator = &textAllocator;
+    if (gLayoutFixedMetrics) {
+        args.textRenderMethod = mui::TextRenderMethod::Fixed;
+    }
 
     MobiFormatter mf(&args, mobiDoc);
     Vec<HtmlPage*>* pages = mf.FormatAllPages();
+    int nPages = pages->Size();
     DeleteVecMembers<HtmlPage*>(*pages);
     delete pages;
+    return nPages;
 }
 
 static void MobiTestFile(const char* filePath) {
     printf("Testing file '%s'\n", filePath);
+    auto t = TimeGet();
     MobiDoc* mobiDoc = MobiDoc::CreateFromFile(filePath);
     if (!mobiDoc) {
         printf(" error: failed to parse the file\n");
         return;
     }
+    double loadMs = TimeSinceInMs(t);
+    ByteSlice html = mobiDoc->GetHtmlData();
+    printf("Spent %.2f ms loading %s (%.2f MB of text, %.2f MB/s)\n", loadMs, filePath,
+           (double)html.size() / (1024 * 1024), (double)html.size() / (1024 * 1024) / (loadMs / 1000));
 
     if (gLayout) {
-        auto t = TimeGet();
-        MobiLayout(mobiDoc);
-        printf("Spent %.2f ms laying out %s\n", TimeSinceInMs(t), filePath);
+        t = TimeGet();
+        int nPages = MobiLayout(mobiDoc);
+        printf("Spent %.2f ms laying out %s (%d pages)\n", TimeSinceInMs(t), filePath, nPages);
     }
 
     if (gSaveHtml || gSaveImages) {
@@ -191,6 +216,321 @@ void ZipCreateTest() {
     }
 }
 
+// mimics a rendered text page: white background with short runs of
+// anti-aliased gray and black "glyphs" on every other band of rows
+static u8* MakeTextPixmap(int dx, int dy, int stride) {
+    u8* d = AllocArray<u8>((size_t)stride * dy);
+    memset(d, 0xff, (size_t)stride * dy);
+    for (int y = 0; y < dy; y++) {
+        if ((y / 16) % 2 == 0) {
+            continue;
+        }
+        u8* row = d + (size_t)y * stride;
+        for (int x = (y * 7) % 13; x < dx - 8; x += 11 + (x % 5)) {
+            for (int i = 0; i < 4; i++) {
+                u8 v = (u8)((x + y + i) % 16 * 16);
+                row[(x + i) * 4 + 0] = v;
+                row[(x + i) * 4 + 1] = v;
+                row[(x + i) * 4 + 2] = v;
+            }
+        }
+    }
+    return d;
+}
+
+static void BenchPixelUtil() {
+    // a 4K page
+    int dx = 3840;
+    int dy = 2160;
+    int stride = dx * 4;
+    u8* src = MakeTextPixmap(dx, dy, stride);
+    u8* dst = AllocArray<u8>((size_t)stride * dy);
+    u32 palette[256];
+    const int kIterations = 5;
+
+    auto t = TimeGet();
+    for (int i = 0; i < kIterations; i++) {
+        PalettizeRgbxScalar(src, stride, dst, dx, dx, dy, palette);
+    }
+    double palScalarMs = TimeSinceInMs(t) / kIterations;
+    t = TimeGet();
+    for (int i = 0; i < kIterations; i++) {
+        PalettizeRgbx(src, stride, dst, dx, dx, dy, palette);
+    }
+    double palMs = TimeSinceInMs(t) / kIterations;
+
+    t = TimeGet();
+    for (int i = 0; i < kIterations; i++) {
+        SwapRedBlueScalar(src, stride, dst, stride, dx, dy);
+    }
+    double swapScalarMs = TimeSinceInMs(t) / kIterations;
+    t = TimeGet();
+    for (int i = 0; i < kIterations; i++) {
+        SwapRedBlue(src, stride, dst, stride, dx, dy);
+    }
+    double swapMs = TimeSinceInMs(t) / kIterations;
+
+    printf("PixelUtil %dx%d text page: palettize %.2f ms (scalar %.2f ms), swap red/blue %.2f ms (scalar %.2f ms)\n",
+           dx, dy, palMs, palScalarMs, swapMs, swapScalarMs);
+    free(src);
+    free(dst);
+}
+
+static void BenchStrConv() {
+    // text with a non-ASCII character every few bytes
+    size_t len = 8 * 1024 * 1024;
+    char* s = AllocArray<char>(len + 1);
+    for (size_t i = 0; i < len; i++) {
+        s[i] = (i % 7 == 6) ? (char)(0xC0 + i % 64) : (char)('a' + i % 26);
+    }
+    auto t = TimeGet();
+    TempStr all = strconv::ToMultiByteTemp(s, 1252, CP_UTF8);
+    double allMs = TimeSinceInMs(t);
+    t = TimeGet();
+    str::Str chunked(len + len / 8);
+    strconv::AppendAsUtf8(chunked, s, len, 1252);
+    double chunkedMs = TimeSinceInMs(t);
+    if (!str::Eq(chunked.Get(), all)) {
+        printf("BenchStrConv: converting in chunks gave a different result\n");
+    }
+    printf("StrConv %d MB from CP1252: in chunks %.2f ms (all at once %.2f ms)\n", (int)(len >> 20), chunkedMs,
+           allMs);
+    free(s);
+    ResetTempAllocator();
+}
+
+static void BenchHtmlPullParser() {
+    const char* chunk =
+        "<p class=\"calibre\" style='text-indent: 1em'>Lorem ipsum dolor sit amet, <i>consectetur</i> adipiscing "
+        "elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua &amp; ut enim ad minim veniam.</p>\n"
+        "<div id=\"c1\"><span>quis nostrud</span> <a href=\"chapter2.html#note1\">exercitation</a><br/></div>\n"
+        "<!-- a comment --><h2 class=\"title\">Chapter</h2><img src=\"images/00001.jpg\" alt=\"cover\"/>\n";
+    str::Str html;
+    while (html.size() < 8 * 1024 * 1024) {
+        html.Append(chunk);
+    }
+
+    auto t = TimeGet();
+    int nTokens = 0;
+    int nAttrs = 0;
+    HtmlPullParser parser(html.Get(), html.size());
+    while (HtmlToken* tok = parser.Next()) {
+        nTokens++;
+        if (tok->IsStartTag() || tok->IsEmptyElementEndTag()) {
+            while (tok->NextAttr()) {
+                nAttrs++;
+            }
+        }
+    }
+    double ms = TimeSinceInMs(t);
+    double mb = (double)html.size() / (1024 * 1024);
+    printf("HtmlPullParser: %.1f MB, %d tokens, %d attributes in %.2f ms (%.1f MB/s)\n", mb, nTokens, nAttrs, ms,
+           mb * 1000 / ms);
+}
+
+constexpr int kLayoutStressRounds = 4;
+
+struct LayoutStressData {
+    const char* path = nullptr;
+    // page count when laid out alone
+    int nPages = 0;
+    int nMismatches = 0;
+};
+
+// waits until the background layout has finished and releases the engine
+static int LayoutAllPages(EngineBase* engine) {
+    if (!engine) {
+        return -1;
+    }
+    while (engine->IsLoadingPages()) {
+        if (!engine->AddLoadedPages()) {
+            Sleep(1);
+        }
+    }
+    int nPages = engine->PageCount();
+    SafeEngineRelease(&engine);
+    return nPages;
+}
+
+static int LayoutEbookPageCount(const char* path) {
+    return LayoutAllPages(CreateEngineFromFile(path, nullptr, true));
+}
+
+static void LayoutStressThread(LayoutStressData* d) {
+    for (int i = 0; i < kLayoutStressRounds; i++) {
+        if (LayoutEbookPageCount(d->path) != d->nPages) {
+            d->nMismatches++;
+        }
+        ResetTempAllocator();
+    }
+}
+
+// lays out ebooks on several threads at once (so that their layout threads
+// measure text concurrently) and checks that they get the same page counts
+// as when each is laid out alone
+static void LayoutStressTest(StrVec& paths) {
+    int n = paths.Size();
+    Vec<LayoutStressData> data;
+    for (int i = 0; i < n; i++) {
+        LayoutStressData d;
+        d.path = paths.At(i);
+        d.nPages = LayoutEbookPageCount(d.path);
+        if (d.nPages < 0) {
+            printf("LayoutStressTest: failed to open '%s'\n", d.path);
+            return;
+        }
+        data.Append(d);
+    }
+
+    auto t = TimeGet();
+    Vec<HANDLE> threads;
+    for (int i = 0; i < n; i++) {
+        auto fn = MkFunc0<LayoutStressData>(LayoutStressThread, &data.at(i));
+        threads.Append(StartThread(fn, "LayoutStressThread"));
+    }
+    for (HANDLE h : threads) {
+        WaitForSingleObject(h, INFINITE);
+        CloseHandle(h);
+    }
+    for (LayoutStressData& d : data) {
+        printf("%s: %d pages, %d of %d concurrent layouts differed\n", d.path, d.nPages, d.nMismatches,
+               kLayoutStressRounds);
+    }
+    printf("LayoutStressTest: %.2f ms\n", TimeSinceInMs(t));
+}
+
+// lays out a generated text document, truncates the layout cache saved for it
+// at many points and checks that the document is then laid out again
+static void LayoutCacheTest() {
+    TempStr dir = path::JoinTemp(GetTempDirTemp(), "SumatraLayoutCacheTest");
+    dir::CreateAll(dir);
+    SetEbookLayoutCacheDir(dir);
+    TempStr txtPath = path::JoinTemp(dir, "layout.txt");
+    str::Str txt;
+    while (txt.size() < 64 * 1024) {
+        txt.Append("Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor.\r\n");
+    }
+    file::WriteFile(txtPath, txt.AsByteSlice());
+
+    // lays out the document and saves the layout cache
+    int nPages = LayoutAllPages(CreateEngineTxtFromFile(txtPath));
+    TempStr cachePath = GetEbookLayoutCachePathTemp(txtPath);
+    ByteSlice cache = file::ReadFile(cachePath);
+    if (nPages <= 0 || cache.empty()) {
+        printf("LayoutCacheTest: the layout cache wasn't saved\n");
+    } else {
+        int nFailed = 0;
+        int nTests = 0;
+        size_t step = std::max(cache.size() / 64, (size_t)1);
+        for (size_t size = 0; size < cache.size(); size += step) {
+            // the cache is overwritten by every layout
+            file::WriteFile(cachePath, {cache.data(), size});
+            if (LayoutAllPages(CreateEngineTxtFromFile(txtPath)) != nPages) {
+                printf("LayoutCacheTest: wrong page count with the cache truncated to %d bytes\n", (int)size);
+                nFailed++;
+            }
+            nTests++;
+            ResetTempAllocator();
+        }
+        file::WriteFile(cachePath, cache);
+        if (LayoutAllPages(CreateEngineTxtFromFile(txtPath)) != nPages) {
+            printf("LayoutCacheTest: wrong page count when loaded from the cache\n");
+            nFailed++;
+        }
+        printf("LayoutCacheTest: %d pages, %d of %d truncated caches failed\n", nPages, nFailed, nTests);
+    }
+    cache.Free();
+    SetEbookLayoutCacheDir(nullptr);
+    dir::RemoveAll(dir);
+}
+
+// a file of the given size that only takes up disk space for the data at its start
+static bool CreateSparseFile(const char* path, i64 size) {
+    DWORD access = GENERIC_READ | GENERIC_WRITE;
+    AutoCloseHandle h = CreateFileW(ToWStrTemp(path), access, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (!h.IsValid()) {
+        return false;
+    }
+    DWORD n;
+    if (!DeviceIoControl(h, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &n, nullptr)) {
+        return false;
+    }
+    const char* header = "%PDF-1.7\n";
+    if (!::WriteFile(h, header, (DWORD)str::Len(header), &n, nullptr)) {
+        return false;
+    }
+    LARGE_INTEGER off;
+    off.QuadPart = size;
+    return SetFilePointerEx(h, off, nullptr, FILE_BEGIN) && SetEndOfFile(h);
+}
+
+static double TimeFingerprint(const char* path, bool fromStream, u8 digest[16]) {
+    auto t = TimeGet();
+    if (!CalcPdfFileFingerprint(path, fromStream, digest)) {
+        return -1;
+    }
+    return TimeSinceInMs(t);
+}
+
+// the fingerprint of files smaller than 1 GB must still be the md5 of the
+// whole file (so that remembered decryption keys keep working) and larger
+// files must take about the same time no matter how large they are
+static void FingerprintTest() {
+    int nFailed = 0;
+    TempStr dir = path::JoinTemp(GetTempDirTemp(), "SumatraFingerprintTest");
+    dir::CreateAll(dir);
+
+    // large enough to not be read into memory when opened
+    TempStr path = path::JoinTemp(dir, "small.pdf");
+    str::Str s;
+    for (int i = 0; s.size() < 40 * 1024 * 1024; i++) {
+        s.AppendFmt("%d 0 obj << /Length %d >> endobj\n", i, i * 7);
+    }
+    file::WriteFile(path, s.AsByteSlice());
+    u8 expected[16];
+    CalcMD5Digest(s.Get(), (int)s.size(), expected);
+    for (bool fromStream : {false, true}) {
+        u8 digest[16];
+        double ms = TimeFingerprint(path, fromStream, digest);
+        if (ms < 0 || !memeq(digest, expected, sizeof(digest))) {
+            printf("FingerprintTest: wrong fingerprint of a %d MB file (fromStream: %d)\n", (int)(s.size() >> 20),
+                   (int)fromStream);
+            nFailed++;
+        }
+    }
+
+    i64 sizes[] = {(i64)2 << 30, (i64)64 << 30};
+    double times[2][2]{};
+    for (int i = 0; i < 2; i++) {
+        path = path::JoinTemp(dir, str::FormatTemp("sparse%d.pdf", i));
+        if (!CreateSparseFile(path, sizes[i])) {
+            printf("FingerprintTest: couldn't create a sparse file of %d GB\n", (int)(sizes[i] >> 30));
+            nFailed++;
+            continue;
+        }
+        for (int fromStream = 0; fromStream < 2; fromStream++) {
+            u8 digest[16];
+            times[i][fromStream] = TimeFingerprint(path, fromStream != 0, digest);
+            printf("FingerprintTest: %d GB sparse file in %.2f ms (fromStream: %d)\n", (int)(sizes[i] >> 30),
+                   times[i][fromStream], fromStream);
+        }
+        file::Delete(path);
+    }
+    for (int fromStream = 0; fromStream < 2; fromStream++) {
+        double small = times[0][fromStream];
+        double large = times[1][fromStream];
+        // 32 times the size, but only a few MB are read for either
+        if (small < 0 || large < 0 || large > 4 * small + 100) {
+            printf("FingerprintTest: fingerprint of large files doesn't take constant time (fromStream: %d)\n",
+                   fromStream);
+            nFailed++;
+        }
+    }
+
+    dir::RemoveAll(dir);
+    printf("FingerprintTest: %d failures\n", nFailed);
+}
+
 int TesterMain() {
     RedirectIOToConsole();
 
@@ -220,6 +560,9 @@ int TesterMain() {
         } else if (str::Eq(arg, "-layout")) {
             gLayout = true;
             ++i;
+        } else if (str::Eq(arg, "-fixed-metrics")) {
+            gLayoutFixedMetrics = true;
+            ++i;
         } else if (str::Eq(arg, "-save-html")) {
             gSaveHtml = true;
             ++i;
@@ -229,6 +572,32 @@ int TesterMain() {
         } else if (str::Eq(arg, "-zip-create")) {
             ZipCreateTest();
             ++i;
+        } else if (str::Eq(arg, "-bench-pixelutil")) {
+            BenchPixelUtil();
+            ++i;
+        } else if (str::Eq(arg, "-bench-strconv")) {
+            BenchStrConv();
+            ++i;
+        } else if (str::Eq(arg, "-bench-html")) {
+            BenchHtmlPullParser();
+            ++i;
+        } else if (str::Eq(arg, "-layout-stress")) {
+            ++i;
+            StrVec paths;
+            while (i < nArgs && argv.at(i)[0] != '-') {
+                paths.Append(argv.at(i));
+                ++i;
+            }
+            if (paths.Size() < 2) {
+                return Usage();
+            }
+            LayoutStressTest(paths);
+        } else if (str::Eq(arg, "-layout-cache")) {
+            LayoutCacheTest();
+            ++i;
+        } else if (str::Eq(arg, "-fingerprint")) {
+            FingerprintTest();
+            ++i;
         } else {
             // unknown argument
             return Usage();
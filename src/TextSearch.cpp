@@ -309,6 +309,13 @@ bool TextSearch::FindStartingAtPage(int pageNo) {
         return false;
     }
 
+    // the engine might have loaded more pages since the last search
+    if (nPages != engine->PageCount()) {
+        nPages = engine->PageCount();
+        pagesToSkip.SetSize(nPages);
+        markAllPagesNonSkip(pagesToSkip);
+    }
+
     int next = forward ? 1 : -1;
     while ((1 <= pageNo) && (pageNo <= nPages) && !WasCanceled(progressCb)) {
         UpdateProgress(progressCb, pageNo, nPages);
@@ -350,6 +357,7 @@ bool TextSearch::FindStartingAtPage(int pageNo) {
 
 TextSel* TextSearch::FindFirst(int page, const WCHAR* text) {
     SetText(text);
+    textCache->StartIndexing();
 
     if (FindStartingAtPage(page)) {
         return &result;
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/UIModels.h"
@@ -28,10 +29,15 @@ DocumentTextCache::DocumentTextCache(EngineBase* engine) : engine(engine) {
 }
 
 DocumentTextCache::~DocumentTextCache() {
+    if (indexThread) {
+        indexCancel.Set(1);
+        WaitForSingleObject(indexThread, INFINITE);
+        CloseHandle(indexThread);
+    }
+
     EnterCriticalSection(&access);
 
-    int n = engine->PageCount();
-    for (int i = 0; i < n; i++) {
+    for (int i = 0; i < nPages; i++) {
         PageText* pageText = &pagesText[i];
         free(pageText->coords);
         free(pageText->text);
@@ -41,16 +47,34 @@ DocumentTextCache::~DocumentTextCache() {
     DeleteCriticalSection(&access);
 }
 
-bool DocumentTextCache::HasTextForPage(int pageNo) const {
+// the engine might have loaded more pages since the last call
+// (see EngineBase::AddLoadedPages()). Must be called with access held
+static void UpdatePageCount(DocumentTextCache* tc) {
+    int n = tc->engine->PageCount();
+    if (n <= tc->nPages) {
+        return;
+    }
+    PageText* pagesText = AllocArray<PageText>(n);
+    memcpy(pagesText, tc->pagesText, tc->nPages * sizeof(PageText));
+    free(tc->pagesText);
+    tc->pagesText = pagesText;
+    tc->debugSize += (n - tc->nPages) * (sizeof(Rect*) + sizeof(WCHAR*) + sizeof(int));
+    tc->nPages = n;
+}
+
+bool DocumentTextCache::HasTextForPage(int pageNo) {
+    ScopedCritSec scope(&access);
+    UpdatePageCount(this);
     ReportIf(pageNo < 1 || pageNo > nPages);
     PageText* pageText = &pagesText[pageNo - 1];
     return pageText->text != nullptr;
 }
 
 const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** coordsOut) {
+    ScopedCritSec scope(&access);
+    UpdatePageCount(this);
     ReportIf(pageNo < 1 || pageNo > nPages);
 
-    ScopedCritSec scope(&access);
     PageText* pageText = &pagesText[pageNo - 1];
 
     if (!pageText->text) {
@@ -60,6 +84,18 @@ const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** c
             pageText->len = 0;
         }
         debugSize += (pageText->len + 1) * (int)(sizeof(WCHAR) + sizeof(Rect));
+    } else if (coordsOut && !pageText->coords && pageText->len > 0) {
+        // only the text has been indexed (see IndexPage()). The text is kept
+        // because callers might still hold on to it
+        PageText extracted = engine->ExtractPageText(pageNo);
+        if (extracted.coords && extracted.len == pageText->len) {
+            pageText->coords = extracted.coords;
+            extracted.coords = nullptr;
+        } else {
+            pageText->coords = AllocArray<Rect>(pageText->len + 1);
+        }
+        FreePageText(&extracted);
+        debugSize += (pageText->len + 1) * (int)sizeof(Rect);
     }
 
     if (lenOut) {
@@ -71,6 +107,86 @@ const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** c
     return pageText->text;
 }
 
+// like GetTextForPage() but only keeps the text, the coordinates of
+// the glyphs are extracted again when they're needed
+void DocumentTextCache::IndexPage(int pageNo) {
+    ScopedCritSec scope(&access);
+    PageText* pageText = &pagesText[pageNo - 1];
+    if (pageText->text) {
+        return;
+    }
+    *pageText = engine->ExtractPageText(pageNo);
+    free(pageText->coords);
+    pageText->coords = nullptr;
+    if (!pageText->text) {
+        pageText->text = str::Dup(L"");
+        pageText->len = 0;
+    }
+    debugSize += (pageText->len + 1) * (int)sizeof(WCHAR);
+}
+
+static void IndexPagesThread(DocumentTextCache* tc) {
+    for (int pageNo = 1;; pageNo++) {
+        if (tc->indexCancel.Get() != 0) {
+            break;
+        }
+        {
+            ScopedCritSec scope(&tc->access);
+            UpdatePageCount(tc);
+            if (pageNo > tc->nPages) {
+                // StartIndexing() starts over for pages loaded after this
+                tc->isIndexing = false;
+                return;
+            }
+        }
+        // takes access for a single page at a time so that searching
+        // and selecting on the UI thread is never blocked for long
+        tc->IndexPage(pageNo);
+    }
+    ScopedCritSec scope(&tc->access);
+    tc->isIndexing = false;
+}
+
+// ebook engines keep their laid out pages in memory, so extracting
+// the text of all pages is cheap compared to parsing a page
+static bool ShouldIndexText(EngineBase* engine) {
+    Kind kind = engine->kind;
+    return kind == kindEngineEpub || kind == kindEngineFb2 || kind == kindEngineMobi || kind == kindEnginePdb ||
+           kind == kindEngineChm || kind == kindEngineHtml || kind == kindEngineTxt;
+}
+
+// called when searching starts: extracts the text of all pages (including
+// those the engine loads later) in the background, so that searching again
+// (e.g. as the user types) only has to scan cached text
+void DocumentTextCache::StartIndexing() {
+    if (!ShouldIndexText(engine)) {
+        return;
+    }
+    ScopedCritSec scope(&access);
+    indexStarted = true;
+    if (isIndexing) {
+        // will pick up the new pages
+        return;
+    }
+    if (indexThread) {
+        // has exited or is about to
+        WaitForSingleObject(indexThread, INFINITE);
+        CloseHandle(indexThread);
+    }
+    auto fn = MkFunc0<DocumentTextCache>(IndexPagesThread, this);
+    isIndexing = true;
+    indexThread = StartThread(fn, "TextIndexThread");
+    isIndexing = indexThread != nullptr;
+}
+
+// indexes pages loaded in the background if searching has already started
+void DocumentTextCache::IndexLoadedPages() {
+    ScopedCritSec scope(&access);
+    if (indexStarted) {
+        StartIndexing();
+    }
+}
+
 TextSelection::TextSelection(EngineBase* engine, DocumentTextCache* textCache) : engine(engine), textCache(textCache) {
 }
 
@@ -9,11 +9,21 @@ struct DocumentTextCache {
 
     CRITICAL_SECTION access;
 
+    // extracts the text of all pages in the background once searching
+    // starts (protected by access)
+    HANDLE indexThread = nullptr;
+    bool indexStarted = false;
+    bool isIndexing = false;
+    AtomicInt indexCancel;
+
     explicit DocumentTextCache(EngineBase* engine);
     ~DocumentTextCache();
 
-    bool HasTextForPage(int pageNo) const;
+    bool HasTextForPage(int pageNo);
     const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, Rect** coordsOut = nullptr);
+    void IndexPage(int pageNo);
+    void StartIndexing();
+    void IndexLoadedPages();
 };
 
 // TODO: replace with Vec<TextSel>
@@ -477,6 +477,55 @@ TextRenderHdc::~TextRenderHdc() {
     DeleteDC(hdc);
 }
 
+// font sizes are in points, text is measured in pixels at 96 dpi
+static float FixedEmDx(CachedFont* font) {
+    float dx = font->GetSize() * 96.f / 72.f;
+    if (font->GetStyle() & Gdiplus::FontStyleBold) {
+        dx *= 1.1f;
+    }
+    return dx;
+}
+
+// advance of c in em, roughly that of a proportional serif font
+static float FixedCharDx(WCHAR c) {
+    if (c == ' ') {
+        return 0.25f;
+    }
+    if (str::FindChar(L"ijlt.,:;'!|()[]", c)) {
+        return 0.3f;
+    }
+    if ((c >= 'A' && c <= 'Z') || c == 'm' || c == 'w') {
+        return 0.75f;
+    }
+    // CJK and other full-width characters
+    if (c >= 0x2e80) {
+        return 1.f;
+    }
+    return 0.5f;
+}
+
+void TextRenderFixed::SetFont(CachedFont* font) {
+    currFont = font;
+}
+
+float TextRenderFixed::GetCurrFontLineSpacing() {
+    return FixedEmDx(currFont) * 1.2f;
+}
+
+RectF TextRenderFixed::Measure(const WCHAR* s, size_t sLen) {
+    ReportIf(!currFont);
+    float dx = 0;
+    for (size_t i = 0; i < sLen; i++) {
+        dx += FixedCharDx(s[i]);
+    }
+    return RectF(0, 0, dx * FixedEmDx(currFont), GetCurrFontLineSpacing());
+}
+
+RectF TextRenderFixed::Measure(const char* s, size_t sLen) {
+    WCHAR* buf = ToWStrTemp(s, sLen);
+    return Measure(buf, str::Len(buf));
+}
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy) {
     ITextRender* res = nullptr;
     if (TextRenderMethod::Gdiplus == method) {
@@ -491,6 +540,9 @@ ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, in
     if (TextRenderMethod::Hdc == method) {
         res = TextRenderHdc::Create(gfx, dx, dy);
     }
+    if (TextRenderMethod::Fixed == method) {
+        res = new TextRenderFixed();
+    }
     ReportIf(!res);
     if (res) {
         res->method = method;
@@ -6,6 +6,7 @@ enum class TextRenderMethod {
     GdiplusQuick, // uses MeasureTextQuick
     Gdi,
     Hdc,
+    Fixed, // made-up metrics that don't depend on installed fonts, see TextRenderFixed
     // TODO: implement TextRenderDirectDraw
     // TextRenderDirectDraw
 };
@@ -168,6 +169,38 @@ class TextRenderHdc : public ITextRender {
     ~TextRenderHdc() override;
 };
 
+// Measures text with fixed metrics that only depend on the font size and style
+// (not on the installed fonts or the GDI+ version), so that laying out a document
+// gives the same result on every machine and doesn't spend time in GDI/GDI+.
+// Meant for benchmarking and regression-testing layout, Draw() doesn't draw anything
+class TextRenderFixed : public ITextRender {
+    CachedFont* currFont = nullptr;
+
+  public:
+    TextRenderFixed() = default;
+
+    void SetFont(CachedFont* font) override;
+    void SetTextColor(Gdiplus::Color) override {
+    }
+    void SetTextBgColor(Gdiplus::Color) override {
+    }
+
+    float GetCurrFontLineSpacing() override;
+
+    RectF Measure(const char* s, size_t sLen) override;
+    RectF Measure(const WCHAR* s, size_t sLen) override;
+
+    void Lock() override {
+    }
+    void Unlock() override {
+    }
+
+    void Draw(const char*, size_t, RectF, bool) override {
+    }
+    void Draw(const WCHAR*, size_t, RectF, bool) override {
+    }
+};
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy);
 
 size_t StringLenForWidth(ITextRender* textMeasure, const WCHAR* s, size_t len, float dx);
@@ -19,11 +19,15 @@ extern void FileUtilTest();
 extern void HtmlPrettyPrintTest();
 extern void HtmlPullParser_UnitTests();
 extern void JsonTest();
+extern void PackBitsTest();
+extern void PixelUtilTest();
 extern void SettingsUtilTest();
 extern void SimpleLogTest();
 extern void SquareTreeTest();
 extern void StrFormatTest();
 extern void StrTest();
+extern void TiffReaderTest();
+extern void TimingStatsTest();
 extern void TrivialHtmlParser_UnitTests();
 extern void VecTest();
 extern void WinUtilTest();
@@ -43,12 +47,16 @@ int main(int, char**) {
     HtmlPrettyPrintTest();
     HtmlPullParser_UnitTests();
     JsonTest();
+    PackBitsTest();
+    PixelUtilTest();
     SettingsUtilTest();
     SimpleLogTest();
     SquareTreeTest();
     StrFormatTest();
     StrTest();
     StrVecTest();
+    TiffReaderTest();
+    TimingStatsTest();
     TrivialHtmlParser_UnitTests();
     VecTest();
     WinUtilTest();
@@ -21,6 +21,16 @@ extern "C" {
 // 3 is for absolute worst case of WCHAR* where last char was partially written
 #define ZERO_PADDING_COUNT 3
 
+// upper limit for files of solid archives kept decompressed
+#if defined(_WIN64)
+constexpr size_t kSolidCacheMaxBytes = 128 * 1024 * 1024;
+#else
+constexpr size_t kSolidCacheMaxBytes = 32 * 1024 * 1024;
+#endif
+
+// the unrar.dll handle is closed when it hasn't been used for this long
+constexpr DWORD kRarIdleCloseMs = 5 * 1000;
+
 FILETIME MultiFormatArchive::FileInfo::GetWinFileTime() const {
     FILETIME ft = {(DWORD)-1, (DWORD)-1};
     LocalFileTimeToFileTime((FILETIME*)&fileTime, &ft);
@@ -32,6 +42,7 @@ MultiFormatArchive::MultiFormatArchive(archive_opener_t opener, MultiFormatArchi
     ReportIf(!opener);
     if (format == Format::Tar)
         loadOnOpen = true;
+    InitializeCriticalSection(&rarAccess_);
 }
 
 bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
@@ -42,6 +53,9 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
     if ((format == Format::Rar) && archivePath) {
         bool ok = OpenUnrarFallback(archivePath);
         if (ok) {
+            // unrar.dll opens the file itself, don't keep it open for nothing
+            ar_close(data_);
+            data_ = nullptr;
             return true;
         }
     }
@@ -87,6 +101,15 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
 }
 
 MultiFormatArchive::~MultiFormatArchive() {
+    if (rarIdleTimer_) {
+        // waits for a running CloseRarHandleIfIdle()
+        DeleteTimerQueueTimer(nullptr, rarIdleTimer_, INVALID_HANDLE_VALUE);
+    }
+    CloseRarHandle();
+    DeleteCriticalSection(&rarAccess_);
+    for (auto& e : solidCache_) {
+        e.data.Free();
+    }
     ar_close_archive(ar_);
     ar_close(data_);
     for (auto& fi : fileInfos_) {
@@ -160,6 +183,52 @@ ByteSlice MultiFormatArchive::GetFileDataById(size_t fileId) {
     return {data, size};
 }
 
+// like GetFileDataById() but only uncompresses up to maxSize bytes, which is
+// enough e.g. to read image headers. Might return the whole file for
+// archives that can't be partially extracted (i.e. when using unrar.dll)
+// the caller must free()
+ByteSlice MultiFormatArchive::GetFileDataPrefixById(size_t fileId, size_t maxSize) {
+    if (fileId == (size_t)-1) {
+        return {};
+    }
+    ReportIf(fileId >= fileInfos_.size());
+
+    auto* fileInfo = fileInfos_[fileId];
+    ReportIf(fileInfo->fileId != fileId);
+
+    size_t size = std::min(fileInfo->fileSizeUncompressed, maxSize);
+    if (fileInfo->data != nullptr) {
+        // don't take ownership, the data will be needed for rendering
+        u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+        if (!data) {
+            return {};
+        }
+        memcpy(data, fileInfo->data, size);
+        return {data, size};
+    }
+
+    if (LoadedUsingUnrarDll()) {
+        return GetFileDataByIdUnarrDll(fileId);
+    }
+
+    if (!ar_) {
+        return {};
+    }
+
+    if (!ar_parse_entry_at(ar_, fileInfo->filePos)) {
+        return {};
+    }
+    u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+    if (!data) {
+        return {};
+    }
+    if (!ar_entry_uncompress(ar_, data, size)) {
+        free(data);
+        return {};
+    }
+    return {data, size};
+}
+
 const char* MultiFormatArchive::GetComment() {
     if (!ar_) {
         return nullptr;
@@ -284,24 +353,94 @@ static int CALLBACK unrarCallback(UINT msg, LPARAM userData, LPARAM rarBuffer, L
     return 1;
 }
 
-static bool FindFile(HANDLE hArc, RARHeaderDataEx* rarHeader, const WCHAR* fileName) {
-    int res;
-    for (;;) {
-        res = RARReadHeaderEx(hArc, rarHeader);
-        if (0 != res) {
-            return false;
-        }
-        str::TransCharsInPlace(rarHeader->FileNameW, L"\\", L"/");
-        if (str::EqI(rarHeader->FileNameW, fileName)) {
-            // don't support files whose uncompressed size is greater than 4GB
-            return rarHeader->UnpSizeHigh == 0;
+static ByteSlice CopyWithPadding(const ByteSlice& d) {
+    size_t size = d.size();
+    u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+    if (!data) {
+        return {};
+    }
+    memcpy(data, d.data(), size);
+    return {data, size};
+}
+
+// extracts the file whose header was just read with RARReadHeaderEx()
+static ByteSlice ExtractRarFile(HANDLE hArc, const RARHeaderDataEx& rarHeader, size_t size) {
+    // don't support files whose uncompressed size is greater than 4GB
+    if (rarHeader.UnpSizeHigh != 0 || rarHeader.UnpSize != size) {
+        return {};
+    }
+    if (addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
+        return {};
+    }
+    u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+    if (!data) {
+        return {};
+    }
+
+    Data uncompressedBuf;
+    uncompressedBuf.d = data;
+    uncompressedBuf.curr = data;
+    uncompressedBuf.sz = size;
+    RARSetCallback(hArc, unrarCallback, (LPARAM)&uncompressedBuf);
+    int res = RARProcessFile(hArc, RAR_TEST, nullptr, nullptr);
+    RARSetCallback(hArc, nullptr, 0);
+    bool ok = (res == 0) && (DataLeft(uncompressedBuf) == 0);
+    if (!ok) {
+        free(data);
+        return {};
+    }
+    return {data, size};
+}
+
+void MultiFormatArchive::CloseRarHandle() {
+    if (rarHandle_) {
+        RARCloseArchive((HANDLE)rarHandle_);
+        rarHandle_ = nullptr;
+    }
+    rarNextFileId_ = 0;
+}
+
+// called periodically on a thread pool thread while the archive is open
+void CALLBACK MultiFormatArchive::CloseRarHandleIfIdle(void* arch, BOOLEAN) {
+    MultiFormatArchive* self = (MultiFormatArchive*)arch;
+    ScopedCritSec scope(&self->rarAccess_);
+    if (self->rarHandle_ && GetTickCount() - self->rarLastUse_ >= kRarIdleCloseMs) {
+        self->CloseRarHandle();
+    }
+}
+
+int MultiFormatArchive::FindInSolidCache(size_t fileId) const {
+    int n = solidCache_.Size();
+    for (int i = 0; i < n; i++) {
+        if (solidCache_.at(i).fileId == fileId) {
+            return i;
         }
-        RARProcessFile(hArc, RAR_SKIP, nullptr, nullptr);
     }
+    return -1;
+}
+
+// takes ownership of data
+void MultiFormatArchive::AddToSolidCache(size_t fileId, ByteSlice data) {
+    size_t size = data.size();
+    if (data.empty() || size > kSolidCacheMaxBytes / 4 || FindInSolidCache(fileId) >= 0) {
+        data.Free();
+        return;
+    }
+    while (solidCacheSize_ + size > kSolidCacheMaxBytes && solidCache_.size() > 0) {
+        SolidCacheEntry e = solidCache_.PopAt(0);
+        solidCacheSize_ -= e.data.size();
+        e.data.Free();
+    }
+    SolidCacheEntry e;
+    e.fileId = fileId;
+    e.data = data;
+    solidCache_.Append(e);
+    solidCacheSize_ += size;
 }
 
 ByteSlice MultiFormatArchive::GetFileDataByIdUnarrDll(size_t fileId) {
     ReportIf(!rarFilePath_);
+    ScopedCritSec scope(&rarAccess_);
 
     auto* fileInfo = fileInfos_[fileId];
     ReportIf(fileInfo->fileId != fileId);
@@ -309,56 +448,74 @@ ByteSlice MultiFormatArchive::GetFileDataByIdUnarrDll(size_t fileId) {
         return {(u8*)fileInfo->data, fileInfo->fileSizeUncompressed};
     }
 
-    auto rarPath = ToWStrTemp(rarFilePath_);
-
-    Data uncompressedBuf;
-
-    RAROpenArchiveDataEx arcData = {nullptr};
-    arcData.ArcNameW = rarPath;
-    arcData.OpenMode = RAR_OM_EXTRACT;
-    arcData.Callback = unrarCallback;
-    arcData.UserData = (LPARAM)&uncompressedBuf;
-
-    HANDLE hArc = RAROpenArchiveEx(&arcData);
-    if (!hArc || arcData.OpenResult != 0) {
-        return {};
+    int idx = FindInSolidCache(fileId);
+    if (idx >= 0) {
+        nSolidCacheHits++;
+        // keep the list Least Recently Used first
+        SolidCacheEntry e = solidCache_.PopAt(idx);
+        solidCache_.Append(e);
+        return CopyWithPadding(e.data);
     }
 
-    char* data = nullptr;
-    size_t size = 0;
-    auto fileName = ToWStrTemp(fileInfo->name);
-    RARHeaderDataEx rarHeader{};
-    int res;
-    bool ok = FindFile(hArc, &rarHeader, fileName);
-    if (!ok) {
-        goto Exit;
+    // files can only be read in order, so start over if we're already past fileId
+    if (rarHandle_ && rarNextFileId_ > fileId) {
+        CloseRarHandle();
+        if (isSolid_) {
+            nSolidRestarts++;
+        }
     }
-    size = fileInfo->fileSizeUncompressed;
-    ReportIf(size != rarHeader.UnpSize);
-    if (addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
-        ok = false;
-        goto Exit;
+    if (!rarHandle_) {
+        auto rarPath = ToWStrTemp(rarFilePath_);
+        RAROpenArchiveDataEx arcData = {nullptr};
+        arcData.ArcNameW = rarPath;
+        arcData.OpenMode = RAR_OM_EXTRACT;
+        HANDLE hArc = RAROpenArchiveEx(&arcData);
+        if (!hArc || arcData.OpenResult != 0) {
+            return {};
+        }
+        rarHandle_ = hArc;
+        rarNextFileId_ = 0;
+        if (!rarIdleTimer_) {
+            CreateTimerQueueTimer(&rarIdleTimer_, nullptr, CloseRarHandleIfIdle, this, kRarIdleCloseMs,
+                                  kRarIdleCloseMs, WT_EXECUTEDEFAULT);
+        }
     }
 
-    data = AllocArray<char>(size + ZERO_PADDING_COUNT);
-    if (!data) {
-        ok = false;
-        goto Exit;
+    HANDLE hArc = (HANDLE)rarHandle_;
+    ByteSlice res;
+    while (rarNextFileId_ <= fileId) {
+        RARHeaderDataEx rarHeader{};
+        if (RARReadHeaderEx(hArc, &rarHeader) != 0) {
+            break;
+        }
+        size_t id = rarNextFileId_++;
+        size_t size = fileInfos_[id]->fileSizeUncompressed;
+        bool isWanted = (id == fileId);
+        // skipping a file in a solid archive decompresses it anyway
+        bool keep = isSolid_ && size > 0 && size <= kSolidCacheMaxBytes / 4 && FindInSolidCache(id) < 0;
+        if (!isWanted && !keep) {
+            RARProcessFile(hArc, RAR_SKIP, nullptr, nullptr);
+            continue;
+        }
+        ByteSlice d = ExtractRarFile(hArc, rarHeader, size);
+        if (d.empty()) {
+            break;
+        }
+        if (!isWanted) {
+            AddToSolidCache(id, d);
+            continue;
+        }
+        res = d;
+        if (isSolid_) {
+            AddToSolidCache(id, CopyWithPadding(d));
+        }
     }
-
-    uncompressedBuf.d = (u8*)data;
-    uncompressedBuf.curr = (u8*)data;
-    uncompressedBuf.sz = size;
-    res = RARProcessFile(hArc, RAR_TEST, nullptr, nullptr);
-    ok = (res == 0) && (DataLeft(uncompressedBuf) == 0);
-
-Exit:
-    RARCloseArchive(hArc);
-    if (!ok) {
-        free(data);
-        return {};
+    if (res.empty()) {
+        // the archive is in an unknown state
+        CloseRarHandle();
     }
-    return {(u8*)data, size};
+    rarLastUse_ = GetTickCount();
+    return res;
 }
 
 // asan build crashes in UnRAR code
@@ -385,6 +542,7 @@ bool MultiFormatArchive::OpenUnrarFallback(const char* rarPath) {
     if (!hArc || arcData.OpenResult != 0) {
         return false;
     }
+    isSolid_ = (arcData.Flags & ROADF_SOLID) != 0;
 
     size_t fileId = 0;
     while (true) {
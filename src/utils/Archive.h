@@ -38,12 +38,17 @@ class MultiFormatArchive {
 
     ByteSlice GetFileDataByName(const char* filename);
     ByteSlice GetFileDataById(size_t fileId);
+    ByteSlice GetFileDataPrefixById(size_t fileId, size_t maxSize);
 
     const char* GetComment();
 
     // if true, will load and uncompress all files on open
     bool loadOnOpen = false;
 
+    // how GetFileDataById() requests for solid archives were satisfied
+    int nSolidCacheHits = 0;
+    int nSolidRestarts = 0;
+
   protected:
     // used for allocating strings that are referenced by ArchFileInfo::name
     PoolAllocator allocator_;
@@ -55,9 +60,34 @@ class MultiFormatArchive {
 
     // only set when we loaded file infos using unrar.dll fallback
     const char* rarFilePath_ = nullptr;
+    bool isSolid_ = false;
+
+    // unrar.dll can only read files in order so the archive is kept open
+    // between calls and rarNextFileId_ is the file whose header comes next.
+    // An open handle keeps the file from being renamed or deleted, so
+    // rarIdleTimer_ closes it once it hasn't been used for a while.
+    // rarAccess_ protects them from the timer's thread
+    void* rarHandle_ = nullptr;
+    size_t rarNextFileId_ = 0;
+    DWORD rarLastUse_ = 0;
+    HANDLE rarIdleTimer_ = nullptr;
+    CRITICAL_SECTION rarAccess_;
+
+    // in solid archives getting to a file means decompressing all files before it,
+    // so those are kept (Least Recently Used first) for going back to them
+    struct SolidCacheEntry {
+        size_t fileId = 0;
+        ByteSlice data;
+    };
+    Vec<SolidCacheEntry> solidCache_;
+    size_t solidCacheSize_ = 0;
 
     bool OpenUnrarFallback(const char* rarPathUtf);
     ByteSlice GetFileDataByIdUnarrDll(size_t fileId);
+    void CloseRarHandle();
+    static void CALLBACK CloseRarHandleIfIdle(void* arch, BOOLEAN timerFired);
+    int FindInSolidCache(size_t fileId) const;
+    void AddToSolidCache(size_t fileId, ByteSlice data);
     bool LoadedUsingUnrarDll() const {
         return rarFilePath_ != nullptr;
     }
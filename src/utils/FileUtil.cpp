@@ -683,6 +683,56 @@ int ReadN(const char* path, char* buf, size_t toRead) {
     return (int)nRead;
 }
 
+// don't use up the address space of 32-bit builds
+#if defined(_WIN64)
+constexpr i64 kMaxMappedFileSize = INT64_MAX;
+#else
+constexpr i64 kMaxMappedFileSize = 256 * 1024 * 1024;
+#endif
+
+MappedFile::~MappedFile() {
+    if (data.data()) {
+        UnmapViewOfFile(data.data());
+    }
+    if (hMap) {
+        CloseHandle(hMap);
+    }
+}
+
+// returns nullptr if the file can't be mapped, in which case it should be read
+// the regular way. Only files on fixed drives are mapped because accessing a
+// mapping of a file that became unreadable (e.g. on a disconnected network drive
+// or a removed USB stick) raises an exception instead of returning an error.
+// Only for short-lived, read-once access: while a view is mapped, Windows refuses
+// to let other programs truncate or rewrite the file (ERROR_USER_MAPPED_FILE),
+// so never keep one open for a document that is being displayed
+MappedFile* MapReadOnly(const char* path) {
+    if (!path || !path::IsOnFixedDrive(path)) {
+        return nullptr;
+    }
+    WCHAR* pathW = ToWStrTemp(path);
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    AutoCloseHandle h = CreateFileW(pathW, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    i64 size = GetSize(h);
+    if (size <= 0 || size > kMaxMappedFileSize) {
+        return nullptr;
+    }
+    // the mapping keeps the file open after h is closed
+    HANDLE hMap = CreateFileMappingW(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!hMap) {
+        return nullptr;
+    }
+    void* d = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!d) {
+        CloseHandle(hMap);
+        return nullptr;
+    }
+    auto res = new MappedFile();
+    res->hMap = hMap;
+    res->data = {(const u8*)d, (size_t)size};
+    return res;
+}
+
 // Return true if the file wasn't there or was successfully deleted
 bool Delete(const char* filePathA) {
     if (!filePathA) {
@@ -53,6 +53,16 @@ HANDLE OpenReadOnly(const char*);
 ByteSlice ReadFileWithAllocator(const char* path, Allocator*);
 ByteSlice ReadFile(const char* path);
 int ReadN(const char* path, char* buf, size_t toRead);
+
+// read-only view of the whole content of a file
+struct MappedFile {
+    HANDLE hMap = nullptr;
+    ByteSlice data;
+
+    MappedFile() = default;
+    ~MappedFile();
+};
+MappedFile* MapReadOnly(const char* path);
 bool WriteFile(const char* path, const ByteSlice&);
 
 i64 GetSize(HANDLE h);
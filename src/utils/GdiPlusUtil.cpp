@@ -4,6 +4,7 @@
 #include "utils/BaseUtil.h"
 
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/ByteReader.h"
@@ -119,27 +120,35 @@ RectF MeasureTextStandard(Graphics* g, Font* f, const WCHAR* s, int len) {
     return RectF{bbox};
 }
 
+// fonts for which MeasureTextQuick() doesn't adjust the width
+// MeasureTextQuick() is called from multiple ebook layout threads at once
+static Mutex gQuickFontsMutex;
+static Vec<Font*> gQuickFonts;
+static Vec<bool> gQuickFontsIsFixed;
+
+static bool IsItalicOrMonospace(Graphics* g, Font* f) {
+    ScopedCritSec scope(&gQuickFontsMutex.cs);
+    int idx = gQuickFonts.Find(f);
+    if (idx >= 0) {
+        return gQuickFontsIsFixed.at(idx);
+    }
+    LOGFONTW lfw;
+    Status ok = f->GetLogFontW(g, &lfw);
+    bool isItalicOrMonospace = Ok != ok || lfw.lfItalic || str::Eq(lfw.lfFaceName, L"Courier New") ||
+                               str::Find(lfw.lfFaceName, L"Consol") || str::EndsWith(lfw.lfFaceName, L"Mono") ||
+                               str::EndsWith(lfw.lfFaceName, L"Typewriter");
+    gQuickFonts.Append(f);
+    gQuickFontsIsFixed.Append(isItalicOrMonospace);
+    return isItalicOrMonospace;
+}
+
 RectF MeasureTextQuick(Graphics* g, Font* f, const WCHAR* s, int len) {
     ReportIf(0 >= len);
 
-    static Vec<Font*> fontCache;
-    static Vec<bool> fixCache;
-
     Gdiplus::RectF bbox;
     g->MeasureString(s, len, f, Gdiplus::PointF(0, 0), &bbox);
-    int idx = fontCache.Find(f);
-    if (-1 == idx) {
-        LOGFONTW lfw;
-        Status ok = f->GetLogFontW(g, &lfw);
-        bool isItalicOrMonospace = Ok != ok || lfw.lfItalic || str::Eq(lfw.lfFaceName, L"Courier New") ||
-                                   str::Find(lfw.lfFaceName, L"Consol") || str::EndsWith(lfw.lfFaceName, L"Mono") ||
-                                   str::EndsWith(lfw.lfFaceName, L"Typewriter");
-        fontCache.Append(f);
-        fixCache.Append(isItalicOrMonospace);
-        idx = (int)fontCache.size() - 1;
-    }
     // most documents look good enough with these adjustments
-    if (!fixCache.at(idx)) {
+    if (!IsItalicOrMonospace(g, f)) {
         float correct = 0;
         for (int i = 0; i < len; i++) {
             switch (s[i]) {
@@ -419,6 +428,14 @@ Bitmap* BitmapFromDataWin(const ByteSlice& bmpData) {
 #define JP2_JP2H 0x6a703268 /**< JP2 header box (super-box) */
 #define JP2_IHDR 0x69686472 /**< Image header box */
 
+// if the data ends too early and more of it might help, *needed is set
+// to how much to try next
+static void SetNeeded(size_t* needed, size_t n) {
+    if (needed) {
+        *needed = n;
+    }
+}
+
 static bool BmpSizeFromData(ByteReader r, Size& result) {
     if (r.len < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER)) {
         return false;
@@ -431,7 +448,7 @@ static bool BmpSizeFromData(ByteReader r, Size& result) {
     return true;
 }
 
-static bool GifSizeFromData(ByteReader r, Size& result) {
+static bool GifSizeFromData(ByteReader r, Size& result, size_t* needed = nullptr) {
     const u8* data = r.d;
     size_t len = r.len;
     if (len < 13) {
@@ -464,15 +481,19 @@ static bool GifSizeFromData(ByteReader r, Size& result) {
             return false;
         }
     }
+    // the global color table alone can be 768 bytes
+    SetNeeded(needed, std::max(idx + 9, len * 2));
     return false;
 }
 
-static bool JpegSizeFromData(ByteReader r, Size& result) {
+static bool JpegSizeFromData(ByteReader r, Size& result, size_t* needed = nullptr) {
     // find the last start of frame marker for non-differential Huffman/arithmetic coding
     size_t n = r.len;
     size_t idx = 2;
     for (;;) {
         if (idx + 9 >= n) {
+            // the segments before it (e.g. EXIF or ICC profile) can be big
+            SetNeeded(needed, idx + 10);
             return false;
         }
         u8 b = r.Byte(idx);
@@ -490,15 +511,25 @@ static bool JpegSizeFromData(ByteReader r, Size& result) {
     return false;
 }
 
-static bool TiffSizeFromData(ByteReader r, Size& result) {
-    if (r.len < 10) {
+static bool TiffSizeFromData(ByteReader r, Size& result, size_t* needed = nullptr) {
+    if (r.len < 12) {
         return false;
     }
     bool isBE = r.Byte(0) == 'M', isJXR = r.Byte(2) == 0xBC;
     ReportIf(!isBE && r.Byte(0) != 'I' || isJXR && isBE);
     const WORD WIDTH = isJXR ? 0xBC80 : 0x0100, HEIGHT = isJXR ? 0xBC81 : 0x0101;
     size_t idx = r.DWord(4, isBE);
-    WORD count = idx <= r.len - 2 ? r.Word(idx, isBE) : 0;
+    // the first IFD is often written after the image data
+    if (idx > r.len - 2) {
+        // guess the size of a typical IFD, the next try will know better
+        SetNeeded(needed, idx + 2 + 32 * 12);
+        return false;
+    }
+    WORD count = r.Word(idx, isBE);
+    if (idx + 2 + (size_t)count * 12 > r.len) {
+        SetNeeded(needed, idx + 2 + (size_t)count * 12);
+        return false;
+    }
     for (idx += 2; count > 0 && idx <= r.len - 12; count--, idx += 12) {
         WORD tag = r.Word(idx, isBE), type = r.Word(idx + 2, isBE);
         if (r.DWord(idx + 4, isBE) != 1) {
@@ -592,21 +623,146 @@ static bool AvifSizeFromData(ByteReader r, Size& result) {
     return !result.IsEmpty();
 }
 
+constexpr u32 FourCC(const char* s) {
+    return ((u32)(u8)s[0] << 24) | ((u32)(u8)s[1] << 16) | ((u32)(u8)s[2] << 8) | (u32)(u8)s[3];
+}
+
+// header of an ISO base media file format box, boxEnd can be past end
+static bool IsoBoxHeader(ByteReader& r, size_t idx, size_t end, u32& type, size_t& contentStart, size_t& boxEnd) {
+    if (idx + 8 > end) {
+        return false;
+    }
+    u64 size = r.DWordBE(idx);
+    type = r.DWordBE(idx + 4);
+    contentStart = idx + 8;
+    if (size == 1) {
+        if (idx + 16 > end) {
+            return false;
+        }
+        size = r.QWordBE(idx + 8);
+        contentStart = idx + 16;
+    } else if (size == 0) {
+        // extends to the end of the file, which we might not know
+        return false;
+    }
+    if (size < contentStart - idx || size > (u64)(SIZE_MAX - idx)) {
+        return false;
+    }
+    boxEnd = idx + (size_t)size;
+    return true;
+}
+
+// size of the primary image from the 'meta' box of an AVIF/HEIF file:
+// the 'ispe' property associated with the 'pitm' item, rotated by 'irot'
+static bool HeifSizeFromMeta(ByteReader& r, size_t idx, size_t end, Size& result) {
+    u32 primaryId = 0;
+    size_t ipco = 0, ipcoEnd = 0, ipma = 0, ipmaEnd = 0;
+    u32 type;
+    size_t start, boxEnd;
+    // meta is a full box (version and flags come first)
+    for (idx += 4; IsoBoxHeader(r, idx, end, type, start, boxEnd) && boxEnd <= end; idx = boxEnd) {
+        if (type == FourCC("pitm")) {
+            primaryId = r.Byte(start) == 0 ? r.WordBE(start + 4) : r.DWordBE(start + 4);
+        } else if (type == FourCC("iprp")) {
+            u32 childType;
+            size_t childStart, childEnd;
+            for (size_t i = start; IsoBoxHeader(r, i, boxEnd, childType, childStart, childEnd) && childEnd <= boxEnd;
+                 i = childEnd) {
+                if (childType == FourCC("ipco")) {
+                    ipco = childStart;
+                    ipcoEnd = childEnd;
+                } else if (childType == FourCC("ipma")) {
+                    ipma = childStart;
+                    ipmaEnd = childEnd;
+                }
+            }
+        }
+    }
+    if (!ipco || !ipma) {
+        return false;
+    }
+
+    // 1-based indexes into ipco of the properties of the primary item
+    Vec<int> props;
+    u8 version = r.Byte(ipma);
+    bool bigIdx = (r.Byte(ipma + 3) & 1) != 0;
+    u32 nEntries = r.DWordBE(ipma + 4);
+    size_t i = ipma + 8;
+    for (u32 n = 0; n < nEntries && i < ipmaEnd; n++) {
+        u32 itemId = version < 1 ? r.WordBE(i) : r.DWordBE(i);
+        i += version < 1 ? 2 : 4;
+        int nAssoc = r.Byte(i++);
+        for (int j = 0; j < nAssoc; j++) {
+            int propIdx = bigIdx ? (r.WordBE(i) & 0x7fff) : (r.Byte(i) & 0x7f);
+            i += bigIdx ? 2 : 1;
+            if (itemId == primaryId) {
+                props.Append(propIdx);
+            }
+        }
+    }
+
+    Size size;
+    int angle = 0;
+    int propIdx = 1;
+    for (i = ipco; IsoBoxHeader(r, i, ipcoEnd, type, start, boxEnd) && boxEnd <= ipcoEnd; i = boxEnd, propIdx++) {
+        if (!props.Contains(propIdx)) {
+            continue;
+        }
+        if (type == FourCC("ispe")) {
+            size.dx = (int)r.DWordBE(start + 4);
+            size.dy = (int)r.DWordBE(start + 8);
+        } else if (type == FourCC("irot")) {
+            angle = r.Byte(start) & 3;
+        }
+    }
+    if (size.dx <= 0 || size.dy <= 0) {
+        return false;
+    }
+    if (angle == 1 || angle == 3) {
+        std::swap(size.dx, size.dy);
+    }
+    result = size;
+    return true;
+}
+
+static bool HeifSizeFromData(ByteReader r, Size& result, size_t* needed = nullptr) {
+    size_t idx = 0;
+    u32 type;
+    size_t start, boxEnd;
+    for (;;) {
+        if (!IsoBoxHeader(r, idx, r.len, type, start, boxEnd)) {
+            if (idx + 16 > r.len) {
+                SetNeeded(needed, idx + 16);
+            }
+            return false;
+        }
+        if (type == FourCC("meta")) {
+            if (boxEnd > r.len) {
+                SetNeeded(needed, boxEnd);
+                return false;
+            }
+            return HeifSizeFromMeta(r, start, boxEnd, result);
+        }
+        idx = boxEnd;
+    }
+}
+
 // adapted from http://cpansearch.perl.org/src/RJRAY/Image-Size-3.230/lib/Image/Size.pm
-Size BitmapSizeFromData(const ByteSlice& d) {
+Size BitmapSizeFromHeader(const ByteSlice& d, size_t* needed) {
     Size result;
     bool ok = false;
+    SetNeeded(needed, 0);
     Kind kind = GuessFileTypeFromContent(d);
 
     ByteReader r(d);
     if (kind == kindFileBmp) {
         ok = BmpSizeFromData(r, result);
     } else if (kind == kindFileGif) {
-        ok = GifSizeFromData(r, result);
+        ok = GifSizeFromData(r, result, needed);
     } else if (kind == kindFileJpeg) {
-        ok = JpegSizeFromData(r, result);
+        ok = JpegSizeFromData(r, result, needed);
     } else if (kind == kindFileJxr || kind == kindFileTiff) {
-        ok = TiffSizeFromData(r, result);
+        ok = TiffSizeFromData(r, result, needed);
     } else if (kind == kindFilePng) {
         ok = PngSizeFromData(r, result);
     } else if (kind == kindFileTga) {
@@ -616,11 +772,27 @@ Size BitmapSizeFromData(const ByteSlice& d) {
     } else if (kind == kindFileJp2) {
         ok = Jp2SizeFromData(r, result);
     } else if (kind == kindFileAvif || kind == kindFileHeic) {
-        ok = AvifSizeFromData(r, result);
+        ok = HeifSizeFromData(r, result, needed);
     }
     if (ok && !result.IsEmpty()) {
         return result;
     }
+    return {};
+}
+
+Size BitmapSizeFromData(const ByteSlice& d) {
+    Size result = BitmapSizeFromHeader(d, nullptr);
+    if (!result.IsEmpty()) {
+        return result;
+    }
+
+    Kind kind = GuessFileTypeFromContent(d);
+    if (kind == kindFileAvif || kind == kindFileHeic) {
+        ByteReader r(d);
+        if (AvifSizeFromData(r, result)) {
+            return result;
+        }
+    }
 
     // try expensive way of getting the info by decoding the image
     // (currently happens for animated GIF)
@@ -652,6 +824,48 @@ CLSID GetEncoderClsid(const WCHAR* format) {
     return null;
 }
 
+Size BitmapSizeFromFile(const char* path) {
+    // with a mapping of the file, only the parts of it that are looked at are
+    // read from disk, no matter how far into the file the size is
+    file::MappedFile* mf = file::MapReadOnly(path);
+    if (mf) {
+        Size size = BitmapSizeFromData(mf->data);
+        delete mf;
+        return size;
+    }
+
+    // most formats have the size within the first few hundred bytes
+    size_t toRead = kBitmapHeaderProbeSize;
+    for (int i = 0; i < 3; i++) {
+        u8* buf = AllocArray<u8>(toRead);
+        int nRead = file::ReadN(path, (char*)buf, toRead);
+        if (nRead <= 0) {
+            free(buf);
+            return {};
+        }
+        ByteSlice d{buf, (size_t)nRead};
+        size_t needed = 0;
+        Size size = BitmapSizeFromHeader(d, &needed);
+        bool isWholeFile = (size_t)nRead < toRead;
+        if (size.IsEmpty() && isWholeFile) {
+            size = BitmapSizeFromData(d);
+        }
+        free(buf);
+        if (!size.IsEmpty() || isWholeFile) {
+            return size;
+        }
+        if (needed <= toRead || needed > kBitmapHeaderMaxProbeSize) {
+            break;
+        }
+        toRead = needed;
+    }
+
+    ByteSlice d = file::ReadFile(path);
+    Size size = BitmapSizeFromData(d);
+    d.Free();
+    return size;
+}
+
 RenderedBitmap* LoadRenderedBitmapWin(const char* path) {
     if (!path) {
         return nullptr;
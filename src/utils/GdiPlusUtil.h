@@ -21,5 +21,16 @@ void GetBaseTransform(Gdiplus::Matrix& m, Gdiplus::RectF pageRect, float zoom, i
 
 Gdiplus::Bitmap* BitmapFromDataWin(const ByteSlice& bmpData);
 Size BitmapSizeFromData(const ByteSlice&);
+
+// how much image data to read to get its size with BitmapSizeFromHeader()
+constexpr size_t kBitmapHeaderProbeSize = 512;
+// don't try to read more than that instead of the whole image
+constexpr size_t kBitmapHeaderMaxProbeSize = 1024 * 1024;
+// like BitmapSizeFromData() but without ever decoding the image, so d can
+// be just the beginning of the image data. Returns an empty size if that
+// isn't enough and sets *needed to how much to try next (0 if unknown)
+Size BitmapSizeFromHeader(const ByteSlice& d, size_t* needed);
+// reads only as much of the file as needed
+Size BitmapSizeFromFile(const char* path);
 CLSID GetEncoderClsid(const WCHAR* format);
 RenderedBitmap* LoadRenderedBitmapWin(const char* path);
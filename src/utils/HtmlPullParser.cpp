@@ -5,6 +5,15 @@
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
 
+#if IS_INTEL_32 || IS_INTEL_64
+// SSE2 is part of x64 and we require it for 32-bit builds as well
+#include <emmintrin.h>
+#include <intrin.h>
+#define HAS_SSE2 1
+#else
+#define HAS_SSE2 0
+#endif
+
 // returns -1 if didn't find
 int HtmlEntityNameToRune(const char* name, size_t nameLen) {
     return FindHtmlEntityRune(name, nameLen);
@@ -31,19 +40,71 @@ int HtmlEntityNameToRune(const WCHAR* name, size_t nameLen) {
     return FindHtmlEntityRune(asciiName, nameLen);
 }
 
-bool SkipUntil(const char*& s, const char* end, char c) {
+#if HAS_SSE2
+static inline int FirstSetBit(int mask) {
+    unsigned long idx;
+    _BitScanForward(&idx, (unsigned long)mask);
+    return (int)idx;
+}
+#endif
+
+// returns the position of the first c in [s, end) or end
+static inline const char* FindChar(const char* s, const char* end, char c) {
+#if HAS_SSE2
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; end - s >= 16; s += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (mask != 0) {
+            return s + FirstSetBit(mask);
+        }
+    }
+#endif
     while ((s < end) && (*s != c)) {
         ++s;
     }
+    return s;
+}
+
+// returns the position of the first '>', '\'' or '"' in [s, end) or end
+static inline const char* FindTagEndOrQuote(const char* s, const char* end) {
+#if HAS_SSE2
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quote = _mm_set1_epi8('\'');
+    const __m128i dquote = _mm_set1_epi8('"');
+    for (; end - s >= 16; s += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, dquote)));
+        int mask = _mm_movemask_epi8(m);
+        if (mask != 0) {
+            return s + FirstSetBit(mask);
+        }
+    }
+#endif
+    while ((s < end) && (*s != '>') && (*s != '\'') && (*s != '"')) {
+        ++s;
+    }
+    return s;
+}
+
+bool SkipUntil(const char*& s, const char* end, char c) {
+    if (s < end) {
+        s = FindChar(s, end, c);
+    }
     return *s == c;
 }
 
 bool SkipUntil(const char*& s, const char* end, const char* term) {
     size_t len = str::Len(term);
-    for (; s < end; s++) {
+    while (s < end) {
+        s = FindChar(s, end, term[0]);
+        if (s == end) {
+            break;
+        }
         if (s + len <= end && str::StartsWith(s, term)) {
             return true;
         }
+        s++;
     }
     return false;
 }
@@ -228,13 +289,76 @@ bool AttrInfo::ValIs(const char* s) const {
     return str::EqNIx(val, valLen, s);
 }
 
+// names of all tags in HtmlTag, in the same order
+static const char* gHtmlTagNames[] = {
+    "a", "abbr", "acronym", "area", "audio", "b", "base", "basefont", "blockquote", "body", "br", "center", "code",
+    "col", "dd", "div", "dl", "dt", "em", "font", "frame", "h1", "h2", "h3", "h4", "h5", "h6", "head", "hr", "html",
+    "i", "image", "img", "input", "lh", "li", "link", "mbp:pagebreak", "meta", "nav", "object", "ol", "p", "pagebreak",
+    "param", "pre", "s", "script", "section", "small", "span", "strike", "strong", "style", "sub", "subtitle", "sup",
+    "svg", "svg:image", "table", "td", "th", "title", "tr", "tt", "u", "ul", "video"};
+static_assert(dimof(gHtmlTagNames) == Tag_NotFound, "gHtmlTagNames must match HtmlTag");
+
+constexpr size_t kMaxHtmlTagNameLen = 13; // "mbp:pagebreak"
+constexpr u32 kTagSlotsBits = 8;
+constexpr u32 kTagSlotsMask = (1 << kTagSlotsBits) - 1;
+
+// case-insensitive for ASCII letters; other characters that differ only
+// in bit 0x20 collide, which the final comparison sorts out
+static inline u32 HashTagName(const char* s, size_t len) {
+    u32 h = (u32)len;
+    for (size_t i = 0; i < len; i++) {
+        h = h * 31 + ((u8)s[i] | 0x20);
+    }
+    return (h * 2654435761u) >> (32 - kTagSlotsBits);
+}
+
+// open addressing hash table of tag names, filled once on first use
+struct HtmlTagTable {
+    u8 slots[1 << kTagSlotsBits];
+    u8 nameLens[Tag_NotFound];
+
+    HtmlTagTable() {
+        static_assert(Tag_NotFound < 256, "HtmlTag must fit in u8");
+        memset(slots, Tag_NotFound, sizeof(slots));
+        for (int tag = 0; tag < (int)Tag_NotFound; tag++) {
+            const char* name = gHtmlTagNames[tag];
+            size_t len = str::Len(name);
+            ReportIf(len > kMaxHtmlTagNameLen || FindHtmlTag(name, len) != (HtmlTag)tag);
+            nameLens[tag] = (u8)len;
+            u32 i = HashTagName(name, len);
+            while (slots[i] != Tag_NotFound) {
+                i = (i + 1) & kTagSlotsMask;
+            }
+            slots[i] = (u8)tag;
+        }
+    }
+};
+
+// same result as FindHtmlTag() but a single hash probe instead of
+// a switch over all tags and follow-up comparisons
+HtmlTag FindHtmlTagFast(const char* name, size_t len) {
+    if (0 == len || len > kMaxHtmlTagNameLen) {
+        return Tag_NotFound;
+    }
+    static const HtmlTagTable table;
+    for (u32 i = HashTagName(name, len);; i = (i + 1) & kTagSlotsMask) {
+        u8 tag = table.slots[i];
+        if (tag == Tag_NotFound) {
+            return Tag_NotFound;
+        }
+        if (table.nameLens[tag] == len && str::EqNI(name, gHtmlTagNames[tag], len)) {
+            return (HtmlTag)tag;
+        }
+    }
+}
+
 void HtmlToken::SetTag(TokenType new_type, const char* new_s, const char* end) {
     type = new_type;
     s = new_s;
     sLen = end - s;
     SkipName(new_s, s + sLen);
     nLen = new_s - s;
-    tag = FindHtmlTag(s, nLen);
+    tag = FindHtmlTagFast(s, nLen);
     nextAttr = nullptr;
 }
 
@@ -364,6 +488,10 @@ AttrInfo* HtmlToken::NextAttr() {
 // Returns false if didn't find
 static bool SkipUntilTagEnd(const char*& s, const char* end) {
     while (s < end) {
+        s = FindTagEndOrQuote(s, end);
+        if (s == end) {
+            break;
+        }
         char c = *s++;
         if ('>' == c) {
             --s;
@@ -112,6 +112,8 @@ bool SkipUntil(const char*& s, const char* end, char c);
 bool SkipUntil(const char*& s, const char* end, const char* term);
 bool IsSpaceOnly(const char* s, const char* end);
 
+HtmlTag FindHtmlTagFast(const char* name, size_t len);
+
 int HtmlEntityNameToRune(const char* name, size_t nameLen);
 int HtmlEntityNameToRune(const WCHAR* name, size_t nameLen);
 
@@ -0,0 +1,103 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/PackBits.h"
+
+/*
+The compressed data is a sequence of runs, each starting with a control byte c:
+- c < 128 : c + 1 units follow verbatim
+- c >= 128 : the single unit that follows is repeated c - 126 times (2 to 129)
+*/
+
+constexpr size_t kMaxLiteralUnits = 128;
+constexpr size_t kMaxRepeatUnits = 129;
+
+static inline bool SameUnit(const u8* a, const u8* b, int unitSize) {
+    switch (unitSize) {
+        case 1:
+            return *a == *b;
+        case 4: {
+            u32 x, y;
+            memcpy(&x, a, 4);
+            memcpy(&y, b, 4);
+            return x == y;
+        }
+    }
+    return memcmp(a, b, unitSize) == 0;
+}
+
+ByteSlice PackBitsCompress(const ByteSlice& d, int unitSize) {
+    if (unitSize < 1 || unitSize > 4 || (d.sz % unitSize) != 0) {
+        return {};
+    }
+    const u8* s = d.d;
+    size_t n = d.sz / unitSize;
+    size_t u = (size_t)unitSize;
+    // rendered pages usually compress to well below 1/8 of their size
+    str::Str res(d.sz / 8);
+    size_t i = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < kMaxRepeatUnits && SameUnit(s + i * u, s + (i + run) * u, unitSize)) {
+            run++;
+        }
+        if (run > 1) {
+            res.AppendChar((char)(run + 126));
+            res.Append(s + i * u, u);
+            i += run;
+            continue;
+        }
+        // collect units until the next repeat starts
+        size_t start = i;
+        while (i < n && i - start < kMaxLiteralUnits) {
+            if (i + 1 < n && SameUnit(s + i * u, s + (i + 1) * u, unitSize)) {
+                break;
+            }
+            i++;
+        }
+        size_t nLiteral = i - start;
+        res.AppendChar((char)(nLiteral - 1));
+        res.Append(s + start * u, nLiteral * u);
+    }
+    return res.StealAsByteSlice();
+}
+
+bool PackBitsDecompress(const ByteSlice& compressed, int unitSize, const ByteSlice& dst) {
+    if (unitSize < 1 || unitSize > 4) {
+        return false;
+    }
+    const u8* s = compressed.d;
+    const u8* end = s + compressed.sz;
+    u8* d = dst.d;
+    u8* dEnd = d + dst.sz;
+    size_t u = (size_t)unitSize;
+    while (s < end) {
+        u8 c = *s++;
+        if (c < 128) {
+            size_t nBytes = ((size_t)c + 1) * u;
+            if ((size_t)(end - s) < nBytes || (size_t)(dEnd - d) < nBytes) {
+                return false;
+            }
+            memcpy(d, s, nBytes);
+            s += nBytes;
+            d += nBytes;
+            continue;
+        }
+        size_t count = (size_t)c - 126;
+        if ((size_t)(end - s) < u || (size_t)(dEnd - d) < count * u) {
+            return false;
+        }
+        if (u == 1) {
+            memset(d, *s, count);
+            d += count;
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                memcpy(d, s, u);
+                d += u;
+            }
+        }
+        s += u;
+    }
+    return d == dEnd;
+}
@@ -0,0 +1,12 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// PackBits-style run-length encoding operating on units of 1 to 4 bytes
+// (i.e. one pixel of a 8/24/32-bit bitmap) instead of single bytes.
+// Rendered pages consist mostly of long runs of the background color
+// so this compresses them well while being much faster than zlib.
+
+// d.sz must be a multiple of unitSize
+ByteSlice PackBitsCompress(const ByteSlice& d, int unitSize);
+// dst must be exactly as big as the data that was compressed
+bool PackBitsDecompress(const ByteSlice& compressed, int unitSize, const ByteSlice& dst);
@@ -0,0 +1,196 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/PixelUtil.h"
+
+#if IS_INTEL_32 || IS_INTEL_64
+// SSE2 is part of x64 and we require it for 32-bit builds as well
+#include <emmintrin.h>
+#define HAS_SSE2 1
+#else
+#define HAS_SSE2 0
+#endif
+
+constexpr u32 kRgbMask = 0x00ffffff;
+
+// RGBX as read from memory (0xXXBBGGRR) => RGBQUAD (0x00RRGGBB)
+static inline u32 RgbxToPaletteColor(u32 c) {
+    return ((c & 0xff) << 16) | (c & 0xff00) | ((c >> 16) & 0xff);
+}
+
+static inline u32 LoadU32(const u8* s) {
+    u32 v;
+    memcpy(&v, s, 4);
+    return v;
+}
+
+// open addressing hash from rgb color to its palette index; most pages
+// have only a handful of colors so this is much faster than scanning
+// the palette, and a table 4x the maximum palette size keeps probe
+// sequences short
+struct PaletteHash {
+    static constexpr int kSize = 1024;
+    static constexpr u32 kEmpty = 0xffffffff; // not a valid masked color
+    u32 keys[kSize];
+    u8 idxs[kSize];
+    u32* palette = nullptr;
+    int nColors = 0;
+
+    explicit PaletteHash(u32* palette) {
+        this->palette = palette;
+        memset(keys, 0xff, sizeof(keys));
+    }
+
+    // returns -1 if the palette is full
+    int Find(u32 rgb) {
+        u32 h = (rgb * 2654435761u) >> 22;
+        for (;;) {
+            u32 k = keys[h];
+            if (k == rgb) {
+                return idxs[h];
+            }
+            if (k == kEmpty) {
+                break;
+            }
+            h = (h + 1) & (kSize - 1);
+        }
+        if (nColors == 256) {
+            return -1;
+        }
+        keys[h] = rgb;
+        idxs[h] = (u8)nColors;
+        palette[nColors] = RgbxToPaletteColor(rgb);
+        return nColors++;
+    }
+};
+
+int PalettizeRgbxScalar(const u8* src, int srcStride, u8* dst, int dstStride, int dx, int dy, u32* palette) {
+    if (dx <= 0 || dy <= 0) {
+        return 0;
+    }
+    PaletteHash hash(palette);
+    // pages are mostly long runs of the same color, so
+    // remember the last lookup
+    u32 lastRgb = kRgbMask & ~LoadU32(src);
+    int lastIdx = 0;
+    for (int y = 0; y < dy; y++) {
+        const u8* s = src + (size_t)y * srcStride;
+        u8* d = dst + (size_t)y * dstStride;
+        for (int x = 0; x < dx; x++) {
+            u32 rgb = LoadU32(s + x * 4) & kRgbMask;
+            if (rgb != lastRgb) {
+                lastIdx = hash.Find(rgb);
+                if (lastIdx < 0) {
+                    return -1;
+                }
+                lastRgb = rgb;
+            }
+            d[x] = (u8)lastIdx;
+        }
+    }
+    return hash.nColors;
+}
+
+void SwapRedBlueScalar(const u8* src, int srcStride, u8* dst, int dstStride, int dx, int dy) {
+    for (int y = 0; y < dy; y++) {
+        const u8* s = src + (size_t)y * srcStride;
+        u8* d = dst + (size_t)y * dstStride;
+        for (int x = 0; x < dx; x++) {
+            u32 c = LoadU32(s);
+            c = (c & 0xff00ff00) | ((c & 0xff) << 16) | ((c >> 16) & 0xff);
+            memcpy(d, &c, 4);
+            s += 4;
+            d += 4;
+        }
+    }
+}
+
+#if HAS_SSE2
+
+int PalettizeRgbx(const u8* src, int srcStride, u8* dst, int dstStride, int dx, int dy, u32* palette) {
+    if (dx <= 0 || dy <= 0) {
+        return 0;
+    }
+    PaletteHash hash(palette);
+    const __m128i mask = _mm_set1_epi32((int)kRgbMask);
+    u32 lastRgb = kRgbMask & ~LoadU32(src);
+    int lastIdx = 0;
+    __m128i last4 = _mm_set1_epi32((int)lastRgb);
+    for (int y = 0; y < dy; y++) {
+        const u8* s = src + (size_t)y * srcStride;
+        u8* d = dst + (size_t)y * dstStride;
+        int x = 0;
+        for (; x + 4 <= dx; x += 4) {
+            // the common case: 4 pixels with the same color as the last one
+            __m128i px = _mm_and_si128(_mm_loadu_si128((const __m128i*)(s + x * 4)), mask);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(px, last4)) == 0xffff) {
+                u32 idx4 = (u32)lastIdx * 0x01010101;
+                memcpy(d + x, &idx4, 4);
+                continue;
+            }
+            for (int i = 0; i < 4; i++) {
+                u32 rgb = LoadU32(s + (x + i) * 4) & kRgbMask;
+                if (rgb != lastRgb) {
+                    lastIdx = hash.Find(rgb);
+                    if (lastIdx < 0) {
+                        return -1;
+                    }
+                    lastRgb = rgb;
+                }
+                d[x + i] = (u8)lastIdx;
+            }
+            last4 = _mm_set1_epi32((int)lastRgb);
+        }
+        for (; x < dx; x++) {
+            u32 rgb = LoadU32(s + x * 4) & kRgbMask;
+            if (rgb != lastRgb) {
+                lastIdx = hash.Find(rgb);
+                if (lastIdx < 0) {
+                    return -1;
+                }
+                lastRgb = rgb;
+                last4 = _mm_set1_epi32((int)lastRgb);
+            }
+            d[x] = (u8)lastIdx;
+        }
+    }
+    return hash.nColors;
+}
+
+// without SSSE3's pshufb, swap the 16-bit halves of the 0x00BB00RR part
+static inline __m128i SwapRedBlue4(__m128i px) {
+    const __m128i maskAG = _mm_set1_epi32((int)0xff00ff00);
+    __m128i ag = _mm_and_si128(px, maskAG);
+    __m128i rb = _mm_andnot_si128(maskAG, px);
+    rb = _mm_shufflelo_epi16(rb, _MM_SHUFFLE(2, 3, 0, 1));
+    rb = _mm_shufflehi_epi16(rb, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(ag, rb);
+}
+
+void SwapRedBlue(const u8* src, int srcStride, u8* dst, int dstStride, int dx, int dy) {
+    for (int y = 0; y < dy; y++) {
+        const u8* s = src + (size_t)y * srcStride;
+        u8* d = dst + (size_t)y * dstStride;
+        int x = 0;
+        for (; x + 8 <= dx; x += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(s + x * 4));
+            __m128i b = _mm_loadu_si128((const __m128i*)(s + x * 4 + 16));
+            _mm_storeu_si128((__m128i*)(d + x * 4), SwapRedBlue4(a));
+            _mm_storeu_si128((__m128i*)(d + x * 4 + 16), SwapRedBlue4(b));
+        }
+        SwapRedBlueScalar(s + x * 4, 0, d + x * 4, 0, dx - x, 1);
+    }
+}
+
+#else
+
+int PalettizeRgbx(const u8* src, int srcStride, u8* dst, int dstStride, int dx, int dy, u32* palette) {
+    return PalettizeRgbxScalar(src, srcStride, dst, dstStride, dx, dy, palette);
+}
+
+void SwapRedBlue(const u8* src, int srcStride, u8* dst, int dstStride, int dx, int dy) {
+    SwapRedBlueScalar(src, srcStride, dst, dstStride, dx, dy);
+}
+
+#endif
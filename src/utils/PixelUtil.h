@@ -0,0 +1,19 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Conversion kernels for 32-bit pixmaps, as produced by mupdf (RGBA) and
+// consumed by GDI (BGRA or 8-bit palette). Use SSE2 on x86/x64 and plain
+// C everywhere else.
+
+// Converts RGBX pixels (4th byte is ignored) to 8-bit palette indices.
+// palette receives the colors in RGBQUAD layout (0x00RRGGBB) and must
+// have room for 256 entries. Returns the number of colors or -1 if
+// there are more than 256 (in which case dst contents are undefined).
+int PalettizeRgbx(const u8* src, int srcStride, u8* dst, int dstStride, int dx, int dy, u32* palette);
+
+// RGBA => BGRA (and vice versa). src and dst can be the same.
+void SwapRedBlue(const u8* src, int srcStride, u8* dst, int dstStride, int dx, int dy);
+
+// plain C versions, exposed for testing and benchmarking
+int PalettizeRgbxScalar(const u8* src, int srcStride, u8* dst, int dstStride, int dx, int dy, u32* palette);
+void SwapRedBlueScalar(const u8* src, int srcStride, u8* dst, int dstStride, int dx, int dy);
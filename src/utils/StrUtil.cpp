@@ -1612,6 +1612,10 @@ bool Str::AppendSlice(const ByteSlice& d) {
     return this->Append(d.data(), d.size());
 }
 
+char* Str::AppendBlanks(size_t count) {
+    return MakeSpaceAt(this, len, count);
+}
+
 void Str::AppendFmt(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
@@ -330,6 +330,8 @@ struct Str {
     ByteSlice StealAsByteSlice();
     bool Append(const u8* src, size_t size = -1);
     bool AppendSlice(const ByteSlice& d);
+    // appends count uninitialized chars to be filled in by the caller
+    char* AppendBlanks(size_t count);
     void AppendFmt(const char* fmt, ...);
     void Set(const char*);
     char* Get() const;
@@ -128,6 +128,58 @@ TempStr StrToUtf8Temp(const char* src, uint codePage) {
     return ToMultiByteTemp(src, codePage, CP_UTF8);
 }
 
+// converts src from codePage to UTF-8 and appends it to dst. Unlike ToMultiByteTemp()
+// this converts in chunks, so large texts don't need a temporary WCHAR copy
+bool AppendAsUtf8(str::Str& dst, const char* src, size_t cbSrc, uint codePage) {
+    // 20127 is US-ASCII (see ToMultiByteTemp())
+    if (codePage == CP_UTF8 || codePage == 20127) {
+        return dst.Append(src, cbSrc);
+    }
+    CPINFO cpInfo{};
+    if (!GetCPInfo(codePage, &cpInfo) || cpInfo.MaxCharSize > 2) {
+        // we can't tell where a character starts in e.g. GB18030, so convert all at once
+        TempWStr ws = StrCPToWStrTemp(src, codePage, (int)cbSrc);
+        TempStr s = ws ? (TempStr)WStrToCodePage(CP_UTF8, ws, str::Len(ws), GetTempAllocator()) : nullptr;
+        return s && dst.Append(s);
+    }
+
+    constexpr size_t kChunkSize = 64 * 1024;
+    // a byte never converts to more than one WCHAR and a WCHAR to more than 3 bytes
+    WCHAR* ws = AllocArray<WCHAR>(kChunkSize);
+    if (!ws) {
+        return false;
+    }
+    bool ok = true;
+    const char* end = src + cbSrc;
+    while (src < end) {
+        size_t n = std::min(kChunkSize, (size_t)(end - src));
+        if (cpInfo.MaxCharSize == 2 && src + n < end) {
+            // don't split a double-byte character between chunks
+            size_t i = 0;
+            while (i < n) {
+                i += IsDBCSLeadByteEx(codePage, (BYTE)src[i]) ? 2 : 1;
+            }
+            if (i > n) {
+                n--;
+            }
+        }
+        int cch = MultiByteToWideChar(codePage, 0, src, (int)n, ws, (int)kChunkSize);
+        int cbMax = cch * 3;
+        char* s = cch > 0 ? dst.AppendBlanks(cbMax) : nullptr;
+        if (!s) {
+            ok = false;
+            break;
+        }
+        int cb = WideCharToMultiByte(CP_UTF8, 0, ws, cch, s, cbMax, nullptr, nullptr);
+        if (cb < cbMax) {
+            dst.RemoveAt(dst.size() - (cbMax - cb), cbMax - cb);
+        }
+        src += n;
+    }
+    free(ws);
+    return ok;
+}
+
 // tries to convert a string in unknown encoding to utf8, as best
 // as it can
 // caller has to free() it
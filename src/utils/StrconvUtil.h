@@ -11,6 +11,7 @@ TempStr ToMultiByteTemp(const char* src, uint codePageSrc, uint codePageDest);
 WCHAR* StrCPToWStr(const char* src, uint codePage, int cbSrc = -1);
 TempWStr StrCPToWStrTemp(const char* src, uint codePage, int cbSrc = -1);
 TempStr StrToUtf8Temp(const char* src, uint codePage);
+bool AppendAsUtf8(str::Str& dst, const char* src, size_t cbSrc, uint codePage);
 
 char* UnknownToUtf8Temp(const char*);
 
@@ -0,0 +1,167 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/ByteReader.h"
+#include "utils/TiffReader.h"
+
+static bool TiffReadValues(const ByteReader& r, bool isBE, size_t entry, Vec<u32>& values) {
+    u16 type = r.Word(entry + 2, isBE);
+    size_t count = r.DWord(entry + 4, isBE);
+    size_t n = (1 == type || 7 == type) ? 1 : 3 == type ? 2 : 4 == type ? 4 : 0;
+    if (n == 0 || count == 0 || count > r.len / n) {
+        return false;
+    }
+    size_t off = count * n <= 4 ? entry + 8 : r.DWord(entry + 8, isBE);
+    if (off > r.len - count * n) {
+        return false;
+    }
+    values.Reset();
+    for (size_t i = 0; i < count; i++) {
+        u32 v = 1 == n ? r.Byte(off + i) : 2 == n ? r.Word(off + i * 2, isBE) : r.DWord(off + i * 4, isBE);
+        values.Append(v);
+    }
+    return true;
+}
+
+bool TiffParse(const ByteSlice& data, TiffInfo& info) {
+    ByteReader r(data);
+    bool isBE = r.Byte(0) == 'M';
+    if (r.len < 8 || r.Word(2, isBE) != 42) {
+        return false;
+    }
+    size_t idx = r.DWord(4, isBE);
+    size_t count = r.Word(idx, isBE);
+    if (idx > r.len || idx + 2 + count * 12 + 4 > r.len) {
+        return false;
+    }
+    info.isMultiPage = r.DWord(idx + 2 + count * 12, isBE) != 0;
+
+    int resUnit = 2;
+    float xres = 0;
+    size_t rowsPerStrip = 0;
+    Vec<u32> v;
+    for (idx += 2; count > 0; count--, idx += 12) {
+        u16 tag = r.Word(idx, isBE);
+        if (tag == 282 && r.Word(idx + 2, isBE) == 5) {
+            // XResolution is a RATIONAL
+            size_t off = r.DWord(idx + 8, isBE);
+            u32 den = r.DWord(off + 4, isBE);
+            if (den != 0) {
+                xres = (float)r.DWord(off, isBE) / (float)den;
+            }
+            continue;
+        }
+        if (!TiffReadValues(r, isBE, idx, v)) {
+            continue;
+        }
+        switch (tag) {
+            case 256:
+                info.size.dx = (int)v[0];
+                break;
+            case 257:
+                info.size.dy = (int)v[0];
+                break;
+            case 258:
+                info.bitsPerSample = (int)v[0];
+                break;
+            case 259:
+                info.compression = (int)v[0];
+                break;
+            case 262:
+                info.photometric = (int)v[0];
+                break;
+            case 266:
+                info.fillOrder = (int)v[0];
+                break;
+            case 273:
+            case 324:
+                info.offsets = v;
+                info.isTiled = tag == 324;
+                break;
+            case 274:
+                info.orientation = (v[0] >= 1 && v[0] <= 8) ? (int)v[0] : 1;
+                break;
+            case 277:
+                info.samplesPerPixel = (int)v[0];
+                break;
+            case 278:
+                rowsPerStrip = v[0];
+                break;
+            case 279:
+            case 325:
+                info.byteCounts = v;
+                break;
+            case 284:
+                info.planarConfig = (int)v[0];
+                break;
+            case 292:
+                info.g3opts = (int)v[0];
+                break;
+            case 296:
+                resUnit = (int)v[0];
+                break;
+            case 317:
+                info.predictor = (int)v[0];
+                break;
+            case 322:
+                info.band.dx = (int)v[0];
+                break;
+            case 323:
+                info.band.dy = (int)v[0];
+                break;
+            case 347:
+                info.jpegTables = {r.d + (v.size() <= 4 ? idx + 8 : r.DWord(idx + 8, isBE)), v.size()};
+                break;
+        }
+    }
+    if (xres > 0) {
+        info.dpi = resUnit == 3 ? xres * 2.54f : xres;
+    }
+    if (!info.isTiled) {
+        Size& sz = info.size;
+        info.band.dx = sz.dx;
+        info.band.dy = (rowsPerStrip == 0 || rowsPerStrip > (size_t)sz.dy) ? sz.dy : (int)rowsPerStrip;
+    }
+    return info.size.dx > 0 && info.size.dy > 0;
+}
+
+// orientations 5 to 8 swap rows and columns
+Size TiffOrientedSize(Size size, int orientation) {
+    if (orientation >= 5 && orientation <= 8) {
+        return Size(size.dy, size.dx);
+    }
+    return size;
+}
+
+Rect TiffOrientRect(Rect rc, Size size, int orientation) {
+    int x = rc.x, y = rc.y, dx = rc.dx, dy = rc.dy;
+    int w = size.dx, h = size.dy;
+    switch (orientation) {
+        case 2: // mirrored horizontally
+            return Rect(w - x - dx, y, dx, dy);
+        case 3: // rotated by 180 degrees
+            return Rect(w - x - dx, h - y - dy, dx, dy);
+        case 4: // mirrored vertically
+            return Rect(x, h - y - dy, dx, dy);
+        case 5: // transposed
+            return Rect(y, x, dy, dx);
+        case 6: // rotated by 90 degrees clockwise
+            return Rect(h - y - dy, x, dy, dx);
+        case 7: // transversed
+            return Rect(h - y - dy, w - x - dx, dy, dx);
+        case 8: // rotated by 90 degrees counter-clockwise
+            return Rect(y, w - x - dx, dy, dx);
+    }
+    return rc;
+}
+
+int TiffInverseOrientation(int orientation) {
+    if (orientation == 6) {
+        return 8;
+    }
+    if (orientation == 8) {
+        return 6;
+    }
+    return orientation;
+}
@@ -0,0 +1,37 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// the tags of the first image of a TIFF file needed for decoding it
+// strip by strip or tile by tile (BigTIFF isn't supported)
+struct TiffInfo {
+    // as stored, before applying orientation
+    Size size;
+    int compression = 1;
+    int photometric = 1;
+    int bitsPerSample = 1;
+    int samplesPerPixel = 1;
+    int predictor = 1;
+    int g3opts = 0;
+    int fillOrder = 1;
+    int planarConfig = 1;
+    // tag 274, 1 to 8 like EXIF orientation
+    int orientation = 1;
+    float dpi = 0;
+    bool isTiled = false;
+    bool isMultiPage = false;
+    // the size of a tile or the image width and rows per strip
+    Size band;
+    Vec<u32> offsets;
+    Vec<u32> byteCounts;
+    // points into the parsed data
+    ByteSlice jpegTables;
+};
+
+bool TiffParse(const ByteSlice& data, TiffInfo& info);
+
+// the size of an image of the given stored size once orientation is applied
+Size TiffOrientedSize(Size size, int orientation);
+// maps a part rc of an image of the given stored size to the same part of the
+// oriented image, TiffInverseOrientation() maps back from the oriented image
+Rect TiffOrientRect(Rect rc, Size size, int orientation);
+int TiffInverseOrientation(int orientation);
@@ -0,0 +1,124 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/Timer.h"
+#include "utils/TimingStats.h"
+
+#include "utils/Log.h"
+
+bool gTimingStatsEnabled = false;
+
+// TimingStats are globals so the list is built during static initialization.
+// a plain pointer is zero-initialized before any constructor runs
+static TimingStats* gFirstTimingStats = nullptr;
+
+TimingStats::TimingStats(const char* name) {
+    this->name = name;
+    next = gFirstTimingStats;
+    gFirstTimingStats = this;
+}
+
+int TimingStatsBucket(double ms) {
+    u64 us = ms > 0 ? (u64)(ms * 1000.0) : 0;
+    int bucket = 0;
+    while (us > 1 && bucket < kTimingStatsBuckets - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static double BucketUpperBoundMs(int bucket) {
+    return (double)(1ULL << (bucket + 1)) / 1000.0;
+}
+
+// can be called from multiple threads
+void TimingStats::Add(double ms) {
+    LONG64 us = ms > 0 ? (LONG64)(ms * 1000.0) : 0;
+    InterlockedIncrement64(&count);
+    InterlockedAdd64(&totalUs, us);
+    InterlockedIncrement64(&buckets[TimingStatsBucket(ms)]);
+    LONG64 prevMax = maxUs;
+    while (us > prevMax) {
+        LONG64 was = InterlockedCompareExchange64(&maxUs, us, prevMax);
+        if (was == prevMax) {
+            break;
+        }
+        prevMax = was;
+    }
+}
+
+void TimingStats::Reset() {
+    count = 0;
+    totalUs = 0;
+    maxUs = 0;
+    for (LONG64& n : buckets) {
+        n = 0;
+    }
+}
+
+double TimingStats::PercentileMs(int perc) const {
+    if (count == 0) {
+        return 0;
+    }
+    LONG64 limit = (count * perc + 99) / 100;
+    LONG64 n = 0;
+    for (int i = 0; i < kTimingStatsBuckets; i++) {
+        n += buckets[i];
+        if (n >= limit) {
+            return std::min(BucketUpperBoundMs(i), (double)maxUs / 1000.0);
+        }
+    }
+    return (double)maxUs / 1000.0;
+}
+
+void TimingStatsResetAll() {
+    for (TimingStats* s = gFirstTimingStats; s; s = s->next) {
+        s->Reset();
+    }
+}
+
+void TimingStatsLogAll() {
+    for (TimingStats* s = gFirstTimingStats; s; s = s->next) {
+        if (s->count == 0) {
+            continue;
+        }
+        double avg = (double)s->totalUs / (double)s->count / 1000.0;
+        logf("%s: count: %d, avg: %.2f ms, max: %.2f ms, p50: %.2f ms, p90: %.2f ms, p99: %.2f ms\n", s->name,
+             (int)s->count, avg, (double)s->maxUs / 1000.0, s->PercentileMs(50), s->PercentileMs(90),
+             s->PercentileMs(99));
+        for (int i = 0; i < kTimingStatsBuckets; i++) {
+            if (s->buckets[i] > 0) {
+                logf("  < %.3f ms: %d\n", BucketUpperBoundMs(i), (int)s->buckets[i]);
+            }
+        }
+    }
+}
+
+// names must not need escaping
+void TimingStatsToJson(str::Str& out) {
+    out.Append("[\n");
+    bool first = true;
+    for (TimingStats* s = gFirstTimingStats; s; s = s->next) {
+        if (!first) {
+            out.Append(",\n");
+        }
+        first = false;
+        out.AppendFmt("  {\"name\": \"%s\", \"count\": %lld, \"totalMs\": %.3f, \"maxMs\": %.3f, \"buckets\": [",
+                      s->name, (long long)s->count, (double)s->totalUs / 1000.0, (double)s->maxUs / 1000.0);
+        bool firstBucket = true;
+        for (int i = 0; i < kTimingStatsBuckets; i++) {
+            if (s->buckets[i] == 0) {
+                continue;
+            }
+            if (!firstBucket) {
+                out.Append(", ");
+            }
+            firstBucket = false;
+            out.AppendFmt("{\"upToMs\": %.3f, \"count\": %lld}", BucketUpperBoundMs(i), (long long)s->buckets[i]);
+        }
+        out.Append("]}");
+    }
+    out.Append("\n]\n");
+}
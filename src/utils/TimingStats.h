@@ -0,0 +1,56 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Aggregates durations of a piece of code into a histogram with power-of-2 buckets.
+// Meant to be instantiated as a global:
+//   static TimingStats gRenderPageStats("RenderPage");
+//   ...
+//   TimingScope timing(&gRenderPageStats);
+// Recording is off by default and costs a single bool check in that case.
+
+extern bool gTimingStatsEnabled;
+
+// bucket i counts durations in [2^i, 2^(i+1)) microseconds
+// (bucket 0 also counts shorter and the last bucket longer ones)
+constexpr int kTimingStatsBuckets = 24;
+
+struct TimingStats {
+    const char* name = nullptr;
+    LONG64 count = 0;
+    LONG64 totalUs = 0;
+    LONG64 maxUs = 0;
+    LONG64 buckets[kTimingStatsBuckets]{};
+    // intrusive list of all TimingStats
+    TimingStats* next = nullptr;
+
+    explicit TimingStats(const char* name);
+    TimingStats(TimingStats const&) = delete;
+    TimingStats& operator=(TimingStats const&) = delete;
+
+    void Add(double ms);
+    void Reset();
+    // approximate (upper bound of the bucket), perc in 0..100
+    double PercentileMs(int perc) const;
+};
+
+struct TimingScope {
+    TimingStats* stats = nullptr;
+    LARGE_INTEGER start{};
+
+    explicit TimingScope(TimingStats* stats) {
+        if (gTimingStatsEnabled) {
+            this->stats = stats;
+            start = TimeGet();
+        }
+    }
+    ~TimingScope() {
+        if (stats) {
+            stats->Add(TimeSinceInMs(start));
+        }
+    }
+};
+
+int TimingStatsBucket(double ms);
+void TimingStatsResetAll();
+void TimingStatsLogAll();
+void TimingStatsToJson(str::Str& out);
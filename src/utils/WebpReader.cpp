@@ -25,11 +25,25 @@ Size SizeFromData(const ByteSlice& d) {
     return size;
 }
 
-Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
-    int w, h;
-    if (!WebPGetInfo((const u8*)d.data(), d.size(), &w, &h)) {
+Gdiplus::Bitmap* ImageFromData(const ByteSlice& d, int reduce) {
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) {
         return nullptr;
     }
+    if (WebPGetFeatures((const u8*)d.data(), d.size(), &config.input) != VP8_STATUS_OK) {
+        return nullptr;
+    }
+    int w = config.input.width;
+    int h = config.input.height;
+    if (reduce > 0) {
+        // libwebp scales rows as they're decoded so that
+        // the full-size image never has to be allocated
+        w = std::max(w >> reduce, 1);
+        h = std::max(h >> reduce, 1);
+        config.options.use_scaling = 1;
+        config.options.scaled_width = w;
+        config.options.scaled_height = h;
+    }
 
     Gdiplus::Bitmap bmp(w, h, PixelFormat32bppARGB);
     Gdiplus::Rect bmpRect(0, 0, w, h);
@@ -38,10 +52,17 @@ Gdiplus::Bitmap* ImageFromData(const ByteSlice& d) {
     if (ok != Gdiplus::Ok) {
         return nullptr;
     }
-    if (!WebPDecodeBGRAInto((const u8*)d.data(), d.size(), (u8*)bmpData.Scan0, bmpData.Stride * h, bmpData.Stride)) {
+    config.output.colorspace = MODE_BGRA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = (u8*)bmpData.Scan0;
+    config.output.u.RGBA.stride = bmpData.Stride;
+    config.output.u.RGBA.size = (size_t)bmpData.Stride * h;
+    VP8StatusCode status = WebPDecode((const u8*)d.data(), d.size(), &config);
+    WebPFreeDecBuffer(&config.output);
+    bmp.UnlockBits(&bmpData);
+    if (status != VP8_STATUS_OK) {
         return nullptr;
     }
-    bmp.UnlockBits(&bmpData);
     return bmp.Clone(0, 0, w, h, PixelFormat32bppARGB);
 }
 
@@ -55,7 +76,7 @@ bool HasSignature(const ByteSlice&) {
 Size SizeFromData(const ByteSlice&) {
     return Size();
 }
-Gdiplus::Bitmap* ImageFromData(const ByteSlice&) {
+Gdiplus::Bitmap* ImageFromData(const ByteSlice&, int) {
     return nullptr;
 }
 } // namespace webp
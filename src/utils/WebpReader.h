@@ -5,6 +5,7 @@ namespace webp {
 
 bool HasSignature(const ByteSlice&);
 Size SizeFromData(const ByteSlice&);
-Gdiplus::Bitmap* ImageFromData(const ByteSlice&);
+// reduce: decode at 1/2^reduce of the full size
+Gdiplus::Bitmap* ImageFromData(const ByteSlice&, int reduce = 0);
 
 } // namespace webp
@@ -86,4 +86,17 @@ void FileUtilTest() {
         // utassert(str::Eq(path, "foo\\bar\\z"));
         // str::Free(path);
     }
+    {
+        TempStr path = GetTempFilePathTemp("map");
+        const char* s = "mapped file content";
+        utassert(file::WriteFile(path, s));
+        file::MappedFile* mf = file::MapReadOnly(path);
+        // temp dir might not be on a fixed drive
+        if (mf) {
+            utassert(mf->data.size() == str::Len(s));
+            utassert(memeq(mf->data.data(), s, str::Len(s)));
+            delete mf;
+        }
+        file::Delete(path);
+    }
 }
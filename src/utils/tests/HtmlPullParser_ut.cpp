@@ -108,6 +108,41 @@ static void Test03() {
     utassert(!t);
 }
 
+// structural characters past the first 16 bytes exercise the vectorized scanning
+static void Test04() {
+    const char* s =
+        "some text that is longer than a block &amp; more text<DIV class=\"a long attribute value > with a gt\" "
+        "title='another > one'>x<!-- a long comment with -- dashes and <tags> inside --><mbp:PageBreak/>";
+    HtmlPullParser parser(s, str::Len(s));
+    HtmlToken* t = parser.Next();
+    utassert(t && t->IsText() && str::EqNIx(t->s, t->sLen, "some text that is longer than a block &amp; more text"));
+    t = parser.Next();
+    utassert(t && t->IsStartTag() && Tag_Div == t->tag);
+    AttrInfo* a = t->GetAttrByName("class");
+    utassert(a && a->ValIs("a long attribute value > with a gt"));
+    a = t->GetAttrByName("title");
+    utassert(a && a->ValIs("another > one"));
+    t = parser.Next();
+    utassert(t && t->IsText() && str::EqNIx(t->s, t->sLen, "x"));
+    t = parser.Next();
+    utassert(t && t->IsEmptyElementEndTag() && Tag_Mbp_Pagebreak == t->tag);
+    t = parser.Next();
+    utassert(!t);
+}
+
+static void TestFindHtmlTagFast() {
+    const char* names[] = {"a", "A", "abbr", "aBBR", "blockquote", "body", "br", "h1", "H6", "h7", "img",
+                           "mbp:pagebreak", "pagebreak", "svg:image", "SVG", "td", "video", "vide", "videos",
+                           "x", "", "dc:title", "navPoint", "a1", "blockquotes"};
+    for (const char* name : names) {
+        size_t len = str::Len(name);
+        utassert(FindHtmlTagFast(name, len) == FindHtmlTag(name, len));
+    }
+    utassert(FindHtmlTagFast("span", 4) == Tag_Span);
+    utassert(FindHtmlTagFast("spanner", 4) == Tag_Span);
+    utassert(FindHtmlTagFast("nope", 4) == Tag_NotFound);
+}
+
 void HtmlPullParser_UnitTests() {
     Test00("<p a1='>' foo=bar />", HtmlToken::EmptyElementTag);
     Test00("<p a1 ='>'     foo=\"bar\"/>", HtmlToken::EmptyElementTag);
@@ -118,4 +153,6 @@ void HtmlPullParser_UnitTests() {
     Test01();
     Test02();
     Test03();
+    Test04();
+    TestFindHtmlTagFast();
 }
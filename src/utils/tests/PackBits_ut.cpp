@@ -0,0 +1,66 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/PackBits.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static void PackBitsRoundTrip(const ByteSlice& d, int unitSize) {
+    ByteSlice packed = PackBitsCompress(d, unitSize);
+    utassert(!packed.empty() || d.empty());
+    u8* res = AllocArray<u8>(d.sz + 1);
+    utassert(PackBitsDecompress(packed, unitSize, {res, d.sz}));
+    utassert(d.sz == 0 || memeq(res, d.d, d.sz));
+    // must detect too small and too big destinations
+    if (d.sz > 0) {
+        utassert(!PackBitsDecompress(packed, unitSize, {res, d.sz - 1}));
+        utassert(!PackBitsDecompress(packed, unitSize, {res, d.sz + 1}));
+    }
+    free(res);
+    packed.Free();
+}
+
+void PackBitsTest() {
+    int unitSizes[] = {1, 3, 4};
+    for (int unitSize : unitSizes) {
+        PackBitsRoundTrip({}, unitSize);
+
+        // a single unit, only repeats, only literals and mixes of both
+        // crossing the maximum run lengths
+        size_t sizes[] = {1, 2, 127, 128, 129, 130, 257, 1000};
+        for (size_t n : sizes) {
+            size_t sz = n * unitSize;
+            u8* d = AllocArray<u8>(sz);
+            PackBitsRoundTrip({d, sz}, unitSize);
+            for (size_t i = 0; i < sz; i++) {
+                d[i] = (u8)(i * 7 + i / 5);
+            }
+            PackBitsRoundTrip({d, sz}, unitSize);
+            for (size_t i = 0; i < sz; i++) {
+                d[i] = (i % 300) < 150 ? 0xff : (u8)(rand() % 4);
+            }
+            PackBitsRoundTrip({d, sz}, unitSize);
+            free(d);
+        }
+    }
+
+    // a blank page should compress to almost nothing
+    size_t sz = 4 * 1024 * 1024;
+    u8* d = AllocArray<u8>(sz);
+    memset(d, 0xff, sz);
+    ByteSlice packed = PackBitsCompress({d, sz}, 4);
+    utassert(packed.sz < sz / 100);
+    packed.Free();
+
+    // data that isn't a multiple of the unit size is rejected
+    packed = PackBitsCompress({d, 7}, 4);
+    utassert(packed.empty());
+    free(d);
+
+    // truncated input
+    u8 broken[] = {3, 1, 2};
+    u8 out[4];
+    utassert(!PackBitsDecompress({broken, sizeof(broken)}, 1, {out, sizeof(out)}));
+}
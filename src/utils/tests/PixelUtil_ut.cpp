@@ -0,0 +1,105 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/PixelUtil.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+// mimics a rendered text page: white background with short runs of
+// anti-aliased gray and black "glyphs" on every other band of rows
+static u8* MakeTextPixmap(int dx, int dy, int stride) {
+    u8* d = AllocArray<u8>((size_t)stride * dy);
+    memset(d, 0xff, (size_t)stride * dy);
+    for (int y = 0; y < dy; y++) {
+        if ((y / 16) % 2 == 0) {
+            continue;
+        }
+        u8* row = d + (size_t)y * stride;
+        for (int x = (y * 7) % 13; x < dx - 8; x += 11 + (x % 5)) {
+            for (int i = 0; i < 4; i++) {
+                u8 v = (u8)((x + y + i) % 16 * 16);
+                row[(x + i) * 4 + 0] = v;
+                row[(x + i) * 4 + 1] = v;
+                row[(x + i) * 4 + 2] = v;
+            }
+        }
+    }
+    return d;
+}
+
+static void CheckPalettize(const u8* src, int stride, int dx, int dy, int expectedColors) {
+    int dstStride = ((dx + 3) / 4) * 4;
+    u8* dst1 = AllocArray<u8>((size_t)dstStride * dy);
+    u8* dst2 = AllocArray<u8>((size_t)dstStride * dy);
+    u32 pal1[256], pal2[256];
+    int n1 = PalettizeRgbxScalar(src, stride, dst1, dstStride, dx, dy, pal1);
+    int n2 = PalettizeRgbx(src, stride, dst2, dstStride, dx, dy, pal2);
+    utassert(n1 == n2);
+    if (expectedColors != 0) {
+        utassert(n1 == expectedColors);
+    }
+    if (n1 > 0) {
+        utassert(memeq(pal1, pal2, n1 * sizeof(u32)));
+        utassert(memeq(dst1, dst2, (size_t)dstStride * dy));
+        // indices must map back to the original colors
+        for (int y = 0; y < dy; y++) {
+            for (int x = 0; x < dx; x++) {
+                const u8* s = src + (size_t)y * stride + x * 4;
+                u32 c = pal1[dst1[y * dstStride + x]];
+                utassert(c == (((u32)s[0] << 16) | ((u32)s[1] << 8) | s[2]));
+            }
+        }
+    }
+    free(dst1);
+    free(dst2);
+}
+
+static void CheckSwapRedBlue(const u8* src, int stride, int dx, int dy) {
+    u8* dst1 = AllocArray<u8>((size_t)stride * dy);
+    u8* dst2 = AllocArray<u8>((size_t)stride * dy);
+    SwapRedBlueScalar(src, stride, dst1, stride, dx, dy);
+    SwapRedBlue(src, stride, dst2, stride, dx, dy);
+    utassert(memeq(dst1, dst2, (size_t)stride * dy));
+    utassert(dst1[0] == src[2] && dst1[1] == src[1] && dst1[2] == src[0] && dst1[3] == src[3]);
+    // converting in place and back must be lossless
+    SwapRedBlue(dst2, stride, dst2, stride, dx, dy);
+    for (int y = 0; y < dy; y++) {
+        utassert(memeq(dst2 + (size_t)y * stride, src + (size_t)y * stride, dx * 4));
+    }
+    free(dst1);
+    free(dst2);
+}
+
+void PixelUtilTest() {
+    // odd sizes and a padded stride exercise the non-vectorized tails
+    int sizes[][2] = {{1, 1}, {3, 2}, {4, 4}, {7, 3}, {8, 1}, {17, 5}, {301, 67}};
+    for (auto& sz : sizes) {
+        int dx = sz[0];
+        int dy = sz[1];
+        int stride = dx * 4 + 12;
+        u8* src = MakeTextPixmap(dx, dy, stride);
+        CheckPalettize(src, stride, dx, dy, 0);
+        for (int i = 0; i < stride * dy; i++) {
+            src[i] = (u8)(i * 31 + i / 7);
+        }
+        CheckSwapRedBlue(src, stride, dx, dy);
+        free(src);
+    }
+
+    // alpha is ignored, colors that differ in red and blue are distinct
+    u8 px[] = {1, 2, 3, 0, 1, 2, 3, 0xff, 3, 2, 1, 0, 3, 2, 1, 0x80};
+    CheckPalettize(px, sizeof(px), 4, 1, 2);
+
+    // exactly 256 colors fit, 257 don't
+    int dx = 257;
+    u8* src = AllocArray<u8>(dx * 4);
+    for (int x = 0; x < dx; x++) {
+        src[x * 4 + 0] = (u8)x;
+        src[x * 4 + 2] = (u8)(x >> 8);
+    }
+    CheckPalettize(src, dx * 4, dx - 1, 1, 256);
+    CheckPalettize(src, dx * 4, dx, 1, -1);
+    free(src);
+}
@@ -108,6 +108,54 @@ static void StrConvTest() {
 #endif
 }
 
+// text in codePage that has a non-ASCII character every few bytes
+static char* MakeCodePageText(size_t len, uint codePage) {
+    char* s = AllocArray<char>(len + 1);
+    for (size_t i = 0; i < len; i++) {
+        s[i] = (char)('a' + i % 26);
+        if (i % 7 == 6 && i + 2 < len) {
+            if (codePage == 936) {
+                // "\xC4\xE3" is a double-byte character in GBK
+                s[i++] = '\xC4';
+                s[i] = '\xE3';
+            } else {
+                s[i] = (char)(0xC0 + i % 64);
+            }
+        }
+    }
+    return s;
+}
+
+static void CheckAppendAsUtf8(const char* s, size_t len, uint codePage) {
+    str::Str res("prefix");
+    utassert(strconv::AppendAsUtf8(res, s, len, codePage));
+    TempStr expected = strconv::ToMultiByteTemp(s, codePage, CP_UTF8);
+    utassert(str::StartsWith(res.Get(), "prefix"));
+    utassert(str::Eq(res.Get() + 6, expected));
+    utassert(res.size() == 6 + str::Len(expected));
+}
+
+static void StrConvChunkedTest() {
+    uint codePages[] = {1252, 936, 20127, CP_UTF8};
+    // 65535 splits a double-byte character at the end of the first chunk
+    size_t sizes[] = {0, 1, 13, 64 * 1024 - 1, 64 * 1024, 200 * 1024 + 3};
+    for (uint cp : codePages) {
+        for (size_t len : sizes) {
+            char* s = MakeCodePageText(len, cp);
+            CheckAppendAsUtf8(s, len, cp);
+            free(s);
+        }
+    }
+    // a double-byte character right on the chunk boundary
+    size_t len = 64 * 1024 + 10;
+    char* s = AllocArray<char>(len + 1);
+    memset(s, 'x', len);
+    s[64 * 1024 - 1] = '\xC4';
+    s[64 * 1024] = '\xE3';
+    CheckAppendAsUtf8(s, len, 936);
+    free(s);
+}
+
 static void StrUrlExtractTest() {
     utassert(!url::GetFileNameTemp(""));
     utassert(!url::GetFileNameTemp("#hash_only"));
@@ -594,6 +642,7 @@ void StrTest() {
     StrReplaceTest();
     StrSeqTest();
     StrConvTest();
+    StrConvChunkedTest();
     StrUrlExtractTest();
     // ParseUntilTest();
 }
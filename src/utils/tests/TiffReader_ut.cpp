@@ -0,0 +1,159 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/TiffReader.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+// type is 3 (SHORT), 4 (LONG) or 5 (RATIONAL, v[0] / v[1])
+struct TiffTestEntry {
+    u16 tag;
+    u16 type;
+    int count;
+    u32 v[6];
+};
+
+static void TiffPut(Vec<u8>& d, size_t off, u32 val, int size, bool isBE) {
+    for (int i = 0; i < size; i++) {
+        int shift = isBE ? (size - 1 - i) * 8 : i * 8;
+        d.at(off + i) = (u8)(val >> shift);
+    }
+}
+
+// a TIFF with a single IFD, values that don't fit into their entry follow the IFD
+static void BuildTiff(Vec<u8>& d, const TiffTestEntry* entries, int n, bool isBE) {
+    size_t ifdSize = 2 + (size_t)n * 12 + 4;
+    size_t extra = 0;
+    for (int i = 0; i < n; i++) {
+        const TiffTestEntry& e = entries[i];
+        size_t sz = e.type == 5 ? 8 : (size_t)e.count * (e.type == 3 ? 2 : 4);
+        if (sz > 4) {
+            extra += sz;
+        }
+    }
+    d.Reset();
+    d.AppendBlanks(8 + ifdSize + extra);
+    memset(d.LendData(), 0, d.size());
+    d.at(0) = d.at(1) = isBE ? 'M' : 'I';
+    TiffPut(d, 2, 42, 2, isBE);
+    TiffPut(d, 4, 8, 4, isBE);
+    TiffPut(d, 8, (u32)n, 2, isBE);
+    size_t extraOff = 8 + ifdSize;
+    for (int i = 0; i < n; i++) {
+        const TiffTestEntry& e = entries[i];
+        size_t entry = 10 + (size_t)i * 12;
+        TiffPut(d, entry, e.tag, 2, isBE);
+        TiffPut(d, entry + 2, e.type, 2, isBE);
+        TiffPut(d, entry + 4, (u32)e.count, 4, isBE);
+        int valSize = e.type == 3 ? 2 : 4;
+        int nVals = e.type == 5 ? 2 : e.count;
+        size_t off = entry + 8;
+        if ((size_t)nVals * valSize > 4) {
+            TiffPut(d, entry + 8, (u32)extraOff, 4, isBE);
+            off = extraOff;
+            extraOff += (size_t)nVals * valSize;
+        }
+        for (int j = 0; j < nVals; j++) {
+            TiffPut(d, off + (size_t)j * valSize, e.v[j], valSize, isBE);
+        }
+    }
+}
+
+static void TiffBaselineTest() {
+    // 4x3 8-bit gray, a single uncompressed strip, 300 dpi
+    TiffTestEntry entries[] = {
+        {256, 3, 1, {4}},    {257, 3, 1, {3}},      {258, 3, 1, {8}},   {259, 3, 1, {1}},
+        {262, 3, 1, {1}},    {273, 4, 1, {1000}},   {277, 3, 1, {1}},   {278, 3, 1, {3}},
+        {279, 4, 1, {12}},   {282, 5, 1, {300, 1}}, {296, 3, 1, {2}},
+    };
+    Vec<u8> d;
+    BuildTiff(d, entries, dimof(entries), false);
+    TiffInfo info;
+    utassert(TiffParse({d.LendData(), d.size()}, info));
+    utassert(info.size == Size(4, 3));
+    utassert(info.band == Size(4, 3));
+    utassert(!info.isTiled && !info.isMultiPage);
+    utassert(info.compression == 1 && info.photometric == 1);
+    utassert(info.bitsPerSample == 8 && info.samplesPerPixel == 1);
+    utassert(info.orientation == 1);
+    utassert(info.offsets.size() == 1 && info.offsets[0] == 1000);
+    utassert(info.byteCounts.size() == 1 && info.byteCounts[0] == 12);
+    utassert(info.dpi == 300.f);
+
+    // truncated IFD, not a TIFF
+    TiffInfo info2;
+    utassert(!TiffParse({d.LendData(), 20}, info2));
+    d.at(2) = 43;
+    utassert(!TiffParse({d.LendData(), d.size()}, info2));
+}
+
+static void TiffStripsTest() {
+    // big-endian 8x10 RGB in 3 strips of 4 rows, rotated by 90 degrees
+    TiffTestEntry entries[] = {
+        {256, 4, 1, {8}},           {257, 4, 1, {10}},          {258, 3, 3, {8, 8, 8}}, {259, 3, 1, {5}},
+        {262, 3, 1, {2}},           {273, 4, 3, {200, 300, 400}}, {274, 3, 1, {6}},     {277, 3, 1, {3}},
+        {278, 4, 1, {4}},           {279, 4, 3, {90, 91, 50}},  {317, 3, 1, {2}},
+    };
+    Vec<u8> d;
+    BuildTiff(d, entries, dimof(entries), true);
+    TiffInfo info;
+    utassert(TiffParse({d.LendData(), d.size()}, info));
+    utassert(info.size == Size(8, 10));
+    utassert(info.band == Size(8, 4));
+    utassert(!info.isTiled);
+    utassert(info.compression == 5 && info.photometric == 2 && info.predictor == 2);
+    utassert(info.samplesPerPixel == 3);
+    utassert(info.offsets.size() == 3 && info.offsets[2] == 400);
+    utassert(info.byteCounts.size() == 3 && info.byteCounts[1] == 91);
+    utassert(info.orientation == 6);
+    utassert(TiffOrientedSize(info.size, info.orientation) == Size(10, 8));
+}
+
+static void TiffTilesTest() {
+    // 40x20 bilevel in 16x16 tiles (3 tiles per row, 2 rows of tiles)
+    TiffTestEntry entries[] = {
+        {256, 3, 1, {40}}, {257, 3, 1, {20}}, {259, 3, 1, {4}}, {262, 3, 1, {0}},
+        {322, 3, 1, {16}}, {323, 3, 1, {16}}, {324, 4, 6, {10, 20, 30, 40, 50, 60}},
+        {325, 4, 6, {1, 2, 3, 4, 5, 6}},
+    };
+    Vec<u8> d;
+    BuildTiff(d, entries, dimof(entries), false);
+    TiffInfo info;
+    utassert(TiffParse({d.LendData(), d.size()}, info));
+    utassert(info.size == Size(40, 20));
+    utassert(info.isTiled);
+    utassert(info.band == Size(16, 16));
+    utassert(info.bitsPerSample == 1 && info.compression == 4 && info.photometric == 0);
+    utassert(info.offsets.size() == 6 && info.offsets[5] == 60);
+    utassert(info.byteCounts.size() == 6 && info.byteCounts[3] == 4);
+    utassert(info.dpi == 0);
+}
+
+static void TiffOrientationTest() {
+    Size size(4, 3);
+    Rect px(0, 0, 1, 1);
+    // where the top-left pixel of the stored image ends up
+    Point expected[] = {{0, 0}, {3, 0}, {3, 2}, {0, 2}, {0, 0}, {2, 0}, {2, 3}, {0, 3}};
+    for (int o = 1; o <= 8; o++) {
+        Size oriented = TiffOrientedSize(size, o);
+        utassert(oriented == (o >= 5 ? Size(3, 4) : size));
+        Rect r = TiffOrientRect(px, size, o);
+        utassert(r.x == expected[o - 1].x && r.y == expected[o - 1].y);
+
+        Rect rc(1, 0, 2, 3);
+        Rect rc2 = TiffOrientRect(rc, size, o);
+        utassert(rc2.dx == (o >= 5 ? rc.dy : rc.dx));
+        utassert(Rect(0, 0, oriented.dx, oriented.dy).Intersect(rc2) == rc2);
+        Rect back = TiffOrientRect(rc2, oriented, TiffInverseOrientation(o));
+        utassert(back == rc);
+    }
+}
+
+void TiffReaderTest() {
+    TiffBaselineTest();
+    TiffStripsTest();
+    TiffTilesTest();
+    TiffOrientationTest();
+}
@@ -0,0 +1,59 @@
+/* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/Timer.h"
+#include "utils/TimingStats.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static TimingStats gTestStats("TimingStatsTest");
+
+void TimingStatsTest() {
+    utassert(TimingStatsBucket(0) == 0);
+    utassert(TimingStatsBucket(0.001) == 0);
+    utassert(TimingStatsBucket(0.002) == 1);
+    utassert(TimingStatsBucket(0.003) == 1);
+    utassert(TimingStatsBucket(1.0) == 9);    // 1000 us
+    utassert(TimingStatsBucket(1.5) == 10);   // 1500 us
+    utassert(TimingStatsBucket(1000000.0) == kTimingStatsBuckets - 1);
+
+    gTestStats.Reset();
+    for (int i = 0; i < 90; i++) {
+        gTestStats.Add(1.0);
+    }
+    for (int i = 0; i < 10; i++) {
+        gTestStats.Add(100.0);
+    }
+    utassert(gTestStats.count == 100);
+    utassert(gTestStats.totalUs == 90 * 1000 + 10 * 100000);
+    utassert(gTestStats.maxUs == 100000);
+    utassert(gTestStats.buckets[9] == 90);
+    utassert(gTestStats.PercentileMs(50) == 1.024);
+    utassert(gTestStats.PercentileMs(90) == 1.024);
+    utassert(gTestStats.PercentileMs(99) == 100.0);
+
+    str::Str json;
+    TimingStatsToJson(json);
+    utassert(str::Find(json.Get(), "\"name\": \"TimingStatsTest\", \"count\": 100"));
+    utassert(str::Find(json.Get(), "{\"upToMs\": 1.024, \"count\": 90}"));
+
+    // disabled scopes don't record anything
+    bool wasEnabled = gTimingStatsEnabled;
+    gTimingStatsEnabled = false;
+    {
+        TimingScope timing(&gTestStats);
+    }
+    utassert(gTestStats.count == 100);
+    gTimingStatsEnabled = true;
+    {
+        TimingScope timing(&gTestStats);
+    }
+    utassert(gTestStats.count == 101);
+    gTimingStatsEnabled = wasEnabled;
+
+    TimingStatsResetAll();
+    utassert(gTestStats.count == 0);
+    utassert(gTestStats.PercentileMs(50) == 0);
+}